@@ -0,0 +1,180 @@
+#include "phase_detector.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+void PhaseDetector::reset()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    signals_.clear();
+    phases_.clear();
+    current_ = PhaseStats();
+}
+
+void PhaseDetector::update(ProfilingSnapshot& snapshot)
+{
+    std::vector<std::pair<std::string, double>> values;
+    extract_signals(snapshot, values);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (current_.ticks == 0 && phases_.empty())
+    {
+        start_phase(snapshot.timestamp_ms);
+    }
+
+    bool changed = false;
+    for (const auto& [name, value] : values)
+    {
+        auto it = std::find_if(signals_.begin(), signals_.end(), [&name](const Signal& s){ return s.name == name; });
+        if (it == signals_.end())
+        {
+            signals_.push_back(Signal());
+            signals_.back().name = name;
+            it = signals_.end() - 1;
+        }
+        changed = feed(*it, value) || changed;
+    }
+
+    if (changed && current_.ticks >= settings_.warmup_ticks)
+    {
+        close_phase();
+        start_phase(snapshot.timestamp_ms);
+        snapshot.phase_boundary = true;
+
+        for (const auto& [name, value] : values)
+        {
+            auto it = std::find_if(signals_.begin(), signals_.end(), [&name](const Signal& s){ return s.name == name; });
+            feed(*it, value);
+        }
+    }
+
+    current_.ticks++;
+    current_.end_ms = snapshot.timestamp_ms;
+    for (const auto& metric : snapshot.metrics)
+    {
+        uint64_t& total = current_.metric_totals[metric.type];
+        total = is_gauge_metric(metric.type) ? std::max(total, metric.value) : total + metric.value;
+    }
+    snapshot.phase_id = current_.id;
+}
+
+std::vector<PhaseStats> PhaseDetector::get_phases() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<PhaseStats> result = phases_;
+    if (current_.ticks > 0)
+    {
+        PhaseStats open = current_;
+        for (const auto& signal : signals_)
+        {
+            if (signal.count)
+            {
+                open.signal_means[signal.name] = signal.mean;
+            }
+        }
+        result.push_back(open);
+    }
+    return result;
+}
+
+bool PhaseDetector::extract_signals(const ProfilingSnapshot& snapshot, std::vector<std::pair<std::string, double>>& out)
+{
+    auto value_of = [&snapshot](MetricType type) -> const MetricValue*
+    {
+        return snapshot.find_metric(type);
+    };
+
+    const MetricValue* instructions = value_of(MetricType::INSTRUCTIONS);
+    const MetricValue* cycles = value_of(MetricType::CPU_CYCLES);
+    const MetricValue* misses = value_of(MetricType::CACHE_MISSES);
+    const MetricValue* references = value_of(MetricType::CACHE_REFERENCES);
+    const MetricValue* branch_misses = value_of(MetricType::BRANCH_MISSES);
+
+    if (instructions && cycles && cycles->value > 0)
+    {
+        out.push_back({"ipc", static_cast<double>(instructions->value) / cycles->value});
+    }
+    if (misses && references && references->value > 0)
+    {
+        out.push_back({"cache_miss_rate", static_cast<double>(misses->value) / references->value});
+    }
+    if (branch_misses && instructions && instructions->value > 0)
+    {
+        out.push_back({"branch_mpki", 1000.0 * branch_misses->value / instructions->value});
+    }
+
+    //no hardware ratios selected: fall back to software event rates
+    if (out.empty() && snapshot.duration_ms > 0)
+    {
+        for (MetricType type : {MetricType::PAGE_FAULTS, MetricType::CONTEXT_SWITCHES})
+        {
+            if (const MetricValue* metric = value_of(type))
+            {
+                out.push_back({std::string(metric_name(type)) + "_per_s", 1000.0 * metric->value / snapshot.duration_ms});
+            }
+        }
+    }
+    return !out.empty();
+}
+
+bool PhaseDetector::feed(Signal& signal, double value)
+{
+    bool changed = false;
+    if (signal.count >= settings_.warmup_ticks)
+    {
+        double stddev = signal.count > 1 ? std::sqrt(signal.m2 / (signal.count - 1)) : 0.0;
+        double scale = std::max({stddev, settings_.noise_floor * std::fabs(signal.mean), 1e-12});
+        double z = (value - signal.mean) / scale;
+
+        signal.cusum_pos = std::max(0.0, signal.cusum_pos + z - settings_.drift);
+        signal.cusum_neg = std::max(0.0, signal.cusum_neg - z - settings_.drift);
+        changed = signal.cusum_pos > settings_.threshold || signal.cusum_neg > settings_.threshold;
+    }
+
+    signal.count++;
+    double delta = value - signal.mean;
+    signal.mean += delta / signal.count;
+    signal.m2 += delta * (value - signal.mean);
+    return changed;
+}
+
+void PhaseDetector::start_phase(uint64_t timestamp_ms)
+{
+    uint32_t id = phases_.empty() && current_.ticks == 0 ? 0 : current_.id + 1;
+    current_ = PhaseStats();
+    current_.id = id;
+    current_.start_ms = timestamp_ms;
+    current_.end_ms = timestamp_ms;
+
+    for (auto& signal : signals_)
+    {
+        signal.count = 0;
+        signal.mean = 0.0;
+        signal.m2 = 0.0;
+        signal.cusum_pos = 0.0;
+        signal.cusum_neg = 0.0;
+    }
+}
+
+void PhaseDetector::close_phase()
+{
+    for (const auto& signal : signals_)
+    {
+        if (signal.count)
+        {
+            current_.signal_means[signal.name] = signal.mean;
+        }
+    }
+    phases_.push_back(current_);
+}
+
+std::ostream& operator<<(std::ostream& ostr, const PhaseStats& phase)
+{
+    ostr << "phase " << phase.id << ": " << (phase.end_ms - phase.start_ms) << "ms, " << phase.ticks << " ticks";
+    for (const auto& [name, mean] : phase.signal_means)
+    {
+        ostr << ", " << name << "=" << std::setprecision(4) << mean;
+    }
+    return ostr;
+}
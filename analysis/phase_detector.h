@@ -0,0 +1,69 @@
+#ifndef PHASE_DETECTOR_H
+#define PHASE_DETECTOR_H
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../metrics/metrics_collector.h"
+
+struct PhaseStats
+{
+    uint32_t id = 0;
+    uint64_t start_ms = 0;
+    uint64_t end_ms = 0;
+    uint64_t ticks = 0;
+    std::map<std::string, double> signal_means;
+    std::map<MetricType, uint64_t> metric_totals;  //peak for gauges
+
+    friend std::ostream& operator<<(std::ostream& ostr, const PhaseStats& phase);
+};
+
+//two-sided CUSUM on standardized IPC / miss-rate signals, O(1) per tick
+class PhaseDetector
+{
+public:
+    struct Settings
+    {
+        double drift = 0.5;         //k, in standard deviations
+        double threshold = 6.0;     //h, in standard deviations
+        uint32_t warmup_ticks = 4;  //ticks used to estimate the new phase baseline
+        double noise_floor = 0.02;  //relative, keeps flat signals from firing on jitter
+    };
+
+    PhaseDetector() = default;
+    explicit PhaseDetector(const Settings& settings): settings_(settings) {}
+
+    void reset();
+    //annotates snapshot with phase_id / phase_boundary
+    void update(ProfilingSnapshot& snapshot);
+
+    std::vector<PhaseStats> get_phases() const;
+
+private:
+    struct Signal
+    {
+        std::string name;
+        uint64_t count = 0;
+        double mean = 0.0;
+        double m2 = 0.0;
+        double cusum_pos = 0.0;
+        double cusum_neg = 0.0;
+    };
+
+    Settings settings_;
+    mutable std::mutex mutex_;
+    std::vector<Signal> signals_;
+    std::vector<PhaseStats> phases_;
+    PhaseStats current_;
+
+    static bool extract_signals(const ProfilingSnapshot& snapshot, std::vector<std::pair<std::string, double>>& out);
+    bool feed(Signal& signal, double value);
+    void start_phase(uint64_t timestamp_ms);
+    void close_phase();
+};
+
+#endif
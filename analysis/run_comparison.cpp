@@ -0,0 +1,260 @@
+#include "run_comparison.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <map>
+#include <numeric>
+#include <random>
+#include <sstream>
+
+struct MetricSamples
+{
+    std::string unit;
+    bool higher_is_better = false;
+    std::vector<double> values;
+};
+
+static std::map<std::string, MetricSamples> extract_samples(const std::vector<ProfilingSnapshot>& run)
+{
+    std::map<std::string, MetricSamples> samples;
+    for (const auto& snapshot : run)
+    {
+        if (snapshot.duration_ms == 0)
+        {
+            continue;
+        }
+
+        for (const auto& metric : snapshot.metrics)
+        {
+            //extrapolated ticks of a rotated counter are not observations
+            if (is_profiler_metric(metric.type) || metric.coverage == 0.0)
+            {
+                continue;
+            }
+            MetricSamples& entry = samples[metric.name];
+            if (is_gauge_metric(metric.type))
+            {
+                entry.unit = metric.unit;
+                entry.values.push_back(static_cast<double>(metric.value));
+                continue;
+            }
+            entry.unit = metric.unit + "/s";
+            entry.values.push_back(1000.0 * metric.value / snapshot.duration_ms);
+        }
+
+        //derived ratios only from ticks where both counters were really counted
+        const MetricValue* instructions = snapshot.find_metric(MetricType::INSTRUCTIONS);
+        const MetricValue* cycles = snapshot.find_metric(MetricType::CPU_CYCLES);
+        if (instructions && cycles && cycles->value > 0 && instructions->coverage > 0.0 && cycles->coverage > 0.0)
+        {
+            MetricSamples& entry = samples["ipc"];
+            entry.unit = "ratio";
+            entry.higher_is_better = true;
+            entry.values.push_back(static_cast<double>(instructions->value) / cycles->value);
+        }
+
+        const MetricValue* misses = snapshot.find_metric(MetricType::CACHE_MISSES);
+        const MetricValue* references = snapshot.find_metric(MetricType::CACHE_REFERENCES);
+        if (misses && references && references->value > 0 && misses->coverage > 0.0 && references->coverage > 0.0)
+        {
+            MetricSamples& entry = samples["cache_miss_rate"];
+            entry.unit = "ratio";
+            entry.values.push_back(static_cast<double>(misses->value) / references->value);
+        }
+    }
+    return samples;
+}
+
+static double mean_of(const std::vector<double>& values)
+{
+    return values.empty() ? 0.0 : std::accumulate(values.begin(), values.end(), 0.0) / values.size();
+}
+
+static double relative_delta_pct(double a, double b)
+{
+    if (a == 0.0)
+    {
+        return b == 0.0 ? 0.0 : 100.0;
+    }
+    return 100.0 * (b - a) / std::fabs(a);
+}
+
+double mann_whitney_p_value(const std::vector<double>& a, const std::vector<double>& b)
+{
+    const size_t n1 = a.size();
+    const size_t n2 = b.size();
+    if (n1 == 0 || n2 == 0)
+    {
+        return 1.0;
+    }
+
+    std::vector<std::pair<double, int>> combined;
+    combined.reserve(n1 + n2);
+    for (double v : a)
+    {
+        combined.push_back({v, 0});
+    }
+    for (double v : b)
+    {
+        combined.push_back({v, 1});
+    }
+    std::sort(combined.begin(), combined.end());
+
+    const double n = static_cast<double>(n1 + n2);
+    double rank_sum_a = 0.0;
+    double tie_term = 0.0;
+    for (size_t i = 0; i < combined.size();)
+    {
+        size_t j = i;
+        while (j < combined.size() && combined[j].first == combined[i].first)
+        {
+            j++;
+        }
+        double average_rank = (i + 1 + j) / 2.0;
+        double ties = static_cast<double>(j - i);
+        tie_term += ties * ties * ties - ties;
+        for (size_t k = i; k < j; k++)
+        {
+            if (combined[k].second == 0)
+            {
+                rank_sum_a += average_rank;
+            }
+        }
+        i = j;
+    }
+
+    double u = rank_sum_a - n1 * (n1 + 1) / 2.0;
+    double mu = n1 * n2 / 2.0;
+    double sigma = std::sqrt(n1 * n2 / 12.0 * ((n + 1) - tie_term / (n * (n - 1))));
+    if (sigma == 0.0)
+    {
+        return 1.0;
+    }
+
+    double continuity = u > mu ? -0.5 : (u < mu ? 0.5 : 0.0);
+    double z = (u - mu + continuity) / sigma;
+    return std::erfc(std::fabs(z) / std::sqrt(2.0));
+}
+
+static void bootstrap_ci(const std::vector<double>& a, const std::vector<double>& b, const ComparisonSettings& settings, double& low, double& high)
+{
+    std::mt19937_64 rng(0x5eed);    //fixed seed: the same inputs must give the same CI in CI jobs
+    std::uniform_int_distribution<size_t> pick_a(0, a.size() - 1);
+    std::uniform_int_distribution<size_t> pick_b(0, b.size() - 1);
+
+    std::vector<double> deltas(settings.bootstrap_resamples);
+    for (auto& delta : deltas)
+    {
+        double sum_a = 0.0;
+        double sum_b = 0.0;
+        for (size_t i = 0; i < a.size(); i++)
+        {
+            sum_a += a[pick_a(rng)];
+        }
+        for (size_t i = 0; i < b.size(); i++)
+        {
+            sum_b += b[pick_b(rng)];
+        }
+        delta = relative_delta_pct(sum_a / a.size(), sum_b / b.size());
+    }
+    std::sort(deltas.begin(), deltas.end());
+
+    double tail = (1.0 - settings.confidence) / 2.0;
+    low = deltas[static_cast<size_t>(tail * (deltas.size() - 1))];
+    high = deltas[static_cast<size_t>((1.0 - tail) * (deltas.size() - 1))];
+}
+
+ComparisonReport compare_runs(const std::vector<ProfilingSnapshot>& run_a, const std::vector<ProfilingSnapshot>& run_b, const ComparisonSettings& settings)
+{
+    ComparisonReport report;
+    report.settings = settings;
+
+    auto samples_a = extract_samples(run_a);
+    auto samples_b = extract_samples(run_b);
+
+    for (const auto& [name, a] : samples_a)
+    {
+        auto it = samples_b.find(name);
+        if (it == samples_b.end() || a.values.empty() || it->second.values.empty())
+        {
+            continue;
+        }
+        const MetricSamples& b = it->second;
+
+        MetricComparison comparison;
+        comparison.name = name;
+        comparison.unit = a.unit;
+        comparison.higher_is_better = a.higher_is_better;
+        comparison.samples_a = a.values.size();
+        comparison.samples_b = b.values.size();
+        comparison.mean_a = mean_of(a.values);
+        comparison.mean_b = mean_of(b.values);
+        comparison.delta_pct = relative_delta_pct(comparison.mean_a, comparison.mean_b);
+        bootstrap_ci(a.values, b.values, settings, comparison.ci_low_pct, comparison.ci_high_pct);
+        comparison.p_value = mann_whitney_p_value(a.values, b.values);
+        comparison.significant = comparison.p_value < settings.alpha;
+
+        bool worse = comparison.higher_is_better ? comparison.delta_pct < 0.0 : comparison.delta_pct > 0.0;
+        comparison.regression = comparison.significant && worse && std::fabs(comparison.delta_pct) >= settings.threshold_pct;
+        report.metrics.push_back(comparison);
+    }
+    return report;
+}
+
+bool ComparisonReport::has_regression() const
+{
+    return std::any_of(metrics.begin(), metrics.end(), [](const MetricComparison& m){ return m.regression; });
+}
+
+void ComparisonReport::write_json(std::ostream& ostr) const
+{
+    std::streamsize precision = ostr.precision(10);
+    ostr << "{\n";
+    ostr << "  \"alpha\": " << settings.alpha << ",\n";
+    ostr << "  \"threshold_pct\": " << settings.threshold_pct << ",\n";
+    ostr << "  \"confidence\": " << settings.confidence << ",\n";
+    ostr << "  \"regression\": " << (has_regression() ? "true" : "false") << ",\n";
+    ostr << "  \"metrics\": [\n";
+    for (size_t i = 0; i < metrics.size(); i++)
+    {
+        const MetricComparison& m = metrics[i];
+        ostr << "    {\"name\": \"" << m.name << "\", \"unit\": \"" << m.unit << "\""
+             << ", \"samples_a\": " << m.samples_a << ", \"samples_b\": " << m.samples_b
+             << ", \"mean_a\": " << m.mean_a << ", \"mean_b\": " << m.mean_b
+             << ", \"delta_pct\": " << m.delta_pct
+             << ", \"ci_low_pct\": " << m.ci_low_pct << ", \"ci_high_pct\": " << m.ci_high_pct
+             << ", \"p_value\": " << m.p_value
+             << ", \"significant\": " << (m.significant ? "true" : "false")
+             << ", \"regression\": " << (m.regression ? "true" : "false") << "}"
+             << (i + 1 < metrics.size() ? "," : "") << "\n";
+    }
+    ostr << "  ]\n";
+    ostr << "}\n";
+    ostr.precision(precision);
+}
+
+std::ostream& operator<<(std::ostream& ostr, const ComparisonReport& report)
+{
+    std::streamsize precision = ostr.precision();
+    ostr << std::left << std::setw(20) << "metric" << std::right
+         << std::setw(14) << "A" << std::setw(14) << "B"
+         << std::setw(10) << "delta%" << std::setw(22) << "CI%"
+         << std::setw(10) << "p" << std::endl;
+
+    for (const auto& m : report.metrics)
+    {
+        std::ostringstream ci;
+        ci << std::fixed << std::setprecision(2) << "[" << m.ci_low_pct << ", " << m.ci_high_pct << "]";
+
+        ostr << std::left << std::setw(20) << m.name << std::right << std::setprecision(6)
+             << std::setw(14) << m.mean_a << std::setw(14) << m.mean_b
+             << std::fixed << std::setprecision(2) << std::setw(10) << m.delta_pct
+             << std::setw(22) << ci.str()
+             << std::setprecision(4) << std::setw(10) << m.p_value
+             << (m.regression ? "  REGRESSION" : (m.significant ? "  changed" : "")) << std::endl;
+        ostr.unsetf(std::ios::floatfield);
+    }
+    ostr.precision(precision);
+    return ostr;
+}
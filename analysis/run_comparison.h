@@ -0,0 +1,52 @@
+#ifndef RUN_COMPARISON_H
+#define RUN_COMPARISON_H
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../metrics/metrics_collector.h"
+
+struct MetricComparison
+{
+    std::string name;
+    std::string unit;
+    bool higher_is_better = false;
+    size_t samples_a = 0;
+    size_t samples_b = 0;
+    double mean_a = 0.0;
+    double mean_b = 0.0;
+    double delta_pct = 0.0;
+    double ci_low_pct = 0.0;    //bootstrap CI of delta_pct
+    double ci_high_pct = 0.0;
+    double p_value = 1.0;       //two-sided Mann-Whitney U
+    bool significant = false;
+    bool regression = false;
+};
+
+struct ComparisonSettings
+{
+    double alpha = 0.05;
+    double threshold_pct = 5.0;     //smaller changes are never reported as regressions
+    size_t bootstrap_resamples = 2000;
+    double confidence = 0.95;
+};
+
+struct ComparisonReport
+{
+    ComparisonSettings settings;
+    std::vector<MetricComparison> metrics;
+
+    bool has_regression() const;
+    void write_json(std::ostream& ostr) const;
+
+    friend std::ostream& operator<<(std::ostream& ostr, const ComparisonReport& report);
+};
+
+//compares per-interval rates (per second) of every target metric present in both runs
+ComparisonReport compare_runs(const std::vector<ProfilingSnapshot>& run_a, const std::vector<ProfilingSnapshot>& run_b, const ComparisonSettings& settings);
+
+double mann_whitney_p_value(const std::vector<double>& a, const std::vector<double>& b);
+
+#endif
@@ -0,0 +1,505 @@
+#include "window_query.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <sstream>
+
+#include "../metrics/snapshot_history.h"
+
+static bool is_rate_signal(const std::string& signal)
+{
+    return signal.size() > 2 && signal.compare(signal.size() - 2, 2, "/s") == 0;
+}
+
+bool is_known_signal(const std::string& signal)
+{
+    if (signal == "ipc" || signal == "cache_miss_rate")
+    {
+        return true;
+    }
+    MetricType type;
+    return metric_from_name(is_rate_signal(signal) ? signal.substr(0, signal.size() - 2) : signal, type);
+}
+
+bool signal_sample(const ProfilingSnapshot& snapshot, const std::string& signal, double& numerator, double& denominator)
+{
+    if (signal == "ipc" || signal == "cache_miss_rate")
+    {
+        bool ipc = signal == "ipc";
+        const MetricValue* top = snapshot.find_metric(ipc ? MetricType::INSTRUCTIONS : MetricType::CACHE_MISSES);
+        const MetricValue* bottom = snapshot.find_metric(ipc ? MetricType::CPU_CYCLES : MetricType::CACHE_REFERENCES);
+        if (!top || !bottom || bottom->value == 0 || top->coverage == 0.0 || bottom->coverage == 0.0)
+        {
+            return false;
+        }
+        numerator = static_cast<double>(top->value);
+        denominator = static_cast<double>(bottom->value);
+        return true;
+    }
+
+    bool rate = is_rate_signal(signal);
+    MetricType type;
+    if (!metric_from_name(rate ? signal.substr(0, signal.size() - 2) : signal, type))
+    {
+        return false;
+    }
+    const MetricValue* metric = snapshot.find_metric(type);
+    if (!metric || metric->coverage == 0.0 || (rate && snapshot.duration_ms == 0))
+    {
+        return false;
+    }
+    numerator = static_cast<double>(metric->value);
+    denominator = rate ? snapshot.duration_ms / 1000.0 : 1.0;
+    return true;
+}
+
+bool parse_window_query(const std::string& spec, WindowQuery& query, std::string& error)
+{
+    size_t open = spec.find('(');
+    size_t close = spec.find(')', open == std::string::npos ? 0 : open);
+    if (open == std::string::npos || close == std::string::npos || open == 0)
+    {
+        error = "Expected <aggregate>(<signal>)[@<window>]: " + spec;
+        return false;
+    }
+
+    query = WindowQuery();
+    query.text = spec;
+    std::string aggregate = spec.substr(0, open);
+    if (aggregate == "sum")
+    {
+        query.aggregate = WindowAggregate::SUM;
+    }
+    else if (aggregate == "mean" || aggregate == "avg")
+    {
+        query.aggregate = WindowAggregate::MEAN;
+    }
+    else if (aggregate == "min")
+    {
+        query.aggregate = WindowAggregate::MIN;
+    }
+    else if (aggregate == "max")
+    {
+        query.aggregate = WindowAggregate::MAX;
+    }
+    else if (aggregate == "rate")
+    {
+        query.aggregate = WindowAggregate::RATE;
+    }
+    else if (aggregate.size() > 1 && aggregate[0] == 'p' && aggregate.find_first_not_of("0123456789.", 1) == std::string::npos)
+    {
+        query.aggregate = WindowAggregate::PERCENTILE;
+        char* end = nullptr;
+        query.percentile = std::strtod(aggregate.c_str() + 1, &end);
+        if (*end != '\0' || query.percentile > 100.0)
+        {
+            error = "Invalid percentile: " + aggregate;
+            return false;
+        }
+    }
+    else
+    {
+        error = "Unknown aggregate: " + aggregate;
+        return false;
+    }
+
+    query.signal = spec.substr(open + 1, close - open - 1);
+    if (!is_known_signal(query.signal))
+    {
+        error = "Unknown signal: " + query.signal;
+        return false;
+    }
+
+    std::string window = spec.substr(close + 1);
+    if (window.empty())
+    {
+        return true;
+    }
+    if (window[0] != '@' || window.size() < 2)
+    {
+        error = "Expected @-<duration> or @<from>:<to> after the signal: " + spec;
+        return false;
+    }
+    if (window[1] == '-')
+    {
+        query.last = true;
+        if (!parse_duration(window.substr(2), query.last_ms) || query.last_ms == 0)
+        {
+            error = "Invalid window duration: " + window;
+            return false;
+        }
+        return true;
+    }
+    size_t colon = window.find(':');
+    if (colon == std::string::npos || !parse_duration(window.substr(1, colon - 1), query.from_ms) ||
+        (colon + 1 < window.size() && !parse_duration(window.substr(colon + 1), query.to_ms)))
+    {
+        error = "Invalid window: " + window;
+        return false;
+    }
+    if (colon + 1 == window.size())
+    {
+        query.to_ms = UINT64_MAX;
+    }
+    return true;
+}
+
+std::string describe_window_result(const WindowQuery& query, bool found, double result, size_t samples)
+{
+    std::ostringstream ostr;
+    ostr << query.text << " = ";
+    if (found)
+    {
+        ostr << result;
+    }
+    else
+    {
+        ostr << "n/a";
+    }
+    ostr << " (" << samples << " snapshots)";
+    return ostr.str();
+}
+
+void SignalSeries::reserve(size_t snapshots)
+{
+    time_.reserve(snapshots);
+    value_.reserve(snapshots);
+    numerator_sum_.reserve(snapshots + 1);
+    denominator_sum_.reserve(snapshots + 1);
+    seconds_sum_.reserve(snapshots + 1);
+}
+
+void SignalSeries::append(const ProfilingSnapshot& snapshot)
+{
+    double numerator = 0.0, denominator = 0.0;
+    if (!signal_sample(snapshot, signal_, numerator, denominator) || denominator == 0.0)
+    {
+        return;
+    }
+    if (numerator_sum_.empty())
+    {
+        numerator_sum_.push_back(0.0);
+        denominator_sum_.push_back(0.0);
+        seconds_sum_.push_back(0.0);
+    }
+
+    size_t index = time_.size();
+    double value = numerator / denominator;
+    time_.push_back(snapshot.timestamp_ms);
+    value_.push_back(value);
+    numerator_sum_.push_back(numerator_sum_.back() + numerator);
+    denominator_sum_.push_back(denominator_sum_.back() + denominator);
+    seconds_sum_.push_back(seconds_sum_.back() + snapshot.duration_ms / 1000.0);
+
+    if (index % block_size == 0)
+    {
+        block_min_.push_back(value);
+        block_max_.push_back(value);
+    }
+    else
+    {
+        block_min_.back() = std::min(block_min_.back(), value);
+        block_max_.back() = std::max(block_max_.back(), value);
+    }
+    if (index % super_size == 0)
+    {
+        super_min_.push_back(value);
+        super_max_.push_back(value);
+    }
+    else
+    {
+        super_min_.back() = std::min(super_min_.back(), value);
+        super_max_.back() = std::max(super_max_.back(), value);
+    }
+
+    if (histogram_sums_.empty())
+    {
+        histogram_sums_.assign(histogram_size, 0);
+        open_histogram_.assign(histogram_size, 0);
+    }
+    open_histogram_[bucket_of(value)]++;
+    if ((index + 1) % super_size == 0)
+    {
+        size_t previous = histogram_sums_.size() - histogram_size;
+        histogram_sums_.resize(previous + 2 * histogram_size);
+        for (size_t i = 0; i < histogram_size; i++)
+        {
+            histogram_sums_[previous + histogram_size + i] = histogram_sums_[previous + i] + open_histogram_[i];
+        }
+        std::fill(open_histogram_.begin(), open_histogram_.end(), 0);
+    }
+}
+
+void SignalSeries::evict_before(uint64_t from_ms)
+{
+    first_ = std::lower_bound(time_.begin() + first_, time_.end(), from_ms) - time_.begin();
+    if (first_ < super_size || first_ * 2 < time_.size())
+    {
+        return;
+    }
+
+    //whole superblocks keep every index at its place in the blocks above it,
+    //the prefix sums are rebased so a long run does not eat their precision
+    size_t supers = first_ / super_size;
+    size_t count = supers * super_size;
+    time_.erase(time_.begin(), time_.begin() + count);
+    value_.erase(value_.begin(), value_.begin() + count);
+    numerator_sum_.erase(numerator_sum_.begin(), numerator_sum_.begin() + count);
+    denominator_sum_.erase(denominator_sum_.begin(), denominator_sum_.begin() + count);
+    seconds_sum_.erase(seconds_sum_.begin(), seconds_sum_.begin() + count);
+    block_min_.erase(block_min_.begin(), block_min_.begin() + count / block_size);
+    block_max_.erase(block_max_.begin(), block_max_.begin() + count / block_size);
+    super_min_.erase(super_min_.begin(), super_min_.begin() + supers);
+    super_max_.erase(super_max_.begin(), super_max_.begin() + supers);
+    histogram_sums_.erase(histogram_sums_.begin(), histogram_sums_.begin() + supers * histogram_size);
+    first_ -= count;
+
+    for (auto* sums : {&numerator_sum_, &denominator_sum_, &seconds_sum_})
+    {
+        double base = sums->front();
+        for (double& sum : *sums)
+        {
+            sum -= base;
+        }
+    }
+    for (size_t boundary = histogram_sums_.size() / histogram_size; boundary-- > 0;)
+    {
+        for (size_t i = 0; i < histogram_size; i++)
+        {
+            histogram_sums_[boundary * histogram_size + i] -= histogram_sums_[i];
+        }
+    }
+}
+
+size_t SignalSeries::bucket_of(double value)
+{
+    if (!(value > 0.0))
+    {
+        return 0;
+    }
+    int exponent = 0;
+    double mantissa = std::frexp(value, &exponent);     //[0.5, 1)
+    if (exponent < min_exponent)
+    {
+        return 1;
+    }
+    if (exponent > max_exponent)
+    {
+        return histogram_size - 1;
+    }
+    size_t step = std::min(static_cast<size_t>((mantissa - 0.5) * 2.0 * sub_buckets), sub_buckets - 1);
+    return 1 + static_cast<size_t>(exponent - min_exponent) * sub_buckets + step;
+}
+
+double SignalSeries::bucket_value(size_t bucket)
+{
+    if (bucket == 0)
+    {
+        return 0.0;
+    }
+    int exponent = static_cast<int>((bucket - 1) / sub_buckets) + min_exponent;
+    double mantissa = 0.5 + ((bucket - 1) % sub_buckets + 0.5) / (2.0 * sub_buckets);
+    return std::ldexp(mantissa, exponent);
+}
+
+double SignalSeries::approximate_percentile(size_t first, size_t last, double percentile) const
+{
+    //whole superblocks from the prefix histograms, the ends bucketed one by one
+    size_t super_first = (first + super_size - 1) / super_size;
+    size_t super_last = last / super_size;
+    std::vector<uint32_t> counts(histogram_size, 0);
+    if (super_first < super_last)
+    {
+        const uint32_t* high = histogram_sums_.data() + super_last * histogram_size;
+        const uint32_t* low = histogram_sums_.data() + super_first * histogram_size;
+        for (size_t i = 0; i < histogram_size; i++)
+        {
+            counts[i] = high[i] - low[i];
+        }
+    }
+    else
+    {
+        super_first = super_last = last / super_size;
+    }
+    for (size_t i = first; i < std::min(last, super_first * super_size); i++)
+    {
+        counts[bucket_of(value_[i])]++;
+    }
+    for (size_t i = std::max(first, super_last * super_size); i < last; i++)
+    {
+        counts[bucket_of(value_[i])]++;
+    }
+
+    size_t rank = static_cast<size_t>(std::ceil(percentile / 100.0 * (last - first)));
+    size_t seen = 0;
+    for (size_t bucket = 0; bucket < histogram_size; bucket++)
+    {
+        seen += counts[bucket];
+        if (seen >= std::max<size_t>(rank, 1))
+        {
+            //the bucket's middle, never outside what the window really holds
+            return std::clamp(bucket_value(bucket), extreme(first, last, false), extreme(first, last, true));
+        }
+    }
+    return extreme(first, last, true);
+}
+
+void SignalSeries::range(uint64_t from_ms, uint64_t to_ms, size_t& first, size_t& last) const
+{
+    first = std::lower_bound(time_.begin() + first_, time_.end(), from_ms) - time_.begin();
+    last = std::upper_bound(time_.begin() + first, time_.end(), to_ms) - time_.begin();
+}
+
+//independent lanes: a single running min is a chain the compiler may not reorder
+//for doubles, four of them become packed min/max instructions
+static constexpr size_t scan_lanes = 4;
+
+static double scan_min(const double* values, size_t count, double result)
+{
+    double lanes[scan_lanes] = {result, result, result, result};
+    size_t i = 0;
+    for (; i + scan_lanes <= count; i += scan_lanes)
+    {
+        for (size_t lane = 0; lane < scan_lanes; lane++)
+        {
+            lanes[lane] = values[i + lane] < lanes[lane] ? values[i + lane] : lanes[lane];
+        }
+    }
+    for (; i < count; i++)
+    {
+        lanes[0] = values[i] < lanes[0] ? values[i] : lanes[0];
+    }
+    return std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+}
+
+static double scan_max(const double* values, size_t count, double result)
+{
+    double lanes[scan_lanes] = {result, result, result, result};
+    size_t i = 0;
+    for (; i + scan_lanes <= count; i += scan_lanes)
+    {
+        for (size_t lane = 0; lane < scan_lanes; lane++)
+        {
+            lanes[lane] = values[i + lane] > lanes[lane] ? values[i + lane] : lanes[lane];
+        }
+    }
+    for (; i < count; i++)
+    {
+        lanes[0] = values[i] > lanes[0] ? values[i] : lanes[0];
+    }
+    return std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+}
+
+double SignalSeries::extreme(size_t first, size_t last, bool maximum) const
+{
+    double result = maximum ? -std::numeric_limits<double>::infinity() : std::numeric_limits<double>::infinity();
+    auto scan = [&result, maximum](const std::vector<double>& values, size_t from, size_t to)
+    {
+        if (from < to)
+        {
+            result = maximum ? scan_max(values.data() + from, to - from, result) : scan_min(values.data() + from, to - from, result);
+        }
+    };
+
+    //whole blocks and whole superblocks inside [first, last) come from the levels above
+    size_t block_first = (first + block_size - 1) / block_size;
+    size_t block_last = last / block_size;
+    if (block_first >= block_last)
+    {
+        scan(value_, first, last);
+        return result;
+    }
+    scan(value_, first, block_first * block_size);
+    size_t super_first = (block_first + block_size - 1) / block_size;
+    size_t super_last = block_last / block_size;
+    const std::vector<double>& blocks = maximum ? block_max_ : block_min_;
+    if (super_first < super_last)
+    {
+        scan(blocks, block_first, super_first * block_size);
+        scan(maximum ? super_max_ : super_min_, super_first, super_last);
+        scan(blocks, super_last * block_size, block_last);
+    }
+    else
+    {
+        scan(blocks, block_first, block_last);
+    }
+    scan(value_, block_last * block_size, last);
+    return result;
+}
+
+bool SignalSeries::aggregate(size_t first, size_t last, WindowAggregate aggregate, double percentile, double& result) const
+{
+    if (first >= last || first < first_ || last > time_.size())
+    {
+        return false;
+    }
+
+    switch (aggregate)
+    {
+        case WindowAggregate::SUM:
+            result = numerator_sum_[last] - numerator_sum_[first];
+            return true;
+        case WindowAggregate::MEAN:
+        {
+            double denominator = denominator_sum_[last] - denominator_sum_[first];
+            result = denominator > 0.0 ? (numerator_sum_[last] - numerator_sum_[first]) / denominator : 0.0;
+            return denominator > 0.0;
+        }
+        case WindowAggregate::RATE:
+        {
+            double seconds = seconds_sum_[last] - seconds_sum_[first];
+            result = seconds > 0.0 ? (numerator_sum_[last] - numerator_sum_[first]) / seconds : 0.0;
+            return seconds > 0.0;
+        }
+        case WindowAggregate::MIN:
+            result = extreme(first, last, false);
+            return true;
+        case WindowAggregate::MAX:
+            result = extreme(first, last, true);
+            return true;
+        case WindowAggregate::PERCENTILE:
+        {
+            if (last - first > exact_percentile_limit)
+            {
+                result = approximate_percentile(first, last, percentile);
+                return true;
+            }
+            //nearest rank over a copy of the window
+            std::vector<double> window(value_.begin() + first, value_.begin() + last);
+            size_t rank = static_cast<size_t>(std::ceil(percentile / 100.0 * window.size()));
+            size_t index = rank > 0 ? rank - 1 : 0;
+            std::nth_element(window.begin(), window.begin() + index, window.end());
+            result = window[index];
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SignalSeries::evaluate(const WindowQuery& query, double& result, size_t& samples) const
+{
+    samples = 0;
+    if (first_ >= time_.size())
+    {
+        return false;
+    }
+
+    uint64_t from_ms, to_ms;
+    if (query.last)
+    {
+        to_ms = time_.back();
+        from_ms = to_ms > query.last_ms ? to_ms - query.last_ms : 0;
+    }
+    else
+    {
+        from_ms = time_[first_] + query.from_ms;
+        to_ms = query.to_ms == UINT64_MAX ? UINT64_MAX : time_[first_] + query.to_ms;
+    }
+
+    size_t first, last;
+    range(from_ms, to_ms, first, last);
+    samples = last - first;
+    return aggregate(first, last, query.aggregate, query.percentile, result);
+}
@@ -0,0 +1,102 @@
+#ifndef WINDOW_QUERY_H
+#define WINDOW_QUERY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../metrics/profiling_snapshot.h"
+
+//signals: ipc, cache_miss_rate, <metric>/s (rate) or <metric> (value per snapshot)
+bool is_known_signal(const std::string& signal);
+//the signal of one snapshot as numerator / denominator, so windows weight snapshots
+//properly: instructions / cycles, value / seconds, value / 1
+bool signal_sample(const ProfilingSnapshot& snapshot, const std::string& signal, double& numerator, double& denominator);
+
+enum class WindowAggregate
+{
+    SUM,            //of the numerators: total instructions, total faults
+    MEAN,           //sum of numerators over sum of denominators
+    MIN,            //of the per-snapshot values
+    MAX,
+    RATE,           //sum of numerators per second of snapshot intervals
+    PERCENTILE
+};
+
+//"mean(ipc)", "max(page_faults/s)@-10s", "p99(context_switches/s)@2s:8s";
+//@-<duration> is the end of the series, @<from>:<to> is counted from its first
+//snapshot, durations as in retention specs (ms, s, m, h, d)
+struct WindowQuery
+{
+    std::string text;
+    WindowAggregate aggregate = WindowAggregate::MEAN;
+    double percentile = 0.0;        //0-100
+    std::string signal;
+    bool last = false;
+    uint64_t last_ms = 0;
+    uint64_t from_ms = 0;
+    uint64_t to_ms = UINT64_MAX;
+};
+
+bool parse_window_query(const std::string& spec, WindowQuery& query, std::string& error);
+//"mean(ipc)@-10s = 1.42 (97 snapshots)", "... = n/a" without data
+std::string describe_window_result(const WindowQuery& query, bool found, double result, size_t samples);
+
+//append-only time series of one signal: prefix sums answer sum, mean and rate
+//in O(1), min and max come from per-block extremes over two levels, only the
+//partial blocks at the ends are scanned; time ranges are found by binary search.
+//Percentiles are exact up to exact_percentile_limit snapshots, beyond that they
+//come from log-linear histograms kept as prefix sums at superblock boundaries.
+//Eviction only moves the start, storage is given back in whole superblocks
+class SignalSeries
+{
+public:
+    explicit SignalSeries(const std::string& signal): signal_(signal) {}
+
+    const std::string& signal() const { return signal_; }
+    size_t size() const { return time_.size() - first_; }
+
+    //snapshots must come in time order, those without the signal are skipped
+    void append(const ProfilingSnapshot& snapshot);
+    void reserve(size_t snapshots);
+    //drops the snapshots before from_ms
+    void evict_before(uint64_t from_ms);
+
+    //indices [first, last) of the snapshots in [from_ms, to_ms], absolute timestamps
+    void range(uint64_t from_ms, uint64_t to_ms, size_t& first, size_t& last) const;
+    //false for an empty range or a zero denominator
+    bool aggregate(size_t first, size_t last, WindowAggregate aggregate, double percentile, double& result) const;
+    //resolves the query's window against this series
+    bool evaluate(const WindowQuery& query, double& result, size_t& samples) const;
+
+private:
+    static constexpr size_t block_size = 64;
+    static constexpr size_t super_size = block_size * block_size;
+    static constexpr size_t exact_percentile_limit = super_size;
+    //32 linear steps per power of two from 2^-32 to 2^64, about 3% wide, bucket 0 for <= 0
+    static constexpr int min_exponent = -31;
+    static constexpr int max_exponent = 64;
+    static constexpr size_t sub_buckets = 32;
+    static constexpr size_t histogram_size = 1 + (max_exponent - min_exponent + 1) * sub_buckets;
+
+    std::string signal_;
+    size_t first_ = 0;                      //evicted before it, less than a superblock once compacted
+    std::vector<uint64_t> time_;
+    std::vector<double> value_;
+    std::vector<double> numerator_sum_;     //prefix sums, one longer than time_
+    std::vector<double> denominator_sum_;
+    std::vector<double> seconds_sum_;
+    std::vector<double> block_min_;
+    std::vector<double> block_max_;
+    std::vector<double> super_min_;
+    std::vector<double> super_max_;
+    std::vector<uint32_t> histogram_sums_;  //histogram_size counts per superblock boundary
+    std::vector<uint32_t> open_histogram_;  //of the superblock being filled
+
+    double extreme(size_t first, size_t last, bool maximum) const;
+    double approximate_percentile(size_t first, size_t last, double percentile) const;
+    static size_t bucket_of(double value);
+    static double bucket_value(size_t bucket);
+};
+
+#endif
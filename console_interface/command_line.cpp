@@ -0,0 +1,433 @@
+#include "command_line.h"
+
+#include <sstream>
+
+static bool take_value(int argc, char** argv, int& i, std::string& value, std::string& error)
+{
+    if(i + 1 >= argc)
+    {
+        error = std::string("Missing value for ") + argv[i];
+        return false;
+    }
+    value = argv[++i];
+    return true;
+}
+
+static bool parse_metrics(const std::string& list, std::vector<MetricType>& metrics, std::string& error)
+{
+    std::istringstream istr(list);
+    std::string name;
+    while(std::getline(istr, name, ','))
+    {
+        MetricType type;
+        if(!metric_from_name(name, type))
+        {
+            error = "Unknown metric: " + name;
+            return false;
+        }
+        metrics.push_back(type);
+    }
+    return true;
+}
+
+bool parse_command_line(int argc, char** argv, CommandLineOptions& options, std::string& error)
+{
+    try
+    {
+        for(int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            std::string value;
+            if(arg == "--record")
+            {
+                if(!take_value(argc, argv, i, options.record_path, error))
+                {
+                    return false;
+                }
+            }
+            else if(arg == "--offcpu")
+            {
+                if(!take_value(argc, argv, i, options.sources.offcpu_folded_path, error))
+                {
+                    return false;
+                }
+                options.metrics.push_back(MetricType::OFFCPU_TIME);
+            }
+            else if(arg == "--faults")
+            {
+                if(!take_value(argc, argv, i, options.sources.fault_heatmap_path, error))
+                {
+                    return false;
+                }
+                options.metrics.push_back(MetricType::FAULT_SAMPLES);
+            }
+            else if(arg == "--syscalls")
+            {
+                if(!take_value(argc, argv, i, options.sources.syscall_table_path, error))
+                {
+                    return false;
+                }
+                options.metrics.push_back(MetricType::SYSCALL_COUNT);
+                options.metrics.push_back(MetricType::SYSCALL_TIME);
+            }
+            else if(arg == "--contention")
+            {
+                if(!take_value(argc, argv, i, options.sources.contention_table_path, error))
+                {
+                    return false;
+                }
+                options.metrics.push_back(MetricType::FUTEX_WAITS);
+                options.metrics.push_back(MetricType::FUTEX_WAIT_TIME);
+                options.metrics.push_back(MetricType::FUTEX_WAKES);
+            }
+            else if(arg == "--io")
+            {
+                for(int type = static_cast<int>(MetricType::IO_READ_CHARS); type <= static_cast<int>(MetricType::IO_CANCELLED_WRITE_BYTES); type++)
+                {
+                    options.metrics.push_back(static_cast<MetricType>(type));
+                }
+            }
+            else if(arg == "--block")
+            {
+                if(!take_value(argc, argv, i, options.sources.block_table_path, error))
+                {
+                    return false;
+                }
+                options.metrics.push_back(MetricType::BLOCK_REQUESTS);
+                options.metrics.push_back(MetricType::BLOCK_TIME);
+            }
+            else if(arg == "--tree")
+            {
+                if(!take_value(argc, argv, i, options.sources.tree_table_path, error))
+                {
+                    return false;
+                }
+                options.sources.process_tree = true;
+                options.counters.inherit = true;
+            }
+            else if(arg == "--fault-ips")
+            {
+                options.sources.fault_ips = true;
+            }
+            else if(arg == "--alloc")
+            {
+                if(!take_value(argc, argv, i, options.sources.alloc_folded_path, error))
+                {
+                    return false;
+                }
+                options.alloc.enabled = true;
+            }
+            else if(arg == "--alloc-shim")
+            {
+                if(!take_value(argc, argv, i, options.alloc.shim_path, error))
+                {
+                    return false;
+                }
+            }
+            else if(arg == "--adaptive")
+            {
+                if(!take_value(argc, argv, i, value, error))
+                {
+                    return false;
+                }
+                size_t colon = value.find(':');
+                if(colon == std::string::npos)
+                {
+                    error = "Expected --adaptive <min_ms>:<max_ms>";
+                    return false;
+                }
+                options.adaptive.enabled = true;
+                options.adaptive.min_interval_ms = std::stoull(value.substr(0, colon));
+                options.adaptive.max_interval_ms = std::stoull(value.substr(colon + 1));
+                if(options.adaptive.min_interval_ms < AdaptiveInterval::lowest_interval_ms || options.adaptive.min_interval_ms > options.adaptive.max_interval_ms)
+                {
+                    error = "Invalid adaptive interval bounds: " + value;
+                    return false;
+                }
+            }
+            else if(arg == "--flight")
+            {
+                if(!take_value(argc, argv, i, options.flight.dump_dir, error))
+                {
+                    return false;
+                }
+                options.flight.enabled = true;
+            }
+            else if(arg == "--trigger")
+            {
+                FlightTrigger trigger;
+                if(!take_value(argc, argv, i, value, error) || !parse_trigger(value, trigger, error))
+                {
+                    return false;
+                }
+                options.flight.triggers.push_back(trigger);
+            }
+            else if(arg == "--flight-window")
+            {
+                if(!take_value(argc, argv, i, value, error))
+                {
+                    return false;
+                }
+                size_t colon = value.find(':');
+                if(colon == std::string::npos)
+                {
+                    error = "Expected --flight-window <before_s>:<after_s>";
+                    return false;
+                }
+                options.flight.pre_trigger_ms = static_cast<uint64_t>(std::stod(value.substr(0, colon)) * 1000);
+                options.flight.post_trigger_ms = static_cast<uint64_t>(std::stod(value.substr(colon + 1)) * 1000);
+            }
+            else if(arg == "--retention")
+            {
+                if(!take_value(argc, argv, i, value, error) || !parse_retention(value, options.history, error))
+                {
+                    return false;
+                }
+            }
+            else if(arg == "--regions")
+            {
+                options.region_markers = true;
+            }
+            else if(arg == "--compare" || arg == "--compare-cmd")
+            {
+                std::string first, second;
+                if(!take_value(argc, argv, i, first, error) || !take_value(argc, argv, i, second, error))
+                {
+                    return false;
+                }
+                options.mode = arg == "--compare" ? RunMode::COMPARE_RECORDINGS : RunMode::COMPARE_COMMANDS;
+                options.compare_inputs = {first, second};
+            }
+            else if(arg == "--query")
+            {
+                std::string queries;
+                if(!take_value(argc, argv, i, options.query_input, error) || !take_value(argc, argv, i, queries, error))
+                {
+                    return false;
+                }
+                options.mode = RunMode::QUERY;
+                std::istringstream istr(queries);
+                std::string query;
+                while(std::getline(istr, query, ','))
+                {
+                    options.queries.push_back(query);
+                }
+            }
+            else if(arg == "--daemon")
+            {
+                if(!take_value(argc, argv, i, options.socket_path, error))
+                {
+                    return false;
+                }
+                options.mode = RunMode::DAEMON;
+            }
+            else if(arg == "--client")
+            {
+                if(!take_value(argc, argv, i, options.socket_path, error) || !take_value(argc, argv, i, options.client_request, error))
+                {
+                    return false;
+                }
+                options.mode = RunMode::CLIENT;
+            }
+            else if(arg == "--cmd")
+            {
+                if(!take_value(argc, argv, i, options.command, error))
+                {
+                    return false;
+                }
+            }
+            else if(arg == "--cpus" || arg == "--housekeeping-cpus" || arg == "--numa" || arg == "--sched" || arg == "--nice")
+            {
+                if(!take_value(argc, argv, i, value, error))
+                {
+                    return false;
+                }
+
+                bool valid = true;
+                if(arg == "--cpus")
+                {
+                    valid = parse_cpu_list(value, options.isolation.cpu_set);
+                }
+                else if(arg == "--housekeeping-cpus")
+                {
+                    valid = parse_cpu_list(value, options.housekeeping_cpus);
+                }
+                else if(arg == "--numa")
+                {
+                    valid = parse_numa_policy(value, options.isolation.numa_policy, options.isolation.numa_nodes);
+                }
+                else if(arg == "--sched")
+                {
+                    valid = parse_scheduling_class(value, options.isolation.scheduling_class, options.isolation.scheduling_priority);
+                }
+                else
+                {
+                    options.isolation.nice_value = std::stoi(value);
+                }
+
+                if(!valid)
+                {
+                    error = "Invalid value for " + arg + ": " + value;
+                    return false;
+                }
+            }
+            else if(arg == "--json")
+            {
+                if(!take_value(argc, argv, i, options.json_path, error))
+                {
+                    return false;
+                }
+            }
+            else if(arg == "--alpha" || arg == "--threshold" || arg == "--interval" || arg == "--duration" || arg == "--metrics" || arg == "--repeat" || arg == "--parallel" || arg == "--counters" || arg == "--history-mb" || arg == "--overhead-budget" || arg == "--flight-callchains" || arg == "--fault-period" || arg == "--alloc-sample" || arg == "--kernel-timed")
+            {
+                if(!take_value(argc, argv, i, value, error))
+                {
+                    return false;
+                }
+                if(arg == "--alpha")
+                {
+                    options.alpha = std::stod(value);
+                }
+                else if(arg == "--threshold")
+                {
+                    options.threshold_pct = std::stod(value);
+                }
+                else if(arg == "--interval")
+                {
+                    options.interval_ms = std::stoi(value);
+                }
+                else if(arg == "--duration")
+                {
+                    options.duration_s = std::stoul(value);
+                }
+                else if(arg == "--repeat")
+                {
+                    options.repeat_runs = std::stoul(value);
+                    options.mode = RunMode::REPEAT;
+                }
+                else if(arg == "--parallel")
+                {
+                    options.parallel_runs = std::stoul(value);
+                }
+                else if(arg == "--counters")
+                {
+                    options.counters.counters_per_group = std::stoul(value);
+                }
+                else if(arg == "--kernel-timed")
+                {
+                    options.counters.kernel_timed_batch = std::stoul(value);
+                }
+                else if(arg == "--overhead-budget")
+                {
+                    options.adaptive.overhead_budget = std::stod(value) / 100.0;
+                }
+                else if(arg == "--fault-period")
+                {
+                    options.sources.fault_sample_period = std::stoull(value);
+                }
+                else if(arg == "--alloc-sample")
+                {
+                    options.alloc.sample_bytes = std::stoull(value);
+                }
+                else if(arg == "--flight-callchains")
+                {
+                    options.flight.callchain_frequency = std::stoul(value);
+                }
+                else if(arg == "--history-mb")
+                {
+                    options.history.memory_cap_bytes = static_cast<size_t>(std::stoul(value)) << 20;
+                }
+                else if(!parse_metrics(value, options.metrics, error))
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                error = "Unknown option: " + arg;
+                return false;
+            }
+        }
+    }
+    catch(const std::exception&)
+    {
+        error = "Invalid numeric value";
+        return false;
+    }
+    if(options.flight.enabled && options.flight.triggers.empty())
+    {
+        error = "--flight needs at least one --trigger";
+        return false;
+    }
+    if(options.counters.kernel_timed_batch > 0 && (options.adaptive.enabled || options.counters.inherit))
+    {
+        error = "--kernel-timed can't be combined with --adaptive or --tree";
+        return false;
+    }
+    if(options.mode == RunMode::REPEAT && options.command.empty())
+    {
+        error = "--repeat needs a command: --cmd \"<programm> <args>\"";
+        return false;
+    }
+    return true;
+}
+
+void print_usage(std::ostream& ostr, const char* program)
+{
+    ostr << "Usage: " << program << " [options]" << std::endl;
+    ostr << "  --record <file>               save snapshots, phases and run metadata to <file>" << std::endl;
+    ostr << "  --offcpu <file>               trace off-CPU time and write folded blocked stacks to <file>" << std::endl;
+    ostr << "  --faults <file>               sample page-fault addresses and write a per-mapping heatmap to <file>" << std::endl;
+    ostr << "  --fault-period <n>            with --faults: one address sample per n faults (1)" << std::endl;
+    ostr << "  --fault-ips                   with --faults: list the code locations causing the faults" << std::endl;
+    ostr << "  --tree <file>                 follow the whole process tree, write per-command totals to <file>" << std::endl;
+    ostr << "  --syscalls <file>             trace syscalls, write per-syscall counts and latency histograms to <file>" << std::endl;
+    ostr << "  --contention <file>           trace futex waits, write per-lock and per-callchain wait times to <file>" << std::endl;
+    ostr << "  --io                          read/write bytes and syscalls of the target from /proc/<pid>/io" << std::endl;
+    ostr << "  --block <file>                trace block requests system-wide, write per-device latency histograms to <file>" << std::endl;
+    ostr << "  --alloc <file>                preload an allocation shim, write folded allocation stacks to <file>" << std::endl;
+    ostr << "  --alloc-shim <path>           with --alloc: shim library (libprofiler_alloc.so next to the profiler)" << std::endl;
+    ostr << "  --alloc-sample <bytes>        with --alloc: mean allocated bytes between stacks, 0 - counters only (524288)" << std::endl;
+    ostr << "  --adaptive <min>:<max>        adapt the interval (ms) to how fast metrics change" << std::endl;
+    ostr << "  --overhead-budget <pct>       profiler CPU budget of the adaptive interval (2)" << std::endl;
+    ostr << "  --flight <dir>                keep recent snapshots in memory, dump them to <dir> on a trigger" << std::endl;
+    ostr << "  --trigger <expr>              flight trigger, e.g. ipc<0.8 or page_faults/s>5000, repeatable" << std::endl;
+    ostr << "  --flight-window <pre>:<post>  seconds dumped before and after a trigger (30:10)" << std::endl;
+    ostr << "  --flight-callchains <hz>      sample callchains between a trigger and its dump" << std::endl;
+    ostr << "  --retention <tiers>           history tiers, default raw:10m,1s:1d,1m:forever" << std::endl;
+    ostr << "  --history-mb <n>              memory cap of the snapshot history (64)" << std::endl;
+    ostr << "  --regions                     split counters by region_begin/region_end markers of the target" << std::endl;
+    ostr << "  --compare <a.rec> <b.rec>     compare two recordings" << std::endl;
+    ostr << "  --compare-cmd <cmd a> <cmd b> profile two commands one after another and compare them" << std::endl;
+    ostr << "  --repeat <n> --cmd <command>  run the command n times and aggregate the totals" << std::endl;
+    ostr << "  --parallel <p>                with --repeat: up to p runs at once on disjoint CPU sets" << std::endl;
+    ostr << "  --daemon <socket>             host profiling sessions for clients on a Unix socket" << std::endl;
+    ostr << "  --client <socket> <request>   send list, \"start <command>\", \"attach <id>\", \"stop <id>\" or \"query <id> <query>\" to a daemon" << std::endl;
+    ostr << "  --query <rec> <q1,q2,...>     window queries over a recording, e.g. mean(ipc)@-10s or p99(page_faults/s)@2s:8s" << std::endl;
+    ostr << "  --json <file|->               write the comparison as JSON" << std::endl;
+    ostr << "  --alpha <p>                   significance level (default 0.05)" << std::endl;
+    ostr << "  --threshold <pct>             minimal change reported as regression (default 5)" << std::endl;
+    ostr << "  --cpus <list>                 pin the target to CPUs, e.g. 2-5,7" << std::endl;
+    ostr << "  --numa <policy:nodes>         target memory policy: bind, interleave or preferred, e.g. bind:0" << std::endl;
+    ostr << "  --nice <n>                    target nice value" << std::endl;
+    ostr << "  --sched <class>               target scheduling class: other, batch, idle, fifo:<prio>, rr:<prio>" << std::endl;
+    ostr << "  --housekeeping-cpus <list>    pin the profiler's own threads to these CPUs" << std::endl;
+    ostr << "  --metrics <a,b,...>           metrics for non-interactive runs, e.g. instructions,cpu_cycles" << std::endl;
+    ostr << "  --counters <n>                hardware counters per group, more events are rotated" << std::endl;
+    ostr << "  --kernel-timed <n>            the kernel samples the counters every interval of CPU time, read every n samples" << std::endl;
+    ostr << "  --interval <ms>               sampling interval for non-interactive runs" << std::endl;
+    ostr << "  --duration <s>                maximal duration of one non-interactive run" << std::endl;
+    ostr << "Exit code 2 in compare mode means a significant regression was found." << std::endl;
+}
+
+std::vector<std::string> split_command(const std::string& command)
+{
+    std::vector<std::string> parts;
+    std::istringstream istr(command);
+    std::string part;
+    while(istr >> part)
+    {
+        parts.push_back(part);
+    }
+    return parts;
+}
@@ -0,0 +1,72 @@
+#ifndef COMMAND_LINE_H
+#define COMMAND_LINE_H
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../metrics/metrics_collector.h"
+#include "../metrics/snapshot_history.h"
+#include "../recording/flight_recorder.h"
+#include "../processes/isolation.h"
+#include "../processes/alloc_buffer.h"
+
+enum class RunMode
+{
+    INTERACTIVE,
+    COMPARE_RECORDINGS,
+    COMPARE_COMMANDS,
+    REPEAT,
+    DAEMON,
+    CLIENT,
+    QUERY
+};
+
+struct CommandLineOptions
+{
+    RunMode mode = RunMode::INTERACTIVE;
+    std::string record_path;
+    SourceOptions sources;
+    CounterSettings counters;
+    HistorySettings history;
+    AdaptiveSettings adaptive;
+    FlightSettings flight;
+
+    //compare mode: two recordings or two command lines
+    std::vector<std::string> compare_inputs;
+    std::string json_path;
+    double alpha = 0.05;
+    double threshold_pct = 5.0;
+
+    //repeat mode
+    std::string command;
+    uint32_t repeat_runs = 0;
+    uint32_t parallel_runs = 1;
+
+    //query mode: window queries over a recording
+    std::string query_input;
+    std::vector<std::string> queries;
+
+    //daemon and client modes
+    std::string socket_path;
+    std::string client_request;
+
+    //target isolation and profiler housekeeping CPUs
+    IsolationOptions isolation;
+    bool region_markers = false;
+    AllocOptions alloc;
+    std::vector<int> housekeeping_cpus;
+
+    //non-interactive runs
+    std::vector<MetricType> metrics;
+    int interval_ms = 100;
+    uint32_t duration_s = 30;
+};
+
+bool parse_command_line(int argc, char** argv, CommandLineOptions& options, std::string& error);
+void print_usage(std::ostream& ostr, const char* program);
+
+std::vector<std::string> split_command(const std::string& command);
+
+#endif
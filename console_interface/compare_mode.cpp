@@ -0,0 +1,101 @@
+#include "compare_mode.h"
+
+#include <fstream>
+
+#include "../manager/manager.h"
+#include "../analysis/run_comparison.h"
+#include "../recording/recorder.h"
+
+static bool profile_command(const std::string& command, const CommandLineOptions& options, std::vector<ProfilingSnapshot>& snapshots)
+{
+    std::vector<std::string> parts = split_command(command);
+    if(parts.empty())
+    {
+        std::cerr << "Empty command to compare" << std::endl;
+        return false;
+    }
+
+    ProfilingConfiguration config;
+    if(!options.metrics.empty())
+    {
+        config.metrics = options.metrics;
+    }
+    config.interval_ms = options.interval_ms;
+    config.launch.isolation = options.isolation;
+    config.launch.region_markers = options.region_markers;
+    config.launch.alloc = options.alloc;
+    config.housekeeping_cpus = options.housekeeping_cpus;
+    config.sources = options.sources;
+    config.counters = options.counters;
+    config.history = options.history;
+    config.adaptive = options.adaptive;
+    config.flight = options.flight;
+
+    Manager manager;
+    manager.setup_log_callback([](const std::string&){});
+    manager.setup_error_callback([](const std::string& error){ std::cerr << error << std::endl; });
+
+    std::cout << "Profiling: " << command << std::endl;
+    std::string programm = parts.front();
+    parts.erase(parts.begin());
+    return manager.run_to_completion(programm, parts, config, options.duration_s, snapshots);
+}
+
+static bool load_run(const std::string& input, const CommandLineOptions& options, std::vector<ProfilingSnapshot>& snapshots)
+{
+    if(options.mode == RunMode::COMPARE_COMMANDS)
+    {
+        return profile_command(input, options, snapshots);
+    }
+
+    Recording recording;
+    std::string error;
+    if(!load_recording(input, recording, error))
+    {
+        std::cerr << error << std::endl;
+        return false;
+    }
+    snapshots = std::move(recording.snapshots);
+    return true;
+}
+
+int run_compare_mode(const CommandLineOptions& options)
+{
+    std::vector<ProfilingSnapshot> run_a, run_b;
+    if(!load_run(options.compare_inputs[0], options, run_a) || !load_run(options.compare_inputs[1], options, run_b))
+    {
+        return 1;
+    }
+
+    ComparisonSettings settings;
+    settings.alpha = options.alpha;
+    settings.threshold_pct = options.threshold_pct;
+    ComparisonReport report = compare_runs(run_a, run_b, settings);
+
+    if(report.metrics.empty())
+    {
+        std::cerr << "The runs have no common metrics to compare" << std::endl;
+        return 1;
+    }
+
+    std::cout << "A: " << options.compare_inputs[0] << " (" << run_a.size() << " samples)" << std::endl;
+    std::cout << "B: " << options.compare_inputs[1] << " (" << run_b.size() << " samples)" << std::endl;
+    std::cout << report;
+
+    if(options.json_path == "-")
+    {
+        report.write_json(std::cout);
+    }
+    else if(!options.json_path.empty())
+    {
+        std::ofstream out(options.json_path);
+        if(!out.is_open())
+        {
+            std::cerr << "Can't write " << options.json_path << std::endl;
+            return 1;
+        }
+        report.write_json(out);
+    }
+
+    return report.has_regression() ? 2 : 0;
+}
@@ -0,0 +1,9 @@
+#ifndef COMPARE_MODE_H
+#define COMPARE_MODE_H
+
+#include "command_line.h"
+
+//returns the process exit code: 0 - no regression, 1 - error, 2 - regression
+int run_compare_mode(const CommandLineOptions& options);
+
+#endif
@@ -0,0 +1,238 @@
+#include "daemon_mode.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../daemon/profiler_daemon.h"
+
+static ProfilerDaemon* running_daemon = nullptr;
+
+static void on_stop_signal(int)
+{
+    if(running_daemon)
+    {
+        running_daemon->stop();
+    }
+}
+
+int run_daemon_mode(const CommandLineOptions& options)
+{
+    DaemonSettings settings;
+    settings.socket_path = options.socket_path;
+    ProfilingConfiguration& config = settings.defaults;
+    if(!options.metrics.empty())
+    {
+        config.metrics = options.metrics;
+    }
+    config.interval_ms = options.interval_ms;
+    config.launch.isolation = options.isolation;
+    config.launch.region_markers = options.region_markers;
+    config.launch.alloc = options.alloc;
+    config.housekeeping_cpus = options.housekeeping_cpus;
+    config.sources = options.sources;
+    config.counters = options.counters;
+    config.history = options.history;
+    config.adaptive = options.adaptive;
+    config.flight = options.flight;
+
+    ProfilerDaemon daemon(settings);
+    std::string error;
+    if(!daemon.open(error))
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    running_daemon = &daemon;
+    std::signal(SIGINT, on_stop_signal);
+    std::signal(SIGTERM, on_stop_signal);
+    std::cout << "[Daemon] Listening on " << options.socket_path << std::endl;
+    daemon.run();
+    running_daemon = nullptr;
+    return 0;
+}
+
+static int connect_daemon(const std::string& path)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(address.sun_path))
+    {
+        return -1;
+    }
+    strcpy(address.sun_path, path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd != -1 && connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool send_frame(int fd, FrameType type, uint32_t session, const std::string& payload = std::string())
+{
+    std::string frame;
+    append_frame(frame, type, session, payload);
+    size_t sent = 0;
+    while(sent < frame.size())
+    {
+        ssize_t length = send(fd, frame.data() + sent, frame.size() - sent, MSG_NOSIGNAL);
+        if(length <= 0)
+        {
+            return false;
+        }
+        sent += length;
+    }
+    return true;
+}
+
+static bool receive_frame(int fd, FrameReader& reader, Frame& frame)
+{
+    std::string error;
+    char buffer[4096];
+    while(!reader.next(frame, error))
+    {
+        if(!error.empty())
+        {
+            std::cerr << error << std::endl;
+            return false;
+        }
+        ssize_t length = recv(fd, buffer, sizeof(buffer), 0);
+        if(length <= 0)
+        {
+            return false;
+        }
+        reader.feed(buffer, length);
+    }
+    return true;
+}
+
+//prints snapshots of the session until it ends or the daemon goes away
+static int stream_session(int fd, FrameReader& reader, uint32_t session)
+{
+    if(!send_frame(fd, FrameType::ATTACH, session))
+    {
+        return 1;
+    }
+
+    Frame frame;
+    while(receive_frame(fd, reader, frame))
+    {
+        switch(frame.type)
+        {
+            case FrameType::SNAPSHOT:
+            {
+                ProfilingSnapshot snapshot;
+                if(decode_snapshot(frame.payload, snapshot))
+                {
+                    std::cout << snapshot << std::endl;
+                }
+                break;
+            }
+            case FrameType::LOG:
+                std::cerr << frame.payload;
+                break;
+            case FrameType::ERROR:
+                std::cerr << frame.payload << std::endl;
+                return 1;
+            case FrameType::ENDED:
+                std::cout << "Session " << session << " ended" << std::endl;
+                return 0;
+            default:
+                break;
+        }
+    }
+    std::cerr << "Connection to the daemon lost" << std::endl;
+    return 1;
+}
+
+int run_client_mode(const CommandLineOptions& options)
+{
+    std::vector<std::string> parts = split_command(options.client_request);
+    if(parts.empty())
+    {
+        std::cerr << "Empty daemon request" << std::endl;
+        return 1;
+    }
+
+    int fd = connect_daemon(options.socket_path);
+    if(fd == -1)
+    {
+        std::cerr << "Can't connect to " << options.socket_path << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    FrameReader reader;
+    Frame frame;
+    const std::string& verb = parts.front();
+    int result = 1;
+    if(verb == "list")
+    {
+        if(send_frame(fd, FrameType::LIST, 0) && receive_frame(fd, reader, frame))
+        {
+            std::cout << frame.payload;
+            result = 0;
+        }
+    }
+    else if(verb == "start" && parts.size() > 1)
+    {
+        StartRequest request;
+        request.programm = parts[1];
+        request.args.assign(parts.begin() + 2, parts.end());
+        request.metrics = options.metrics;
+        request.interval_ms = options.interval_ms;
+
+        if(send_frame(fd, FrameType::START, 0, encode_start(request)) && receive_frame(fd, reader, frame))
+        {
+            if(frame.type == FrameType::STARTED)
+            {
+                std::cout << "Session " << frame.session << " started" << std::endl;
+                result = stream_session(fd, reader, frame.session);
+            }
+            else
+            {
+                std::cerr << frame.payload << std::endl;
+            }
+        }
+    }
+    else if((verb == "attach" || verb == "stop") && parts.size() == 2)
+    {
+        uint32_t session = static_cast<uint32_t>(std::strtoul(parts[1].c_str(), nullptr, 10));
+        if(verb == "attach")
+        {
+            result = stream_session(fd, reader, session);
+        }
+        else if(send_frame(fd, FrameType::STOP, session) && receive_frame(fd, reader, frame))
+        {
+            result = frame.type == FrameType::OK ? 0 : 1;
+            if(result != 0)
+            {
+                std::cerr << frame.payload << std::endl;
+            }
+        }
+    }
+    else if(verb == "query" && parts.size() == 3)
+    {
+        uint32_t session = static_cast<uint32_t>(std::strtoul(parts[1].c_str(), nullptr, 10));
+        if(send_frame(fd, FrameType::QUERY, session, parts[2]) && receive_frame(fd, reader, frame))
+        {
+            result = frame.type == FrameType::RESULT ? 0 : 1;
+            (result == 0 ? std::cout : std::cerr) << frame.payload << std::endl;
+        }
+    }
+    else
+    {
+        std::cerr << "Unknown daemon request: " << options.client_request << std::endl;
+    }
+
+    close(fd);
+    return result;
+}
@@ -0,0 +1,12 @@
+#ifndef DAEMON_MODE_H
+#define DAEMON_MODE_H
+
+#include "command_line.h"
+
+//serves sessions on options.socket_path until SIGINT/SIGTERM
+int run_daemon_mode(const CommandLineOptions& options);
+
+//one request to a running daemon: list, start <command>, attach <id>, stop <id>
+int run_client_mode(const CommandLineOptions& options);
+
+#endif
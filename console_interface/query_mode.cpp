@@ -0,0 +1,64 @@
+#include "query_mode.h"
+
+#include <chrono>
+#include <map>
+
+#include "../analysis/window_query.h"
+#include "../recording/recorder.h"
+
+int run_query_mode(const CommandLineOptions& options)
+{
+    std::vector<WindowQuery> queries;
+    for(const auto& spec : options.queries)
+    {
+        WindowQuery query;
+        std::string error;
+        if(!parse_window_query(spec, query, error))
+        {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        queries.push_back(query);
+    }
+
+    Recording recording;
+    std::string error;
+    if(!load_recording(options.query_input, recording, error))
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    //one index per signal, built once and shared by its queries
+    std::map<std::string, SignalSeries> series;
+    int result = 0;
+    for(const auto& query : queries)
+    {
+        auto it = series.find(query.signal);
+        if(it == series.end())
+        {
+            //reported apart, the per-query times below are of evaluate alone
+            auto start = std::chrono::steady_clock::now();
+            it = series.emplace(query.signal, SignalSeries(query.signal)).first;
+            it->second.reserve(recording.snapshots.size());
+            for(const auto& snapshot : recording.snapshots)
+            {
+                it->second.append(snapshot);
+            }
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "index of " << query.signal << ": " << it->second.size() << " snapshots in " << elapsed / 1000.0 << " us" << std::endl;
+        }
+
+        double value = 0.0;
+        size_t samples = 0;
+        auto start = std::chrono::steady_clock::now();
+        bool found = it->second.evaluate(query, value, samples);
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        std::cout << describe_window_result(query, found, value, samples) << " in " << elapsed / 1000.0 << " us" << std::endl;
+        if(!found)
+        {
+            result = 1;
+        }
+    }
+    return result;
+}
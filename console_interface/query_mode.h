@@ -0,0 +1,9 @@
+#ifndef QUERY_MODE_H
+#define QUERY_MODE_H
+
+#include "command_line.h"
+
+//returns the process exit code: 0 - every query had data, 1 - otherwise
+int run_query_mode(const CommandLineOptions& options);
+
+#endif
@@ -0,0 +1,48 @@
+#include "repeat_mode.h"
+
+#include "../manager/manager.h"
+
+int run_repeat_mode(const CommandLineOptions& options)
+{
+    std::vector<std::string> parts = split_command(options.command);
+    if(parts.empty())
+    {
+        std::cerr << "Empty command to repeat" << std::endl;
+        return 1;
+    }
+    std::string programm = parts.front();
+    parts.erase(parts.begin());
+
+    ProfilingConfiguration config;
+    if(!options.metrics.empty())
+    {
+        config.metrics = options.metrics;
+    }
+    config.interval_ms = options.interval_ms;
+    config.launch.isolation = options.isolation;
+    config.launch.region_markers = options.region_markers;
+    config.launch.alloc = options.alloc;
+    config.housekeeping_cpus = options.housekeeping_cpus;
+    config.sources = options.sources;
+    config.counters = options.counters;
+    config.history = options.history;
+    config.adaptive = options.adaptive;
+    config.flight = options.flight;
+
+    RepeatOptions repeat;
+    repeat.runs = options.repeat_runs;
+    repeat.parallel = options.parallel_runs;
+    repeat.max_duration_s = options.duration_s;
+
+    Manager manager;
+    manager.setup_log_callback([](const std::string&){});
+    manager.setup_error_callback([](const std::string& error){ std::cerr << error << std::endl; });
+
+    RepeatReport report;
+    if(!manager.run_repeated(programm, parts, config, repeat, report))
+    {
+        return 1;
+    }
+    std::cout << report;
+    return 0;
+}
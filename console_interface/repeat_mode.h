@@ -0,0 +1,8 @@
+#ifndef REPEAT_MODE_H
+#define REPEAT_MODE_H
+
+#include "command_line.h"
+
+int run_repeat_mode(const CommandLineOptions& options);
+
+#endif
@@ -1,6 +1,20 @@
 #include "user_interface_c.h"
 
-ConsoleInterface::ConsoleInterface()
+#include <algorithm>
+
+static bool has_counters(const ProfilingSnapshot& snapshot)
+{
+    return std::any_of(snapshot.metrics.begin(), snapshot.metrics.end(), [](const MetricValue& metric)
+    {
+        return is_perf_metric(metric.type);
+    });
+}
+
+ConsoleInterface::ConsoleInterface(): ConsoleInterface(CommandLineOptions())
+{
+}
+
+ConsoleInterface::ConsoleInterface(const CommandLineOptions& options): options(options)
 {
     manager = std::make_unique<Manager>();
 
@@ -22,6 +36,7 @@ void ConsoleInterface::run()
     {
         print_screen();
     }
+    print_summary();
 
     std::cout << "Have a nice day!"<< std::endl;
 }
@@ -70,10 +85,10 @@ void ConsoleInterface::wait_for_user_input()
 
 void ConsoleInterface::setup_callbacks()
 {
-    MetricCallback metric_callback = [this](const ProfilingSnapshot& snapshot)
-    {
-        this->on_metric_recv(snapshot);
-    };
+    //the screen only needs the latest snapshot
+    SinkOptions ui_sink;
+    ui_sink.capacity = 4;
+    ui_sink.policy = BackpressurePolicy::DROP_OLDEST;
 
     ErrorCallback error_callback = [this](const std::string& error)
     {
@@ -85,7 +100,10 @@ void ConsoleInterface::setup_callbacks()
         this->on_log_recv(log);
     };
 
-    manager->setup_metrics_callback(metric_callback);
+    manager->subscribe("ui", [this](const SnapshotPtr& snapshot)
+    {
+        this->on_metric_recv(snapshot);
+    }, ui_sink);
     manager->setup_error_callback(error_callback);
     manager->setup_log_callback(log_callback);
 }
@@ -102,6 +120,13 @@ Configuration ConsoleInterface::get_configuration() const //этот ужас п
     std::cout << "║  5. Branch Misses                    ║\n";
     std::cout << "║  6. Page Faults                      ║\n";
     std::cout << "║  7. Context Switches                 ║\n";
+    std::cout << "║  8. Memory (RSS/PSS/anon/file/swap)  ║\n";
+    std::cout << "║  9. Thread scheduling statistics     ║\n";
+    std::cout << "║ 10. Off-CPU time (blocked stacks)    ║\n";
+    std::cout << "║ 11. Page-fault addresses             ║\n";
+    std::cout << "║ 12. Syscall counts and latencies     ║\n";
+    std::cout << "║ 13. Lock contention (futex waits)    ║\n";
+    std::cout << "║ 14. I/O throughput (/proc/pid/io)    ║\n";
     std::cout << "║  0. Select All Metrics               ║\n";
     std::cout << "╚══════════════════════════════════════╝\n";
     std::cout << "Enter your choice(s) separated by spaces: ";
@@ -117,7 +142,7 @@ Configuration ConsoleInterface::get_configuration() const //этот ужас п
     std::istringstream istr_m(line);
     while(istr_m >> choice)
     {   
-        if(choice < 0 || choice > 7)
+        if(choice < 0 || choice > 14)
         {
             std::cout << std::endl;
             std::cout << "Incorrect metric choice: "<< choice << std::endl;
@@ -162,12 +187,67 @@ Configuration ConsoleInterface::get_configuration() const //этот ужас п
                 metric = MetricType::CONTEXT_SWITCHES;
                 break;
             }
+            case 8:
+            {
+                for(int i = static_cast<int>(MetricType::MEMORY_RSS);i <= static_cast<int>(MetricType::MEMORY_SWAP);i++)
+                {
+                    metrics.push_back(static_cast<MetricType>(i));
+                }
+                continue;
+            }
+            case 9:
+            {
+                for(int i = static_cast<int>(MetricType::SCHED_RUN_TIME);i <= static_cast<int>(MetricType::SCHED_MIGRATIONS);i++)
+                {
+                    metrics.push_back(static_cast<MetricType>(i));
+                }
+                continue;
+            }
+            case 10:
+            {
+                metric = MetricType::OFFCPU_TIME;
+                break;
+            }
+            case 11:
+            {
+                metric = MetricType::FAULT_SAMPLES;
+                break;
+            }
+            case 12:
+            {
+                metrics.push_back(MetricType::SYSCALL_COUNT);
+                metrics.push_back(MetricType::SYSCALL_TIME);
+                continue;
+            }
+            case 13:
+            {
+                metrics.push_back(MetricType::FUTEX_WAITS);
+                metrics.push_back(MetricType::FUTEX_WAIT_TIME);
+                metrics.push_back(MetricType::FUTEX_WAKES);
+                continue;
+            }
+            case 14:
+            {
+                for(int i = static_cast<int>(MetricType::IO_READ_CHARS);i <= static_cast<int>(MetricType::IO_CANCELLED_WRITE_BYTES);i++)
+                {
+                    metrics.push_back(static_cast<MetricType>(i));
+                }
+                continue;
+            }
             case 0:
             {
                 for(int i = static_cast<int>(MetricType::INSTRUCTIONS);i <= static_cast<int>(MetricType::CONTEXT_SWITCHES);i++)
                 {
                     metrics.push_back(static_cast<MetricType>(i));
                 }
+                for(int i = static_cast<int>(MetricType::MEMORY_RSS);i <= static_cast<int>(MetricType::SCHED_MIGRATIONS);i++)
+                {
+                    metrics.push_back(static_cast<MetricType>(i));
+                }
+                for(int i = static_cast<int>(MetricType::IO_READ_CHARS);i <= static_cast<int>(MetricType::IO_CANCELLED_WRITE_BYTES);i++)
+                {
+                    metrics.push_back(static_cast<MetricType>(i));
+                }
                 break;
             }
             default:
@@ -219,12 +299,31 @@ Configuration ConsoleInterface::get_configuration() const //этот ужас п
         program_args.push_back(program_arg);
     }
     config.program_args = program_args;
+    config.cfg.record_path = options.record_path;
+    config.cfg.launch.isolation = options.isolation;
+    config.cfg.launch.region_markers = options.region_markers;
+    config.cfg.launch.alloc = options.alloc;
+    config.cfg.housekeeping_cpus = options.housekeeping_cpus;
+    config.cfg.sources = options.sources;
+    config.cfg.counters = options.counters;
+    config.cfg.history = options.history;
+    config.cfg.adaptive = options.adaptive;
+    config.cfg.flight = options.flight;
+    for(auto type : options.metrics)
+    {
+        if(std::find(config.cfg.metrics.begin(), config.cfg.metrics.end(), type) == config.cfg.metrics.end())
+        {
+            config.cfg.metrics.push_back(type);
+        }
+    }
 
     return config;
 }
 
 void ConsoleInterface::print_screen()//потом разделить на print_log и print_metrics
 {
+    SelfMonitor::StageTimer timer(manager->get_self_monitor(), PipelineStage::RENDER);
+
     system("clear");
     std::cout << "LOGS:" << std::endl;
     for(const auto& log : logs)
@@ -232,22 +331,71 @@ void ConsoleInterface::print_screen()//потом разделить на print_
         std::cout << log << std::endl;
     }
 
-    std::cout<<"Snapshot:" << std::endl;
-    std::cout << last_snapshot << std::endl;
+    if(last_snapshot)
+    {
+        std::cout<<"Snapshot:" << std::endl;
+        std::cout << *last_snapshot << std::endl;
+        if(last_sources)
+        {
+            std::cout << "Sources:" << std::endl;
+            std::cout << *last_sources << std::endl;
+        }
+
+        std::cout << "Phase: " << last_snapshot->phase_id << (last_snapshot->phase_boundary ? " (new)" : "") << std::endl;
+    }
+    print_phases(5);
+    std::cout << std::endl;
 
     print_configuration();
 }
 
+void ConsoleInterface::print_summary()
+{
+    std::cout << "Phases:" << std::endl;
+    print_phases(std::numeric_limits<size_t>::max());
+
+    std::cout << "Profiler overhead:" << std::endl;
+    std::cout << manager->get_self_monitor().report();
+
+    std::cout << "History: " << manager->get_history_usage() << std::endl;
+
+    std::cout << "Snapshot sinks:" << std::endl;
+    for(const auto& sink : manager->get_sink_stats())
+    {
+        std::cout << "  " << sink << std::endl;
+    }
+
+    for(const auto& dump : manager->get_flight_dumps())
+    {
+        std::cout << "Flight dump: " << dump << std::endl;
+    }
+}
+
+void ConsoleInterface::print_phases(size_t last_count) const
+{
+    std::vector<PhaseStats> phases = manager->get_phases();
+    size_t first = phases.size() > last_count ? phases.size() - last_count : 0;
+    for(size_t i = first; i < phases.size(); i++)
+    {
+        std::cout << "  " << phases[i] << std::endl;
+    }
+}
+
 void ConsoleInterface::print_error_screen()
 {
     system("clear");
     std::cout << "ERROR: " << last_error << std::endl;
 }
 
-void ConsoleInterface::on_metric_recv(const ProfilingSnapshot& snapshot)
+void ConsoleInterface::on_metric_recv(const SnapshotPtr& snapshot)
 {
     std::lock_guard<std::mutex> lock(new_data);
     new_data_available = true;
+    if(last_snapshot && has_counters(*last_snapshot) && !has_counters(*snapshot))
+    {
+        last_sources = snapshot;
+        return;
+    }
     last_snapshot = snapshot;
 }
 
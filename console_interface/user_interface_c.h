@@ -14,8 +14,8 @@
 #include <sstream>
 
 #include "../manager/manager.h"
+#include "command_line.h"
 
-using MetricCallback = std::function<void(const ProfilingSnapshot& snapshot)>;
 using ErrorCallback = std::function<void(const std::string& error)>;
 using LogCallback = std::function<void(const std::string& log)>;
 
@@ -41,22 +41,26 @@ struct Configuration
 class ConsoleInterface
 {
     std::unique_ptr<Manager> manager;
+    CommandLineOptions options;
 
     std::atomic<bool> stop_signal{false};
 
     std::string last_error;
-    ProfilingSnapshot last_snapshot;
+    SnapshotPtr last_snapshot;
+    SnapshotPtr last_sources;           //kernel-timed mode: the sources of a batch come on their own
     std::vector<std::string> logs;
     std::atomic<bool> new_data_available{false};
     std::atomic<bool> error_recieved{false};
     std::mutex new_data;
 
     void on_error_recv(const std::string& error);
-    void on_metric_recv(const ProfilingSnapshot& snapshot);
+    void on_metric_recv(const SnapshotPtr& snapshot);
     void on_log_recv(const std::string& log);
     void print_configuration() const;
     void print_screen();
     void print_error_screen();
+    void print_summary();
+    void print_phases(size_t last_count) const;
     void setup_callbacks();
     void wait_for_user_input();
 
@@ -67,7 +71,9 @@ class ConsoleInterface
 
     public:
     ConsoleInterface();
-    ~ConsoleInterface() = default;
+    explicit ConsoleInterface(const CommandLineOptions& options);
+    //the manager's sink threads call back into this object
+    ~ConsoleInterface() { manager.reset(); }
     void run();
 };
 
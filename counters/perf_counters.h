@@ -0,0 +1,189 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+//In-process counters around hot code of the calling thread:
+//
+//    using LoopCounters = PerfCounters<PerfEvent::INSTRUCTIONS, PerfEvent::CPU_CYCLES>;
+//    thread_local LoopCounters counters;
+//    LoopCounters::Values totals{};
+//    {
+//        ScopedCounters<LoopCounters> scope(counters, totals);
+//        hot_loop();
+//    }
+//    totals[LoopCounters::index_of<PerfEvent::CPU_CYCLES>()]
+//
+//The event set is fixed at compile time, reads are unrolled and allocation free.
+//Hardware counters are read with rdpmc through the event's user page when the
+//kernel allows it, otherwise with one group read(2). Counts are not scaled:
+//keep the set small enough to stay on the PMU. Events follow the thread that
+//created them.
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include "perf_event.h"
+
+//rdpmc through the event's user page, false when the counter is not on the PMU
+inline bool read_user_counter(const perf_event_mmap_page* page, uint64_t& value)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (!page)
+    {
+        return false;
+    }
+
+    const volatile perf_event_mmap_page* user_page = page;
+    uint32_t sequence;
+    bool on_pmu;
+    do
+    {
+        sequence = user_page->lock;
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        uint32_t index = user_page->index;
+        value = user_page->offset;
+        on_pmu = user_page->cap_user_rdpmc && index != 0;
+        if (on_pmu)
+        {
+            uint32_t width = user_page->pmc_width;
+            int64_t pmc = static_cast<int64_t>(static_cast<uint64_t>(__builtin_ia32_rdpmc(index - 1)) << (64 - width));
+            value += static_cast<uint64_t>(pmc >> (64 - width));
+        }
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    } while (user_page->lock != sequence);
+    return on_pmu;
+#else
+    (void)page;
+    (void)value;
+    return false;
+#endif
+}
+
+template <PerfEvent... Events>
+class PerfCounters
+{
+public:
+    static_assert(sizeof...(Events) > 0, "empty event set");
+
+    static constexpr size_t size = sizeof...(Events);
+    using Values = std::array<uint64_t, size>;
+
+    PerfCounters()
+    {
+        fds_.fill(-1);
+        pages_.fill(nullptr);
+        for (size_t i = 0; i < size; i++)
+        {
+            fds_[i] = open_counting_event(events_[i], 0, i ? fds_[0] : -1, PERF_FORMAT_GROUP, error_);
+            if (fds_[i] < 0)
+            {
+                close();
+                return;
+            }
+            pages_[i] = map_event_page(fds_[i]);
+        }
+    }
+
+    ~PerfCounters() { close(); }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool is_open() const { return fds_[0] >= 0; }
+    const std::string& error() const { return error_; }
+
+    //zeros when the events could not be opened
+    void read(Values& values) const
+    {
+        if (!read_all(values, std::make_index_sequence<size>()))
+        {
+            //software events or rdpmc not allowed: one syscall for the whole group
+            std::array<uint64_t, size + 1> buffer;
+            if (!read_event_group(fds_[0], buffer.data(), size))
+            {
+                values.fill(0);
+                return;
+            }
+            std::copy(buffer.begin() + 1, buffer.end(), values.begin());
+        }
+    }
+
+    template <PerfEvent Event>
+    static constexpr size_t index_of()
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            if (events_[i] == Event)
+            {
+                return i;
+            }
+        }
+        return size;
+    }
+
+private:
+    static constexpr PerfEvent events_[size] = {Events...};
+
+    std::array<int, size> fds_;
+    std::array<perf_event_mmap_page*, size> pages_;
+    std::string error_;
+
+    void close()
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            unmap_event_page(pages_[i]);
+            pages_[i] = nullptr;
+            if (fds_[i] >= 0)
+            {
+                ::close(fds_[i]);
+                fds_[i] = -1;
+            }
+        }
+    }
+
+    template <size_t... I>
+    bool read_all(Values& values, std::index_sequence<I...>) const
+    {
+        return (read_user_counter(pages_[I], values[I]) && ...);
+    }
+};
+
+//adds the counter deltas of its lifetime to totals
+template <typename Counters>
+class ScopedCounters
+{
+public:
+    ScopedCounters(const Counters& counters, typename Counters::Values& totals): counters_(counters), totals_(totals)
+    {
+        counters_.read(start_);
+    }
+
+    ~ScopedCounters()
+    {
+        typename Counters::Values end;
+        counters_.read(end);
+        accumulate(end, std::make_index_sequence<Counters::size>());
+    }
+
+    ScopedCounters(const ScopedCounters&) = delete;
+    ScopedCounters& operator=(const ScopedCounters&) = delete;
+
+private:
+    const Counters& counters_;
+    typename Counters::Values& totals_;
+    typename Counters::Values start_;
+
+    template <size_t... I>
+    void accumulate(const typename Counters::Values& end, std::index_sequence<I...>)
+    {
+        ((totals_[I] += end[I] - start_[I]), ...);
+    }
+};
+
+#endif
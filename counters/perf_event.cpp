@@ -0,0 +1,132 @@
+#include "perf_event.h"
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+long sys_perf_event_open(perf_event_attr* attr, int pid, int cpu, int group_fd, unsigned long flags)
+{
+    return syscall(__NR_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+void describe_perf_event(PerfEvent event, perf_event_attr& attr)
+{
+    switch (event)
+    {
+        case PerfEvent::INSTRUCTIONS:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case PerfEvent::CPU_CYCLES:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case PerfEvent::REF_CPU_CYCLES:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_REF_CPU_CYCLES;
+            break;
+        case PerfEvent::CACHE_MISSES:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        case PerfEvent::CACHE_REFERENCES:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_REFERENCES;
+            break;
+        case PerfEvent::BRANCH_INSTRUCTIONS:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_BRANCH_INSTRUCTIONS;
+            break;
+        case PerfEvent::BRANCH_MISSES:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+        case PerfEvent::PAGE_FAULTS:
+            attr.type = PERF_TYPE_SOFTWARE;
+            attr.config = PERF_COUNT_SW_PAGE_FAULTS;
+            break;
+        case PerfEvent::CONTEXT_SWITCHES:
+            attr.type = PERF_TYPE_SOFTWARE;
+            attr.config = PERF_COUNT_SW_CONTEXT_SWITCHES;
+            break;
+        case PerfEvent::CPU_MIGRATIONS:
+            attr.type = PERF_TYPE_SOFTWARE;
+            attr.config = PERF_COUNT_SW_CPU_MIGRATIONS;
+            break;
+        case PerfEvent::TASK_CLOCK:
+            attr.type = PERF_TYPE_SOFTWARE;
+            attr.config = PERF_COUNT_SW_TASK_CLOCK;
+            break;
+    }
+}
+
+const char* perf_event_name(PerfEvent event)
+{
+    switch (event)
+    {
+        case PerfEvent::INSTRUCTIONS: return "instructions";
+        case PerfEvent::CPU_CYCLES: return "cpu_cycles";
+        case PerfEvent::REF_CPU_CYCLES: return "ref_cpu_cycles";
+        case PerfEvent::CACHE_MISSES: return "cache_misses";
+        case PerfEvent::CACHE_REFERENCES: return "cache_references";
+        case PerfEvent::BRANCH_INSTRUCTIONS: return "branch_instructions";
+        case PerfEvent::BRANCH_MISSES: return "branch_misses";
+        case PerfEvent::PAGE_FAULTS: return "page_faults";
+        case PerfEvent::CONTEXT_SWITCHES: return "context_switches";
+        case PerfEvent::CPU_MIGRATIONS: return "cpu_migrations";
+        case PerfEvent::TASK_CLOCK: return "task_clock";
+    }
+    return "unknown";
+}
+
+int open_counting_event(PerfEvent event, int pid, int group_fd, uint64_t read_format, std::string& error)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    describe_perf_event(event, attr);
+    attr.exclude_kernel = 1;    //also what lets paranoid=2 systems open it
+    attr.exclude_hv = 1;
+    attr.read_format = read_format;
+
+    int fd = static_cast<int>(sys_perf_event_open(&attr, pid, -1, group_fd, PERF_FLAG_FD_CLOEXEC));
+    if (fd < 0)
+    {
+        error = std::string("can't open ") + perf_event_name(event) + ": " + strerror(errno);
+    }
+    return fd;
+}
+
+perf_event_mmap_page* map_event_page(int fd)
+{
+    void* page = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+    return page == MAP_FAILED ? nullptr : static_cast<perf_event_mmap_page*>(page);
+}
+
+void unmap_event_page(perf_event_mmap_page* page)
+{
+    if (page)
+    {
+        munmap(page, sysconf(_SC_PAGESIZE));
+    }
+}
+
+uint64_t read_event_counter(int fd)
+{
+    uint64_t value = 0;
+    if (read(fd, &value, sizeof(value)) != sizeof(value))
+    {
+        return 0;
+    }
+    return value;
+}
+
+bool read_event_group(int fd, uint64_t* buffer, size_t count)
+{
+    ssize_t size = static_cast<ssize_t>((count + 1) * sizeof(uint64_t));
+    return read(fd, buffer, size) == size && buffer[0] == count;
+}
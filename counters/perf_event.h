@@ -0,0 +1,42 @@
+#ifndef PERF_EVENT_H
+#define PERF_EVENT_H
+
+#include <linux/perf_event.h>
+
+#include <cstdint>
+#include <string>
+
+//generic perf events shared by the profiler and the in-process counters
+enum class PerfEvent
+{
+    INSTRUCTIONS,
+    CPU_CYCLES,
+    REF_CPU_CYCLES,
+    CACHE_MISSES,
+    CACHE_REFERENCES,
+    BRANCH_INSTRUCTIONS,
+    BRANCH_MISSES,
+    PAGE_FAULTS,
+    CONTEXT_SWITCHES,
+    CPU_MIGRATIONS,
+    TASK_CLOCK
+};
+
+long sys_perf_event_open(perf_event_attr* attr, int pid, int cpu, int group_fd, unsigned long flags);
+
+//fills type and config
+void describe_perf_event(PerfEvent event, perf_event_attr& attr);
+const char* perf_event_name(PerfEvent event);
+
+//counting event of one task (pid 0 - the calling thread), -1 and error on failure
+int open_counting_event(PerfEvent event, int pid, int group_fd, uint64_t read_format, std::string& error);
+
+//user page of an event for the rdpmc read path, nullptr if it can't be mapped
+perf_event_mmap_page* map_event_page(int fd);
+void unmap_event_page(perf_event_mmap_page* page);
+
+uint64_t read_event_counter(int fd);
+//PERF_FORMAT_GROUP read: nr followed by the values, false on a short read
+bool read_event_group(int fd, uint64_t* buffer, size_t count);
+
+#endif
@@ -0,0 +1,505 @@
+#include "profiler_daemon.h"
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+static constexpr int session_check_ms = 200;
+
+ProfilerDaemon::ProfilerDaemon(const DaemonSettings& settings): settings_(settings)
+{
+}
+
+ProfilerDaemon::~ProfilerDaemon()
+{
+    for (auto& client : clients_)
+    {
+        ::close(client->fd);
+    }
+    if (listen_fd_ != -1)
+    {
+        ::close(listen_fd_);
+        unlink(settings_.socket_path.c_str());
+    }
+    if (wake_fd_ != -1)
+    {
+        ::close(wake_fd_);
+    }
+}
+
+bool ProfilerDaemon::open(std::string& error)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (settings_.socket_path.empty() || settings_.socket_path.size() >= sizeof(address.sun_path))
+    {
+        error = "Invalid socket path: " + settings_.socket_path;
+        return false;
+    }
+    strcpy(address.sun_path, settings_.socket_path.c_str());
+
+    //a stale socket of a previous daemon, never a regular file
+    struct stat info;
+    if (stat(settings_.socket_path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode))
+    {
+        unlink(settings_.socket_path.c_str());
+    }
+
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (listen_fd_ == -1 || wake_fd_ == -1)
+    {
+        error = std::string("socket: ") + strerror(errno);
+        return false;
+    }
+    //sessions launch programms, only the owner may talk to the daemon;
+    //the socket is created 0600, not opened up until a chmod
+    mode_t mask = umask(0177);
+    int bound = bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    umask(mask);
+    if (bound != 0)
+    {
+        error = "bind " + settings_.socket_path + ": " + strerror(errno);
+        ::close(listen_fd_);
+        listen_fd_ = -1;
+        return false;
+    }
+    if (chmod(settings_.socket_path.c_str(), 0600) != 0)
+    {
+        error = "chmod " + settings_.socket_path + ": " + strerror(errno);
+        return false;
+    }
+    if (listen(listen_fd_, 16) != 0)
+    {
+        error = std::string("listen: ") + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+void ProfilerDaemon::run()
+{
+    running_ = true;
+    std::vector<pollfd> fds;
+    while (running_)
+    {
+        fds.clear();
+        fds.push_back({listen_fd_, POLLIN, 0});
+        fds.push_back({wake_fd_, POLLIN, 0});
+        for (auto& client : clients_)
+        {
+            std::lock_guard<std::mutex> lock(client->mutex);
+            fds.push_back({client->fd, static_cast<short>(client->out.empty() ? POLLIN : POLLIN | POLLOUT), 0});
+        }
+
+        if (poll(fds.data(), fds.size(), session_check_ms) < 0 && errno != EINTR)
+        {
+            std::cerr << "[Daemon] poll: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            uint64_t value;
+            ssize_t ignored = read(wake_fd_, &value, sizeof(value));
+            (void)ignored;
+        }
+
+        //clients accepted below are polled next round
+        std::vector<std::shared_ptr<Client>> polled(clients_.begin(), clients_.end());
+        if (fds[0].revents & POLLIN)
+        {
+            accept_client();
+        }
+
+        for (size_t i = 0; i < polled.size(); i++)
+        {
+            short revents = fds[i + 2].revents;
+            bool alive = !(revents & (POLLERR | POLLNVAL)) && !((revents & POLLHUP) && !(revents & POLLIN));
+            if (alive && (revents & POLLIN))
+            {
+                alive = read_client(polled[i]);
+            }
+            if (alive && (revents & POLLOUT))
+            {
+                alive = write_client(*polled[i]);
+            }
+            if (!alive || polled[i]->closing)
+            {
+                remove_client(polled[i]);
+            }
+        }
+
+        finish_starts(false);
+        check_sessions();
+    }
+
+    finish_starts(true);
+    while (!sessions_.empty())
+    {
+        stop_session(sessions_.begin()->first);
+    }
+}
+
+void ProfilerDaemon::stop()
+{
+    running_ = false;
+    wake();
+}
+
+void ProfilerDaemon::accept_client()
+{
+    int fd;
+    while ((fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK)) != -1)
+    {
+        auto client = std::make_shared<Client>();
+        client->fd = fd;
+        clients_.push_back(client);
+    }
+}
+
+bool ProfilerDaemon::read_client(const std::shared_ptr<Client>& client)
+{
+    char buffer[4096];
+    ssize_t length = recv(client->fd, buffer, sizeof(buffer), 0);
+    if (length == 0 || (length < 0 && errno != EAGAIN && errno != EINTR))
+    {
+        return false;
+    }
+    if (length < 0)
+    {
+        return true;
+    }
+
+    client->reader.feed(buffer, length);
+    Frame frame;
+    std::string error;
+    while (client->reader.next(frame, error))
+    {
+        handle_frame(client, frame);
+    }
+    if (!error.empty())
+    {
+        send(*client, FrameType::ERROR, 0, error);
+        client->closing = true;
+    }
+    return true;
+}
+
+bool ProfilerDaemon::write_client(Client& client)
+{
+    std::lock_guard<std::mutex> lock(client.mutex);
+    while (!client.out.empty())
+    {
+        ssize_t sent = ::send(client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0)
+        {
+            return errno == EAGAIN || errno == EINTR;
+        }
+        client.out.erase(0, sent);
+    }
+    return true;
+}
+
+void ProfilerDaemon::remove_client(const std::shared_ptr<Client>& client)
+{
+    for (auto& [id, session] : sessions_)
+    {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        session->viewers.erase(std::remove(session->viewers.begin(), session->viewers.end(), client), session->viewers.end());
+    }
+
+    //a closing client still gets its error before the socket goes away
+    write_client(*client);
+    ::close(client->fd);
+    clients_.erase(std::remove(clients_.begin(), clients_.end(), client), clients_.end());
+}
+
+void ProfilerDaemon::handle_frame(const std::shared_ptr<Client>& client, const Frame& frame)
+{
+    auto session = sessions_.find(frame.session);
+    bool known = session != sessions_.end();
+
+    switch (frame.type)
+    {
+        case FrameType::START:
+        {
+            StartRequest request;
+            if (!decode_start(frame.payload, request))
+            {
+                send(*client, FrameType::ERROR, 0, "Malformed START request");
+                return;
+            }
+            start_session(client, request);
+            return;
+        }
+        case FrameType::STOP:
+            if (!known)
+            {
+                break;
+            }
+            stop_session(frame.session);
+            send(*client, FrameType::OK, frame.session);
+            return;
+        case FrameType::ATTACH:
+        {
+            if (!known)
+            {
+                break;
+            }
+            std::lock_guard<std::mutex> lock(session->second->mutex);
+            auto& viewers = session->second->viewers;
+            if (std::find(viewers.begin(), viewers.end(), client) == viewers.end())
+            {
+                viewers.push_back(client);
+            }
+            send(*client, session->second->ended ? FrameType::ENDED : FrameType::OK, frame.session);
+            return;
+        }
+        case FrameType::DETACH:
+        {
+            if (!known)
+            {
+                break;
+            }
+            std::lock_guard<std::mutex> lock(session->second->mutex);
+            auto& viewers = session->second->viewers;
+            viewers.erase(std::remove(viewers.begin(), viewers.end(), client), viewers.end());
+            send(*client, FrameType::OK, frame.session);
+            return;
+        }
+        case FrameType::LIST:
+            send(*client, FrameType::SESSIONS, 0, describe_sessions());
+            return;
+        case FrameType::QUERY:
+        {
+            if (!known)
+            {
+                break;
+            }
+            WindowQuery query;
+            std::string error;
+            if (!parse_window_query(frame.payload, query, error))
+            {
+                send(*client, FrameType::ERROR, frame.session, error);
+                return;
+            }
+            double result = 0.0;
+            size_t samples = 0;
+            bool found = session->second->manager->query_window(query, result, samples);
+            send(*client, FrameType::RESULT, frame.session, describe_window_result(query, found, result, samples));
+            return;
+        }
+        default:
+            send(*client, FrameType::ERROR, frame.session, "Unexpected frame type " + std::to_string(static_cast<int>(frame.type)));
+            return;
+    }
+    send(*client, FrameType::ERROR, frame.session, "No session " + std::to_string(frame.session));
+}
+
+void ProfilerDaemon::start_session(const std::shared_ptr<Client>& client, const StartRequest& request)
+{
+    if (sessions_.size() + starting_.size() >= settings_.max_sessions)
+    {
+        send(*client, FrameType::ERROR, 0, "Too many sessions");
+        return;
+    }
+
+    ProfilingConfiguration config = settings_.defaults;
+    config.record_path.clear();
+    if (!request.metrics.empty())
+    {
+        config.metrics = request.metrics;
+    }
+    if (request.interval_ms != 0)
+    {
+        config.interval_ms = request.interval_ms;
+    }
+
+    auto session = std::make_unique<Session>();
+    Session* raw = session.get();
+    raw->id = next_session_++;
+    raw->requester = client;
+    raw->command = request.programm;
+    for (const auto& arg : request.args)
+    {
+        raw->command += " " + arg;
+    }
+    raw->manager = std::make_unique<Manager>();
+
+    raw->manager->setup_log_callback([this, raw](const std::string& log)
+    {
+        broadcast(*raw, FrameType::LOG, log);
+    });
+    raw->manager->setup_error_callback([this, raw](const std::string& error)
+    {
+        {
+            std::lock_guard<std::mutex> lock(raw->mutex);
+            if (raw->starting)
+            {
+                raw->start_error += error;
+            }
+        }
+        broadcast(*raw, FrameType::LOG, error);
+    });
+
+    //encoded once per snapshot, the frame is shared by every viewer
+    SinkOptions options;
+    options.capacity = 64;
+    raw->manager->subscribe("daemon", [this, raw](const SnapshotPtr& snapshot)
+    {
+        std::lock_guard<std::mutex> lock(raw->mutex);
+        raw->snapshots++;
+        if (raw->viewers.empty())
+        {
+            return;
+        }
+        std::string frame;
+        append_frame(frame, FrameType::SNAPSHOT, raw->id, encode_snapshot(*snapshot));
+        for (auto& viewer : raw->viewers)
+        {
+            enqueue(*viewer, frame, true);
+        }
+    }, options);
+
+    //start_profiling waits for the programm to settle, other clients must not
+    raw->starter = std::thread([this, raw, request, config]()
+    {
+        bool started = raw->manager->start_profiling(request.programm, request.args, config);
+        {
+            std::lock_guard<std::mutex> lock(raw->mutex);
+            raw->starting = false;
+            raw->started = started;
+        }
+        wake();
+    });
+    starting_.push_back(std::move(session));
+}
+
+void ProfilerDaemon::finish_starts(bool wait)
+{
+    for (auto it = starting_.begin(); it != starting_.end();)
+    {
+        if (!wait)
+        {
+            std::lock_guard<std::mutex> lock((*it)->mutex);
+            if ((*it)->starting)
+            {
+                ++it;
+                continue;
+            }
+        }
+        (*it)->starter.join();
+        std::unique_ptr<Session> session = std::move(*it);
+        it = starting_.erase(it);
+
+        std::shared_ptr<Client> client = std::move(session->requester);
+        if (!session->started)
+        {
+            send(*client, FrameType::ERROR, 0, session->start_error.empty() ? "Can't start " + session->command : session->start_error);
+            continue;
+        }
+
+        uint32_t id = session->id;
+        std::cout << "[Daemon] Session " << id << " started: " << session->command << " (pid " << session->manager->get_current_pid() << ")" << std::endl;
+        sessions_.emplace(id, std::move(session));
+        send(*client, FrameType::STARTED, id);
+    }
+}
+
+void ProfilerDaemon::stop_session(uint32_t id)
+{
+    auto it = sessions_.find(id);
+    if (it == sessions_.end())
+    {
+        return;
+    }
+    std::unique_ptr<Session> session = std::move(it->second);
+    sessions_.erase(it);
+
+    session->manager->stop_profiling();
+    if (!session->ended)
+    {
+        broadcast(*session, FrameType::ENDED, std::string());
+    }
+    //joins the sink threads, they must not wait on the session lock
+    session->manager.reset();
+    std::cout << "[Daemon] Session " << id << " stopped" << std::endl;
+}
+
+void ProfilerDaemon::check_sessions()
+{
+    for (auto& [id, session] : sessions_)
+    {
+        if (session->ended || session->manager->is_process_alive())
+        {
+            continue;
+        }
+        //delivers the final snapshot before ENDED and releases the perf fds
+        session->manager->stop_profiling();
+        session->ended = true;
+        broadcast(*session, FrameType::ENDED, std::string());
+        std::cout << "[Daemon] Session " << id << " ended" << std::endl;
+    }
+}
+
+std::string ProfilerDaemon::describe_sessions() const
+{
+    std::ostringstream ostr;
+    for (const auto& [id, session] : sessions_)
+    {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        ostr << id << " pid=" << session->manager->get_current_pid() << " " << (session->ended ? "ended" : "running")
+             << " viewers=" << session->viewers.size() << " snapshots=" << session->snapshots << " " << session->command << "\n";
+    }
+    return ostr.str();
+}
+
+void ProfilerDaemon::send(Client& client, FrameType type, uint32_t session, const std::string& payload)
+{
+    std::string frame;
+    append_frame(frame, type, session, payload);
+    enqueue(client, frame, false);
+}
+
+void ProfilerDaemon::broadcast(Session& session, FrameType type, const std::string& payload)
+{
+    std::string frame;
+    append_frame(frame, type, session.id, payload);
+    std::lock_guard<std::mutex> lock(session.mutex);
+    for (auto& viewer : session.viewers)
+    {
+        enqueue(*viewer, frame, false);
+    }
+}
+
+void ProfilerDaemon::enqueue(Client& client, const std::string& frame, bool droppable)
+{
+    {
+        std::lock_guard<std::mutex> lock(client.mutex);
+        //a viewer that does not keep up loses whole snapshots, never parts of frames
+        if (droppable && client.out.size() + frame.size() > settings_.client_buffer_bytes)
+        {
+            client.dropped++;
+            return;
+        }
+        client.out += frame;
+    }
+    wake();
+}
+
+void ProfilerDaemon::wake()
+{
+    uint64_t value = 1;
+    ssize_t ignored = write(wake_fd_, &value, sizeof(value));
+    (void)ignored;
+}
@@ -0,0 +1,98 @@
+#ifndef PROFILER_DAEMON_H
+#define PROFILER_DAEMON_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "protocol.h"
+#include "../manager/manager.h"
+
+struct DaemonSettings
+{
+    std::string socket_path;
+    ProfilingConfiguration defaults;        //requests override metrics and interval
+    size_t client_buffer_bytes = 4u << 20;  //unsent bytes per client before snapshots are dropped
+    uint32_t max_sessions = 16;
+};
+
+//Long-lived host of profiling sessions behind a Unix socket. Each session is
+//one Manager (one set of perf fds); its snapshots are encoded once and
+//fanned out to every attached client.
+class ProfilerDaemon
+{
+public:
+    explicit ProfilerDaemon(const DaemonSettings& settings);
+    ~ProfilerDaemon();
+
+    ProfilerDaemon(const ProfilerDaemon&) = delete;
+    ProfilerDaemon& operator=(const ProfilerDaemon&) = delete;
+
+    bool open(std::string& error);
+    //serves clients until stop(), then stops every session
+    void run();
+    //async-signal-safe
+    void stop();
+
+private:
+    struct Client
+    {
+        int fd = -1;
+        FrameReader reader;
+        std::mutex mutex;       //out, dropped
+        std::string out;
+        uint64_t dropped = 0;
+        bool closing = false;
+    };
+
+    struct Session
+    {
+        uint32_t id = 0;
+        std::string command;
+        std::unique_ptr<Manager> manager;
+        std::mutex mutex;       //viewers, snapshots, starting, started, start_error
+        std::vector<std::shared_ptr<Client>> viewers;
+        uint64_t snapshots = 0;
+        bool starting = true;
+        bool started = false;
+        std::string start_error;
+        bool ended = false;
+        std::thread starter;    //launches the programm, the poll loop goes on meanwhile
+        std::shared_ptr<Client> requester;
+    };
+
+    DaemonSettings settings_;
+    int listen_fd_ = -1;
+    int wake_fd_ = -1;
+    std::atomic<bool> running_{false};
+    std::vector<std::shared_ptr<Client>> clients_;
+    std::map<uint32_t, std::unique_ptr<Session>> sessions_;
+    std::vector<std::unique_ptr<Session>> starting_;    //until their starter is done
+    uint32_t next_session_ = 1;
+
+    void accept_client();
+    bool read_client(const std::shared_ptr<Client>& client);
+    bool write_client(Client& client);
+    void remove_client(const std::shared_ptr<Client>& client);
+    void handle_frame(const std::shared_ptr<Client>& client, const Frame& frame);
+
+    void start_session(const std::shared_ptr<Client>& client, const StartRequest& request);
+    //answers the requesters of sessions whose start is done, wait - of every session
+    void finish_starts(bool wait);
+    void stop_session(uint32_t id);
+    void check_sessions();
+    std::string describe_sessions() const;
+
+    //thread-safe, wakes the poll loop
+    void send(Client& client, FrameType type, uint32_t session, const std::string& payload = std::string());
+    void broadcast(Session& session, FrameType type, const std::string& payload);
+    void enqueue(Client& client, const std::string& frame, bool droppable);
+    void wake();
+};
+
+#endif
@@ -0,0 +1,340 @@
+#include "protocol.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    class PayloadWriter
+    {
+    public:
+        template <typename T>
+        void put(T value) { out_.append(reinterpret_cast<const char*>(&value), sizeof(value)); }
+        void put_string(const std::string& value)
+        {
+            uint16_t length = static_cast<uint16_t>(std::min<size_t>(value.size(), UINT16_MAX));
+            put(length);
+            out_.append(value.data(), length);
+        }
+        std::string& str() { return out_; }
+
+    private:
+        std::string out_;
+    };
+
+    class PayloadReader
+    {
+    public:
+        explicit PayloadReader(const std::string& in): in_(in) {}
+
+        template <typename T>
+        bool get(T& value)
+        {
+            if (in_.size() - offset_ < sizeof(value))
+            {
+                return false;
+            }
+            memcpy(&value, in_.data() + offset_, sizeof(value));
+            offset_ += sizeof(value);
+            return true;
+        }
+        bool get_string(std::string& value)
+        {
+            uint16_t length;
+            if (!get(length) || in_.size() - offset_ < length)
+            {
+                return false;
+            }
+            value.assign(in_.data() + offset_, length);
+            offset_ += length;
+            return true;
+        }
+
+    private:
+        const std::string& in_;
+        size_t offset_ = 0;
+    };
+
+    void put_metrics(PayloadWriter& writer, const std::vector<MetricValue>& metrics)
+    {
+        writer.put(static_cast<uint16_t>(metrics.size()));
+        for (const auto& metric : metrics)
+        {
+            writer.put(static_cast<uint8_t>(metric.type));
+            writer.put(metric.value);
+            writer.put(static_cast<float>(metric.coverage));
+            writer.put(static_cast<float>(metric.error));
+        }
+    }
+
+    bool get_metrics(PayloadReader& reader, std::vector<MetricValue>& metrics)
+    {
+        uint16_t count;
+        if (!reader.get(count))
+        {
+            return false;
+        }
+        metrics.clear();
+        metrics.reserve(count);
+        for (uint16_t i = 0; i < count; i++)
+        {
+            uint8_t type;
+            uint64_t value;
+            float coverage;
+            float error;
+            if (!reader.get(type) || !reader.get(value) || !reader.get(coverage) || !reader.get(error) || type >= static_cast<uint8_t>(MetricType::COUNT))
+            {
+                return false;
+            }
+            MetricType metric = static_cast<MetricType>(type);
+            metrics.push_back({metric, value, metric_name(metric), metric_unit(metric), coverage, error});
+        }
+        return true;
+    }
+}
+
+void append_frame(std::string& out, FrameType type, uint32_t session, const std::string& payload)
+{
+    FrameHeader header;
+    header.length = static_cast<uint32_t>(payload.size());
+    header.type = static_cast<uint16_t>(type);
+    header.version = protocol_version;
+    header.session = session;
+    out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.append(payload);
+}
+
+bool FrameReader::next(Frame& frame, std::string& error)
+{
+    if (buffer_.size() - offset_ < sizeof(FrameHeader))
+    {
+        return false;
+    }
+
+    FrameHeader header;
+    memcpy(&header, buffer_.data() + offset_, sizeof(header));
+    if (header.version != protocol_version || header.length > max_frame_payload)
+    {
+        error = "Corrupt frame or protocol version " + std::to_string(header.version);
+        return false;
+    }
+    if (buffer_.size() - offset_ - sizeof(header) < header.length)
+    {
+        return false;
+    }
+
+    frame.type = static_cast<FrameType>(header.type);
+    frame.session = header.session;
+    frame.payload.assign(buffer_.data() + offset_ + sizeof(header), header.length);
+    offset_ += sizeof(header) + header.length;
+
+    //compact once the consumed prefix dominates
+    if (offset_ > buffer_.size() / 2)
+    {
+        buffer_.erase(0, offset_);
+        offset_ = 0;
+    }
+    return true;
+}
+
+std::string encode_start(const StartRequest& request)
+{
+    PayloadWriter writer;
+    writer.put(request.interval_ms);
+    writer.put(static_cast<uint16_t>(request.metrics.size()));
+    for (MetricType metric : request.metrics)
+    {
+        writer.put(static_cast<uint8_t>(metric));
+    }
+    writer.put_string(request.programm);
+    writer.put(static_cast<uint16_t>(request.args.size()));
+    for (const auto& arg : request.args)
+    {
+        writer.put_string(arg);
+    }
+    return std::move(writer.str());
+}
+
+bool decode_start(const std::string& payload, StartRequest& request)
+{
+    PayloadReader reader(payload);
+    uint16_t count;
+    if (!reader.get(request.interval_ms) || !reader.get(count))
+    {
+        return false;
+    }
+    request.metrics.clear();
+    for (uint16_t i = 0; i < count; i++)
+    {
+        uint8_t type;
+        if (!reader.get(type) || type >= static_cast<uint8_t>(MetricType::COUNT))
+        {
+            return false;
+        }
+        request.metrics.push_back(static_cast<MetricType>(type));
+    }
+    if (!reader.get_string(request.programm) || !reader.get(count))
+    {
+        return false;
+    }
+    request.args.resize(count);
+    for (auto& arg : request.args)
+    {
+        if (!reader.get_string(arg))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string encode_snapshot(const ProfilingSnapshot& snapshot)
+{
+    PayloadWriter writer;
+    writer.put(snapshot.timestamp_ms);
+    writer.put(snapshot.duration_ms);
+    writer.put(snapshot.phase_id);
+    writer.put(static_cast<uint8_t>(snapshot.phase_boundary));
+    put_metrics(writer, snapshot.metrics);
+    writer.put(static_cast<uint16_t>(snapshot.regions.size()));
+    for (const auto& region : snapshot.regions)
+    {
+        writer.put_string(region.name);
+        writer.put(region.time_ns);
+        writer.put(region.entries);
+        put_metrics(writer, region.metrics);
+    }
+    writer.put(static_cast<uint16_t>(snapshot.syscalls.size()));
+    for (const auto& syscall : snapshot.syscalls)
+    {
+        writer.put_string(syscall.name);
+        writer.put(syscall.count);
+        writer.put(syscall.time_ns);
+        writer.put(syscall.errors);
+        writer.put(syscall.p50_ns);
+        writer.put(syscall.p99_ns);
+    }
+    writer.put(static_cast<uint16_t>(snapshot.commands.size()));
+    for (const auto& command : snapshot.commands)
+    {
+        writer.put_string(command.name);
+        writer.put(command.processes);
+        writer.put(command.cpu_ns);
+        writer.put(command.page_faults);
+        writer.put(command.context_switches);
+    }
+    writer.put(static_cast<uint16_t>(snapshot.locks.size()));
+    for (const auto& lock : snapshot.locks)
+    {
+        writer.put_string(lock.name);
+        writer.put(lock.waits);
+        writer.put(lock.wakes);
+        writer.put(lock.wait_ns);
+        writer.put(lock.p99_ns);
+    }
+    writer.put(static_cast<uint16_t>(snapshot.devices.size()));
+    for (const auto& device : snapshot.devices)
+    {
+        writer.put_string(device.name);
+        writer.put(device.requests);
+        writer.put(device.bytes);
+        writer.put(device.p50_ns);
+        writer.put(device.p99_ns);
+    }
+    writer.put(static_cast<uint8_t>(snapshot.alloc_sizes.size()));
+    for (uint64_t count : snapshot.alloc_sizes)
+    {
+        writer.put(count);
+    }
+    return std::move(writer.str());
+}
+
+bool decode_snapshot(const std::string& payload, ProfilingSnapshot& snapshot)
+{
+    PayloadReader reader(payload);
+    uint8_t boundary;
+    uint16_t regions;
+    if (!reader.get(snapshot.timestamp_ms) || !reader.get(snapshot.duration_ms) || !reader.get(snapshot.phase_id) || !reader.get(boundary)
+        || !get_metrics(reader, snapshot.metrics) || !reader.get(regions))
+    {
+        return false;
+    }
+    snapshot.phase_boundary = boundary != 0;
+    snapshot.regions.resize(regions);
+    for (auto& region : snapshot.regions)
+    {
+        if (!reader.get_string(region.name) || !reader.get(region.time_ns) || !reader.get(region.entries) || !get_metrics(reader, region.metrics))
+        {
+            return false;
+        }
+    }
+    uint16_t syscalls;
+    if (!reader.get(syscalls))
+    {
+        return false;
+    }
+    snapshot.syscalls.resize(syscalls);
+    for (auto& syscall : snapshot.syscalls)
+    {
+        if (!reader.get_string(syscall.name) || !reader.get(syscall.count) || !reader.get(syscall.time_ns) || !reader.get(syscall.errors)
+            || !reader.get(syscall.p50_ns) || !reader.get(syscall.p99_ns))
+        {
+            return false;
+        }
+    }
+    uint16_t commands;
+    if (!reader.get(commands))
+    {
+        return false;
+    }
+    snapshot.commands.resize(commands);
+    for (auto& command : snapshot.commands)
+    {
+        if (!reader.get_string(command.name) || !reader.get(command.processes) || !reader.get(command.cpu_ns)
+            || !reader.get(command.page_faults) || !reader.get(command.context_switches))
+        {
+            return false;
+        }
+    }
+    uint16_t locks;
+    if (!reader.get(locks))
+    {
+        return false;
+    }
+    snapshot.locks.resize(locks);
+    for (auto& lock : snapshot.locks)
+    {
+        if (!reader.get_string(lock.name) || !reader.get(lock.waits) || !reader.get(lock.wakes) || !reader.get(lock.wait_ns) || !reader.get(lock.p99_ns))
+        {
+            return false;
+        }
+    }
+    uint16_t devices;
+    if (!reader.get(devices))
+    {
+        return false;
+    }
+    snapshot.devices.resize(devices);
+    for (auto& device : snapshot.devices)
+    {
+        if (!reader.get_string(device.name) || !reader.get(device.requests) || !reader.get(device.bytes) || !reader.get(device.p50_ns)
+            || !reader.get(device.p99_ns))
+        {
+            return false;
+        }
+    }
+    uint8_t alloc_classes;
+    if (!reader.get(alloc_classes))
+    {
+        return false;
+    }
+    snapshot.alloc_sizes.resize(alloc_classes);
+    for (auto& count : snapshot.alloc_sizes)
+    {
+        if (!reader.get(count))
+        {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,87 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../metrics/profiling_snapshot.h"
+
+//Every message is a fixed header followed by `length` payload bytes, host
+//byte order (both ends live on the same machine):
+//  u32 length | u16 type | u16 version | u32 session
+const uint16_t protocol_version = 6;
+const uint32_t max_frame_payload = 16u << 20;
+
+enum class FrameType : uint16_t
+{
+    //client -> daemon
+    START = 1,      //StartRequest, replied with STARTED or ERROR
+    STOP,           //session
+    ATTACH,         //session, snapshots follow until DETACH or ENDED
+    DETACH,         //session
+    LIST,
+    QUERY,          //session, window query text, replied with RESULT or ERROR
+
+    //daemon -> client
+    STARTED = 64,   //session
+    OK,
+    ERROR,          //text
+    SESSIONS,       //text, one session per line
+    SNAPSHOT,       //session, encoded ProfilingSnapshot
+    LOG,            //session, text
+    ENDED,          //session, the target exited or was stopped
+    RESULT          //session, text
+};
+
+#pragma pack(push, 1)
+struct FrameHeader
+{
+    uint32_t length;
+    uint16_t type;
+    uint16_t version;
+    uint32_t session;
+};
+#pragma pack(pop)
+
+struct Frame
+{
+    FrameType type;
+    uint32_t session = 0;
+    std::string payload;
+};
+
+struct StartRequest
+{
+    std::string programm;
+    std::vector<std::string> args;
+    std::vector<MetricType> metrics;
+    uint32_t interval_ms = 0;       //0 - daemon default
+};
+
+//header + payload appended to out
+void append_frame(std::string& out, FrameType type, uint32_t session, const std::string& payload = std::string());
+
+//reassembles frames from a byte stream
+class FrameReader
+{
+public:
+    void feed(const char* data, size_t size) { buffer_.append(data, size); }
+    //false when no complete frame is buffered; error is set for a corrupt stream
+    bool next(Frame& frame, std::string& error);
+
+private:
+    std::string buffer_;
+    size_t offset_ = 0;
+};
+
+//payloads: little fixed-width fields, strings as u16 length + bytes
+std::string encode_start(const StartRequest& request);
+bool decode_start(const std::string& payload, StartRequest& request);
+
+//metrics as u8 type + u64 value + f32 coverage + f32 error, names are restored
+//from the type; per-thread and stage latency details are not sent
+std::string encode_snapshot(const ProfilingSnapshot& snapshot);
+bool decode_snapshot(const std::string& payload, ProfilingSnapshot& snapshot);
+
+#endif
@@ -2,10 +2,49 @@
 #include <functional>
 
 #include "./console_interface/user_interface_c.h"
+#include "./console_interface/command_line.h"
+#include "./console_interface/compare_mode.h"
+#include "./console_interface/repeat_mode.h"
+#include "./console_interface/daemon_mode.h"
+#include "./console_interface/query_mode.h"
 
 
-int main() 
+int main(int argc, char** argv) 
 {
-    ConsoleInterface interface;
+    CommandLineOptions options;
+    std::string error;
+    if(!parse_command_line(argc, argv, options, error))
+    {
+        std::cerr << error << std::endl;
+        print_usage(std::cerr, argv[0]);
+        return 1;
+    }
+
+    if(options.mode == RunMode::COMPARE_RECORDINGS || options.mode == RunMode::COMPARE_COMMANDS)
+    {
+        return run_compare_mode(options);
+    }
+
+    if(options.mode == RunMode::REPEAT)
+    {
+        return run_repeat_mode(options);
+    }
+
+    if(options.mode == RunMode::DAEMON)
+    {
+        return run_daemon_mode(options);
+    }
+
+    if(options.mode == RunMode::CLIENT)
+    {
+        return run_client_mode(options);
+    }
+
+    if(options.mode == RunMode::QUERY)
+    {
+        return run_query_mode(options);
+    }
+
+    ConsoleInterface interface(options);
     interface.run();
-}
\ No newline at end of file
+}
@@ -1,5 +1,11 @@
 #include "manager.h"
 
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <map>
+#include <mutex>
+
 Manager::Manager()
 {
     manager = std::make_unique<ProcessManager>();
@@ -8,6 +14,12 @@ Manager::Manager()
     setup();
 }
 
+Manager::~Manager()
+{
+    collector->stop_profiling();
+    bus.stop();
+}
+
 bool Manager::start_profiling(const std::string& programm, const std::vector<std::string>& args, const ProfilingConfiguration& config)//надо пересмотреть, как ошибки будут доходить
 {
     if(current_pid != -1)
@@ -29,7 +41,7 @@ bool Manager::start_profiling(const std::string& programm, const std::vector<std
     }
     current_config = config;
 
-    pid_t new_pid = manager->launch_programm(programm,args);
+    pid_t new_pid = manager->launch_programm(programm,args,current_config.launch);
 
     if(new_pid == -1)
     {
@@ -46,10 +58,46 @@ bool Manager::start_profiling(const std::string& programm, const std::vector<std
     }
 
     current_pid = new_pid;
+    phase_detector.reset();
+    {
+        std::unique_lock<std::shared_mutex> lock(window_mutex);
+        history.set_settings(current_config.history);
+        window_series.clear();
+    }
+
+    if(!apply_housekeeping())
+    {
+        manager->terminate_process();
+        return false;
+    }
+
+    if(!current_config.record_path.empty() && !open_recording(programm, args))
+    {
+        manager->terminate_process();
+        return false;
+    }
 
+    if(current_config.flight.enabled)
+    {
+        std::string command = programm;
+        for(const auto& arg : args)
+        {
+            command += " " + arg;
+        }
+        flight.arm(current_pid, command, current_config.flight);
+    }
+
+    collector->set_housekeeping_cpus(current_config.housekeeping_cpus);
+    SourceOptions sources = current_config.sources;
+    sources.regions = manager->get_regions();
+    sources.allocs = manager->get_allocs();
+    collector->set_source_options(sources);
+    collector->set_counter_settings(current_config.counters);
+    collector->set_adaptive_settings(current_config.adaptive);
     if(!collector->start_profiling(current_pid, current_config.metrics, current_config.interval_ms))
     {
         manager->terminate_process();
+        close_recording();
         return false;
     }
 
@@ -58,9 +106,9 @@ bool Manager::start_profiling(const std::string& programm, const std::vector<std
 
 void Manager::setup()
 {
-    metric_callback metric_callback = [this](const ProfilingSnapshot& snapshot)
+    ProfilingMetricCallback metric_callback = [this](ProfilingSnapshot&& snapshot)
     {
-        this->on_metrics_recieved(snapshot);
+        this->on_metrics_recieved(std::move(snapshot));
     };
 
     error_callback error_callback = [this](const std::string& error)
@@ -76,6 +124,49 @@ void Manager::setup()
     collector->setup_metric_callback(metric_callback);
     collector->setup_error_callback(error_callback);
     collector->setup_log_callback(log_callback);
+    flight.setup_log_callback(log_callback);
+
+    //recording and history must not lose snapshots, they wait instead
+    SinkOptions lossless;
+    lossless.capacity = 256;
+    lossless.policy = BackpressurePolicy::BLOCK;
+
+    bus.subscribe("recorder", [this](const SnapshotPtr& snapshot)
+    {
+        if(recorder.is_open())
+        {
+            SelfMonitor::StageTimer timer(collector->get_self_monitor(), PipelineStage::EXPORT);
+            recorder.write_snapshot(*snapshot);
+        }
+    }, lossless);
+
+    bus.subscribe("history", [this](const SnapshotPtr& snapshot)
+    {
+        std::unique_lock<std::shared_mutex> lock(window_mutex);
+        history.append(snapshot);
+        uint64_t oldest_ms = 0;
+        bool retained = history.oldest_raw(oldest_ms);
+        for(auto& [signal, series] : window_series)
+        {
+            series.append(*snapshot);
+            series.evict_before(retained ? oldest_ms : UINT64_MAX);
+        }
+    }, lossless);
+
+    bus.subscribe("run", [this](const SnapshotPtr& snapshot)
+    {
+        std::lock_guard<std::mutex> lock(run_mutex);
+        if(collecting_run)
+        {
+            run_snapshots.push_back(snapshot);
+        }
+    }, lossless);
+
+    //only keeps pointers until a trigger fires, dumps are written by the recorder's own thread
+    bus.subscribe("flight", [this](const SnapshotPtr& snapshot)
+    {
+        flight.on_snapshot(snapshot);
+    }, lossless);
 }
 
 void Manager::stop_profiling()
@@ -83,11 +174,289 @@ void Manager::stop_profiling()
     manager->terminate_process();
     std::this_thread::sleep_for(std::chrono::milliseconds(100));
     collector->stop_profiling();
+    bus.flush();
+    flight.disarm();
+    close_recording();
+}
+
+bool Manager::run_to_completion(const std::string& programm, const std::vector<std::string>& args, const ProfilingConfiguration& config, uint32_t max_duration_s, std::vector<ProfilingSnapshot>& snapshots)
+{
+    {
+        std::lock_guard<std::mutex> lock(run_mutex);
+        run_snapshots.clear();
+        collecting_run = true;
+    }
+    if(!start_profiling(programm, args, config))
+    {
+        std::lock_guard<std::mutex> lock(run_mutex);
+        collecting_run = false;
+        return false;
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(max_duration_s);
+    while(manager->is_running() && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    //flushed by stop_profiling, nothing of this run is still queued
+    stop_profiling();
+    std::lock_guard<std::mutex> lock(run_mutex);
+    collecting_run = false;
+    snapshots.clear();
+    snapshots.reserve(run_snapshots.size());
+    for(const auto& snapshot : run_snapshots)
+    {
+        snapshots.push_back(*snapshot);
+    }
+    run_snapshots.clear();
+    return true;
+}
+
+static std::vector<int> available_cpus()
+{
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set) != 0)
+    {
+        return cpus;
+    }
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if(CPU_ISSET(cpu, &set))
+        {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+static void add_run_totals(const std::vector<ProfilingSnapshot>& snapshots, std::map<std::string, std::pair<std::string, std::vector<double>>>& totals)
+{
+    std::map<MetricType, uint64_t> sums;
+    for(const auto& snapshot : snapshots)
+    {
+        for(const auto& metric : snapshot.metrics)
+        {
+            //gauges are aggregated as the peak of the run
+            uint64_t& sum = sums[metric.type];
+            sum = is_gauge_metric(metric.type) ? std::max(sum, metric.value) : sum + metric.value;
+        }
+    }
+
+    for(const auto& [type, sum] : sums)
+    {
+        auto& entry = totals[metric_name(type)];
+        entry.first = metric_unit(type);
+        entry.second.push_back(static_cast<double>(sum));
+    }
+
+    auto instructions = sums.find(MetricType::INSTRUCTIONS);
+    auto cycles = sums.find(MetricType::CPU_CYCLES);
+    if(instructions != sums.end() && cycles != sums.end() && cycles->second > 0)
+    {
+        auto& entry = totals["ipc"];
+        entry.first = "ratio";
+        entry.second.push_back(static_cast<double>(instructions->second) / cycles->second);
+    }
+}
+
+bool Manager::run_repeated(const std::string& programm, const std::vector<std::string>& args, const ProfilingConfiguration& config, const RepeatOptions& options, RepeatReport& report)
+{
+    if(options.runs == 0)
+    {
+        report_error("Number of runs must be positive!");
+        return false;
+    }
+
+    std::vector<int> cpus = config.launch.isolation.cpu_set;
+    if(cpus.empty())
+    {
+        for(int cpu : available_cpus())
+        {
+            if(std::find(config.housekeeping_cpus.begin(), config.housekeeping_cpus.end(), cpu) == config.housekeeping_cpus.end())
+            {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    uint32_t parallel = std::max<uint32_t>(1, std::min<uint32_t>({options.parallel, options.runs, static_cast<uint32_t>(cpus.size())}));
+
+    report = RepeatReport();
+    report.runs_requested = options.runs;
+    report.parallel = parallel;
+    if(parallel > 1)
+    {
+        //disjoint CPU sets, so parallel runs don't share cores with each other
+        size_t per_run = cpus.size() / parallel;
+        for(uint32_t slot = 0; slot < parallel; slot++)
+        {
+            report.cpu_sets.emplace_back(cpus.begin() + slot * per_run, cpus.begin() + (slot + 1) * per_run);
+        }
+    }
+
+    ProfilingConfiguration run_config = config;
+    run_config.record_path.clear();
+    //serial runs get the same CPUs as the parallel slots together
+    run_config.launch.isolation.cpu_set = cpus;
+
+    std::vector<std::vector<ProfilingSnapshot>> results(options.runs);
+    std::vector<char> completed(options.runs, 0);
+    std::vector<std::string> errors;
+    std::mutex errors_mutex;
+
+    auto started = std::chrono::steady_clock::now();
+    for(uint32_t first = 0; first < options.runs; first += parallel)
+    {
+        if(parallel == 1)
+        {
+            completed[first] = run_to_completion(programm, args, run_config, options.max_duration_s, results[first]);
+            continue;
+        }
+
+        std::vector<std::thread> workers;
+        for(uint32_t slot = 0; slot < parallel && first + slot < options.runs; slot++)
+        {
+            workers.emplace_back([&, slot, run = first + slot]()
+            {
+                Manager worker;
+                worker.setup_log_callback([](const std::string&){});
+                worker.setup_error_callback([&](const std::string& error)
+                {
+                    std::lock_guard<std::mutex> lock(errors_mutex);
+                    errors.push_back("[run " + std::to_string(run) + "] " + error);
+                });
+
+                ProfilingConfiguration pinned = run_config;
+                pinned.launch.isolation.cpu_set = report.cpu_sets[slot];
+                completed[run] = worker.run_to_completion(programm, args, pinned, options.max_duration_s, results[run]);
+            });
+        }
+        for(auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+    report.wall_time_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    for(const auto& error : errors)
+    {
+        report_error(error);
+    }
+
+    std::map<std::string, std::pair<std::string, std::vector<double>>> totals;
+    for(uint32_t run = 0; run < options.runs; run++)
+    {
+        if(completed[run])
+        {
+            report.runs_completed++;
+            add_run_totals(results[run], totals);
+        }
+    }
+
+    for(const auto& [name, entry] : totals)
+    {
+        const std::vector<double>& values = entry.second;
+
+        RepeatedMetric metric;
+        metric.name = name;
+        metric.unit = entry.first;
+        metric.runs = values.size();
+        metric.min = *std::min_element(values.begin(), values.end());
+        metric.max = *std::max_element(values.begin(), values.end());
+        for(double value : values)
+        {
+            metric.mean += value;
+        }
+        metric.mean /= values.size();
+
+        double squares = 0.0;
+        for(double value : values)
+        {
+            squares += (value - metric.mean) * (value - metric.mean);
+        }
+        metric.stddev = values.size() > 1 ? std::sqrt(squares / (values.size() - 1)) : 0.0;
+        report.metrics.push_back(metric);
+    }
+
+    return report.runs_completed > 0;
 }
 
-void Manager::setup_metrics_callback(metric_callback callback)
+bool Manager::open_recording(const std::string& programm, const std::vector<std::string>& args)
 {
-    callback_metric = callback;
+    if(!recorder.open(current_config.record_path))
+    {
+        report_error("Can't open recording file " + current_config.record_path);
+        return false;
+    }
+
+    std::string command = programm;
+    for(const auto& arg : args)
+    {
+        command += " " + arg;
+    }
+    std::string metrics;
+    for(auto metric : current_config.metrics)
+    {
+        metrics += std::string(metrics.empty() ? "" : ",") + metric_name(metric);
+    }
+
+    recorder.write_metadata("command", command);
+    recorder.write_metadata("pid", std::to_string(current_pid));
+    recorder.write_metadata("interval_ms", std::to_string(current_config.interval_ms));
+    recorder.write_metadata("metrics", metrics);
+    recorder.write_metadata("counters_per_group", std::to_string(current_config.counters.counters_per_group));
+    recorder.write_metadata("kernel_timed_batch", std::to_string(current_config.counters.kernel_timed_batch));
+    const AdaptiveSettings& adaptive = current_config.adaptive;
+    recorder.write_metadata("adaptive_interval", adaptive.enabled ? std::to_string(adaptive.min_interval_ms) + ":" + std::to_string(adaptive.max_interval_ms) : "off");
+
+    const IsolationOptions& isolation = current_config.launch.isolation;
+    recorder.write_metadata("isolation.cpus", format_cpu_list(isolation.cpu_set));
+    recorder.write_metadata("isolation.numa", describe_numa_policy(isolation.numa_policy, isolation.numa_nodes));
+    recorder.write_metadata("isolation.nice", isolation.nice_value ? std::to_string(*isolation.nice_value) : "inherit");
+    recorder.write_metadata("isolation.sched", describe_scheduling_class(isolation.scheduling_class, isolation.scheduling_priority));
+    recorder.write_metadata("isolation.housekeeping_cpus", format_cpu_list(current_config.housekeeping_cpus));
+    return true;
+}
+
+bool Manager::apply_housekeeping()
+{
+    const std::vector<int>& housekeeping = current_config.housekeeping_cpus;
+    const std::vector<int>& target = current_config.launch.isolation.cpu_set;
+    for(int cpu : housekeeping)
+    {
+        if(std::find(target.begin(), target.end(), cpu) != target.end())
+        {
+            report_log("[Manager] Housekeeping CPU " + std::to_string(cpu) + " is shared with the target\n");
+        }
+    }
+
+    std::string error;
+    //only threads the profiler owns: the caller forks the next target, which would
+    //inherit its affinity. The collector pins its own thread, the sink threads
+    //were started with the manager, before any pinning
+    if(!bus.pin(housekeeping, error))
+    {
+        report_error("Can't pin profiler threads: " + error);
+        return false;
+    }
+    return true;
+}
+
+void Manager::close_recording()
+{
+    if(recorder.is_open())
+    {
+        recorder.write_phases(phase_detector.get_phases());
+        recorder.write_stage_latencies(collector->get_self_monitor().stage_latencies());
+        recorder.close();
+    }
+}
+
+void Manager::subscribe(const std::string& name, SnapshotHandler handler, const SinkOptions& options)
+{
+    bus.subscribe(name, std::move(handler), options);
 }
 
 void Manager::setup_error_callback(error_callback callback)
@@ -125,9 +494,78 @@ ProfilingConfiguration Manager::get_current_config() const
     return current_config;
 }
 
-void Manager::on_metrics_recieved(const ProfilingSnapshot& snapshot)
+SelfMonitor& Manager::get_self_monitor()
+{
+    return collector->get_self_monitor();
+}
+
+std::vector<PhaseStats> Manager::get_phases() const
+{
+    return phase_detector.get_phases();
+}
+
+std::vector<SnapshotPtr> Manager::get_history() const
+{
+    return history.raw();
+}
+
+HistoryQuery Manager::query_history(uint64_t from_ms, uint64_t to_ms, size_t max_points) const
+{
+    return history.query(from_ms, to_ms, max_points);
+}
+
+bool Manager::query_window(const WindowQuery& query, double& result, size_t& samples) const
+{
+    {
+        std::shared_lock<std::shared_mutex> lock(window_mutex);
+        auto it = window_series.find(query.signal);
+        if(it != window_series.end())
+        {
+            return it->second.evaluate(query, result, samples);
+        }
+    }
+
+    //the first query of a signal builds its series from the history, later ones only evaluate
+    std::unique_lock<std::shared_mutex> lock(window_mutex);
+    auto it = window_series.find(query.signal);
+    if(it == window_series.end())
+    {
+        std::vector<SnapshotPtr> snapshots = history.raw();
+        SignalSeries series(query.signal);
+        series.reserve(snapshots.size());
+        for(const auto& snapshot : snapshots)
+        {
+            series.append(*snapshot);
+        }
+        if(window_series.size() >= max_window_signals)
+        {
+            return series.evaluate(query, result, samples);
+        }
+        it = window_series.emplace(query.signal, std::move(series)).first;
+    }
+    return it->second.evaluate(query, result, samples);
+}
+
+HistoryUsage Manager::get_history_usage() const
+{
+    return history.usage();
+}
+
+std::vector<SinkStats> Manager::get_sink_stats() const
+{
+    return bus.stats();
+}
+
+std::vector<std::string> Manager::get_flight_dumps() const
+{
+    return flight.dumps();
+}
+
+void Manager::on_metrics_recieved(ProfilingSnapshot&& snapshot)
 {
-    report_metrics(snapshot);
+    //the only mutation, done before the snapshot is shared
+    phase_detector.update(snapshot);
+    bus.publish(std::make_shared<const ProfilingSnapshot>(std::move(snapshot)));
 }
 
 void Manager::on_error_recieved(const std::string& error)
@@ -152,18 +590,6 @@ void Manager::report_error(const std::string& error)
     }
 }
 
-void Manager::report_metrics(const ProfilingSnapshot& snapshot)
-{
-    if(callback_metric)
-    {
-        callback_metric(snapshot);
-    }
-    else
-    {
-        report_error("Unfefined callback in Manager!");
-    }
-}
-
 void Manager::report_log(const std::string& log)
 {
     if(callback_log)
@@ -180,5 +606,44 @@ std::ostream& operator<<(std::ostream& ostr, const ProfilingConfiguration pr_con
 {
     ostr << "Metrics: (later)" << std::endl;
     ostr << "Profiling_interval: "<<pr_config.interval_ms<<std::endl;
+    const IsolationOptions& isolation = pr_config.launch.isolation;
+    ostr << "Target CPUs: "<<format_cpu_list(isolation.cpu_set)
+         << ", NUMA: "<<describe_numa_policy(isolation.numa_policy, isolation.numa_nodes)
+         << ", nice: "<<(isolation.nice_value ? std::to_string(*isolation.nice_value) : "inherit")
+         << ", sched: "<<describe_scheduling_class(isolation.scheduling_class, isolation.scheduling_priority)<<std::endl;
+    ostr << "Profiler CPUs: "<<format_cpu_list(pr_config.housekeeping_cpus)<<std::endl;
+    if(!pr_config.record_path.empty())
+    {
+        ostr << "Recording to: "<<pr_config.record_path<<std::endl;
+    }
     return ostr;
-}
\ No newline at end of file
+}
+
+std::ostream& operator<<(std::ostream& ostr, const RepeatReport& report)
+{
+    std::streamsize precision = ostr.precision();
+    ostr << "Performance counter stats for " << report.runs_completed << "/" << report.runs_requested << " runs"
+         << " (parallel " << report.parallel << ", wall " << std::fixed << std::setprecision(2) << report.wall_time_s << " s):" << std::endl;
+
+    for(const auto& metric : report.metrics)
+    {
+        double relative = metric.mean != 0.0 ? 100.0 * metric.stddev / std::fabs(metric.mean) : 0.0;
+        ostr << "  " << std::left << std::setw(26) << metric.name << std::right
+             << std::setw(18) << metric.mean << " +- " << std::setw(14) << metric.stddev
+             << " (" << std::setw(6) << relative << "%)"
+             << "  [" << metric.min << " .. " << metric.max << "] " << metric.unit << std::endl;
+    }
+
+    for(size_t slot = 0; slot < report.cpu_sets.size(); slot++)
+    {
+        ostr << "  slot " << slot << " cpus:";
+        for(int cpu : report.cpu_sets[slot])
+        {
+            ostr << " " << cpu;
+        }
+        ostr << std::endl;
+    }
+    ostr.unsetf(std::ios::floatfield);
+    ostr.precision(precision);
+    return ostr;
+}
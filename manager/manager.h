@@ -9,9 +9,18 @@
 #include <chrono>
 #include <thread>
 #include <iostream>
+#include <mutex>
+#include <map>
+#include <shared_mutex>
 
 #include "../metrics/metrics_collector.h"
+#include "../metrics/snapshot_bus.h"
+#include "../metrics/snapshot_history.h"
 #include "../processes/process_manager.h"
+#include "../analysis/phase_detector.h"
+#include "../analysis/window_query.h"
+#include "../recording/recorder.h"
+#include "../recording/flight_recorder.h"
 
 const uint32_t min_interval_ms = 100;
 const uint32_t max_interval_ms = 5000;
@@ -20,6 +29,14 @@ struct ProfilingConfiguration
 {
     std::vector<MetricType> metrics = {MetricType::PAGE_FAULTS};
     int interval_ms = 500;
+    std::string record_path;
+    LaunchOptions launch;
+    std::vector<int> housekeeping_cpus;     //profiler threads, empty - not pinned
+    SourceOptions sources;
+    CounterSettings counters;
+    HistorySettings history;
+    AdaptiveSettings adaptive;          //interval_ms is the starting point when enabled
+    FlightSettings flight;
 
     ProfilingConfiguration() = default;
     ProfilingConfiguration(std::vector<MetricType>& metrics, int interval): metrics(std::move(metrics)), interval_ms(interval) {}
@@ -34,7 +51,36 @@ struct ProfilingConfiguration
 
 const ProfilingConfiguration default_cfg;
 
-using metric_callback = std::function<void(ProfilingSnapshot)>;
+struct RepeatOptions
+{
+    uint32_t runs = 5;
+    uint32_t parallel = 1;          //runs executed at the same time, each on its own CPU set
+    uint32_t max_duration_s = 60;
+};
+
+struct RepeatedMetric
+{
+    std::string name;
+    std::string unit;
+    size_t runs = 0;
+    double mean = 0.0;
+    double stddev = 0.0;
+    double min = 0.0;
+    double max = 0.0;
+};
+
+struct RepeatReport
+{
+    uint32_t runs_requested = 0;
+    uint32_t runs_completed = 0;
+    uint32_t parallel = 1;
+    std::vector<std::vector<int>> cpu_sets;
+    double wall_time_s = 0.0;
+    std::vector<RepeatedMetric> metrics;
+
+    friend std::ostream& operator<<(std::ostream& ostr, const RepeatReport& report);
+};
+
 using error_callback = std::function<void(const std::string&)>;
 using log_callback = std::function<void(const std::string& log)>;
 
@@ -42,8 +88,23 @@ class Manager
 {
     std::unique_ptr<MetricCollector> collector;
     std::unique_ptr<ProcessManager> manager;
+    PhaseDetector phase_detector;
+    Recorder recorder;
+    FlightRecorder flight;
+
+    SnapshotHistory history;
+
+    //a series per signal asked for, fed with the history and evicted with its raw snapshots;
+    //the lock also covers history.append, a series built from the history misses nothing
+    static constexpr size_t max_window_signals = 32;
+    mutable std::shared_mutex window_mutex;
+    mutable std::map<std::string, SignalSeries> window_series;
+
+    //every snapshot of a run_to_completion, the history only keeps the raw retention
+    mutable std::mutex run_mutex;
+    bool collecting_run = false;
+    std::vector<SnapshotPtr> run_snapshots;
 
-    metric_callback callback_metric;
     error_callback callback_error;
     log_callback callback_log;
 
@@ -51,15 +112,23 @@ class Manager
     std::string current_programm = "idle";
     ProfilingConfiguration current_config = default_cfg;
 
+    //last member: sink threads use everything above
+    SnapshotBus bus;
+
     public:
     Manager();
-    ~Manager() = default;
+    ~Manager();
 
     void setup();
     bool start_profiling(const std::string& programm, const std::vector<std::string>& args, const ProfilingConfiguration& config);
     void stop_profiling();
+    //blocks until the programm exits or max_duration_s passes
+    bool run_to_completion(const std::string& programm, const std::vector<std::string>& args, const ProfilingConfiguration& config, uint32_t max_duration_s, std::vector<ProfilingSnapshot>& snapshots);
+    //perf stat -r: launches the programm options.runs times and aggregates per-run totals
+    bool run_repeated(const std::string& programm, const std::vector<std::string>& args, const ProfilingConfiguration& config, const RepeatOptions& options, RepeatReport& report);
 
-    void setup_metrics_callback(metric_callback callback);
+    //every sink receives the same immutable snapshot on its own thread
+    void subscribe(const std::string& name, SnapshotHandler handler, const SinkOptions& options = SinkOptions());
     void setup_error_callback(error_callback callback);
     void setup_log_callback(log_callback callback);
     bool is_active() const;
@@ -68,14 +137,27 @@ class Manager
     pid_t get_current_pid() const;
     std::string get_current_programm() const;
     ProfilingConfiguration get_current_config() const;
+    SelfMonitor& get_self_monitor();
+    std::vector<PhaseStats> get_phases() const;
+    //raw snapshots still within the raw retention
+    std::vector<SnapshotPtr> get_history() const;
+    HistoryQuery query_history(uint64_t from_ms, uint64_t to_ms, size_t max_points = 0) const;
+    HistoryUsage get_history_usage() const;
+    //over the raw snapshots still in the history, false without data in the window
+    bool query_window(const WindowQuery& query, double& result, size_t& samples) const;
+    std::vector<SinkStats> get_sink_stats() const;
+    std::vector<std::string> get_flight_dumps() const;
 
     private:
 
     void report_error(const std::string& error);
-    void report_metrics(const ProfilingSnapshot& snapshot);
     void report_log(const std::string& log);
 
-    void on_metrics_recieved(const ProfilingSnapshot& snapshot);
+    bool apply_housekeeping();
+    bool open_recording(const std::string& programm, const std::vector<std::string>& args);
+    void close_recording();
+
+    void on_metrics_recieved(ProfilingSnapshot&& snapshot);
     void on_error_recieved(const std::string& error);
     void on_log_recieved(const std::string& log);
 };
@@ -0,0 +1,350 @@
+//LD_PRELOAD shim of the profiler's allocation tracking. Counts every malloc
+//family call and mmap into the calling thread's slot of the shared AllocShm
+//and records a stack about every sample_bytes allocated.
+
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "alloc_shm.h"
+
+namespace
+{
+    using malloc_fn = void* (*)(size_t);
+    using calloc_fn = void* (*)(size_t, size_t);
+    using realloc_fn = void* (*)(void*, size_t);
+    using free_fn = void (*)(void*);
+    using posix_memalign_fn = int (*)(void**, size_t, size_t);
+    using aligned_alloc_fn = void* (*)(size_t, size_t);
+    using mmap_fn = void* (*)(void*, size_t, int, int, int, off_t);
+
+    malloc_fn real_malloc = nullptr;
+    calloc_fn real_calloc = nullptr;
+    realloc_fn real_realloc = nullptr;
+    free_fn real_free = nullptr;
+    posix_memalign_fn real_posix_memalign = nullptr;
+    aligned_alloc_fn real_aligned_alloc = nullptr;
+    mmap_fn real_mmap = nullptr;
+
+    //dlsym itself may calloc before the real allocator is known
+    alignas(16) char bootstrap_heap[8192];
+    size_t bootstrap_used = 0;
+    bool resolving = false;
+
+    AllocShm* shm = nullptr;
+
+    struct ThreadState
+    {
+        AllocThreadSlot* slot;
+        bool claimed;
+        bool busy;              //inside the shim, nested allocations pass through
+        int64_t until_sample;
+        uint64_t random;
+    };
+
+    //static TLS: touching it must never allocate
+    thread_local ThreadState state __attribute__((tls_model("initial-exec")));
+
+    void resolve()
+    {
+        resolving = true;
+        real_malloc = reinterpret_cast<malloc_fn>(dlsym(RTLD_NEXT, "malloc"));
+        real_calloc = reinterpret_cast<calloc_fn>(dlsym(RTLD_NEXT, "calloc"));
+        real_realloc = reinterpret_cast<realloc_fn>(dlsym(RTLD_NEXT, "realloc"));
+        real_free = reinterpret_cast<free_fn>(dlsym(RTLD_NEXT, "free"));
+        real_posix_memalign = reinterpret_cast<posix_memalign_fn>(dlsym(RTLD_NEXT, "posix_memalign"));
+        real_aligned_alloc = reinterpret_cast<aligned_alloc_fn>(dlsym(RTLD_NEXT, "aligned_alloc"));
+        real_mmap = reinterpret_cast<mmap_fn>(dlsym(RTLD_NEXT, "mmap"));
+        resolving = false;
+    }
+
+    inline void ensure_resolved()
+    {
+        if (__builtin_expect(real_malloc == nullptr, 0) && !resolving)
+        {
+            resolve();
+        }
+    }
+
+    void* bootstrap_alloc(size_t size)
+    {
+        size = (size + 15) & ~size_t(15);
+        if (bootstrap_used + size > sizeof(bootstrap_heap))
+        {
+            return nullptr;
+        }
+        void* result = bootstrap_heap + bootstrap_used;
+        bootstrap_used += size;
+        return result;
+    }
+
+    inline bool is_bootstrap(void* ptr)
+    {
+        return ptr >= bootstrap_heap && ptr < bootstrap_heap + sizeof(bootstrap_heap);
+    }
+
+    inline void bump(std::atomic<uint64_t>& counter, uint64_t value)
+    {
+        //single writer: a plain read-modify-write, no lock prefix
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    //exponential intervals make every byte equally likely to be sampled
+    int64_t next_interval(ThreadState& thread)
+    {
+        if (thread.random == 0)
+        {
+            thread.random = static_cast<uint64_t>(syscall(SYS_gettid)) * 0x9e3779b97f4a7c15ull | 1;
+        }
+        thread.random ^= thread.random << 13;
+        thread.random ^= thread.random >> 7;
+        thread.random ^= thread.random << 17;
+        double uniform = (static_cast<double>(thread.random >> 11) + 1.0) / 9007199254740993.0;
+        return static_cast<int64_t>(-std::log(uniform) * shm->sample_bytes) + 1;
+    }
+
+    AllocThreadSlot* claim(ThreadState& thread)
+    {
+        if (!thread.claimed)
+        {
+            thread.claimed = true;
+            uint32_t index = shm->thread_count.fetch_add(1, std::memory_order_relaxed);
+            if (index >= alloc_max_threads)
+            {
+                shm->untracked_threads.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            thread.slot = &shm->threads[index];
+            thread.slot->tid.store(static_cast<uint32_t>(syscall(SYS_gettid)), std::memory_order_release);
+            if (shm->sample_bytes)
+            {
+                thread.until_sample = next_interval(thread);
+            }
+        }
+        return thread.slot;
+    }
+
+    __attribute__((noinline)) void sample(AllocThreadSlot* slot, uint64_t size, uint32_t kind)
+    {
+        uint64_t head = slot->head.load(std::memory_order_relaxed);
+        if (head - slot->tail.load(std::memory_order_acquire) >= alloc_ring_capacity)
+        {
+            bump(slot->dropped, 1);
+            return;
+        }
+
+        AllocSample& entry = slot->samples[head & (alloc_ring_capacity - 1)];
+        void* frames[alloc_max_frames + 3];
+        //may allocate on first use, thread.busy keeps that out of the counts
+        int depth = backtrace(frames, alloc_max_frames + 3);
+        //drop sample(), on_alloc() and the interposed function itself
+        int skip = depth > 3 ? 3 : 0;
+        entry.depth = 0;
+        for (int i = skip; i < depth; i++)
+        {
+            entry.frames[entry.depth++] = reinterpret_cast<uint64_t>(frames[i]);
+        }
+        entry.size = size;
+        entry.kind = kind;
+        slot->head.store(head + 1, std::memory_order_release);
+    }
+
+    __attribute__((noinline)) void on_alloc(size_t size, uint32_t kind)
+    {
+        ThreadState& thread = state;
+        if (!shm || thread.busy)
+        {
+            return;
+        }
+        thread.busy = true;
+        if (AllocThreadSlot* slot = claim(thread))
+        {
+            if (kind == ALLOC_MMAP)
+            {
+                bump(slot->mmaps, 1);
+                bump(slot->mmap_bytes, size);
+            }
+            else
+            {
+                bump(slot->allocs, 1);
+                bump(slot->alloc_bytes, size);
+                bump(slot->size_classes[alloc_size_class(size)], 1);
+            }
+
+            if (shm->sample_bytes)
+            {
+                thread.until_sample -= static_cast<int64_t>(size);
+                if (thread.until_sample <= 0)
+                {
+                    sample(slot, size, kind);
+                    thread.until_sample = next_interval(thread);
+                }
+            }
+        }
+        thread.busy = false;
+    }
+
+    inline void on_free(void* ptr)
+    {
+        ThreadState& thread = state;
+        if (!shm || thread.busy || !ptr)
+        {
+            return;
+        }
+        if (AllocThreadSlot* slot = claim(thread))
+        {
+            bump(slot->frees, 1);
+            bump(slot->free_bytes, malloc_usable_size(ptr));
+        }
+    }
+
+    void attach()
+    {
+        const char* fd_text = getenv(ALLOC_ENV_VARIABLE);
+        if (!fd_text)
+        {
+            return;
+        }
+        ensure_resolved();
+        void* base = real_mmap(nullptr, sizeof(AllocShm), PROT_READ | PROT_WRITE, MAP_SHARED, atoi(fd_text), 0);
+        if (base == MAP_FAILED)
+        {
+            return;
+        }
+        AllocShm* candidate = static_cast<AllocShm*>(base);
+        if (candidate->magic != alloc_magic || candidate->version != alloc_version)
+        {
+            munmap(base, sizeof(AllocShm));
+            return;
+        }
+
+        //loads the unwinder now rather than inside the first sample
+        void* warmup[2];
+        state.busy = true;
+        backtrace(warmup, 2);
+        state.busy = false;
+
+        //a forked child starts without a slot instead of sharing its parent's
+        pthread_atfork(nullptr, nullptr, []()
+        {
+            state.claimed = false;
+            state.slot = nullptr;
+        });
+        shm = candidate;
+    }
+
+    __attribute__((constructor)) void initialize()
+    {
+        attach();
+    }
+}
+
+extern "C"
+{
+    void* malloc(size_t size) noexcept
+    {
+        ensure_resolved();
+        if (!real_malloc)
+        {
+            return bootstrap_alloc(size);
+        }
+        void* ptr = real_malloc(size);
+        if (ptr)
+        {
+            on_alloc(malloc_usable_size(ptr), ALLOC_MALLOC);
+        }
+        return ptr;
+    }
+
+    void* calloc(size_t count, size_t size) noexcept
+    {
+        ensure_resolved();
+        if (!real_calloc)
+        {
+            //zero filled: the bootstrap heap is static and never reused
+            return bootstrap_alloc(count * size);
+        }
+        void* ptr = real_calloc(count, size);
+        if (ptr)
+        {
+            on_alloc(malloc_usable_size(ptr), ALLOC_MALLOC);
+        }
+        return ptr;
+    }
+
+    void* realloc(void* old, size_t size) noexcept
+    {
+        ensure_resolved();
+        if (is_bootstrap(old))
+        {
+            void* ptr = malloc(size);
+            if (ptr)
+            {
+                memcpy(ptr, old, std::min(size, sizeof(bootstrap_heap) - (static_cast<char*>(old) - bootstrap_heap)));
+            }
+            return ptr;
+        }
+        on_free(old);
+        void* ptr = real_realloc(old, size);
+        if (ptr)
+        {
+            on_alloc(malloc_usable_size(ptr), ALLOC_MALLOC);
+        }
+        return ptr;
+    }
+
+    void free(void* ptr) noexcept
+    {
+        if (!ptr || is_bootstrap(ptr))
+        {
+            return;
+        }
+        ensure_resolved();
+        on_free(ptr);
+        real_free(ptr);
+    }
+
+    int posix_memalign(void** out, size_t alignment, size_t size) noexcept
+    {
+        ensure_resolved();
+        int result = real_posix_memalign(out, alignment, size);
+        if (result == 0)
+        {
+            on_alloc(malloc_usable_size(*out), ALLOC_MALLOC);
+        }
+        return result;
+    }
+
+    void* aligned_alloc(size_t alignment, size_t size) noexcept
+    {
+        ensure_resolved();
+        void* ptr = real_aligned_alloc(alignment, size);
+        if (ptr)
+        {
+            on_alloc(malloc_usable_size(ptr), ALLOC_MALLOC);
+        }
+        return ptr;
+    }
+
+    void* mmap(void* addr, size_t length, int prot, int flags, int fd, off_t offset) noexcept
+    {
+        ensure_resolved();
+        void* ptr = real_mmap(addr, length, prot, flags, fd, offset);
+        if (ptr != MAP_FAILED)
+        {
+            on_alloc(length, ALLOC_MMAP);
+        }
+        return ptr;
+    }
+
+    void* mmap64(void* addr, size_t length, int prot, int flags, int fd, off_t offset) noexcept __attribute__((alias("mmap")));
+}
@@ -0,0 +1,69 @@
+#ifndef ALLOC_SHM_H
+#define ALLOC_SHM_H
+
+//Shared memory between the allocation shim preloaded into the target and the
+//profiler. Every thread owns one slot: plain counters it alone writes (so no
+//locked instructions on the allocation path) and a lock-free ring of sampled
+//allocations with their stacks. Sampling is by bytes: on average one sample
+//per sample_bytes allocated, so the cost does not grow with the call rate.
+
+#include <atomic>
+#include <cstdint>
+
+#define ALLOC_ENV_VARIABLE "PROFILER_ALLOC_FD"
+
+constexpr uint32_t alloc_magic = 0x414c4331;
+constexpr uint32_t alloc_version = 1;
+constexpr uint32_t alloc_max_threads = 128;        //slots are not recycled when threads exit
+constexpr uint32_t alloc_ring_capacity = 256;      //power of two
+constexpr uint32_t alloc_max_frames = 24;
+constexpr uint32_t alloc_size_classes = 32;        //class n: sizes in [2^(n-1), 2^n), class 0 - empty
+
+enum AllocKind : uint32_t
+{
+    ALLOC_MALLOC = 0,
+    ALLOC_MMAP = 1
+};
+
+struct AllocSample
+{
+    uint64_t size;
+    uint32_t kind;
+    uint32_t depth;
+    uint64_t frames[alloc_max_frames];     //return addresses, innermost first
+};
+
+struct alignas(64) AllocThreadSlot
+{
+    std::atomic<uint32_t> tid;
+    std::atomic<uint64_t> allocs;
+    std::atomic<uint64_t> alloc_bytes;
+    std::atomic<uint64_t> frees;
+    std::atomic<uint64_t> free_bytes;
+    std::atomic<uint64_t> mmaps;
+    std::atomic<uint64_t> mmap_bytes;
+    std::atomic<uint64_t> size_classes[alloc_size_classes];
+
+    alignas(64) std::atomic<uint64_t> head;
+    std::atomic<uint64_t> dropped;
+    alignas(64) std::atomic<uint64_t> tail;
+    alignas(64) AllocSample samples[alloc_ring_capacity];
+};
+
+struct AllocShm
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sample_bytes;                  //set by the profiler, 0 - no stacks
+    std::atomic<uint32_t> thread_count;
+    std::atomic<uint64_t> untracked_threads;
+    AllocThreadSlot threads[alloc_max_threads];
+};
+
+inline uint32_t alloc_size_class(uint64_t size)
+{
+    uint32_t size_class = size ? 64 - __builtin_clzll(size) : 0;
+    return size_class < alloc_size_classes ? size_class : alloc_size_classes - 1;
+}
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef REGION_MARKERS_H
+#define REGION_MARKERS_H
+
+//Header-only region markers for profiled programs:
+//
+//    region_begin("parse");
+//    ...
+//    region_end();
+//
+//or RegionScope scope("parse"). Markers are timestamped and written to a
+//lock-free per-thread ring in shared memory that the profiler hands over
+//through PROFILER_REGIONS_FD. Without a profiler every call is one
+//predictable branch. Regions nest, time is attributed to the innermost one.
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#define REGION_ENV_VARIABLE "PROFILER_REGIONS_FD"
+
+constexpr uint32_t region_magic = 0x52474e31;
+constexpr uint32_t region_version = 1;
+constexpr uint32_t region_max_threads = 64;        //rings are not recycled when threads exit
+constexpr uint32_t region_ring_capacity = 4096;    //power of two
+constexpr uint32_t region_max_names = 128;
+constexpr uint32_t region_name_length = 48;
+constexpr uint32_t region_overflow_id = region_max_names;
+
+enum RegionMarkerKind : uint32_t
+{
+    REGION_BEGIN = 0,
+    REGION_END = 1
+};
+
+struct RegionMarker
+{
+    uint64_t time_ns;       //CLOCK_MONOTONIC
+    uint32_t region;
+    uint32_t kind;
+};
+
+//single producer (the thread) / single consumer (the profiler)
+struct alignas(64) RegionThreadRing
+{
+    std::atomic<uint32_t> tid;
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> dropped;
+    alignas(64) std::atomic<uint64_t> tail;
+    alignas(64) RegionMarker markers[region_ring_capacity];
+};
+
+struct RegionShm
+{
+    uint32_t magic;
+    uint32_t version;
+    std::atomic<uint32_t> thread_count;
+    std::atomic<uint32_t> name_count;
+    std::atomic<uint32_t> name_ready[region_max_names];
+    char names[region_max_names][region_name_length];
+    RegionThreadRing threads[region_max_threads];
+};
+
+namespace region_detail
+{
+    inline RegionShm* attach()
+    {
+        const char* fd_text = getenv(REGION_ENV_VARIABLE);
+        if (!fd_text)
+        {
+            return nullptr;
+        }
+        void* base = mmap(nullptr, sizeof(RegionShm), PROT_READ | PROT_WRITE, MAP_SHARED, atoi(fd_text), 0);
+        if (base == MAP_FAILED)
+        {
+            return nullptr;
+        }
+        RegionShm* shm = static_cast<RegionShm*>(base);
+        if (shm->magic != region_magic || shm->version != region_version)
+        {
+            munmap(base, sizeof(RegionShm));
+            return nullptr;
+        }
+        return shm;
+    }
+
+    inline RegionShm* shm = attach();
+
+    struct ThreadState
+    {
+        static constexpr uint32_t cache_size = 16;
+
+        RegionThreadRing* ring = nullptr;
+        bool claimed = false;
+        const char* cached_names[cache_size] = {};
+        uint32_t cached_ids[cache_size] = {};
+    };
+
+    inline thread_local ThreadState thread_state;
+
+    inline RegionThreadRing* claim_ring()
+    {
+        uint32_t index = shm->thread_count.fetch_add(1, std::memory_order_relaxed);
+        if (index >= region_max_threads)
+        {
+            return nullptr;
+        }
+        RegionThreadRing* ring = &shm->threads[index];
+        ring->tid.store(static_cast<uint32_t>(syscall(SYS_gettid)), std::memory_order_release);
+        return ring;
+    }
+
+    inline uint32_t lookup_name(const char* name)
+    {
+        uint32_t count = std::min(shm->name_count.load(std::memory_order_acquire), region_max_names);
+        for (uint32_t id = 0; id < count; id++)
+        {
+            if (shm->name_ready[id].load(std::memory_order_acquire) && strncmp(shm->names[id], name, region_name_length - 1) == 0)
+            {
+                return id;
+            }
+        }
+
+        //two threads racing on a new name may both add it, the profiler merges by name
+        uint32_t id = shm->name_count.fetch_add(1, std::memory_order_relaxed);
+        if (id >= region_max_names)
+        {
+            return region_overflow_id;
+        }
+        strncpy(shm->names[id], name, region_name_length - 1);
+        shm->names[id][region_name_length - 1] = '\0';
+        shm->name_ready[id].store(1, std::memory_order_release);
+        return id;
+    }
+
+    //names are expected to be string literals, the cache is keyed by pointer
+    inline uint32_t intern(ThreadState& state, const char* name)
+    {
+        uint32_t slot = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(name) >> 3) % ThreadState::cache_size;
+        if (state.cached_names[slot] != name)
+        {
+            state.cached_ids[slot] = lookup_name(name);
+            state.cached_names[slot] = name;
+        }
+        return state.cached_ids[slot];
+    }
+
+    inline void push(ThreadState& state, uint32_t region, uint32_t kind)
+    {
+        if (!state.claimed)
+        {
+            state.ring = claim_ring();
+            state.claimed = true;
+        }
+        RegionThreadRing* ring = state.ring;
+        if (!ring)
+        {
+            return;
+        }
+
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        if (head - ring->tail.load(std::memory_order_acquire) >= region_ring_capacity)
+        {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        RegionMarker& marker = ring->markers[head & (region_ring_capacity - 1)];
+        marker.time_ns = static_cast<uint64_t>(now.tv_sec) * 1000000000ull + now.tv_nsec;
+        marker.region = region;
+        marker.kind = kind;
+        ring->head.store(head + 1, std::memory_order_release);
+    }
+}
+
+inline void region_begin(const char* name)
+{
+    if (__builtin_expect(region_detail::shm == nullptr, 1))
+    {
+        return;
+    }
+    region_detail::ThreadState& state = region_detail::thread_state;
+    region_detail::push(state, region_detail::intern(state, name), REGION_BEGIN);
+}
+
+inline void region_end()
+{
+    if (__builtin_expect(region_detail::shm == nullptr, 1))
+    {
+        return;
+    }
+    region_detail::push(region_detail::thread_state, 0, REGION_END);
+}
+
+class RegionScope
+{
+public:
+    explicit RegionScope(const char* name) { region_begin(name); }
+    ~RegionScope() { region_end(); }
+
+    RegionScope(const RegionScope&) = delete;
+    RegionScope& operator=(const RegionScope&) = delete;
+};
+
+#endif
@@ -0,0 +1,86 @@
+#include "adaptive_interval.h"
+
+#include <algorithm>
+#include <cmath>
+
+void AdaptiveInterval::reset(const AdaptiveSettings& settings, uint64_t initial_ms)
+{
+    settings_ = settings;
+    settings_.min_interval_ms = std::max(settings_.min_interval_ms, lowest_interval_ms);
+    settings_.max_interval_ms = std::max(settings_.max_interval_ms, settings_.min_interval_ms);
+    interval_ms_ = std::clamp(initial_ms, settings_.min_interval_ms, settings_.max_interval_ms);
+    steady_ticks_ = 0;
+    cost_us_ = 0.0;
+    change_ = 0.0;
+    observed_ = false;
+    rates_.fill(-1.0);
+}
+
+void AdaptiveInterval::observe(const ProfilingSnapshot& snapshot)
+{
+    if (!settings_.enabled || snapshot.duration_ms == 0)
+    {
+        return;
+    }
+
+    double change = 0.0;
+    for (const auto& metric : snapshot.metrics)
+    {
+        if (is_profiler_metric(metric.type) || is_gauge_metric(metric.type) || metric.coverage == 0.0)
+        {
+            continue;
+        }
+
+        double rate = static_cast<double>(metric.value) / snapshot.duration_ms;
+        double& average = rates_[static_cast<size_t>(metric.type)];
+        if (average < 0.0)
+        {
+            average = rate;
+            continue;
+        }
+        //deviations within counting noise (~sqrt of the expected count) are not changes,
+        //otherwise short intervals of low-rate counters always look bursty
+        double expected = average * snapshot.duration_ms;
+        double deviation = std::fabs(static_cast<double>(metric.value) - expected);
+        if (deviation > noise_sigmas * std::sqrt(expected) + 1.0)
+        {
+            change = std::max(change, deviation / (expected + 1.0));
+        }
+        average += smoothing * (rate - average);
+    }
+    change_ = change;
+    observed_ = true;
+}
+
+uint64_t AdaptiveInterval::update(uint64_t sample_cost_us)
+{
+    if (!observed_)
+    {
+        return interval_ms_;
+    }
+    observed_ = false;
+
+    cost_us_ = cost_us_ == 0.0 ? sample_cost_us : cost_us_ + smoothing * (sample_cost_us - cost_us_);
+
+    double change = change_;
+    uint64_t next = interval_ms_;
+    if (change > settings_.tighten_change)
+    {
+        next = interval_ms_ / 2;
+        steady_ticks_ = 0;
+    }
+    else if (change < settings_.relax_change && ++steady_ticks_ >= settings_.relax_ticks)
+    {
+        next = interval_ms_ + std::max<uint64_t>(interval_ms_ / 4, 1);
+        steady_ticks_ = 0;
+    }
+
+    //cost per sample / interval must stay under the budget
+    uint64_t floor_ms = settings_.min_interval_ms;
+    if (settings_.overhead_budget > 0.0)
+    {
+        floor_ms = std::max(floor_ms, static_cast<uint64_t>(std::ceil(cost_us_ / 1000.0 / settings_.overhead_budget)));
+    }
+    interval_ms_ = std::clamp(next, std::min(floor_ms, settings_.max_interval_ms), settings_.max_interval_ms);
+    return interval_ms_;
+}
@@ -0,0 +1,48 @@
+#ifndef ADAPTIVE_INTERVAL_H
+#define ADAPTIVE_INTERVAL_H
+
+#include <array>
+#include <cstdint>
+
+#include "profiling_snapshot.h"
+
+struct AdaptiveSettings
+{
+    bool enabled = false;
+    uint64_t min_interval_ms = 20;
+    uint64_t max_interval_ms = 2000;
+    double overhead_budget = 0.02;      //sampling cost per wall time
+    double tighten_change = 0.25;       //relative rate change that halves the interval
+    double relax_change = 0.05;         //below this for relax_ticks the interval grows
+    uint32_t relax_ticks = 3;
+};
+
+//picks the next sampling interval from how fast the metric rates move:
+//bursts halve it, steady phases stretch it by 25%, the profiler's own cost
+//per sample puts a floor under it so the overhead stays within budget
+class AdaptiveInterval
+{
+public:
+    static constexpr uint64_t lowest_interval_ms = 10;
+
+    void reset(const AdaptiveSettings& settings, uint64_t initial_ms);
+    //the rates of a snapshot, before it is handed over
+    void observe(const ProfilingSnapshot& snapshot);
+    //sample_cost_us - time spent collecting and delivering the observed snapshot
+    uint64_t update(uint64_t sample_cost_us);
+    uint64_t interval_ms() const { return interval_ms_; }
+
+private:
+    static constexpr double smoothing = 0.3;
+    static constexpr double noise_sigmas = 3.0;
+
+    AdaptiveSettings settings_;
+    uint64_t interval_ms_ = 100;
+    uint32_t steady_ticks_ = 0;
+    double cost_us_ = 0.0;              //EWMA of sample_cost_us
+    double change_ = 0.0;               //of the last observed snapshot
+    bool observed_ = false;
+    std::array<double, static_cast<size_t>(MetricType::COUNT)> rates_{};   //EWMA per ms, <0 - unset
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include "alloc_source.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+bool AllocSource::open(int pid, std::string& error)
+{
+    if (!shm_)
+    {
+        error = "no allocation buffer";
+        return false;
+    }
+    pid_ = pid;
+    //the target is usually gone by the time the stacks are written
+    comm_ = std::to_string(pid);
+    std::ifstream comm_file("/proc/" + comm_ + "/comm");
+    std::getline(comm_file, comm_);
+    seen_.assign(alloc_max_threads, SlotCounters());
+    stacks_.clear();
+    maps_.load(pid);
+    ticks_since_maps_ = 0;
+    return true;
+}
+
+void AllocSource::collect(ProfilingSnapshot& snapshot)
+{
+    SlotCounters delta;
+    uint32_t threads = std::min(shm_->thread_count.load(std::memory_order_acquire), alloc_max_threads);
+    for (uint32_t i = 0; i < threads; i++)
+    {
+        AllocThreadSlot& slot = shm_->threads[i];
+        SlotCounters& seen = seen_[i];
+        auto take = [](const std::atomic<uint64_t>& counter, uint64_t& last)
+        {
+            uint64_t value = counter.load(std::memory_order_relaxed);
+            uint64_t change = value - last;
+            last = value;
+            return change;
+        };
+        delta.allocs += take(slot.allocs, seen.allocs);
+        delta.alloc_bytes += take(slot.alloc_bytes, seen.alloc_bytes);
+        delta.frees += take(slot.frees, seen.frees);
+        delta.free_bytes += take(slot.free_bytes, seen.free_bytes);
+        delta.mmaps += take(slot.mmaps, seen.mmaps);
+        delta.mmap_bytes += take(slot.mmap_bytes, seen.mmap_bytes);
+        for (uint32_t c = 0; c < alloc_size_classes; c++)
+        {
+            delta.size_classes[c] += take(slot.size_classes[c], seen.size_classes[c]);
+        }
+        drain_samples(slot);
+    }
+
+    if (++ticks_since_maps_ >= maps_refresh_ticks)
+    {
+        maps_.load(pid_);
+        ticks_since_maps_ = 0;
+    }
+
+    for (auto [type, value] : {std::pair{MetricType::ALLOC_CALLS, delta.allocs}, {MetricType::ALLOC_BYTES, delta.alloc_bytes},
+                               {MetricType::FREE_CALLS, delta.frees}, {MetricType::FREE_BYTES, delta.free_bytes},
+                               {MetricType::MMAP_CALLS, delta.mmaps}, {MetricType::MMAP_BYTES, delta.mmap_bytes}})
+    {
+        snapshot.metrics.push_back({type, value, metric_name(type), metric_unit(type)});
+    }
+    snapshot.alloc_sizes.assign(delta.size_classes.begin(), delta.size_classes.end());
+}
+
+void AllocSource::close()
+{
+    if (seen_.empty())
+    {
+        return;
+    }
+    uint32_t threads = std::min(shm_->thread_count.load(std::memory_order_acquire), alloc_max_threads);
+    for (uint32_t i = 0; i < threads; i++)
+    {
+        drain_samples(shm_->threads[i]);
+    }
+    if (!options_.alloc_folded_path.empty())
+    {
+        write_folded(options_.alloc_folded_path);
+    }
+    seen_.clear();
+}
+
+void AllocSource::drain_samples(AllocThreadSlot& slot)
+{
+    double mean = static_cast<double>(shm_->sample_bytes);
+    uint64_t head = slot.head.load(std::memory_order_acquire);
+    uint64_t tail = slot.tail.load(std::memory_order_relaxed);
+    std::vector<uint64_t> frames;
+    for (; tail < head; tail++)
+    {
+        const AllocSample& sample = slot.samples[tail & (alloc_ring_capacity - 1)];
+        frames.assign(sample.frames, sample.frames + std::min(sample.depth, alloc_max_frames));
+
+        auto it = stacks_.find(frames);
+        if (it == stacks_.end())
+        {
+            if (stacks_.size() >= max_stacks)
+            {
+                frames.clear();     //folded into [overflow]
+            }
+            it = stacks_.emplace(frames, StackTotals()).first;
+        }
+        //unbiased weight of a byte-sampled allocation: size / P(sampled)
+        double size = static_cast<double>(sample.size);
+        it->second.bytes += mean > 0.0 ? size / (1.0 - std::exp(-size / mean)) : size;
+        it->second.samples++;
+    }
+    slot.tail.store(tail, std::memory_order_release);
+}
+
+bool AllocSource::write_folded(const std::string& path) const
+{
+    std::ofstream out(path);
+    if (!out.is_open())
+    {
+        return false;
+    }
+
+    uint64_t dropped = 0;
+    for (uint32_t i = 0; i < std::min(shm_->thread_count.load(), alloc_max_threads); i++)
+    {
+        dropped += shm_->threads[i].dropped.load(std::memory_order_relaxed);
+    }
+
+    for (const auto& [frames, totals] : stacks_)
+    {
+        std::string line = comm_;
+        if (frames.empty())
+        {
+            line += ";[overflow]";
+        }
+        for (auto it = frames.rbegin(); it != frames.rend(); ++it)
+        {
+            //return addresses point after the call
+            line += ";" + maps_.format_address(*it - 1);
+        }
+        out << line << ' ' << static_cast<uint64_t>(totals.bytes) << '\n';
+    }
+    if (dropped)
+    {
+        out << comm_ << ";[dropped " << dropped << " samples] 1\n";
+    }
+    return true;
+}
@@ -0,0 +1,61 @@
+#ifndef ALLOC_SOURCE_H
+#define ALLOC_SOURCE_H
+
+#include <array>
+#include <map>
+#include <vector>
+
+#include "metric_source.h"
+#include "proc_maps.h"
+#include "../markers/alloc_shm.h"
+
+//allocation rates and size classes from the preloaded allocation shim, plus
+//byte-sampled allocation stacks written as folded stacks when profiling stops
+class AllocSource : public MetricSource
+{
+public:
+    AllocSource(AllocShm* shm, const SourceOptions& options): shm_(shm), options_(options) {}
+
+    const char* name() const override { return "allocs"; }
+    bool open(int pid, std::string& error) override;
+    void collect(ProfilingSnapshot& snapshot) override;
+    void close() override;
+
+    //"comm;outer;...;leaf <estimated bytes>" lines
+    bool write_folded(const std::string& path) const;
+
+private:
+    static constexpr size_t max_stacks = 4096;
+    static constexpr uint32_t maps_refresh_ticks = 50;
+
+    struct SlotCounters
+    {
+        uint64_t allocs = 0;
+        uint64_t alloc_bytes = 0;
+        uint64_t frees = 0;
+        uint64_t free_bytes = 0;
+        uint64_t mmaps = 0;
+        uint64_t mmap_bytes = 0;
+        std::array<uint64_t, alloc_size_classes> size_classes{};
+    };
+
+    struct StackTotals
+    {
+        double bytes = 0.0;     //estimated bytes allocated, not just the sampled ones
+        uint64_t samples = 0;
+    };
+
+    AllocShm* shm_;
+    SourceOptions options_;
+    int pid_ = -1;
+    std::string comm_;
+    ProcMaps maps_;
+    uint32_t ticks_since_maps_ = 0;
+
+    std::vector<SlotCounters> seen_;
+    std::map<std::vector<uint64_t>, StackTotals> stacks_;
+
+    void drain_samples(AllocThreadSlot& slot);
+};
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef APPEND_LOG_H
+#define APPEND_LOG_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+//single-writer log of fixed-capacity chunks: an item is written once, before
+//the length that covers it is published, and never moved; readers take views
+//without locks, a view keeps the chunks it covers alive after the writer drops them
+template <typename T, size_t ChunkSize = 256>
+class AppendLog
+{
+    static_assert(ChunkSize > 0, "chunks can't be empty");
+
+    using Chunk = std::vector<T>;       //capacity reserved up front, never reallocated
+
+    struct Directory
+    {
+        uint64_t first = 0;             //index of the first item of chunks[0]
+        std::vector<std::shared_ptr<Chunk>> chunks;
+    };
+
+public:
+    class View
+    {
+    public:
+        View() = default;
+
+        size_t size() const { return static_cast<size_t>(end_ - begin_); }
+        bool empty() const { return begin_ == end_; }
+        const T& operator[](size_t i) const
+        {
+            uint64_t index = begin_ + i - directory_->first;
+            return (*directory_->chunks[index / ChunkSize])[index % ChunkSize];
+        }
+        const T& front() const { return (*this)[0]; }
+        const T& back() const { return (*this)[size() - 1]; }
+
+    private:
+        friend class AppendLog;
+        std::shared_ptr<const Directory> directory_;
+        uint64_t begin_ = 0;
+        uint64_t end_ = 0;
+    };
+
+    AppendLog(): directory_(std::make_shared<const Directory>()) {}
+
+    AppendLog(const AppendLog&) = delete;
+    AppendLog& operator=(const AppendLog&) = delete;
+
+    //any thread: the items published when it was taken
+    View view() const
+    {
+        View view;
+        //the directory is published before the length that needs it, and trimmed
+        //only behind a begin that is published first
+        view.end_ = end_.load(std::memory_order_acquire);
+        view.directory_ = std::atomic_load(&directory_);
+        view.begin_ = std::min(begin_.load(std::memory_order_acquire), view.end_);
+        return view;
+    }
+
+    //writer only from here on
+    size_t size() const { return static_cast<size_t>(end_.load(std::memory_order_relaxed) - begin_.load(std::memory_order_relaxed)); }
+    bool empty() const { return size() == 0; }
+    const T& front() const { return at(begin_.load(std::memory_order_relaxed)); }
+    const T& back() const { return at(end_.load(std::memory_order_relaxed) - 1); }
+
+    void push_back(T item)
+    {
+        uint64_t end = end_.load(std::memory_order_relaxed);
+        size_t chunk = static_cast<size_t>((end - directory_->first) / ChunkSize);
+        if (chunk == directory_->chunks.size())
+        {
+            auto next = std::make_shared<Directory>(*directory_);
+            next->chunks.push_back(std::make_shared<Chunk>());
+            next->chunks.back()->reserve(ChunkSize);
+            std::atomic_store(&directory_, std::shared_ptr<const Directory>(std::move(next)));
+        }
+        directory_->chunks[chunk]->push_back(std::move(item));
+        end_.store(end + 1, std::memory_order_release);
+    }
+
+    void pop_front(size_t count = 1)
+    {
+        uint64_t end = end_.load(std::memory_order_relaxed);
+        uint64_t begin = std::min(begin_.load(std::memory_order_relaxed) + count, end);
+        begin_.store(begin, std::memory_order_release);
+
+        size_t dead = static_cast<size_t>((begin - directory_->first) / ChunkSize);
+        if (dead > 0)
+        {
+            auto next = std::make_shared<Directory>();
+            next->first = directory_->first + dead * ChunkSize;
+            next->chunks.assign(directory_->chunks.begin() + dead, directory_->chunks.end());
+            std::atomic_store(&directory_, std::shared_ptr<const Directory>(std::move(next)));
+        }
+    }
+
+    void clear() { pop_front(size()); }
+
+private:
+    std::shared_ptr<const Directory> directory_;    //atomic_load/atomic_store only
+    std::atomic<uint64_t> begin_{0};
+    std::atomic<uint64_t> end_{0};
+
+    const T& at(uint64_t index) const
+    {
+        index -= directory_->first;
+        return (*directory_->chunks[index / ChunkSize])[index % ChunkSize];
+    }
+};
+
+#endif
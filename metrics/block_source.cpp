@@ -0,0 +1,295 @@
+#include "block_source.h"
+
+#include <unistd.h>
+
+#include <fstream>
+
+#include "procfs_reader.h"
+
+//system-wide, but block requests are far rarer than syscalls
+static constexpr size_t block_ring_pages = 64;
+
+std::string block_device_name(uint32_t dev)
+{
+    //kernel dev_t: 12 bits of major, 20 of minor
+    std::string id = std::to_string(dev >> 20) + ":" + std::to_string(dev & ((1u << 20) - 1));
+    ProcfsFile uevent;
+    char buffer[512];
+    ssize_t length = uevent.open("/sys/dev/block/" + id + "/uevent") ? uevent.read(buffer, sizeof(buffer)) : -1;
+    if (length <= 0)
+    {
+        return id;
+    }
+
+    const char* name = strstr(buffer, "DEVNAME=");
+    if (!name)
+    {
+        return id;
+    }
+    name += 8;
+    const char* end = strchr(name, '\n');
+    return std::string(name, end ? end - name : strlen(name));
+}
+
+void BlockSource::DeviceStats::add(const DeviceStats& other)
+{
+    errors += other.errors;
+    bytes += other.bytes;
+    latency.add(other.latency);
+}
+
+BlockSource::BlockSource(const SourceOptions& options): options_(options)
+{
+}
+
+bool BlockSource::open(int pid, std::string& error)
+{
+    (void)pid;
+
+    Tracepoint issue, complete;
+    if (!issue.load("block", "block_rq_issue", error) || !complete.load("block", "block_rq_complete", error)
+        || !issue.find("dev", issue_dev_, error) || !issue.find("sector", issue_sector_, error) || !issue.find("bytes", issue_bytes_, error)
+        || !complete.find("dev", complete_dev_, error) || !complete.find("sector", complete_sector_, error)
+        || !complete.find("error", complete_error_, error))
+    {
+        return false;
+    }
+    issue_id_ = issue.id;
+
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_TRACEPOINT;
+    attr.config = issue.id;
+    attr.sample_period = 1;
+    attr.sample_type = PERF_SAMPLE_TIME | PERF_SAMPLE_RAW;
+    attr.watermark = 1;
+    attr.wakeup_watermark = static_cast<uint32_t>(block_ring_pages * sysconf(_SC_PAGESIZE) / 4);
+
+    if (!sampler_.open(-1, attr, block_ring_pages, error))
+    {
+        return false;
+    }
+    attr.config = complete.id;
+    if (!sampler_.add_event(attr, error))
+    {
+        sampler_.close();
+        return false;
+    }
+
+    devices_.clear();
+    devices_.reserve(max_devices);
+    devices_.resize(1);
+    devices_[0].name = "[other]";
+    device_index_.clear();
+    pending_.clear();
+    pending_.reserve(1024);
+    events_.clear();
+    events_.reserve(1 << 14);
+    lost_records_ = 0;
+
+    sampler_.enable();
+    reader_.start(sampler_, [this]
+    {
+        drain();
+        process_events();
+    });
+    return true;
+}
+
+void BlockSource::collect(ProfilingSnapshot& snapshot)
+{
+    std::lock_guard<std::mutex> lock(reader_.mutex());
+    drain();
+    process_events();
+
+    uint64_t requests = 0;
+    uint64_t time_ns = 0;
+    for (auto& device : devices_)
+    {
+        const LogHistogram& latency = device.interval.latency;
+        if (latency.count == 0)
+        {
+            continue;
+        }
+        requests += latency.count;
+        time_ns += latency.sum_ns;
+
+        DeviceSample sample;
+        sample.name = device.name;
+        sample.requests = latency.count;
+        sample.bytes = device.interval.bytes;
+        sample.p50_ns = latency.percentile_ns(0.5);
+        sample.p99_ns = latency.percentile_ns(0.99);
+        snapshot.devices.push_back(sample);
+
+        device.total.add(device.interval);
+        device.interval = DeviceStats();
+    }
+
+    snapshot.metrics.push_back({MetricType::BLOCK_REQUESTS, requests, metric_name(MetricType::BLOCK_REQUESTS), metric_unit(MetricType::BLOCK_REQUESTS)});
+    snapshot.metrics.push_back({MetricType::BLOCK_TIME, time_ns, metric_name(MetricType::BLOCK_TIME), metric_unit(MetricType::BLOCK_TIME)});
+}
+
+void BlockSource::close()
+{
+    if (!sampler_.is_open())
+    {
+        return;
+    }
+
+    reader_.stop();
+    sampler_.disable();
+    drain();
+    process_events();
+    sampler_.close();
+    for (auto& device : devices_)
+    {
+        device.total.add(device.interval);
+        device.interval = DeviceStats();
+    }
+
+    if (!options_.block_table_path.empty())
+    {
+        write_table(options_.block_table_path);
+    }
+}
+
+void BlockSource::drain()
+{
+    sampler_.drain([this](const perf_event_header* record)
+    {
+        const char* body = reinterpret_cast<const char*>(record + 1);
+        const char* end = reinterpret_cast<const char*>(record) + record->size;
+
+        if (record->type == PERF_RECORD_SAMPLE && body + 12 <= end)
+        {
+            //time, raw size, raw data
+            uint32_t raw_size = *reinterpret_cast<const uint32_t*>(body + 8);
+            const char* raw = body + 12;
+            if (raw + raw_size > end || raw_size < 2)
+            {
+                return;
+            }
+
+            BlockEvent event;
+            event.time = *reinterpret_cast<const uint64_t*>(body);
+            //common_type tells the two tracepoints apart, both share the ring
+            uint16_t type = *reinterpret_cast<const uint16_t*>(raw);
+            event.complete = type != issue_id_;
+            const TracepointField& dev = event.complete ? complete_dev_ : issue_dev_;
+            const TracepointField& sector = event.complete ? complete_sector_ : issue_sector_;
+            const TracepointField& extra = event.complete ? complete_error_ : issue_bytes_;
+            if (dev.offset + dev.size > raw_size || sector.offset + sector.size > raw_size || extra.offset + extra.size > raw_size)
+            {
+                return;
+            }
+            event.dev = static_cast<uint32_t>(read_tracepoint_field(raw, dev));
+            event.sector = static_cast<uint64_t>(read_tracepoint_field(raw, sector));
+            event.bytes = event.complete ? 0 : static_cast<uint32_t>(read_tracepoint_field(raw, extra));
+            event.error = event.complete ? static_cast<int32_t>(read_tracepoint_field(raw, extra)) : 0;
+            events_.push_back(event);
+        }
+        else if (record->type == PERF_RECORD_LOST && body + 16 <= end)
+        {
+            lost_records_ += *reinterpret_cast<const uint64_t*>(body + 8);
+        }
+    });
+}
+
+void BlockSource::process_events()
+{
+    //a request completes on whichever CPU takes the interrupt
+    sort_by_time(events_);
+
+    for (const auto& event : events_)
+    {
+        uint64_t key = request_key(event.dev, event.sector);
+        if (!event.complete)
+        {
+            //a requeued request is issued again, the latest issue wins
+            if (pending_.size() >= max_pending && !pending_.count(key))
+            {
+                //lost completions, and requests merged or requeued under another sector
+                sweep_pending(event.time);
+            }
+            if (pending_.size() < max_pending || pending_.count(key))
+            {
+                pending_[key] = {event.time, event.bytes};
+            }
+            continue;
+        }
+
+        //issued before tracing started, or a flush without a sector
+        auto it = pending_.find(key);
+        if (it == pending_.end() || it->second.issue_time > event.time)
+        {
+            continue;
+        }
+        DeviceStats& stats = devices_[device_slot(event.dev)].interval;
+        stats.latency.record(event.time - it->second.issue_time);
+        stats.bytes += it->second.bytes;
+        if (event.error)
+        {
+            stats.errors++;
+        }
+        pending_.erase(it);
+    }
+    events_.clear();
+}
+
+void BlockSource::sweep_pending(uint64_t now)
+{
+    for (auto it = pending_.begin(); it != pending_.end();)
+    {
+        it = it->second.issue_time + stale_pending_ns < now ? pending_.erase(it) : std::next(it);
+    }
+}
+
+uint32_t BlockSource::device_slot(uint32_t dev)
+{
+    auto it = device_index_.find(dev);
+    if (it != device_index_.end())
+    {
+        return it->second;
+    }
+    if (devices_.size() >= max_devices)
+    {
+        return 0;
+    }
+
+    DeviceEntry entry;
+    entry.dev = dev;
+    entry.name = block_device_name(dev);
+    devices_.push_back(entry);
+    uint32_t index = static_cast<uint32_t>(devices_.size() - 1);
+    device_index_.emplace(dev, index);
+    return index;
+}
+
+bool BlockSource::write_table(const std::string& path) const
+{
+    std::ofstream out(path);
+    if (!out.is_open())
+    {
+        return false;
+    }
+
+    out << "# device requests errors bytes total_ns p50_ns p99_ns max_ns latency buckets (<ns:count)\n";
+    for (const auto& device : devices_)
+    {
+        const LogHistogram& latency = device.total.latency;
+        if (latency.count == 0)
+        {
+            continue;
+        }
+        out << device.name << ' ' << latency.count << ' ' << device.total.errors << ' ' << device.total.bytes << ' ' << latency.sum_ns
+            << ' ' << latency.percentile_ns(0.5) << ' ' << latency.percentile_ns(0.99) << ' ' << latency.max_ns;
+        latency.write_buckets(out);
+        out << '\n';
+    }
+    if (lost_records_)
+    {
+        out << "# lost " << lost_records_ << " records\n";
+    }
+    return true;
+}
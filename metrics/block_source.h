@@ -0,0 +1,98 @@
+#ifndef BLOCK_SOURCE_H
+#define BLOCK_SOURCE_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "latency_histogram.h"
+#include "metric_source.h"
+#include "perf_ring.h"
+#include "tracepoint.h"
+#include "tracepoint_reader.h"
+
+//per-device block request latency from block:block_rq_issue to block:block_rq_complete.
+//Requests are issued by writeback and completed in interrupts, not by the target,
+//so the tracepoints are opened system-wide: the latencies are of the devices the
+//target shares with everything else, its own share is in the io_* metrics
+class BlockSource : public MetricSource
+{
+public:
+    explicit BlockSource(const SourceOptions& options);
+
+    const char* name() const override { return "block"; }
+    bool open(int pid, std::string& error) override;
+    void collect(ProfilingSnapshot& snapshot) override;
+    void close() override;
+
+    //whole-run table, one device per line with its latency histogram
+    bool write_table(const std::string& path) const;
+
+private:
+    static constexpr size_t max_devices = 64;           //devices past it share entry 0
+    static constexpr size_t max_pending = 65536;
+    static constexpr uint64_t stale_pending_ns = 10000000000ull;    //swept once the table is full
+
+    struct DeviceStats
+    {
+        uint64_t errors = 0;
+        uint64_t bytes = 0;
+        LogHistogram latency;       //its count is the requests
+
+        void add(const DeviceStats& other);
+    };
+
+    struct DeviceEntry
+    {
+        uint32_t dev = 0;
+        std::string name;
+        DeviceStats interval;
+        DeviceStats total;
+    };
+
+    struct BlockEvent
+    {
+        uint64_t time;
+        uint64_t sector;
+        uint32_t dev;
+        uint32_t bytes;
+        int32_t error;
+        bool complete;
+    };
+
+    struct PendingRequest
+    {
+        uint64_t issue_time;
+        uint32_t bytes;
+    };
+
+    SourceOptions options_;
+    PerCpuSampler sampler_;
+    uint32_t issue_id_ = 0;
+    TracepointField issue_dev_;
+    TracepointField issue_sector_;
+    TracepointField issue_bytes_;
+    TracepointField complete_dev_;
+    TracepointField complete_sector_;
+    TracepointField complete_error_;
+
+    //bounded: a slot per device, reused every tick
+    std::vector<DeviceEntry> devices_;
+    std::unordered_map<uint32_t, uint32_t> device_index_;
+    std::unordered_map<uint64_t, PendingRequest> pending_;
+    std::vector<BlockEvent> events_;
+    uint64_t lost_records_ = 0;
+
+    TracepointReader reader_;       //everything above is shared with it
+
+    void drain();
+    void process_events();
+    void sweep_pending(uint64_t now);
+    uint32_t device_slot(uint32_t dev);
+    static uint64_t request_key(uint32_t dev, uint64_t sector) { return (sector * 0x9e3779b97f4a7c15ull) ^ dev; }
+};
+
+//"vda" from /sys/dev/block/<major>:<minor>/uevent, "major:minor" if it has no name
+std::string block_device_name(uint32_t dev);
+
+#endif
@@ -0,0 +1,280 @@
+#include "counter_scheduler.h"
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+#include "../counters/perf_event.h"
+
+bool is_hardware_metric(MetricType type)
+{
+    return type >= MetricType::INSTRUCTIONS && type <= MetricType::BRANCH_MISSES;
+}
+
+bool perf_event_of(MetricType type, PerfEvent& event)
+{
+    switch (type)
+    {
+        case MetricType::INSTRUCTIONS:
+            event = PerfEvent::INSTRUCTIONS;
+            return true;
+        case MetricType::CPU_CYCLES:
+            event = PerfEvent::CPU_CYCLES;
+            return true;
+        case MetricType::CACHE_MISSES:
+            event = PerfEvent::CACHE_MISSES;
+            return true;
+        case MetricType::CACHE_REFERENCES:
+            event = PerfEvent::CACHE_REFERENCES;
+            return true;
+        case MetricType::BRANCH_MISSES:
+            event = PerfEvent::BRANCH_MISSES;
+            return true;
+        case MetricType::PAGE_FAULTS:
+            event = PerfEvent::PAGE_FAULTS;
+            return true;
+        case MetricType::CONTEXT_SWITCHES:
+            event = PerfEvent::CONTEXT_SWITCHES;
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool CounterScheduler::open(int pid, const std::vector<MetricType>& metrics, std::string& error)
+{
+    close();
+
+    std::vector<MetricType> hardware;
+    std::vector<MetricType> software;
+    for (auto type : metrics)
+    {
+        if (!is_perf_metric(type))
+        {
+            continue;
+        }
+        auto& list = is_hardware_metric(type) ? hardware : software;
+        if (std::find(list.begin(), list.end(), type) == list.end())
+        {
+            list.push_back(type);
+        }
+    }
+
+    //software events do not take PMU counters, they are always counting
+    if (!software.empty())
+    {
+        Group group;
+        int error_code = 0;
+        if (!open_group(pid, software, false, group, error_code))
+        {
+            error = "failed to open software perf events: " + std::string(strerror(error_code));
+            close();
+            return false;
+        }
+        groups_.push_back(std::move(group));
+    }
+
+    //first fit, shrinking a group when the kernel says it can never be scheduled
+    size_t per_group = std::max<uint32_t>(settings_.counters_per_group, 1);
+    size_t next = 0;
+    while (next < hardware.size())
+    {
+        size_t size = std::min(per_group, hardware.size() - next);
+        Group group;
+        int error_code = 0;
+        while (!open_group(pid, std::vector<MetricType>(hardware.begin() + next, hardware.begin() + next + size), true, group, error_code))
+        {
+            if (size == 1 || (error_code != EINVAL && error_code != ENOSPC))
+            {
+                error = std::string("failed to open perf event ") + metric_name(hardware[next]) + ": " + strerror(error_code);
+                close();
+                return false;
+            }
+            size--;
+        }
+        next += size;
+        rotating_.push_back(groups_.size());
+        groups_.push_back(std::move(group));
+    }
+
+    size_t max_events = 0;
+    for (const auto& group : groups_)
+    {
+        max_events = std::max(max_events, group.events.size());
+    }
+    read_buffer_.assign(3 + max_events, 0);
+
+    for (const auto& group : groups_)
+    {
+        if (!group.hardware)
+        {
+            set_group_enabled(group, true);
+        }
+    }
+    active_ = 0;
+    if (!rotating_.empty())
+    {
+        set_group_enabled(groups_[rotating_[active_]], true);
+    }
+    return true;
+}
+
+void CounterScheduler::close()
+{
+    for (auto& group : groups_)
+    {
+        for (auto& event : group.events)
+        {
+            if (event.fd >= 0)
+            {
+                ::close(event.fd);
+            }
+        }
+    }
+    groups_.clear();
+    rotating_.clear();
+    active_ = 0;
+}
+
+bool CounterScheduler::open_group(int pid, const std::vector<MetricType>& types, bool hardware, Group& group, int& error_code)
+{
+    group = Group();
+    group.hardware = hardware;
+    int leader = -1;
+    for (auto type : types)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        PerfEvent perf_event;
+        perf_event_of(type, perf_event);
+        describe_perf_event(perf_event, attr);
+        attr.disabled = leader < 0 ? 1 : 0;     //members follow the leader
+        attr.exclude_hv = 1;
+        attr.inherit = settings_.inherit ? 1 : 0;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        int fd = static_cast<int>(sys_perf_event_open(&attr, pid, -1, leader, PERF_FLAG_FD_CLOEXEC));
+        if (fd < 0)
+        {
+            error_code = errno;
+            for (auto& event : group.events)
+            {
+                ::close(event.fd);
+            }
+            group.events.clear();
+            return false;
+        }
+        if (leader < 0)
+        {
+            leader = fd;
+        }
+        Event event;
+        event.type = type;
+        event.fd = fd;
+        group.events.push_back(event);
+    }
+    return !group.events.empty();
+}
+
+void CounterScheduler::set_group_enabled(const Group& group, bool enabled)
+{
+    ioctl(group.events.front().fd, enabled ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+}
+
+bool CounterScheduler::read_group(Group& group, uint64_t& enabled_delta, uint64_t& running_delta)
+{
+    //nr, time_enabled, time_running, values[nr]
+    size_t size = (3 + group.events.size()) * sizeof(uint64_t);
+    if (::read(group.events.front().fd, read_buffer_.data(), size) != static_cast<ssize_t>(size) || read_buffer_[0] != group.events.size())
+    {
+        enabled_delta = 0;
+        running_delta = 0;
+        return false;
+    }
+
+    enabled_delta = read_buffer_[1] - group.last_enabled;
+    running_delta = read_buffer_[2] - group.last_running;
+    group.last_enabled = read_buffer_[1];
+    group.last_running = read_buffer_[2];
+    return true;
+}
+
+double CounterScheduler::relative_spread(const Event& event)
+{
+    if (event.observations < 2 || event.rate_mean <= 0.0)
+    {
+        return 1.0;
+    }
+    return std::sqrt(event.rate_m2 / (event.observations - 1)) / event.rate_mean;
+}
+
+void CounterScheduler::read(std::vector<MetricValue>& out)
+{
+    //on-CPU time of the task over the tick, taken from the groups that counted it
+    uint64_t tick_ns = 0;
+    for (size_t g = 0; g < groups_.size(); g++)
+    {
+        Group& group = groups_[g];
+        group.counted = !group.hardware || g == rotating_[active_];
+        if (group.counted && read_group(group, group.tick_enabled, group.tick_running))
+        {
+            for (size_t i = 0; i < group.events.size(); i++)
+            {
+                group.events[i].tick_raw = read_buffer_[3 + i] - group.events[i].last_raw;
+                group.events[i].last_raw = read_buffer_[3 + i];
+            }
+            tick_ns = std::max(tick_ns, group.tick_enabled);
+        }
+        else
+        {
+            group.counted = false;
+        }
+    }
+
+    for (auto& group : groups_)
+    {
+        for (auto& event : group.events)
+        {
+            MetricValue metric{event.type, 0, metric_name(event.type), metric_unit(event.type)};
+            if (group.counted)
+            {
+                metric.coverage = group.tick_enabled ? static_cast<double>(group.tick_running) / group.tick_enabled : 1.0;
+                if (group.tick_running > 0)
+                {
+                    metric.value = static_cast<uint64_t>(std::llround(static_cast<double>(event.tick_raw) * group.tick_enabled / group.tick_running));
+                    add_observation(event, static_cast<double>(event.tick_raw) / group.tick_running);
+                }
+                metric.error = metric.coverage < 1.0 ? relative_spread(event) * (1.0 - metric.coverage) : 0.0;
+            }
+            else
+            {
+                //not on the PMU this tick: extrapolate the last observed rate
+                metric.value = static_cast<uint64_t>(std::llround(event.last_rate * tick_ns));
+                metric.coverage = 0.0;
+                metric.error = relative_spread(event);
+            }
+            out.push_back(metric);
+        }
+    }
+
+    if (rotating_.size() > 1)
+    {
+        set_group_enabled(groups_[rotating_[active_]], false);
+        active_ = (active_ + 1) % rotating_.size();
+        set_group_enabled(groups_[rotating_[active_]], true);
+    }
+}
+
+void CounterScheduler::add_observation(Event& event, double rate)
+{
+    event.last_rate = rate;
+    event.observations++;
+    double delta = rate - event.rate_mean;
+    event.rate_mean += delta / event.observations;
+    event.rate_m2 += delta * (rate - event.rate_mean);
+}
@@ -0,0 +1,90 @@
+#ifndef COUNTER_SCHEDULER_H
+#define COUNTER_SCHEDULER_H
+
+#include <linux/perf_event.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "profiling_snapshot.h"
+#include "../counters/perf_event.h"
+
+struct CounterSettings
+{
+    uint32_t counters_per_group = 4;    //general purpose PMU counters assumed free for one group
+    bool inherit = false;               //also count every task the target spawns
+    uint32_t kernel_timed_batch = 0;    //>0: the kernel samples the counters, the collector wakes every that many samples
+};
+
+//packs the requested perf events into groups that fit the PMU and rotates the
+//hardware groups explicitly, one group per tick, instead of leaving it to the
+//kernel; every value is scaled to the task's on-CPU time of the tick and
+//carries its coverage and an estimated relative error
+class CounterScheduler
+{
+public:
+    CounterScheduler() = default;
+    explicit CounterScheduler(const CounterSettings& settings): settings_(settings) {}
+    ~CounterScheduler() { close(); }
+
+    CounterScheduler(const CounterScheduler&) = delete;
+    CounterScheduler& operator=(const CounterScheduler&) = delete;
+
+    void set_settings(const CounterSettings& settings) { settings_ = settings; }
+    const CounterSettings& settings() const { return settings_; }
+
+    //opens every perf metric in metrics, others are ignored
+    bool open(int pid, const std::vector<MetricType>& metrics, std::string& error);
+    void close();
+    bool empty() const { return groups_.empty(); }
+
+    size_t group_count() const { return groups_.size(); }
+    size_t rotating_group_count() const { return rotating_.size(); }
+
+    //reads the counters of the tick that just ended, appends one value per
+    //event and switches to the next hardware group
+    void read(std::vector<MetricValue>& out);
+
+private:
+    struct Event
+    {
+        MetricType type;
+        int fd = -1;
+        uint64_t last_raw = 0;
+        uint64_t tick_raw = 0;
+        //observed rate in events per on-CPU ns, Welford over the observed ticks
+        uint64_t observations = 0;
+        double last_rate = 0.0;
+        double rate_mean = 0.0;
+        double rate_m2 = 0.0;
+    };
+
+    struct Group
+    {
+        std::vector<Event> events;
+        bool hardware = false;
+        uint64_t last_enabled = 0;
+        uint64_t last_running = 0;
+        bool counted = false;           //on the PMU during the last tick
+        uint64_t tick_enabled = 0;
+        uint64_t tick_running = 0;
+    };
+
+    CounterSettings settings_;
+    std::vector<Group> groups_;
+    std::vector<size_t> rotating_;      //hardware groups taking turns on the PMU
+    size_t active_ = 0;                 //index into rotating_
+    std::vector<uint64_t> read_buffer_;
+
+    bool open_group(int pid, const std::vector<MetricType>& types, bool hardware, Group& group, int& error_code);
+    bool read_group(Group& group, uint64_t& enabled_delta, uint64_t& running_delta);
+    void set_group_enabled(const Group& group, bool enabled);
+    static void add_observation(Event& event, double rate);
+    static double relative_spread(const Event& event);
+};
+
+bool is_hardware_metric(MetricType type);
+bool perf_event_of(MetricType type, PerfEvent& event);
+
+#endif
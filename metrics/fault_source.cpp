@@ -0,0 +1,236 @@
+#include "fault_source.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+static constexpr size_t fault_ring_pages = 64;
+
+FaultSource::FaultSource(const SourceOptions& options): options_(options)
+{
+}
+
+bool FaultSource::open(int pid, std::string& error)
+{
+    pid_ = pid;
+
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_PAGE_FAULTS;
+    attr.sample_period = std::max<uint64_t>(options_.fault_sample_period, 1);
+    attr.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_ADDR;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.wakeup_events = 1;
+
+    if (!sampler_.open(pid, attr, fault_ring_pages, error))
+    {
+        return false;
+    }
+
+    mappings_.clear();
+    mapping_index_.clear();
+    unmapped_ = FaultMapping();
+    unmapped_.mapping.path = "[unmapped]";
+    lost_records_ = 0;
+    maps_.load(pid);
+
+    sampler_.enable();
+    return true;
+}
+
+void FaultSource::collect(ProfilingSnapshot& snapshot)
+{
+    drain();
+    uint64_t sampled = process_samples();
+    snapshot.metrics.push_back({MetricType::FAULT_SAMPLES, sampled, metric_name(MetricType::FAULT_SAMPLES), metric_unit(MetricType::FAULT_SAMPLES)});
+}
+
+void FaultSource::close()
+{
+    if (!sampler_.is_open())
+    {
+        return;
+    }
+
+    sampler_.disable();
+    drain();
+    process_samples();
+    sampler_.close();
+
+    if (!options_.fault_heatmap_path.empty())
+    {
+        write_heatmap(options_.fault_heatmap_path);
+    }
+}
+
+void FaultSource::drain()
+{
+    sampler_.drain([this](const perf_event_header* record)
+    {
+        const char* body = reinterpret_cast<const char*>(record + 1);
+        const char* end = reinterpret_cast<const char*>(record) + record->size;
+
+        if (record->type == PERF_RECORD_SAMPLE && body + 24 <= end)
+        {
+            //ip, pid, tid, addr
+            FaultSample sample;
+            sample.ip = *reinterpret_cast<const uint64_t*>(body);
+            sample.address = *reinterpret_cast<const uint64_t*>(body + 16);
+            samples_.push_back(sample);
+        }
+        else if (record->type == PERF_RECORD_LOST && body + 16 <= end)
+        {
+            lost_records_ += *reinterpret_cast<const uint64_t*>(body + 8);
+        }
+    });
+}
+
+uint64_t FaultSource::process_samples()
+{
+    uint64_t sampled = samples_.size();
+    misses_.clear();
+    for (const auto& sample : samples_)
+    {
+        if (!account(sample))
+        {
+            misses_.push_back(sample);
+        }
+    }
+    samples_.clear();
+
+    //new mappings since the last read: reread maps once per tick, not per fault
+    if (!misses_.empty())
+    {
+        maps_.load(pid_);
+        for (const auto& sample : misses_)
+        {
+            if (!account(sample))
+            {
+                add(unmapped_, sample.address / range_bytes, sample.ip);
+            }
+        }
+    }
+    return sampled;
+}
+
+bool FaultSource::account(const FaultSample& sample)
+{
+    const MemoryMapping* mapping = maps_.find(sample.address);
+    if (!mapping)
+    {
+        return false;
+    }
+
+    FaultMapping* entry = find_entry(*mapping);
+    if (!entry)
+    {
+        if (mappings_.size() >= max_mappings)
+        {
+            add(unmapped_, sample.address / range_bytes, sample.ip);
+            return true;
+        }
+        //another file or inode at a reused start gets its own entry, the old one keeps its faults
+        mappings_.emplace_back();
+        mappings_.back().mapping = *mapping;
+        mapping_index_.emplace(mapping->start, mappings_.size() - 1);
+        entry = &mappings_.back();
+    }
+
+    add(*entry, (sample.address - mapping->start) / range_bytes, sample.ip);
+    return true;
+}
+
+FaultSource::FaultMapping* FaultSource::find_entry(const MemoryMapping& mapping)
+{
+    auto range = mapping_index_.equal_range(mapping.start);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        FaultMapping& entry = mappings_[it->second];
+        if (entry.mapping.path == mapping.path && entry.mapping.inode == mapping.inode)
+        {
+            //[heap] and anonymous mappings grow in place, one row keeps all their faults
+            entry.mapping.end = std::max(entry.mapping.end, mapping.end);
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+void FaultSource::add(FaultMapping& entry, uint64_t range, uint64_t ip)
+{
+    entry.faults++;
+    entry.ranges[range]++;
+    if (options_.fault_ips)
+    {
+        auto it = entry.ips.find(ip);
+        if (it != entry.ips.end())
+        {
+            it->second++;
+        }
+        else if (entry.ips.size() < max_ips)
+        {
+            entry.ips.emplace(ip, 1);
+        }
+    }
+}
+
+bool FaultSource::write_heatmap(const std::string& path) const
+{
+    std::ofstream out(path);
+    if (!out.is_open())
+    {
+        return false;
+    }
+
+    std::vector<const FaultMapping*> entries;
+    for (const auto& entry : mappings_)
+    {
+        entries.push_back(&entry);
+    }
+    if (unmapped_.faults)
+    {
+        entries.push_back(&unmapped_);
+    }
+    std::sort(entries.begin(), entries.end(), [](const FaultMapping* a, const FaultMapping* b){ return a->faults > b->faults; });
+
+    uint64_t period = std::max<uint64_t>(options_.fault_sample_period, 1);
+    out << "# page-fault heatmap of pid " << pid_ << ", 1 sample per " << period << " faults, " << (range_bytes >> 20) << "MB ranges\n";
+    out << "# ~1 fault per range means huge pages, ~512 means 4KB first touch\n";
+    if (lost_records_)
+    {
+        out << "# lost " << lost_records_ << " samples\n";
+    }
+
+    char line[128];
+    for (const FaultMapping* entry : entries)
+    {
+        const MemoryMapping& mapping = entry->mapping;
+        snprintf(line, sizeof(line), "0x%llx-0x%llx %s", static_cast<unsigned long long>(mapping.start), static_cast<unsigned long long>(mapping.end), mapping.permissions.c_str());
+        out << mapping_label(mapping) << ' ' << line << ' ' << entry->faults << '\n';
+
+        std::vector<std::pair<uint64_t, uint64_t>> ranges(entry->ranges.begin(), entry->ranges.end());
+        std::sort(ranges.begin(), ranges.end());
+        uint64_t peak = 0;
+        for (const auto& range : ranges)
+        {
+            peak = std::max(peak, range.second);
+        }
+        for (const auto& [index, faults] : ranges)
+        {
+            //offsets within the mapping; absolute addresses for [unmapped]
+            snprintf(line, sizeof(line), "  +0x%09llx %8llu ", static_cast<unsigned long long>(index * range_bytes), static_cast<unsigned long long>(faults));
+            out << line << std::string(1 + 39 * faults / peak, '#') << '\n';
+        }
+
+        std::vector<std::pair<uint64_t, uint64_t>> ips(entry->ips.begin(), entry->ips.end());
+        std::sort(ips.begin(), ips.end(), [](const auto& a, const auto& b){ return a.second > b.second; });
+        for (size_t i = 0; i < ips.size() && i < top_ips; i++)
+        {
+            out << "  ip " << maps_.format_address(ips[i].first) << ' ' << ips[i].second << '\n';
+        }
+    }
+    return true;
+}
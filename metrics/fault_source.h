@@ -0,0 +1,64 @@
+#ifndef FAULT_SOURCE_H
+#define FAULT_SOURCE_H
+
+#include <unordered_map>
+#include <vector>
+
+#include "metric_source.h"
+#include "perf_ring.h"
+#include "proc_maps.h"
+
+//page-fault addresses sampled with PERF_SAMPLE_ADDR, bucketed per mapping and
+//per page range; software event only, so it works on VMs without a PMU
+class FaultSource : public MetricSource
+{
+public:
+    explicit FaultSource(const SourceOptions& options);
+
+    const char* name() const override { return "faults"; }
+    bool open(int pid, std::string& error) override;
+    void collect(ProfilingSnapshot& snapshot) override;
+    void close() override;
+
+    bool write_heatmap(const std::string& path) const;
+
+private:
+    static constexpr uint64_t range_bytes = 2ull << 20;    //one THP: ~1 fault per range when backed by huge pages
+    static constexpr size_t max_mappings = 1024;
+    static constexpr size_t max_ips = 256;                 //per mapping
+    static constexpr size_t top_ips = 5;
+
+    struct FaultMapping
+    {
+        MemoryMapping mapping;
+        uint64_t faults = 0;
+        std::unordered_map<uint64_t, uint64_t> ranges;     //range index from mapping start
+        std::unordered_map<uint64_t, uint64_t> ips;
+    };
+
+    struct FaultSample
+    {
+        uint64_t ip;
+        uint64_t address;
+    };
+
+    SourceOptions options_;
+    int pid_ = -1;
+    PerCpuSampler sampler_;
+    ProcMaps maps_;
+
+    std::vector<FaultMapping> mappings_;
+    std::unordered_multimap<uint64_t, size_t> mapping_index_;  //by mapping start, then path and inode
+    FaultMapping unmapped_;         //mapping gone before maps were reread
+    std::vector<FaultSample> samples_;
+    std::vector<FaultSample> misses_;
+    uint64_t lost_records_ = 0;
+
+    void drain();
+    uint64_t process_samples();
+    bool account(const FaultSample& sample);
+    FaultMapping* find_entry(const MemoryMapping& mapping);
+    void add(FaultMapping& entry, uint64_t range, uint64_t ip);
+};
+
+#endif
@@ -0,0 +1,482 @@
+#include "futex_source.h"
+
+#include <dirent.h>
+#include <linux/futex.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+
+//records carry a user callchain, only futex calls of the target land here
+static constexpr size_t futex_ring_pages = 256;
+
+#ifndef FUTEX_LOCK_PI2
+#define FUTEX_LOCK_PI2 13
+#endif
+
+static bool is_wait_op(int64_t command)
+{
+    return command == FUTEX_WAIT || command == FUTEX_WAIT_BITSET || command == FUTEX_LOCK_PI || command == FUTEX_LOCK_PI2
+        || command == FUTEX_WAIT_REQUEUE_PI;
+}
+
+static bool is_wake_op(int64_t command)
+{
+    return command == FUTEX_WAKE || command == FUTEX_WAKE_BITSET || command == FUTEX_WAKE_OP || command == FUTEX_UNLOCK_PI
+        || command == FUTEX_REQUEUE || command == FUTEX_CMP_REQUEUE || command == FUTEX_CMP_REQUEUE_PI;
+}
+
+FutexSource::FutexSource(const SourceOptions& options): options_(options)
+{
+}
+
+bool FutexSource::open(int pid, std::string& error)
+{
+    Tracepoint enter, exit;
+    if (!enter.load("syscalls", "sys_enter_futex", error) || !exit.load("syscalls", "sys_exit_futex", error)
+        || !enter.find("uaddr", enter_uaddr_, error) || !enter.find("op", enter_op_, error))
+    {
+        return false;
+    }
+    enter_id_ = enter.id;
+    pid_ = pid;
+
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_TRACEPOINT;
+    attr.config = enter.id;
+    attr.sample_period = 1;
+    //both events share the layout, the exit's callchain is the same as its entry's and is skipped
+    attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_CALLCHAIN | PERF_SAMPLE_RAW;
+    attr.exclude_callchain_kernel = 1;
+    attr.inherit = 1;
+    attr.watermark = 1;
+    attr.wakeup_watermark = static_cast<uint32_t>(futex_ring_pages * sysconf(_SC_PAGESIZE) / 4);
+
+    if (!sampler_.open(pid, attr, futex_ring_pages, error))
+    {
+        return false;
+    }
+    attr.config = exit.id;
+    if (!sampler_.add_event(attr, error) || !attach_threads(pid, error))
+    {
+        sampler_.close();
+        return false;
+    }
+
+    locks_.clear();
+    locks_.reserve(max_locks);
+    locks_.resize(1);       //overflow_entry
+    lock_index_.clear();
+    lock_index_.reserve(max_locks);
+    stacks_.clear();
+    stacks_.reserve(max_stacks);
+    stacks_.resize(2);      //overflow_entry, unknown_stack
+    stack_index_.clear();
+    stack_index_.reserve(max_stacks);
+    touched_.clear();
+    touched_.reserve(max_locks);
+    pending_.clear();
+    pending_.reserve(1024);
+    events_.clear();
+    events_.reserve(1 << 16);
+    lost_records_ = 0;
+
+    maps_.load(pid);
+    ticks_since_maps_ = 0;
+
+    sampler_.enable();
+    reader_.start(sampler_, [this]
+    {
+        drain();
+        process_events();
+    });
+    return true;
+}
+
+bool FutexSource::attach_threads(int pid, std::string& error)
+{
+    //an attached server already runs its workers, the leader's events don't see them
+    std::string task_dir = "/proc/" + std::to_string(pid) + "/task";
+    DIR* dir = opendir(task_dir.c_str());
+    if (!dir)
+    {
+        error = "Can't list " + task_dir;
+        return false;
+    }
+
+    bool ok = true;
+    while (dirent* entry = readdir(dir))
+    {
+        char* end = nullptr;
+        long tid = strtol(entry->d_name, &end, 10);
+        if (*end != '\0' || tid <= 0 || tid == pid)
+        {
+            continue;
+        }
+        if (!sampler_.add_thread(tid, error) && access((task_dir + "/" + entry->d_name).c_str(), F_OK) == 0)
+        {
+            ok = false;     //not just a thread that exited meanwhile
+            break;
+        }
+    }
+    closedir(dir);
+    return ok;
+}
+
+void FutexSource::collect(ProfilingSnapshot& snapshot)
+{
+    std::lock_guard<std::mutex> lock(reader_.mutex());
+    drain();
+    process_events();
+
+    if (++ticks_since_maps_ >= maps_refresh_ticks)
+    {
+        //locks in libraries loaded later get named too
+        maps_.load(pid_);
+        ticks_since_maps_ = 0;
+    }
+
+    uint64_t waits = 0;
+    uint64_t wait_ns = 0;
+    uint64_t wakes = 0;
+    for (uint32_t index : touched_)
+    {
+        waits += locks_[index].interval.count;
+        wait_ns += locks_[index].interval.sum_ns;
+        wakes += locks_[index].interval_wakes;
+    }
+
+    //hottest locks of the interval by time waited, wake-only futexes stay out
+    std::sort(touched_.begin(), touched_.end(), [this](uint32_t a, uint32_t b)
+    {
+        return locks_[a].interval.sum_ns != locks_[b].interval.sum_ns ? locks_[a].interval.sum_ns > locks_[b].interval.sum_ns
+                                                                       : locks_[a].interval.count > locks_[b].interval.count;
+    });
+    for (size_t i = 0; i < touched_.size() && i < top_locks && locks_[touched_[i]].interval.count; i++)
+    {
+        const LockEntry& entry = locks_[touched_[i]];
+        LockSample sample;
+        sample.name = lock_name(touched_[i]);
+        sample.waits = entry.interval.count;
+        sample.wakes = entry.interval_wakes;
+        sample.wait_ns = entry.interval.sum_ns;
+        sample.p99_ns = entry.interval.percentile_ns(0.99);
+        snapshot.locks.push_back(sample);
+    }
+
+    for (uint32_t index : touched_)
+    {
+        LockEntry& entry = locks_[index];
+        entry.total.add(entry.interval);
+        entry.wakes += entry.interval_wakes;
+        entry.interval = LogHistogram();
+        entry.interval_wakes = 0;
+    }
+    touched_.clear();
+
+    snapshot.metrics.push_back({MetricType::FUTEX_WAITS, waits, metric_name(MetricType::FUTEX_WAITS), metric_unit(MetricType::FUTEX_WAITS)});
+    snapshot.metrics.push_back({MetricType::FUTEX_WAIT_TIME, wait_ns, metric_name(MetricType::FUTEX_WAIT_TIME), metric_unit(MetricType::FUTEX_WAIT_TIME)});
+    snapshot.metrics.push_back({MetricType::FUTEX_WAKES, wakes, metric_name(MetricType::FUTEX_WAKES), metric_unit(MetricType::FUTEX_WAKES)});
+}
+
+void FutexSource::close()
+{
+    if (!sampler_.is_open())
+    {
+        return;
+    }
+
+    reader_.stop();
+    sampler_.disable();
+    drain();
+    process_events();
+    sampler_.close();
+    for (uint32_t index : touched_)
+    {
+        locks_[index].total.add(locks_[index].interval);
+        locks_[index].wakes += locks_[index].interval_wakes;
+    }
+    touched_.clear();
+
+    if (!options_.contention_table_path.empty())
+    {
+        write_table(options_.contention_table_path);
+    }
+}
+
+void FutexSource::drain()
+{
+    sampler_.drain([this](const perf_event_header* record)
+    {
+        const char* body = reinterpret_cast<const char*>(record + 1);
+        const char* end = reinterpret_cast<const char*>(record) + record->size;
+
+        if (record->type == PERF_RECORD_SAMPLE && body + 24 <= end)
+        {
+            //pid, tid, time, nr, ips[nr], raw size, raw data
+            uint64_t nr = *reinterpret_cast<const uint64_t*>(body + 16);
+            const uint64_t* ips = reinterpret_cast<const uint64_t*>(body + 24);
+            if (nr > static_cast<uint64_t>(end - body - 24) / sizeof(uint64_t))
+            {
+                return;
+            }
+            const char* raw_header = body + 24 + nr * sizeof(uint64_t);
+            if (raw_header + 4 > end)
+            {
+                return;
+            }
+            uint32_t raw_size = *reinterpret_cast<const uint32_t*>(raw_header);
+            const char* raw = raw_header + 4;
+            if (raw + raw_size > end || raw_size < 2)
+            {
+                return;
+            }
+
+            FutexEvent event;
+            uint32_t pid = *reinterpret_cast<const uint32_t*>(body);
+            event.tid = *reinterpret_cast<const uint32_t*>(body + 4);
+            event.time = *reinterpret_cast<const uint64_t*>(body + 8);
+            event.lock = overflow_entry;
+            event.stack = unknown_stack;
+            //common_type tells the two tracepoints apart, both share the ring
+            uint16_t type = *reinterpret_cast<const uint16_t*>(raw);
+            if (type != enter_id_)
+            {
+                event.kind = EventKind::EXIT;
+                events_.push_back(event);
+                return;
+            }
+            if (enter_uaddr_.offset + enter_uaddr_.size > raw_size || enter_op_.offset + enter_op_.size > raw_size)
+            {
+                return;
+            }
+
+            int64_t command = read_tracepoint_field(raw, enter_op_) & FUTEX_CMD_MASK;
+            uint64_t address = static_cast<uint64_t>(read_tracepoint_field(raw, enter_uaddr_));
+            if (is_wait_op(command))
+            {
+                event.kind = EventKind::WAIT;
+                event.lock = intern_lock(pid, address);
+                event.stack = intern_stack(ips, nr);
+            }
+            else if (is_wake_op(command))
+            {
+                event.kind = EventKind::WAKE;
+                event.lock = intern_lock(pid, address);
+            }
+            else
+            {
+                event.kind = EventKind::OTHER;
+            }
+            events_.push_back(event);
+        }
+        else if (record->type == PERF_RECORD_LOST && body + 16 <= end)
+        {
+            lost_records_ += *reinterpret_cast<const uint64_t*>(body + 8);
+        }
+    });
+}
+
+void FutexSource::process_events()
+{
+    //a thread that migrated while waiting exits in another ring
+    sort_by_time(events_);
+
+    for (const auto& event : events_)
+    {
+        switch (event.kind)
+        {
+            case EventKind::WAIT:
+            {
+                if (pending_.size() < max_pending || pending_.count(event.tid))
+                {
+                    pending_[event.tid] = {event.time, event.lock, event.stack};
+                }
+                break;
+            }
+            case EventKind::WAKE:
+            {
+                LockEntry& entry = locks_[event.lock];
+                if (entry.interval.count == 0 && entry.interval_wakes == 0)
+                {
+                    touched_.push_back(event.lock);
+                }
+                entry.interval_wakes++;
+                pending_.erase(event.tid);
+                break;
+            }
+            case EventKind::OTHER:
+            {
+                pending_.erase(event.tid);
+                break;
+            }
+            case EventKind::EXIT:
+            {
+                //waits entered before profiling started are not timed
+                auto it = pending_.find(event.tid);
+                if (it == pending_.end() || it->second.enter_time > event.time)
+                {
+                    break;
+                }
+                uint64_t ns = event.time - it->second.enter_time;
+                LockEntry& entry = locks_[it->second.lock];
+                if (entry.interval.count == 0 && entry.interval_wakes == 0)
+                {
+                    touched_.push_back(it->second.lock);
+                }
+                entry.interval.record(ns);
+                StackEntry& stack = stacks_[it->second.stack];
+                stack.waits.record(ns);
+                stack.lock = it->second.lock;
+                pending_.erase(it);
+                break;
+            }
+        }
+    }
+    events_.clear();
+}
+
+uint32_t FutexSource::intern_lock(uint32_t pid, uint64_t address)
+{
+    uint64_t key = (address * 1099511628211ull) ^ pid;
+    auto it = lock_index_.find(key);
+    if (it != lock_index_.end())
+    {
+        return it->second;
+    }
+    if (locks_.size() >= max_locks)
+    {
+        return overflow_entry;
+    }
+
+    LockEntry entry;
+    entry.pid = pid;
+    entry.address = address;
+    locks_.push_back(entry);
+    uint32_t index = static_cast<uint32_t>(locks_.size() - 1);
+    lock_index_.emplace(key, index);
+    return index;
+}
+
+uint32_t FutexSource::intern_stack(const uint64_t* ips, uint64_t nr)
+{
+    uint64_t frames[max_frames];
+    uint32_t depth = 0;
+    uint64_t hash = 1469598103934665603ull;
+    for (uint64_t i = 0; i < nr && depth < max_frames; i++)
+    {
+        if (ips[i] >= static_cast<uint64_t>(PERF_CONTEXT_MAX))
+        {
+            continue;   //PERF_CONTEXT_USER and friends
+        }
+        frames[depth++] = ips[i];
+        hash = (hash ^ ips[i]) * 1099511628211ull;
+    }
+    if (depth == 0)
+    {
+        return unknown_stack;
+    }
+
+    auto it = stack_index_.find(hash);
+    if (it != stack_index_.end())
+    {
+        return it->second;
+    }
+    if (stacks_.size() >= max_stacks)
+    {
+        return overflow_entry;
+    }
+
+    StackEntry entry;
+    entry.depth = depth;
+    std::copy(frames, frames + depth, entry.ips.begin());
+    stacks_.push_back(entry);
+    uint32_t index = static_cast<uint32_t>(stacks_.size() - 1);
+    stack_index_.emplace(hash, index);
+    return index;
+}
+
+std::string FutexSource::lock_name(uint32_t lock) const
+{
+    if (lock == overflow_entry)
+    {
+        return "[lock table full]";
+    }
+    const LockEntry& entry = locks_[lock];
+    if (static_cast<int>(entry.pid) == pid_)
+    {
+        //"app+0x4c2a0" for locks in static data, heap and stack locks stay raw addresses
+        return maps_.format_address(entry.address);
+    }
+    char buffer[48];
+    snprintf(buffer, sizeof(buffer), "%u:0x%llx", entry.pid, static_cast<unsigned long long>(entry.address));
+    return buffer;
+}
+
+bool FutexSource::write_table(const std::string& path) const
+{
+    std::ofstream out(path);
+    if (!out.is_open())
+    {
+        return false;
+    }
+
+    std::vector<uint32_t> order;
+    for (uint32_t index = 0; index < locks_.size(); index++)
+    {
+        if (locks_[index].total.count || locks_[index].wakes)
+        {
+            order.push_back(index);
+        }
+    }
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b)
+    {
+        return locks_[a].total.sum_ns != locks_[b].total.sum_ns ? locks_[a].total.sum_ns > locks_[b].total.sum_ns : locks_[a].wakes > locks_[b].wakes;
+    });
+
+    out << "# lock waits wakes total_ns p50_ns p99_ns max_ns\n";
+    for (uint32_t index : order)
+    {
+        const LockEntry& entry = locks_[index];
+        out << lock_name(index) << ' ' << entry.total.count << ' ' << entry.wakes << ' ' << entry.total.sum_ns << ' '
+            << entry.total.percentile_ns(0.5) << ' ' << entry.total.percentile_ns(0.99) << ' ' << entry.total.max_ns << '\n';
+    }
+
+    order.clear();
+    for (uint32_t index = 0; index < stacks_.size(); index++)
+    {
+        if (stacks_[index].waits.count)
+        {
+            order.push_back(index);
+        }
+    }
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return stacks_[a].waits.sum_ns > stacks_[b].waits.sum_ns; });
+
+    out << "# callchain waits total_ns p99_ns lock outer;...;leaf\n";
+    for (uint32_t index : order)
+    {
+        const StackEntry& stack = stacks_[index];
+        out << "callchain " << stack.waits.count << ' ' << stack.waits.sum_ns << ' ' << stack.waits.percentile_ns(0.99) << ' '
+            << lock_name(stack.lock) << ' ';
+        if (index == overflow_entry)
+        {
+            out << "[stack table full]";
+        }
+        else if (index == unknown_stack)
+        {
+            out << "[unknown]";
+        }
+        for (uint32_t frame = stack.depth; frame > 0; frame--)
+        {
+            out << maps_.format_address(stack.ips[frame - 1]) << (frame > 1 ? ";" : "");
+        }
+        out << '\n';
+    }
+    if (lost_records_)
+    {
+        out << "# lost " << lost_records_ << " records\n";
+    }
+    return true;
+}
@@ -0,0 +1,114 @@
+#ifndef FUTEX_SOURCE_H
+#define FUTEX_SOURCE_H
+
+#include <array>
+#include <unordered_map>
+#include <vector>
+
+#include "latency_histogram.h"
+#include "metric_source.h"
+#include "perf_ring.h"
+#include "proc_maps.h"
+#include "tracepoint.h"
+#include "tracepoint_reader.h"
+
+//lock contention from the futex syscall tracepoints: a wait is timed from
+//sys_enter_futex to sys_exit_futex of the same thread and charged to the futex
+//address and to the user callchain that waited. Both tables are bounded, addresses
+//and callchains past their size share an overflow entry. Condition variables
+//wait on futexes too, the callchains tell them apart from contended mutexes
+class FutexSource : public MetricSource
+{
+public:
+    explicit FutexSource(const SourceOptions& options);
+
+    const char* name() const override { return "futex"; }
+    bool open(int pid, std::string& error) override;
+    void collect(ProfilingSnapshot& snapshot) override;
+    void close() override;
+
+    //whole-run tables: locks ordered by wait time, then the waiting callchains
+    bool write_table(const std::string& path) const;
+
+private:
+    static constexpr size_t max_locks = 4096;
+    static constexpr size_t max_stacks = 4096;
+    static constexpr size_t max_frames = 32;
+    static constexpr size_t max_pending = 65536;
+    static constexpr size_t top_locks = 8;
+    static constexpr uint32_t overflow_entry = 0;
+    static constexpr uint32_t unknown_stack = 1;
+    static constexpr uint32_t maps_refresh_ticks = 50;
+
+    struct LockEntry
+    {
+        uint32_t pid = 0;
+        uint64_t address = 0;
+        LogHistogram interval;
+        LogHistogram total;
+        uint64_t interval_wakes = 0;
+        uint64_t wakes = 0;
+    };
+
+    struct StackEntry
+    {
+        uint32_t depth = 0;
+        std::array<uint64_t, max_frames> ips{};
+        LogHistogram waits;
+        uint32_t lock = overflow_entry;     //of the last wait, a callchain rarely waits on more than one
+    };
+
+    enum class EventKind : uint8_t
+    {
+        WAIT,
+        WAKE,
+        OTHER,          //any other futex op, ends a wait whose exit was lost
+        EXIT
+    };
+
+    struct FutexEvent
+    {
+        uint64_t time;
+        uint32_t tid;
+        uint32_t lock;
+        uint32_t stack;
+        EventKind kind;
+    };
+
+    struct PendingWait
+    {
+        uint64_t enter_time;
+        uint32_t lock;
+        uint32_t stack;
+    };
+
+    SourceOptions options_;
+    int pid_ = -1;
+    PerCpuSampler sampler_;
+    ProcMaps maps_;
+    uint32_t ticks_since_maps_ = 0;
+    uint32_t enter_id_ = 0;
+    TracepointField enter_uaddr_;
+    TracepointField enter_op_;
+
+    //bounded: entry 0 of both tables takes whatever does not fit
+    std::vector<LockEntry> locks_;
+    std::unordered_map<uint64_t, uint32_t> lock_index_;
+    std::vector<StackEntry> stacks_;
+    std::unordered_map<uint64_t, uint32_t> stack_index_;
+    std::vector<uint32_t> touched_;
+    std::unordered_map<uint32_t, PendingWait> pending_;
+    std::vector<FutexEvent> events_;
+    uint64_t lost_records_ = 0;
+
+    TracepointReader reader_;       //everything above is shared with it
+
+    bool attach_threads(int pid, std::string& error);
+    void drain();
+    void process_events();
+    uint32_t intern_lock(uint32_t pid, uint64_t address);
+    uint32_t intern_stack(const uint64_t* ips, uint64_t nr);
+    std::string lock_name(uint32_t lock) const;
+};
+
+#endif
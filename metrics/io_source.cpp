@@ -0,0 +1,75 @@
+#include "io_source.h"
+
+IoSource::IoSource(const std::vector<MetricType>& metrics)
+{
+    for (auto type : metrics)
+    {
+        if (is_io_metric(type))
+        {
+            metrics_.push_back(type);
+        }
+    }
+}
+
+bool IoSource::open(int pid, std::string& error)
+{
+    std::string path = "/proc/" + std::to_string(pid) + "/io";
+    if (!io_.open(path))
+    {
+        error = "Can't open " + path;
+        return false;
+    }
+    //counts since the target started belong to no interval
+    if (!read_io(last_))
+    {
+        error = "Can't read " + path + " (task I/O accounting disabled?)";
+        io_.close();
+        return false;
+    }
+    return true;
+}
+
+void IoSource::collect(ProfilingSnapshot& snapshot)
+{
+    std::array<uint64_t, field_count> values;
+    if (!read_io(values))
+    {
+        return;
+    }
+
+    for (auto type : metrics_)
+    {
+        size_t field = static_cast<size_t>(type) - static_cast<size_t>(MetricType::IO_READ_CHARS);
+        uint64_t delta = values[field] >= last_[field] ? values[field] - last_[field] : 0;
+        snapshot.metrics.push_back({type, delta, metric_name(type), metric_unit(type)});
+    }
+    last_ = values;
+}
+
+void IoSource::close()
+{
+    io_.close();
+}
+
+bool IoSource::read_io(std::array<uint64_t, field_count>& values)
+{
+    char buffer[512];
+    ssize_t length = io_.read(buffer, sizeof(buffer));
+    if (length <= 0)
+    {
+        return false;
+    }
+
+    //same order as MetricType
+    values.fill(0);
+    ProcfsField fields[field_count] = {
+        {"rchar", &values[0], false},
+        {"wchar", &values[1], false},
+        {"syscr", &values[2], false},
+        {"syscw", &values[3], false},
+        {"read_bytes", &values[4], false},
+        {"write_bytes", &values[5], false},
+        {"cancelled_write_bytes", &values[6], false}
+    };
+    return scan_procfs_fields(buffer, length, fields, field_count) > 0;
+}
@@ -0,0 +1,32 @@
+#ifndef IO_SOURCE_H
+#define IO_SOURCE_H
+
+#include <array>
+#include <vector>
+
+#include "metric_source.h"
+#include "procfs_reader.h"
+
+//read/write bytes, syscalls and cancelled writes from /proc/<pid>/io, kept open
+//between ticks; values are deltas of the interval, rates come from <metric>/s
+class IoSource : public MetricSource
+{
+public:
+    explicit IoSource(const std::vector<MetricType>& metrics);
+
+    const char* name() const override { return "io"; }
+    bool open(int pid, std::string& error) override;
+    void collect(ProfilingSnapshot& snapshot) override;
+    void close() override;
+
+private:
+    static constexpr size_t field_count = 7;    //IO_READ_CHARS .. IO_CANCELLED_WRITE_BYTES
+
+    std::vector<MetricType> metrics_;
+    ProcfsFile io_;
+    std::array<uint64_t, field_count> last_{};
+
+    bool read_io(std::array<uint64_t, field_count>& values);
+};
+
+#endif
@@ -0,0 +1,88 @@
+#include "latency_histogram.h"
+
+void LogHistogram::record(uint64_t ns)
+{
+    buckets[bucket_of(ns)]++;
+    count++;
+    sum_ns += ns;
+    max_ns = std::max(max_ns, ns);
+}
+
+void LogHistogram::add(const LogHistogram& other)
+{
+    count += other.count;
+    sum_ns += other.sum_ns;
+    max_ns = std::max(max_ns, other.max_ns);
+    for (size_t bucket = 0; bucket < bucket_count; bucket++)
+    {
+        buckets[bucket] += other.buckets[bucket];
+    }
+}
+
+uint64_t LogHistogram::percentile_ns(double p) const
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    uint64_t rank = static_cast<uint64_t>(p * count);
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < bucket_count; bucket++)
+    {
+        seen += buckets[bucket];
+        if (seen > rank)
+        {
+            //upper bound of the bucket, but never above what was really observed
+            return std::min<uint64_t>((1ull << (bucket + 1)) - 1, max_ns);
+        }
+    }
+    return max_ns;
+}
+
+void LogHistogram::write_buckets(std::ostream& out) const
+{
+    for (size_t bucket = 0; bucket < bucket_count; bucket++)
+    {
+        if (buckets[bucket])
+        {
+            out << ' ' << (1ull << (bucket + 1)) << ':' << buckets[bucket];
+        }
+    }
+}
+
+void LatencyHistogram::record(uint64_t ns)
+{
+    buckets_[LogHistogram::bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_ns_.fetch_add(ns, std::memory_order_relaxed);
+
+    uint64_t current_max = max_ns_.load(std::memory_order_relaxed);
+    while (ns > current_max && !max_ns_.compare_exchange_weak(current_max, ns, std::memory_order_relaxed))
+    {
+    }
+}
+
+void LatencyHistogram::clear()
+{
+    for (auto& bucket : buckets_)
+    {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+    sum_ns_.store(0, std::memory_order_relaxed);
+    max_ns_.store(0, std::memory_order_relaxed);
+}
+
+LogHistogram LatencyHistogram::values() const
+{
+    LogHistogram values;
+    values.count = count();
+    values.sum_ns = sum_ns();
+    values.max_ns = max_ns();
+    for (size_t bucket = 0; bucket < bucket_count; bucket++)
+    {
+        values.buckets[bucket] = buckets_[bucket].load(std::memory_order_relaxed);
+    }
+    return values;
+}
@@ -0,0 +1,53 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+//log2 buckets over nanoseconds, bucket b holds [2^b, 2^(b+1)) and 0 goes to the first;
+//plain values for one thread, the sources keep one per interval and add it to a total
+struct LogHistogram
+{
+    static constexpr size_t bucket_count = 40;
+
+    uint64_t count = 0;
+    uint64_t sum_ns = 0;
+    uint64_t max_ns = 0;
+    std::array<uint64_t, bucket_count> buckets{};
+
+    static size_t bucket_of(uint64_t ns) { return ns ? std::min<size_t>(63 - __builtin_clzll(ns), bucket_count - 1) : 0; }
+
+    void record(uint64_t ns);
+    void add(const LogHistogram& other);
+    uint64_t percentile_ns(double p) const;
+    //" <upper bound>:<count>" per non-empty bucket, the latency columns of the tables
+    void write_buckets(std::ostream& out) const;
+};
+
+//the same buckets, safe to record from any thread
+class LatencyHistogram
+{
+public:
+    static constexpr size_t bucket_count = LogHistogram::bucket_count;
+
+    void record(uint64_t ns);
+    void clear();
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t sum_ns() const { return sum_ns_.load(std::memory_order_relaxed); }
+    uint64_t max_ns() const { return max_ns_.load(std::memory_order_relaxed); }
+    uint64_t percentile_ns(double p) const { return values().percentile_ns(p); }
+    //copy to compute from, concurrent records may be half in it
+    LogHistogram values() const;
+
+private:
+    std::array<std::atomic<uint64_t>, bucket_count> buckets_{};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_ns_{0};
+    std::atomic<uint64_t> max_ns_{0};
+};
+
+#endif
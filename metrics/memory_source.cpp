@@ -0,0 +1,131 @@
+#include "memory_source.h"
+
+#include <algorithm>
+
+MemorySource::MemorySource(const std::vector<MetricType>& metrics)
+{
+    for (auto type : metrics)
+    {
+        if (is_memory_metric(type))
+        {
+            metrics_.push_back(type);
+        }
+    }
+    needs_rollup_ = std::any_of(metrics_.begin(), metrics_.end(), [](MetricType type)
+    {
+        return type == MetricType::MEMORY_PSS || type == MetricType::MEMORY_SWAP;
+    });
+}
+
+bool MemorySource::open(int pid, std::string& error)
+{
+    std::string base = "/proc/" + std::to_string(pid) + "/";
+    if (!statm_.open(base + "statm"))
+    {
+        error = "Can't open " + base + "statm";
+        return false;
+    }
+    if (needs_rollup_ && !smaps_rollup_.open(base + "smaps_rollup"))
+    {
+        error = "Can't open " + base + "smaps_rollup";
+        statm_.close();
+        return false;
+    }
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    page_size_ = page_size > 0 ? page_size : 4096;
+    pss_ = 0;
+    swap_ = 0;
+    next_rollup_ = std::chrono::steady_clock::now();
+    return true;
+}
+
+void MemorySource::collect(ProfilingSnapshot& snapshot)
+{
+    uint64_t rss = 0;
+    uint64_t file = 0;
+    read_statm(rss, file);
+
+    if (needs_rollup_ && std::chrono::steady_clock::now() >= next_rollup_)
+    {
+        read_rollup();
+    }
+
+    for (auto type : metrics_)
+    {
+        uint64_t value = 0;
+        switch (type)
+        {
+            case MetricType::MEMORY_RSS:
+                value = rss;
+                break;
+            case MetricType::MEMORY_PSS:
+                value = pss_;
+                break;
+            case MetricType::MEMORY_ANON:
+                value = rss > file ? rss - file : 0;
+                break;
+            case MetricType::MEMORY_FILE:
+                value = file;
+                break;
+            case MetricType::MEMORY_SWAP:
+                value = swap_;
+                break;
+            default:
+                continue;
+        }
+        snapshot.metrics.push_back({type, value, metric_name(type), metric_unit(type)});
+    }
+}
+
+void MemorySource::close()
+{
+    statm_.close();
+    smaps_rollup_.close();
+}
+
+bool MemorySource::read_statm(uint64_t& rss, uint64_t& file)
+{
+    //size resident shared text lib data dt, in pages
+    char buffer[256];
+    ssize_t length = statm_.read(buffer, sizeof(buffer));
+    if (length <= 0)
+    {
+        return false;
+    }
+
+    const char* end = buffer + length;
+    uint64_t size = 0;
+    uint64_t resident = 0;
+    uint64_t shared = 0;
+    const char* pos = parse_procfs_u64(buffer, end, size);
+    pos = parse_procfs_u64(pos, end, resident);
+    parse_procfs_u64(pos, end, shared);
+
+    rss = resident * page_size_;
+    file = shared * page_size_;
+    return true;
+}
+
+void MemorySource::read_rollup()
+{
+    auto started = std::chrono::steady_clock::now();
+
+    char buffer[4096];
+    ssize_t length = smaps_rollup_.read(buffer, sizeof(buffer));
+    if (length > 0)
+    {
+        uint64_t pss = 0;
+        uint64_t swap = 0;
+        ProcfsField fields[] = {
+            {"Pss", &pss, false},
+            {"Swap", &swap, false}
+        };
+        scan_procfs_fields(buffer, length, fields, 2);
+        pss_ = pss;
+        swap_ = swap;
+    }
+
+    auto finished = std::chrono::steady_clock::now();
+    next_rollup_ = finished + std::chrono::duration_cast<std::chrono::steady_clock::duration>((finished - started) / rollup_time_budget);
+}
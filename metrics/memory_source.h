@@ -0,0 +1,41 @@
+#ifndef MEMORY_SOURCE_H
+#define MEMORY_SOURCE_H
+
+#include <chrono>
+#include <vector>
+
+#include "metric_source.h"
+#include "procfs_reader.h"
+
+//RSS / PSS / anon / file / swap from /proc/<pid>/statm and smaps_rollup
+class MemorySource : public MetricSource
+{
+public:
+    explicit MemorySource(const std::vector<MetricType>& metrics);
+
+    const char* name() const override { return "memory"; }
+    bool open(int pid, std::string& error) override;
+    void collect(ProfilingSnapshot& snapshot) override;
+    void close() override;
+
+private:
+    //smaps_rollup walks the page tables, so it is re-read only as often as
+    //this fraction of wall time allows; statm is O(1) and read every tick
+    static constexpr double rollup_time_budget = 0.02;
+
+    std::vector<MetricType> metrics_;
+    bool needs_rollup_ = false;
+
+    ProcfsFile statm_;
+    ProcfsFile smaps_rollup_;
+    long page_size_ = 4096;
+
+    uint64_t pss_ = 0;
+    uint64_t swap_ = 0;
+    std::chrono::steady_clock::time_point next_rollup_;
+
+    bool read_statm(uint64_t& rss, uint64_t& file);
+    void read_rollup();
+};
+
+#endif
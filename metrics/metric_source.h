@@ -0,0 +1,41 @@
+#ifndef METRIC_SOURCE_H
+#define METRIC_SOURCE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "profiling_snapshot.h"
+
+struct RegionShm;
+struct AllocShm;
+
+struct SourceOptions
+{
+    std::string offcpu_folded_path;     //folded off-CPU stacks written when profiling stops
+    std::string fault_heatmap_path;     //page-fault heatmap written when profiling stops
+    uint64_t fault_sample_period = 1;   //faults per address sample
+    bool fault_ips = false;             //also keep the faulting code locations
+    bool process_tree = false;          //follow every descendant of the target
+    std::string tree_table_path;        //per-command totals of the tree written when profiling stops
+    std::string syscall_table_path;     //per-syscall counts and latency histograms written when profiling stops
+    std::string contention_table_path;  //per-lock and per-callchain futex waits written when profiling stops
+    std::string block_table_path;       //per-device block latency histograms written when profiling stops
+    RegionShm* regions = nullptr;       //region markers of the target, owned by ProcessManager
+    AllocShm* allocs = nullptr;         //allocation shim counters of the target, owned by ProcessManager
+    std::string alloc_folded_path;      //folded allocation stacks written when profiling stops
+};
+
+//non perf-counter metrics merged into the same snapshot tick
+class MetricSource
+{
+public:
+    virtual ~MetricSource() = default;
+
+    virtual const char* name() const = 0;
+    virtual bool open(int pid, std::string& error) = 0;
+    virtual void collect(ProfilingSnapshot& snapshot) = 0;
+    virtual void close() = 0;
+};
+
+#endif
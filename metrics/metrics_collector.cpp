@@ -7,11 +7,21 @@
 #include <signal.h>
 #include <cstring>
 #include <system_error>
+#include <algorithm>
+#include <cmath>
 
-static long perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu, int group_fd, unsigned long flags) 
-{
-    return syscall(__NR_perf_event_open, attr, pid, cpu, group_fd, flags);
-}
+#include "memory_source.h"
+#include "sched_source.h"
+#include "offcpu_source.h"
+#include "fault_source.h"
+#include "alloc_source.h"
+#include "syscall_source.h"
+#include "futex_source.h"
+#include "io_source.h"
+#include "block_source.h"
+#include "process_tree_source.h"
+#include "region_source.h"
+#include "../processes/isolation.h"
 
 MetricCollector::MetricCollector() = default;
 
@@ -48,13 +58,30 @@ bool MetricCollector::start_profiling(int pid, const std::vector<MetricType>& me
     {
         return false;
     }
+
+    if (!setup_sources(pid, metrics))
+    {
+        cleanup_perf_events();
+        return false;
+    }
     
-    snapshots_.clear();
+    self_monitor_.reset();
+    last_self_usage_ = self_monitor_.usage();
+    adaptive_.reset(adaptive_settings_, interval_ms);
+    last_sample_ = std::chrono::steady_clock::now();
     profiling_active_ = true;
     
     profiling_thread_ = std::thread(&MetricCollector::profiling_loop, this);
     
     report_log("[Profiler] Started profiling PID " + std::to_string(pid) +  " with interval " + std::to_string(interval_ms) + "ms\n");
+    if (sampled_.is_open())
+    {
+        report_log("[Profiler] Counters sampled by the kernel every " + std::to_string(interval_ms) + "ms of CPU time, read in batches of " + std::to_string(counters_.settings().kernel_timed_batch) + "\n");
+    }
+    if (adaptive_settings_.enabled)
+    {
+        report_log("[Profiler] Adaptive interval " + std::to_string(adaptive_settings_.min_interval_ms) + "-" + std::to_string(adaptive_settings_.max_interval_ms) + "ms\n");
+    }
     return true;
 }
 
@@ -68,6 +95,7 @@ void MetricCollector::stop_profiling()
         }
 
         cleanup_perf_events();
+        cleanup_sources();
         
         report_log("[Profiler] Stopped profiling PID " + std::to_string(profiled_pid_) + "\n");
         profiled_pid_ = -1;
@@ -77,21 +105,45 @@ void MetricCollector::stop_profiling()
 void MetricCollector::profiling_loop() 
 {
     report_log("[Profiler] Profiling loop started for PID " + std::to_string(profiled_pid_) +"\n");
-    
-    while (profiling_active_ && is_process_alive(profiled_pid_)) 
+
+    std::string pin_error;
+    if (!pin_current_thread(housekeeping_cpus_, pin_error))
     {
-        auto interval_start = std::chrono::steady_clock::now();
-        
-        ProfilingSnapshot snapshot = collect_snapshot(profiling_interval_ms_);
-        snapshots_.push_back(snapshot);
+        report_error("[Profiler] " + pin_error);
+    }
+
+    if (sampled_.is_open())
+    {
+        sampled_loop();
+    }
+    else
+    {
+        while (profiling_active_ && is_process_alive(profiled_pid_)) 
+        {
+            auto interval_start = std::chrono::steady_clock::now();
+
+            //the interval actually covered, sleeps overshoot and the adaptive mode changes it
+            uint64_t actual_ms = std::llround(std::chrono::duration<double, std::milli>(interval_start - last_sample_).count());
+            last_sample_ = interval_start;
+            ProfilingSnapshot snapshot = collect_snapshot(actual_ms);
+            adaptive_.observe(snapshot);
         
-        report_metrics(snapshot);
+            {
+                SelfMonitor::StageTimer timer(self_monitor_, PipelineStage::CALLBACK);
+                report_metrics(std::move(snapshot));
+            }
         
-        auto elapsed = std::chrono::steady_clock::now() - interval_start;
-        auto sleep_time = std::chrono::milliseconds(profiling_interval_ms_) - elapsed;
-        if (sleep_time > std::chrono::milliseconds(0)) 
-        {
-            std::this_thread::sleep_for(sleep_time);
+            auto elapsed = std::chrono::steady_clock::now() - interval_start;
+            uint64_t interval_ms = profiling_interval_ms_;
+            if (adaptive_settings_.enabled)
+            {
+                interval_ms = adaptive_.update(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+            }
+            auto sleep_time = std::chrono::milliseconds(interval_ms) - elapsed;
+            if (sleep_time > std::chrono::milliseconds(0)) 
+            {
+                std::this_thread::sleep_for(sleep_time);
+            }
         }
     }
     if (!is_process_alive(profiled_pid_))
@@ -100,161 +152,241 @@ void MetricCollector::profiling_loop()
         
         if (metric_callback_)
         {
-            ProfilingSnapshot final_snapshot = collect_snapshot(0);
-            metric_callback_(final_snapshot);
+            metric_callback_(collect_snapshot(0));
         }
     }
 
     report_log("[Profiler] Profiling loop finished\n");
 }
 
+void MetricCollector::sampled_loop()
+{
+    //the target may run less than a period per interval, a batch is waited for at most that long
+    uint32_t batch = counters_.settings().kernel_timed_batch;
+    int timeout_ms = static_cast<int>(std::min<uint64_t>(profiling_interval_ms_ * batch, 60000));
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    last_sample_ns_ = static_cast<uint64_t>(now.tv_sec) * 1000000000ull + now.tv_nsec;
+    last_sources_ns_ = last_sample_ns_;
+
+    while (profiling_active_ && is_process_alive(profiled_pid_))
+    {
+        if (sampled_.wait(timeout_ms) < 0)
+        {
+            //the task is gone, the loop ends once it is reaped
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        report_samples(true);
+    }
+    //what the kernel wrote since the last batch, the final snapshot brings the sources
+    report_samples(false);
+    if (sampled_.lost_samples())
+    {
+        report_log("[Profiler] Lost " + std::to_string(sampled_.lost_samples()) + " counter samples\n");
+    }
+}
+
+void MetricCollector::report_samples(bool with_sources)
+{
+    std::vector<SampledCounters::Sample> samples;
+    {
+        SelfMonitor::StageTimer timer(self_monitor_, PipelineStage::READ);
+        sampled_.drain(samples);
+        SampledCounters::Sample sample;
+        if (samples.empty() && with_sources && sampled_.read_now(sample))
+        {
+            samples.push_back(std::move(sample));
+        }
+    }
+
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        SampledCounters::Sample& sample = samples[i];
+        ProfilingSnapshot snapshot;
+        snapshot.timestamp_ms = sample.time_ns / 1000000;
+        snapshot.duration_ms = (sample.time_ns - last_sample_ns_ + 500000) / 1000000;
+        snapshot.metrics = std::move(sample.metrics);
+        last_sample_ns_ = sample.time_ns;
+
+        SelfMonitor::StageTimer timer(self_monitor_, PipelineStage::CALLBACK);
+        report_metrics(std::move(snapshot));
+    }
+    if (!with_sources)
+    {
+        return;
+    }
+
+    //the sources and the self-usage are read once per batch and cover all of it,
+    //on a sample's snapshot their rates would be the batch size too high
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t now_ns = static_cast<uint64_t>(now.tv_sec) * 1000000000ull + now.tv_nsec;
+    ProfilingSnapshot snapshot;
+    snapshot.timestamp_ms = now_ns / 1000000;
+    snapshot.duration_ms = (now_ns - last_sources_ns_ + 500000) / 1000000;
+    last_sources_ns_ = now_ns;
+    {
+        SelfMonitor::StageTimer timer(self_monitor_, PipelineStage::SOURCE_READ);
+        for (auto& source : sources_)
+        {
+            source->collect(snapshot);
+        }
+    }
+    append_self_metrics(snapshot);
+
+    SelfMonitor::StageTimer timer(self_monitor_, PipelineStage::CALLBACK);
+    report_metrics(std::move(snapshot));
+}
+
 ProfilingSnapshot MetricCollector::collect_snapshot(uint64_t duration_ms) 
 {
     ProfilingSnapshot snapshot;
 
     snapshot.timestamp_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();//абсолютное время собираемого снапшота
     snapshot.duration_ms = duration_ms;
-    
-    for (auto& event : perf_events_)
+
     {
-        uint64_t current_value = read_perf_event(event.fd);
-        
-        uint64_t delta = current_value - event.last_value;
-        event.last_value = current_value;
-        
-        MetricValue metric;
-        metric.type = event.type;
-        metric.value = delta;
-        
-        switch (event.type)
+        SelfMonitor::StageTimer timer(self_monitor_, PipelineStage::READ);
+        counters_.read(snapshot.metrics);
+    }
+
+    {
+        SelfMonitor::StageTimer timer(self_monitor_, PipelineStage::SOURCE_READ);
+        for (auto& source : sources_)
         {
-            case MetricType::INSTRUCTIONS:
-                metric.name = "instructions";
-                metric.unit = "count";
-                break;
-            case MetricType::CPU_CYCLES:
-                metric.name = "cpu_cycles";
-                metric.unit = "cycles";
-                break;
-            case MetricType::CACHE_MISSES:
-                metric.name = "cache_misses";
-                metric.unit = "misses";
-                break;
-            case MetricType::CACHE_REFERENCES:
-                metric.name = "cache_references";
-                metric.unit = "references";
-                break;
-            case MetricType::BRANCH_MISSES:
-                metric.name = "branch_misses";
-                metric.unit = "misses";
-                break;
-            case MetricType::PAGE_FAULTS:
-                metric.name = "page_faults";
-                metric.unit = "faults";
-                break;
-            case MetricType::CONTEXT_SWITCHES:
-                metric.name = "context_switches";
-                metric.unit = "switches";
-                break;
+            source->collect(snapshot);
         }
-        snapshot.metrics.push_back(metric);
     }
+    append_self_metrics(snapshot);
     return snapshot;
 }
 
+void MetricCollector::append_self_metrics(ProfilingSnapshot& snapshot)
+{
+    SelfUsage usage = self_monitor_.usage();
+
+    const std::pair<MetricType, uint64_t> deltas[] = {
+        {MetricType::PROFILER_CPU_TIME, usage.cpu_time_us - last_self_usage_.cpu_time_us},
+        {MetricType::PROFILER_CONTEXT_SWITCHES, usage.context_switches - last_self_usage_.context_switches},
+        {MetricType::PROFILER_PAGE_FAULTS, usage.page_faults - last_self_usage_.page_faults}
+    };
+    last_self_usage_ = usage;
+
+    for (const auto& [type, value] : deltas)
+    {
+        snapshot.metrics.push_back({type, value, metric_name(type), metric_unit(type)});
+    }
+    snapshot.stage_latencies = self_monitor_.stage_latencies();
+}
+
 bool MetricCollector::setup_perf_events(int pid, const std::vector<MetricType>& metrics) 
 {
-    for (auto metric_type : metrics)
+    std::string error;
+    if (counters_.settings().kernel_timed_batch > 0)
     {
-        int fd = open_perf_event(pid, metric_type);
-        if (fd < 0)
+        //PERF_SAMPLE_READ of inherited events needs a newer kernel than the tree mode does
+        if (counters_.settings().inherit)
         {
-            cleanup_perf_events();
+            report_error("[Profiler] Kernel-timed counters can't follow the process tree\n");
             return false;
         }
-        
-        perf_events_.push_back({fd, metric_type, 0});
+        if (!sampled_.open(pid, metrics, profiling_interval_ms_ * 1000000, counters_.settings().kernel_timed_batch, error))
+        {
+            report_error("[Profiler] " + error + " pid: " + std::to_string(pid) + "\n");
+            return false;
+        }
+        return true;
+    }
+    if (!counters_.open(pid, metrics, error))
+    {
+        report_error("[Profiler] " + error + " pid: " + std::to_string(pid) + "\n");
+        return false;
+    }
+    if (counters_.rotating_group_count() > 1)
+    {
+        report_log("[Profiler] Hardware events split into " + std::to_string(counters_.rotating_group_count()) + " groups, rotating every interval\n");
     }
-    
     return true;
 }
 
 void MetricCollector::cleanup_perf_events() 
 {
-    for (auto& event : perf_events_)
-    {
-        if (event.fd >= 0)
-        {
-            close(event.fd);
-        }
-    }
-    perf_events_.clear();
+    counters_.close();
+    sampled_.close();
 }
 
-int MetricCollector::open_perf_event(int pid, MetricType type) 
+bool MetricCollector::setup_sources(int pid, const std::vector<MetricType>& metrics)
 {
-    struct perf_event_attr attr;
-    memset(&attr, 0, sizeof(attr));
-    attr.size = sizeof(attr);
-    attr.disabled = 1;              
-    attr.exclude_kernel = 0;        
-    attr.exclude_hv = 1;            
-    
-    switch (type)
-    {
-        case MetricType::INSTRUCTIONS:
-            attr.type = PERF_TYPE_HARDWARE; 
-            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
-            break;
-        case MetricType::CPU_CYCLES:
-            attr.type = PERF_TYPE_HARDWARE; 
-            attr.config = PERF_COUNT_HW_CPU_CYCLES;
-            break;
-        case MetricType::CACHE_MISSES:
-            attr.type = PERF_TYPE_HARDWARE; 
-            attr.config = PERF_COUNT_HW_CACHE_MISSES;
-            break;
-        case MetricType::CACHE_REFERENCES:
-            attr.type = PERF_TYPE_HARDWARE; 
-            attr.config = PERF_COUNT_HW_CACHE_REFERENCES;
-            break;
-        case MetricType::BRANCH_MISSES:
-            attr.type = PERF_TYPE_HARDWARE; 
-            attr.config = PERF_COUNT_HW_BRANCH_MISSES;
-            break;
-        case MetricType::PAGE_FAULTS:
-            attr.type = PERF_TYPE_SOFTWARE; 
-            attr.config = PERF_COUNT_SW_PAGE_FAULTS;
-            break;
-        case MetricType::CONTEXT_SWITCHES:
-            attr.type = PERF_TYPE_SOFTWARE;  
-            attr.config = PERF_COUNT_SW_CONTEXT_SWITCHES;
-            break;
-        default:
-            return -1;
+    if (std::any_of(metrics.begin(), metrics.end(), is_memory_metric))
+    {
+        sources_.push_back(std::make_unique<MemorySource>(metrics));
     }
-    
-    int fd = perf_event_open(&attr, pid, -1, -1, 0);
-    if (fd < 0)
+    if (std::any_of(metrics.begin(), metrics.end(), is_sched_metric))
     {
-        report_error("[Profiler]Failed to open perf event " + std::to_string(static_cast<int>(type)) + " pid: " + std::to_string(pid));
-        return -1;
+        sources_.push_back(std::make_unique<SchedStatSource>(metrics));
     }
-    
-    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
-    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
-    
-    return fd;
+    if (std::find(metrics.begin(), metrics.end(), MetricType::OFFCPU_TIME) != metrics.end())
+    {
+        sources_.push_back(std::make_unique<OffCpuSource>(source_options_));
+    }
+    if (std::find(metrics.begin(), metrics.end(), MetricType::FAULT_SAMPLES) != metrics.end())
+    {
+        sources_.push_back(std::make_unique<FaultSource>(source_options_));
+    }
+    if (std::find(metrics.begin(), metrics.end(), MetricType::SYSCALL_COUNT) != metrics.end()
+        || std::find(metrics.begin(), metrics.end(), MetricType::SYSCALL_TIME) != metrics.end())
+    {
+        sources_.push_back(std::make_unique<SyscallSource>(source_options_));
+    }
+    if (std::find(metrics.begin(), metrics.end(), MetricType::FUTEX_WAITS) != metrics.end()
+        || std::find(metrics.begin(), metrics.end(), MetricType::FUTEX_WAIT_TIME) != metrics.end())
+    {
+        sources_.push_back(std::make_unique<FutexSource>(source_options_));
+    }
+    if (std::any_of(metrics.begin(), metrics.end(), is_io_metric))
+    {
+        sources_.push_back(std::make_unique<IoSource>(metrics));
+    }
+    if (std::find(metrics.begin(), metrics.end(), MetricType::BLOCK_REQUESTS) != metrics.end()
+        || std::find(metrics.begin(), metrics.end(), MetricType::BLOCK_TIME) != metrics.end())
+    {
+        sources_.push_back(std::make_unique<BlockSource>(source_options_));
+    }
+    if (source_options_.process_tree)
+    {
+        sources_.push_back(std::make_unique<ProcessTreeSource>(source_options_));
+    }
+    if (source_options_.allocs)
+    {
+        sources_.push_back(std::make_unique<AllocSource>(source_options_.allocs, source_options_));
+    }
+    //last: splits the values collected before it
+    if (source_options_.regions)
+    {
+        sources_.push_back(std::make_unique<RegionSource>(source_options_.regions));
+    }
+
+    for (auto& source : sources_)
+    {
+        std::string error;
+        if (!source->open(pid, error))
+        {
+            report_error("[Profiler] Failed to open " + std::string(source->name()) + " source: " + error);
+            cleanup_sources();
+            return false;
+        }
+    }
+    return true;
 }
 
-uint64_t MetricCollector::read_perf_event(int fd) 
+void MetricCollector::cleanup_sources()
 {
-    uint64_t value = 0;
-    if (read(fd, &value, sizeof(value)) != sizeof(value))
+    for (auto& source : sources_)
     {
-        return 0;
+        source->close();
     }
-    return value;
+    sources_.clear();
 }
 
 bool MetricCollector::is_process_alive(int pid) 
@@ -262,11 +394,6 @@ bool MetricCollector::is_process_alive(int pid)
     return (kill(pid, 0) == 0);
 }
 
-const std::vector<ProfilingSnapshot>& MetricCollector::get_snapshots() const 
-{
-    return snapshots_;
-}
-
 void MetricCollector::setup_error_callback(ProfilingErrorCallback callback)
 {
     error_callback_ = callback;
@@ -294,11 +421,11 @@ void MetricCollector::report_error(const std::string& error)
     }
 }
 
-void MetricCollector::report_metrics(const ProfilingSnapshot& snapshot)
+void MetricCollector::report_metrics(ProfilingSnapshot&& snapshot)
 {
     if(metric_callback_)
     {
-        metric_callback_(snapshot);
+        metric_callback_(std::move(snapshot));
     }
     else
     {
@@ -317,12 +444,3 @@ void MetricCollector::report_log(const std::string& log)
         report_error("Undefined log_callback in MC!");
     }
 }
-
-std::ostream& operator<<(std::ostream& ostr, const ProfilingSnapshot& snapshot)
-{
-    for(const auto& metric : snapshot.metrics)
-    {
-        ostr << metric.name << ": " << metric.value << std::endl;
-    }
-    return ostr;
-}
\ No newline at end of file
@@ -9,50 +9,16 @@
 #include <functional>
 #include <chrono>
 #include <iostream>
+#include <memory>
 
-enum class MetricType 
-{
-    INSTRUCTIONS,      
-    CPU_CYCLES,        
-    CACHE_MISSES,      
-    CACHE_REFERENCES,  
-    BRANCH_MISSES,     
-    PAGE_FAULTS,      
-    CONTEXT_SWITCHES   
-};
-
-
-struct MetricValue 
-{
-    MetricType type;    
-    uint64_t value;     
-    std::string name;   
-    std::string unit;   
-};
+#include "profiling_snapshot.h"
+#include "metric_source.h"
+#include "counter_scheduler.h"
+#include "sampled_counters.h"
+#include "adaptive_interval.h"
 
-
-struct ProfilingSnapshot 
-{
-    std::vector<MetricValue> metrics;
-    uint64_t timestamp_ms;             
-    uint64_t duration_ms;              
-    
-    const MetricValue* find_metric(MetricType type) const 
-    {
-        for (const auto& metric : metrics) 
-        {
-            if (metric.type == type) 
-            {
-                return &metric;
-            }
-        }
-        return nullptr;
-    }
-
-    friend std::ostream& operator<<(std::ostream& ostr, const ProfilingSnapshot& snapshot);
-};
-
-using ProfilingMetricCallback = std::function<void(const ProfilingSnapshot& snapshot)>;
+//the snapshot is handed over, the collector keeps no copy
+using ProfilingMetricCallback = std::function<void(ProfilingSnapshot&& snapshot)>;
 using ProfilingErrorCallback = std::function<void(const std::string& error)>;
 using ProfilingLogCallback = std::function<void(const std::string& log)>;
 
@@ -69,47 +35,57 @@ public:
     
     void stop_profiling();
     
-    const std::vector<ProfilingSnapshot>& get_snapshots() const;
-
     void setup_error_callback(ProfilingErrorCallback callback);
     void setup_metric_callback(ProfilingMetricCallback callback);
     void setup_log_callback(ProfilingLogCallback callback);
     
     bool is_profiling() const { return profiling_active_; }
     int get_profiled_pid() const { return profiled_pid_; }
+    SelfMonitor& get_self_monitor() { return self_monitor_; }
+    void set_housekeeping_cpus(const std::vector<int>& cpus) { housekeeping_cpus_ = cpus; }
+    void set_source_options(const SourceOptions& options) { source_options_ = options; }
+    void set_counter_settings(const CounterSettings& settings) { counters_.set_settings(settings); }
+    void set_adaptive_settings(const AdaptiveSettings& settings) { adaptive_settings_ = settings; }
 
 private:
-    struct PerfEvent 
-    {
-        int fd;                
-        MetricType type;       
-        uint64_t last_value;    
-    };
-    
     std::atomic<bool> profiling_active_{false};  
     std::atomic<int> profiled_pid_{-1};           
 
     std::thread profiling_thread_;              
-    std::vector<PerfEvent> perf_events_;        
+    CounterScheduler counters_;
+    SampledCounters sampled_;                   //instead of counters_ in kernel-timed mode
+    uint64_t last_sample_ns_ = 0;
+    uint64_t last_sources_ns_ = 0;              //the sources snapshot spans the batch since then
+    std::vector<std::unique_ptr<MetricSource>> sources_;
+    SourceOptions source_options_;
 
     ProfilingMetricCallback metric_callback_; 
     ProfilingErrorCallback error_callback_;   
     ProfilingLogCallback log_callback;
 
-    std::vector<ProfilingSnapshot> snapshots_; 
     uint64_t profiling_interval_ms_;            
+    AdaptiveSettings adaptive_settings_;
+    AdaptiveInterval adaptive_;
+    std::chrono::steady_clock::time_point last_sample_;
+
+    SelfMonitor self_monitor_;
+    std::vector<int> housekeeping_cpus_;
+    SelfUsage last_self_usage_;
     
     void profiling_loop();                     
+    void sampled_loop();
+    void report_samples(bool with_sources);
     bool setup_perf_events(int pid, const std::vector<MetricType>& metrics);
     void cleanup_perf_events();                 
+    bool setup_sources(int pid, const std::vector<MetricType>& metrics);
+    void cleanup_sources();
     ProfilingSnapshot collect_snapshot(uint64_t duration_ms);
+    void append_self_metrics(ProfilingSnapshot& snapshot);
 
     void report_error(const std::string& error);
-    void report_metrics(const ProfilingSnapshot& snapshot);
+    void report_metrics(ProfilingSnapshot&& snapshot);
     void report_log(const std::string& log);
     
-    int open_perf_event(int pid, MetricType type);
-    uint64_t read_perf_event(int fd);
     bool is_process_alive(int pid);
 };
 
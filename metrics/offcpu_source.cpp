@@ -0,0 +1,324 @@
+#include "offcpu_source.h"
+
+#include <algorithm>
+#include <fstream>
+
+#include "procfs_reader.h"
+
+static constexpr size_t offcpu_ring_pages = 64;
+
+OffCpuSource::OffCpuSource(const SourceOptions& options): options_(options)
+{
+}
+
+bool OffCpuSource::open(int pid, std::string& error)
+{
+    pid_ = pid;
+
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_CONTEXT_SWITCHES;
+    attr.sample_period = 1;
+    attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_CALLCHAIN;
+    attr.context_switch = 1;
+    attr.sample_id_all = 1;
+    attr.inherit = 1;
+    attr.task = 1;
+    attr.exclude_callchain_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.wakeup_events = 1;
+
+    if (!sampler_.open(pid, attr, offcpu_ring_pages, error))
+    {
+        return false;
+    }
+
+    stacks_.clear();
+    stacks_.reserve(max_stacks);
+    stacks_.resize(2);      //unknown_stack, overflow_stack
+    stack_index_.clear();
+    stack_index_.reserve(max_stacks);
+    pending_.clear();
+    lost_records_ = 0;
+
+    ProcfsFile comm;
+    char buffer[64];
+    ssize_t length = comm.open("/proc/" + std::to_string(pid) + "/comm") ? comm.read(buffer, sizeof(buffer)) : -1;
+    comm_ = length > 0 ? std::string(buffer, buffer[length - 1] == '\n' ? length - 1 : length) : std::to_string(pid);
+
+    maps_.load(pid);
+    ticks_since_maps_ = 0;
+
+    sampler_.enable();
+    return true;
+}
+
+void OffCpuSource::collect(ProfilingSnapshot& snapshot)
+{
+    drain();
+    uint64_t blocked_ns = process_events();
+
+    if (++ticks_since_maps_ >= maps_refresh_ticks)
+    {
+        //keep the maps fresh for symbolization, the target may be gone when we write
+        maps_.load(pid_);
+        ticks_since_maps_ = 0;
+    }
+
+    snapshot.metrics.push_back({MetricType::OFFCPU_TIME, blocked_ns, metric_name(MetricType::OFFCPU_TIME), metric_unit(MetricType::OFFCPU_TIME)});
+}
+
+void OffCpuSource::close()
+{
+    if (!sampler_.is_open())
+    {
+        return;
+    }
+
+    sampler_.disable();
+    drain();
+    process_events();
+    sampler_.close();
+
+    if (!options_.offcpu_folded_path.empty())
+    {
+        write_folded(options_.offcpu_folded_path);
+    }
+}
+
+void OffCpuSource::drain()
+{
+    sampler_.drain([this](const perf_event_header* record)
+    {
+        const char* body = reinterpret_cast<const char*>(record + 1);
+        const char* end = reinterpret_cast<const char*>(record) + record->size;
+
+        switch (record->type)
+        {
+            case PERF_RECORD_SAMPLE:
+            {
+                //pid, tid, time, nr, ips[nr]
+                if (body + 24 > end)
+                {
+                    return;
+                }
+                SwitchEvent event;
+                event.tid = *reinterpret_cast<const uint32_t*>(body + 4);
+                event.time = *reinterpret_cast<const uint64_t*>(body + 8);
+                uint64_t nr = *reinterpret_cast<const uint64_t*>(body + 16);
+                const uint64_t* ips = reinterpret_cast<const uint64_t*>(body + 24);
+                nr = std::min<uint64_t>(nr, (end - body - 24) / sizeof(uint64_t));
+                event.stack = intern_stack(ips, nr);
+                event.kind = 0;
+                event.preempted = false;
+                events_.push_back(event);
+                break;
+            }
+            case PERF_RECORD_SWITCH:
+            {
+                //sample_id trailer: pid, tid, time
+                if (end - body < 16)
+                {
+                    return;
+                }
+                SwitchEvent event;
+                event.tid = *reinterpret_cast<const uint32_t*>(end - 12);
+                event.time = *reinterpret_cast<const uint64_t*>(end - 8);
+                event.stack = unknown_stack;
+                event.kind = (record->misc & PERF_RECORD_MISC_SWITCH_OUT) ? 1 : 2;
+#ifdef PERF_RECORD_MISC_SWITCH_OUT_PREEMPT
+                event.preempted = (record->misc & PERF_RECORD_MISC_SWITCH_OUT_PREEMPT) != 0;
+#else
+                event.preempted = false;
+#endif
+                events_.push_back(event);
+                break;
+            }
+            case PERF_RECORD_EXIT:
+            {
+                //pid, ppid, tid, ptid, time
+                if (body + 24 > end)
+                {
+                    return;
+                }
+                SwitchEvent event;
+                event.tid = *reinterpret_cast<const uint32_t*>(body + 8);
+                event.time = *reinterpret_cast<const uint64_t*>(body + 16);
+                event.stack = unknown_stack;
+                event.kind = 3;
+                event.preempted = false;
+                events_.push_back(event);
+                break;
+            }
+            case PERF_RECORD_LOST:
+            {
+                lost_records_ += *reinterpret_cast<const uint64_t*>(body + 8);
+                break;
+            }
+            default:
+                break;
+        }
+    });
+}
+
+uint64_t OffCpuSource::process_events()
+{
+    //per-cpu rings are not ordered against each other
+    std::sort(events_.begin(), events_.end(), [](const SwitchEvent& a, const SwitchEvent& b)
+    {
+        return a.time != b.time ? a.time < b.time : a.kind < b.kind;
+    });
+
+    uint64_t blocked_total = 0;
+    for (const auto& event : events_)
+    {
+        if (event.kind == 3)
+        {
+            //an exiting thread switches out for the last time and never back in
+            pending_.erase(event.tid);
+            continue;
+        }
+        if (event.kind != 2)
+        {
+            auto it = pending_.find(event.tid);
+            if (it == pending_.end())
+            {
+                if (pending_.size() >= max_pending)
+                {
+                    //the switch-ins or exits of some threads were lost with their records
+                    sweep_pending(event.time);
+                }
+                if (pending_.size() >= max_pending)
+                {
+                    continue;
+                }
+                it = pending_.emplace(event.tid, PendingSwitch()).first;
+                it->second.out_time = event.time;
+            }
+            if (event.kind == 0)
+            {
+                it->second.out_time = event.time;
+                it->second.stack = event.stack;
+            }
+            else
+            {
+                it->second.preempted = event.preempted;
+            }
+            continue;
+        }
+
+        auto it = pending_.find(event.tid);
+        if (it == pending_.end())
+        {
+            continue;
+        }
+        uint64_t off_ns = event.time > it->second.out_time ? event.time - it->second.out_time : 0;
+        StackEntry& stack = stacks_[it->second.stack];
+        if (it->second.preempted)
+        {
+            stack.preempted_ns += off_ns;
+        }
+        else
+        {
+            stack.blocked_ns += off_ns;
+            blocked_total += off_ns;
+        }
+        stack.count++;
+        pending_.erase(it);
+    }
+    events_.clear();
+    return blocked_total;
+}
+
+void OffCpuSource::sweep_pending(uint64_t now)
+{
+    for (auto it = pending_.begin(); it != pending_.end();)
+    {
+        it = it->second.out_time + stale_pending_ns < now ? pending_.erase(it) : std::next(it);
+    }
+}
+
+uint32_t OffCpuSource::intern_stack(const uint64_t* ips, uint64_t nr)
+{
+    uint64_t frames[max_frames];
+    uint32_t depth = 0;
+    uint64_t hash = 1469598103934665603ull;
+    for (uint64_t i = 0; i < nr && depth < max_frames; i++)
+    {
+        if (ips[i] >= static_cast<uint64_t>(PERF_CONTEXT_MAX))
+        {
+            continue;   //PERF_CONTEXT_USER and friends
+        }
+        frames[depth++] = ips[i];
+        hash = (hash ^ ips[i]) * 1099511628211ull;
+    }
+    if (depth == 0)
+    {
+        return unknown_stack;
+    }
+
+    //a colliding callchain takes the next free key
+    for (auto it = stack_index_.find(hash); it != stack_index_.end(); it = stack_index_.find(++hash))
+    {
+        const StackEntry& stack = stacks_[it->second];
+        if (stack.depth == depth && std::equal(frames, frames + depth, stack.ips.begin()))
+        {
+            return it->second;
+        }
+    }
+    if (stacks_.size() >= max_stacks)
+    {
+        return overflow_stack;
+    }
+
+    StackEntry entry;
+    entry.hash = hash;
+    entry.depth = depth;
+    std::copy(frames, frames + depth, entry.ips.begin());
+    stacks_.push_back(entry);
+    uint32_t index = static_cast<uint32_t>(stacks_.size() - 1);
+    stack_index_.emplace(hash, index);
+    return index;
+}
+
+bool OffCpuSource::write_folded(const std::string& path) const
+{
+    std::ofstream out(path);
+    if (!out.is_open())
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < stacks_.size(); i++)
+    {
+        const StackEntry& stack = stacks_[i];
+        std::string frames = comm_;
+        if (i == unknown_stack)
+        {
+            frames += ";[unknown]";
+        }
+        else if (i == overflow_stack)
+        {
+            frames += ";[stack table full]";
+        }
+        for (uint32_t frame = stack.depth; frame > 0; frame--)
+        {
+            frames += ";" + maps_.format_address(stack.ips[frame - 1]);
+        }
+
+        if (stack.blocked_ns >= 1000)
+        {
+            out << frames << " " << stack.blocked_ns / 1000 << "\n";
+        }
+        if (stack.preempted_ns >= 1000)
+        {
+            out << frames << ";[preempted] " << stack.preempted_ns / 1000 << "\n";
+        }
+    }
+    if (lost_records_)
+    {
+        out << comm_ << ";[lost " << lost_records_ << " records] 1\n";
+    }
+    return true;
+}
@@ -0,0 +1,80 @@
+#ifndef OFFCPU_SOURCE_H
+#define OFFCPU_SOURCE_H
+
+#include <array>
+#include <unordered_map>
+#include <vector>
+
+#include "metric_source.h"
+#include "perf_ring.h"
+#include "proc_maps.h"
+
+//blocked time per user callchain from context-switch samples and PERF_RECORD_SWITCH
+class OffCpuSource : public MetricSource
+{
+public:
+    explicit OffCpuSource(const SourceOptions& options);
+
+    const char* name() const override { return "offcpu"; }
+    bool open(int pid, std::string& error) override;
+    void collect(ProfilingSnapshot& snapshot) override;
+    void close() override;
+
+    //"comm;outer;...;leaf <microseconds>" lines
+    bool write_folded(const std::string& path) const;
+
+private:
+    static constexpr size_t max_stacks = 4096;
+    static constexpr size_t max_frames = 32;
+    static constexpr size_t max_pending = 65536;
+    static constexpr uint64_t stale_pending_ns = 10000000000ull;    //swept once the table is full
+    static constexpr uint32_t unknown_stack = 0;
+    static constexpr uint32_t overflow_stack = 1;
+    static constexpr uint32_t maps_refresh_ticks = 50;
+
+    struct StackEntry
+    {
+        uint64_t hash = 0;
+        uint32_t depth = 0;
+        std::array<uint64_t, max_frames> ips{};
+        uint64_t blocked_ns = 0;
+        uint64_t preempted_ns = 0;
+        uint64_t count = 0;
+    };
+
+    struct SwitchEvent
+    {
+        uint64_t time;
+        uint32_t tid;
+        uint32_t stack;
+        uint8_t kind;       //0 - sample at switch-out, 1 - switch-out record, 2 - switch-in record, 3 - thread exit
+        bool preempted;
+    };
+
+    struct PendingSwitch
+    {
+        uint64_t out_time = 0;
+        uint32_t stack = unknown_stack;
+        bool preempted = false;
+    };
+
+    SourceOptions options_;
+    int pid_ = -1;
+    std::string comm_;
+    PerCpuSampler sampler_;
+    ProcMaps maps_;
+    uint32_t ticks_since_maps_ = 0;
+
+    std::vector<StackEntry> stacks_;
+    std::unordered_map<uint64_t, uint32_t> stack_index_;
+    std::unordered_map<uint32_t, PendingSwitch> pending_;
+    std::vector<SwitchEvent> events_;
+    uint64_t lost_records_ = 0;
+
+    void drain();
+    uint64_t process_events();
+    void sweep_pending(uint64_t now);
+    uint32_t intern_stack(const uint64_t* ips, uint64_t nr);
+};
+
+#endif
@@ -0,0 +1,228 @@
+#include "perf_ring.h"
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <cerrno>
+
+#include "procfs_reader.h"
+#include "../processes/isolation.h"
+
+std::vector<int> online_cpus()
+{
+    std::vector<int> cpus;
+    ProcfsFile online;
+    char buffer[256];
+    ssize_t length = online.open("/sys/devices/system/cpu/online") ? online.read(buffer, sizeof(buffer)) : -1;
+    if (length > 0)
+    {
+        std::string text(buffer, length);
+        while (!text.empty() && (text.back() == '\n' || text.back() == ' '))
+        {
+            text.pop_back();
+        }
+        parse_cpu_list(text, cpus);
+    }
+    if (cpus.empty())
+    {
+        for (long cpu = 0; cpu < sysconf(_SC_NPROCESSORS_ONLN); cpu++)
+        {
+            cpus.push_back(static_cast<int>(cpu));
+        }
+    }
+    return cpus;
+}
+
+PerfRing::PerfRing(PerfRing&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+PerfRing& PerfRing::operator=(PerfRing&& other) noexcept
+{
+    if (this != &other)
+    {
+        close();
+        base_ = other.base_;
+        mmap_size_ = other.mmap_size_;
+        data_size_ = other.data_size_;
+        page_size_ = other.page_size_;
+        scratch_ = std::move(other.scratch_);
+        other.base_ = nullptr;
+        other.mmap_size_ = 0;
+        other.data_size_ = 0;
+    }
+    return *this;
+}
+
+bool PerfRing::open(int fd, size_t data_pages, std::string& error)
+{
+    close();
+    if (data_pages == 0 || (data_pages & (data_pages - 1)) != 0)
+    {
+        error = "perf ring size must be a power of two pages";
+        return false;
+    }
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    page_size_ = page_size > 0 ? page_size : 4096;
+    data_size_ = data_pages * page_size_;
+    mmap_size_ = data_size_ + page_size_;
+
+    void* base = mmap(nullptr, mmap_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        error = std::string("mmap of perf ring failed: ") + strerror(errno);
+        return false;
+    }
+    base_ = base;
+    scratch_.assign(UINT16_MAX + 1, 0);     //a record is at most 64KB
+    return true;
+}
+
+void PerfRing::close()
+{
+    if (base_)
+    {
+        munmap(base_, mmap_size_);
+        base_ = nullptr;
+    }
+}
+
+bool PerCpuSampler::open(int pid, perf_event_attr attr, size_t data_pages, std::string& error)
+{
+    close();
+    attr.size = sizeof(attr);
+    attr.disabled = 1;
+    pid_ = pid;
+
+    for (int cpu : online_cpus())
+    {
+        int fd = sys_perf_event_open(&attr, pid, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+        if (fd < 0)
+        {
+            error = "perf_event_open on cpu " + std::to_string(cpu) + " failed: " + strerror(errno);
+            close();
+            return false;
+        }
+        fds_.push_back(fd);
+
+        PerfRing ring;
+        if (!ring.open(fd, data_pages, error))
+        {
+            close();
+            return false;
+        }
+        rings_.push_back(std::move(ring));
+        cpus_.push_back(cpu);
+    }
+    attrs_.push_back(attr);
+    return !fds_.empty();
+}
+
+bool PerCpuSampler::add_event(perf_event_attr attr, std::string& error)
+{
+    attr.size = sizeof(attr);
+    attr.disabled = 1;
+
+    size_t rings = rings_.size();
+    for (size_t i = 0; i < rings; i++)
+    {
+        int fd = sys_perf_event_open(&attr, pid_, cpus_[i], -1, PERF_FLAG_FD_CLOEXEC);
+        if (fd < 0)
+        {
+            error = "perf_event_open on cpu " + std::to_string(cpus_[i]) + " failed: " + strerror(errno);
+            return false;
+        }
+        fds_.push_back(fd);
+        if (ioctl(fd, PERF_EVENT_IOC_SET_OUTPUT, fds_[i]) != 0)
+        {
+            error = std::string("redirecting perf output failed: ") + strerror(errno);
+            return false;
+        }
+    }
+    attrs_.push_back(attr);
+    return true;
+}
+
+bool PerCpuSampler::add_thread(int tid, std::string& error)
+{
+    size_t rings = rings_.size();
+    for (perf_event_attr attr : attrs_)
+    {
+        for (size_t i = 0; i < rings; i++)
+        {
+            int fd = sys_perf_event_open(&attr, tid, cpus_[i], -1, PERF_FLAG_FD_CLOEXEC);
+            if (fd < 0)
+            {
+                error = "perf_event_open for thread " + std::to_string(tid) + " failed: " + strerror(errno);
+                return false;
+            }
+            fds_.push_back(fd);
+            if (ioctl(fd, PERF_EVENT_IOC_SET_OUTPUT, fds_[i]) != 0)
+            {
+                error = std::string("redirecting perf output failed: ") + strerror(errno);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void PerCpuSampler::close()
+{
+    rings_.clear();
+    for (int fd : fds_)
+    {
+        ::close(fd);
+    }
+    fds_.clear();
+    attrs_.clear();
+    cpus_.clear();
+}
+
+int PerCpuSampler::wait(int timeout_ms)
+{
+    //only the fds owning a ring, redirected events wake through them
+    poll_fds_.resize(rings_.size());
+    for (size_t i = 0; i < rings_.size(); i++)
+    {
+        poll_fds_[i] = {fds_[i], POLLIN, 0};
+    }
+    if (poll_fds_.empty() || poll(poll_fds_.data(), poll_fds_.size(), timeout_ms) < 0)
+    {
+        return -1;
+    }
+
+    int ready = 0;
+    for (const auto& entry : poll_fds_)
+    {
+        if (entry.revents & (POLLHUP | POLLERR))
+        {
+            return -1;
+        }
+        ready += (entry.revents & POLLIN) != 0;
+    }
+    return ready;
+}
+
+bool PerCpuSampler::enable()
+{
+    bool ok = true;
+    for (int fd : fds_)
+    {
+        ok = ioctl(fd, PERF_EVENT_IOC_ENABLE, 0) == 0 && ok;
+    }
+    return ok;
+}
+
+bool PerCpuSampler::disable()
+{
+    bool ok = true;
+    for (int fd : fds_)
+    {
+        ok = ioctl(fd, PERF_EVENT_IOC_DISABLE, 0) == 0 && ok;
+    }
+    return ok;
+}
@@ -0,0 +1,151 @@
+#ifndef PERF_RING_H
+#define PERF_RING_H
+
+#include <linux/perf_event.h>
+#include <poll.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../counters/perf_event.h"
+
+//mmap'ed perf ring buffer of one event fd
+class PerfRing
+{
+public:
+    PerfRing() = default;
+    ~PerfRing() { close(); }
+
+    PerfRing(const PerfRing&) = delete;
+    PerfRing& operator=(const PerfRing&) = delete;
+    PerfRing(PerfRing&& other) noexcept;
+    PerfRing& operator=(PerfRing&& other) noexcept;
+
+    //data_pages must be a power of two
+    bool open(int fd, size_t data_pages, std::string& error);
+    void close();
+    bool is_open() const { return base_ != nullptr; }
+
+    perf_event_mmap_page* header() const { return static_cast<perf_event_mmap_page*>(base_); }
+
+    //calls on_record(const perf_event_header*) for every record, wrapped records
+    //are copied into a scratch buffer owned by the ring, nothing is allocated per record
+    template <typename F>
+    size_t drain(F&& on_record)
+    {
+        if (!base_)
+        {
+            return 0;
+        }
+
+        perf_event_mmap_page* page = header();
+        uint64_t head = __atomic_load_n(&page->data_head, __ATOMIC_ACQUIRE);
+        uint64_t tail = page->data_tail;
+        const char* data = static_cast<const char*>(base_) + page_size_;
+
+        size_t records = 0;
+        while (tail < head)
+        {
+            size_t offset = tail & (data_size_ - 1);
+            const perf_event_header* record = reinterpret_cast<const perf_event_header*>(data + offset);
+            perf_event_header record_header;
+            if (offset + sizeof(record_header) > data_size_)
+            {
+                copy_wrapped(data, offset, &record_header, sizeof(record_header));
+                record = &record_header;
+            }
+            else
+            {
+                record_header = *record;
+            }
+
+            if (record_header.size == 0)
+            {
+                break;
+            }
+            if (offset + record_header.size > data_size_)
+            {
+                copy_wrapped(data, offset, scratch_.data(), record_header.size);
+                record = reinterpret_cast<const perf_event_header*>(scratch_.data());
+            }
+
+            on_record(record);
+            tail += record_header.size;
+            records++;
+        }
+
+        __atomic_store_n(&page->data_tail, tail, __ATOMIC_RELEASE);
+        return records;
+    }
+
+private:
+    void* base_ = nullptr;
+    size_t mmap_size_ = 0;
+    size_t data_size_ = 0;
+    size_t page_size_ = 4096;
+    std::vector<char> scratch_;
+
+    void copy_wrapped(const char* data, size_t offset, void* out, size_t size) const
+    {
+        size_t first = std::min(size, data_size_ - offset);
+        memcpy(out, data + offset, first);
+        memcpy(static_cast<char*>(out) + first, data, size - first);
+    }
+};
+
+//the same sampling event opened on every online CPU for a task and its
+//descendants (inherit needs per-cpu events to be mmap'able)
+class PerCpuSampler
+{
+public:
+    PerCpuSampler() = default;
+    ~PerCpuSampler() { close(); }
+
+    PerCpuSampler(const PerCpuSampler&) = delete;
+    PerCpuSampler& operator=(const PerCpuSampler&) = delete;
+
+    bool open(int pid, perf_event_attr attr, size_t data_pages, std::string& error);
+    //another event of the same task written into the already open per-cpu rings,
+    //so records of both stay ordered in time on each CPU
+    bool add_event(perf_event_attr attr, std::string& error);
+    //the events opened so far for a thread that already existed, inherit only
+    //follows threads created after open(); false if the thread is gone
+    bool add_thread(int tid, std::string& error);
+    void close();
+    bool is_open() const { return !rings_.empty(); }
+
+    bool enable();
+    bool disable();
+    const std::vector<int>& fds() const { return fds_; }
+
+    //waits until a ring passes its wakeup watermark: rings with data, 0 on
+    //timeout, -1 once the task is gone (the fds then poll as hung up forever)
+    int wait(int timeout_ms);
+
+    template <typename F>
+    size_t drain(F&& on_record)
+    {
+        size_t records = 0;
+        for (auto& ring : rings_)
+        {
+            records += ring.drain(on_record);
+        }
+        return records;
+    }
+
+private:
+    int pid_ = -1;
+    std::vector<int> cpus_;
+    std::vector<int> fds_;
+    std::vector<perf_event_attr> attrs_;
+    std::vector<PerfRing> rings_;
+    std::vector<pollfd> poll_fds_;
+};
+
+std::vector<int> online_cpus();
+
+#endif
@@ -0,0 +1,75 @@
+#include "proc_maps.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+bool ProcMaps::load(int pid)
+{
+    std::ifstream maps("/proc/" + std::to_string(pid) + "/maps");
+    if (!maps.is_open())
+    {
+        return false;
+    }
+
+    std::vector<MemoryMapping> mappings;
+    std::string line;
+    while (std::getline(maps, line))
+    {
+        //start-end perms offset dev inode path
+        MemoryMapping mapping;
+        std::istringstream istr(line);
+        std::string range, dev;
+        istr >> range >> mapping.permissions >> std::hex >> mapping.offset >> std::dec >> dev >> mapping.inode;
+        std::getline(istr >> std::ws, mapping.path);
+
+        size_t dash = range.find('-');
+        if (dash == std::string::npos)
+        {
+            continue;
+        }
+        mapping.start = std::stoull(range.substr(0, dash), nullptr, 16);
+        mapping.end = std::stoull(range.substr(dash + 1), nullptr, 16);
+        mappings.push_back(std::move(mapping));
+    }
+
+    std::sort(mappings.begin(), mappings.end(), [](const MemoryMapping& a, const MemoryMapping& b){ return a.start < b.start; });
+    mappings_ = std::move(mappings);
+    return true;
+}
+
+const MemoryMapping* ProcMaps::find(uint64_t address) const
+{
+    auto it = std::upper_bound(mappings_.begin(), mappings_.end(), address, [](uint64_t value, const MemoryMapping& mapping){ return value < mapping.start; });
+    if (it == mappings_.begin())
+    {
+        return nullptr;
+    }
+    --it;
+    return address < it->end ? &*it : nullptr;
+}
+
+std::string ProcMaps::format_address(uint64_t address) const
+{
+    char buffer[32];
+    const MemoryMapping* mapping = find(address);
+    if (!mapping || mapping->path.empty() || mapping->path[0] == '[')
+    {
+        snprintf(buffer, sizeof(buffer), "0x%llx", static_cast<unsigned long long>(address));
+        return buffer;
+    }
+
+    snprintf(buffer, sizeof(buffer), "+0x%llx", static_cast<unsigned long long>(address - mapping->start + mapping->offset));
+    size_t slash = mapping->path.rfind('/');
+    return mapping->path.substr(slash == std::string::npos ? 0 : slash + 1) + buffer;
+}
+
+std::string mapping_label(const MemoryMapping& mapping)
+{
+    if (!mapping.path.empty())
+    {
+        return mapping.path;
+    }
+    return "[anon " + mapping.permissions + "]";
+}
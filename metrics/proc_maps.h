@@ -0,0 +1,34 @@
+#ifndef PROC_MAPS_H
+#define PROC_MAPS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct MemoryMapping
+{
+    uint64_t start = 0;
+    uint64_t end = 0;
+    uint64_t offset = 0;
+    uint64_t inode = 0;
+    std::string permissions;
+    std::string path;       //[heap], [stack], file path or empty for anonymous
+};
+
+//snapshot of /proc/<pid>/maps for address lookups
+class ProcMaps
+{
+public:
+    bool load(int pid);
+    const MemoryMapping* find(uint64_t address) const;
+    //"libc.so.6+0x1a2b3" for file mappings, the raw address otherwise
+    std::string format_address(uint64_t address) const;
+    const std::vector<MemoryMapping>& mappings() const { return mappings_; }
+
+private:
+    std::vector<MemoryMapping> mappings_;
+};
+
+std::string mapping_label(const MemoryMapping& mapping);
+
+#endif
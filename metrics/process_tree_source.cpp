@@ -0,0 +1,590 @@
+#include "process_tree_source.h"
+
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+
+#include "procfs_reader.h"
+
+//fork, comm, exit and three READ records per exiting task; sized for thousands of exits per tick
+static constexpr size_t tree_ring_pages = 128;
+
+static std::string read_comm(const std::string& path, const std::string& fallback)
+{
+    ProcfsFile comm;
+    char buffer[64];
+    ssize_t length = comm.open(path) ? comm.read(buffer, sizeof(buffer)) : -1;
+    return length > 0 ? std::string(buffer, buffer[length - 1] == '\n' ? length - 1 : length) : fallback;
+}
+
+//root and every process below it, from the ppid of each /proc/<pid>/stat
+static std::vector<uint32_t> list_descendants(uint32_t root)
+{
+    std::unordered_map<uint32_t, std::vector<uint32_t>> children;
+    DIR* dir = opendir("/proc");
+    if (dir)
+    {
+        while (dirent* entry = readdir(dir))
+        {
+            char* end = nullptr;
+            long pid = strtol(entry->d_name, &end, 10);
+            if (*end != '\0' || pid <= 0)
+            {
+                continue;
+            }
+
+            ProcfsFile stat;
+            char buffer[512];
+            ssize_t length = stat.open(std::string("/proc/") + entry->d_name + "/stat") ? stat.read(buffer, sizeof(buffer)) : -1;
+            int64_t ppid = 0;
+            if (length > 0 && parse_procfs_token(skip_procfs_stat_comm(buffer, length), buffer + length, 1, ppid))
+            {
+                children[static_cast<uint32_t>(ppid)].push_back(static_cast<uint32_t>(pid));
+            }
+        }
+        closedir(dir);
+    }
+
+    std::vector<uint32_t> tree{root};
+    for (size_t i = 0; i < tree.size(); i++)
+    {
+        auto it = children.find(tree[i]);
+        if (it != children.end())
+        {
+            tree.insert(tree.end(), it->second.begin(), it->second.end());
+        }
+    }
+    return tree;
+}
+
+ProcessTreeSource::ProcessTreeSource(const SourceOptions& options): options_(options)
+{
+}
+
+bool ProcessTreeSource::open(int pid, std::string& error)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_TASK_CLOCK;
+    attr.read_format = PERF_FORMAT_ID;
+    attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME;
+    attr.sample_id_all = 1;
+    attr.inherit = 1;
+    attr.inherit_stat = 1;
+    attr.exclude_hv = 1;
+    //the task clock event owns the rings and carries the task records
+    attr.task = 1;
+    attr.comm = 1;
+    attr.comm_exec = 1;
+
+    if (!sampler_.open(pid, attr, tree_ring_pages, error))
+    {
+        return false;
+    }
+    attr.task = 0;
+    attr.comm = 0;
+    attr.comm_exec = 0;
+    for (auto config : {PERF_COUNT_SW_PAGE_FAULTS, PERF_COUNT_SW_CONTEXT_SWITCHES})
+    {
+        attr.config = config;
+        if (!sampler_.add_event(attr, error))
+        {
+            sampler_.close();
+            return false;
+        }
+    }
+
+    cpus_ = sampler_.fds().size() / column_count;
+    column_of_.clear();
+    if (!map_columns(0, error))
+    {
+        sampler_.close();
+        return false;
+    }
+
+    interval_.clear();
+    total_.clear();
+    command_index_.clear();
+    tasks_.clear();
+    processes_.clear();
+    attached_.clear();
+    exited_.clear();
+    exited_previous_.clear();
+    events_.clear();
+    last_tree_.fill(0);
+    live_.fill(0);
+    held_.fill(0);
+    exited_total_.fill(0);
+    forks_ = 0;
+    exits_ = 0;
+    lost_records_ = 0;
+
+    std::string name = read_comm("/proc/" + std::to_string(pid) + "/comm", std::to_string(pid));
+    root_command_ = intern_command(name.data(), name.size());
+    tasks_[pid] = root_command_;
+    root_pid_ = static_cast<uint32_t>(pid);
+    processes_[root_pid_].attached = true;
+    attached_.insert(root_pid_);
+    attach_descendants(root_pid_);
+
+    sampler_.enable();
+    return true;
+}
+
+bool ProcessTreeSource::map_columns(size_t first, std::string& error)
+{
+    //fds are per column, one per CPU each
+    const std::vector<int>& fds = sampler_.fds();
+    for (size_t i = first; i < fds.size(); i++)
+    {
+        uint64_t id = 0;
+        if (ioctl(fds[i], PERF_EVENT_IOC_ID, &id) != 0)
+        {
+            error = std::string("can't get perf event id: ") + strerror(errno);
+            return false;
+        }
+        column_of_[id] = static_cast<uint32_t>((i - first) / cpus_);
+    }
+    return true;
+}
+
+void ProcessTreeSource::attach_descendants(uint32_t pid)
+{
+    //a fork during a pass is not inherited either, the next pass finds it
+    for (int pass = 0; pass < attach_passes; pass++)
+    {
+        bool found = false;
+        for (uint32_t process : list_descendants(pid))
+        {
+            std::string task_dir = "/proc/" + std::to_string(process) + "/task";
+            DIR* dir = opendir(task_dir.c_str());
+            if (!dir)
+            {
+                continue;
+            }
+            while (dirent* entry = readdir(dir))
+            {
+                char* end = nullptr;
+                long tid = strtol(entry->d_name, &end, 10);
+                if (*end != '\0' || tid <= 0 || attached_.count(tid) || attached_.size() >= max_attached || processes_.size() >= max_tasks)
+                {
+                    continue;
+                }
+                //a thread gone meanwhile or out of fds is still in the stat of its process
+                std::string error;
+                size_t first = sampler_.fds().size();
+                sampler_.add_thread(tid, error);
+                map_columns(first, error);
+                attached_.insert(tid);
+                std::string name = read_comm(task_dir + "/" + entry->d_name + "/comm", std::to_string(tid));
+                tasks_.emplace(tid, intern_command(name.data(), name.size()));
+                processes_[process].attached = true;
+                found = true;
+            }
+            closedir(dir);
+        }
+        if (!found)
+        {
+            break;
+        }
+    }
+}
+
+void ProcessTreeSource::collect(ProfilingSnapshot& snapshot)
+{
+    drain();
+    process_events();
+
+    std::array<uint64_t, column_count> tree_delta, live_delta;
+    advance(tree_delta, live_delta);
+
+    std::vector<uint32_t> active;
+    for (uint32_t i = 0; i < interval_.size(); i++)
+    {
+        if (interval_[i].processes || interval_[i].values[0])
+        {
+            active.push_back(i);
+        }
+    }
+    std::sort(active.begin(), active.end(), [this](uint32_t a, uint32_t b) { return interval_[a].values[0] > interval_[b].values[0]; });
+    if (std::any_of(live_delta.begin(), live_delta.end(), [](uint64_t value) { return value != 0; }))
+    {
+        snapshot.commands.push_back({"[live]", 0, live_delta[0], live_delta[1], live_delta[2]});
+    }
+    for (size_t i = 0; i < active.size() && i < top_commands; i++)
+    {
+        const CommandTotals& command = interval_[active[i]];
+        snapshot.commands.push_back({command.name, command.processes, command.values[0], command.values[1], command.values[2]});
+    }
+
+    snapshot.metrics.push_back({MetricType::TREE_PROCESSES, forks_, metric_name(MetricType::TREE_PROCESSES), metric_unit(MetricType::TREE_PROCESSES)});
+    snapshot.metrics.push_back({MetricType::TREE_EXITS, exits_, metric_name(MetricType::TREE_EXITS), metric_unit(MetricType::TREE_EXITS)});
+    snapshot.metrics.push_back({MetricType::TREE_TASKS, tasks_.size(), metric_name(MetricType::TREE_TASKS), metric_unit(MetricType::TREE_TASKS)});
+    snapshot.metrics.push_back({MetricType::TREE_CPU_TIME, tree_delta[0], metric_name(MetricType::TREE_CPU_TIME), metric_unit(MetricType::TREE_CPU_TIME)});
+    fold_interval();
+}
+
+void ProcessTreeSource::close()
+{
+    if (!sampler_.is_open())
+    {
+        return;
+    }
+
+    sampler_.disable();
+    drain();
+    process_events();
+    std::array<uint64_t, column_count> tree_delta, live_delta;
+    advance(tree_delta, live_delta);
+    fold_interval();
+    sampler_.close();
+
+    if (!options_.tree_table_path.empty())
+    {
+        write_table(options_.tree_table_path);
+    }
+}
+
+void ProcessTreeSource::drain()
+{
+    sampler_.drain([this](const perf_event_header* record)
+    {
+        const char* body = reinterpret_cast<const char*>(record + 1);
+        const char* end = reinterpret_cast<const char*>(record) + record->size;
+        const uint32_t* ids = reinterpret_cast<const uint32_t*>(body);
+
+        TreeEvent event{};
+        switch (record->type)
+        {
+            case PERF_RECORD_FORK:
+            case PERF_RECORD_EXIT:
+            {
+                //pid, ppid, tid, ptid, time
+                if (body + 24 > end)
+                {
+                    return;
+                }
+                event.kind = record->type == PERF_RECORD_FORK ? EventKind::FORK : EventKind::EXIT;
+                event.pid = ids[0];
+                event.tid = ids[2];
+                event.parent_tid = ids[3];
+                event.time = *reinterpret_cast<const uint64_t*>(body + 16);
+                break;
+            }
+            case PERF_RECORD_COMM:
+            {
+                //pid, tid, comm[], sample_id: pid, tid, time
+                if (body + 8 + 16 > end)
+                {
+                    return;
+                }
+                const char* name = body + 8;
+                event.kind = EventKind::COMM;
+                event.pid = ids[0];
+                event.tid = ids[1];
+                event.command = intern_command(name, strnlen(name, end - 16 - name));
+                event.time = *reinterpret_cast<const uint64_t*>(end - 8);
+                break;
+            }
+            case PERF_RECORD_READ:
+            {
+                //pid, tid, value, id, sample_id: pid, tid, time
+                if (body + 24 + 16 > end)
+                {
+                    return;
+                }
+                auto column = column_of_.find(*reinterpret_cast<const uint64_t*>(body + 16));
+                if (column == column_of_.end())
+                {
+                    return;
+                }
+                event.kind = EventKind::READ;
+                event.pid = ids[0];
+                event.tid = ids[1];
+                event.value = *reinterpret_cast<const uint64_t*>(body + 8);
+                event.column = column->second;
+                event.time = *reinterpret_cast<const uint64_t*>(end - 8);
+                break;
+            }
+            case PERF_RECORD_LOST:
+            {
+                lost_records_ += *reinterpret_cast<const uint64_t*>(body + 8);
+                return;
+            }
+            default:
+                return;
+        }
+        events_.push_back(event);
+    });
+}
+
+void ProcessTreeSource::process_events()
+{
+    //per-cpu rings are not ordered against each other
+    std::stable_sort(events_.begin(), events_.end(), [](const TreeEvent& a, const TreeEvent& b) { return a.time < b.time; });
+
+    for (const auto& event : events_)
+    {
+        auto task = tasks_.find(event.tid);
+        switch (event.kind)
+        {
+            case EventKind::FORK:
+            {
+                auto parent = tasks_.find(event.parent_tid);
+                if (task == tasks_.end() && tasks_.size() < max_tasks)
+                {
+                    tasks_[event.tid] = parent != tasks_.end() ? parent->second : root_command_;
+                }
+                if (event.pid == event.tid)
+                {
+                    forks_++;
+                    if (processes_.size() < max_tasks)
+                    {
+                        processes_.emplace(event.pid, ProcessEntry());
+                    }
+                }
+                break;
+            }
+            case EventKind::COMM:
+            {
+                if (task != tasks_.end())
+                {
+                    task->second = event.command;
+                }
+                else if (tasks_.size() < max_tasks)
+                {
+                    tasks_[event.tid] = event.command;
+                }
+                break;
+            }
+            case EventKind::READ:
+            {
+                if (attached_.count(event.tid))
+                {
+                    break;      //the events' own counts plus every exited child, attached tasks are in [live]
+                }
+                //the kernel writes a task's READ records just after its EXIT
+                uint32_t command = root_command_;
+                if (task != tasks_.end())
+                {
+                    command = task->second;
+                }
+                else if (auto exited = exited_.find(event.tid); exited != exited_.end())
+                {
+                    command = exited->second;
+                }
+                else if (auto previous = exited_previous_.find(event.tid); previous != exited_previous_.end())
+                {
+                    command = previous->second;
+                }
+                interval_[command].values[event.column] += event.value;
+                //status has the leader's own switches, stat the totals of every thread of the process
+                auto process = processes_.find(event.pid);
+                if (event.pid != event.tid && event.column != switches_column && process != processes_.end())
+                {
+                    process->second.exited_threads[event.column] += event.value;
+                }
+                break;
+            }
+            case EventKind::EXIT:
+            {
+                if (event.pid == event.tid)
+                {
+                    exits_++;
+                    interval_[task != tasks_.end() ? task->second : root_command_].processes++;
+                    //its READ records come next, an attached one is held once procfs loses it
+                    auto process = processes_.find(event.pid);
+                    if (process != processes_.end() && !process->second.attached)
+                    {
+                        processes_.erase(process);
+                    }
+                }
+                if (task != tasks_.end())
+                {
+                    exited_[event.tid] = task->second;
+                    tasks_.erase(task);
+                }
+                break;
+            }
+        }
+    }
+    events_.clear();
+}
+
+void ProcessTreeSource::advance(std::array<uint64_t, column_count>& tree_delta, std::array<uint64_t, column_count>& live_delta)
+{
+    for (const auto& command : interval_)
+    {
+        for (size_t column = 0; column < column_count; column++)
+        {
+            exited_total_[column] += command.values[column];
+        }
+    }
+
+    //per process: its stat adds up the threads that exited, which had their READ already
+    std::array<uint64_t, column_count> live{};
+    for (auto it = processes_.begin(); it != processes_.end();)
+    {
+        ProcessEntry& process = it->second;
+        std::array<uint64_t, column_count> values;
+        if (!read_process(it->first, values))
+        {
+            if (process.attached)
+            {
+                for (size_t column = 0; column < column_count; column++)
+                {
+                    held_[column] += process.values[column];
+                }
+            }
+            it = processes_.erase(it);
+            continue;
+        }
+        for (size_t column = 0; column < column_count; column++)
+        {
+            values[column] -= std::min(values[column], process.exited_threads[column]);
+            live[column] += values[column];
+        }
+        process.values = values;
+        ++it;
+    }
+
+    for (size_t column = 0; column < column_count; column++)
+    {
+        live[column] += held_[column];
+        uint64_t tree = exited_total_[column] + live[column];
+        tree_delta[column] = tree > last_tree_[column] ? tree - last_tree_[column] : 0;
+        last_tree_[column] = std::max(last_tree_[column], tree);
+        live_delta[column] = live[column] > live_[column] ? live[column] - live_[column] : 0;
+        live_[column] = live[column];
+    }
+}
+
+bool ProcessTreeSource::read_process(uint32_t pid, std::array<uint64_t, column_count>& values) const
+{
+    static const uint64_t ns_per_tick = 1000000000ull / static_cast<uint64_t>(sysconf(_SC_CLK_TCK));
+    std::string base = "/proc/" + std::to_string(pid);
+    char buffer[4096];
+
+    //minflt, majflt, utime, stime are the 8th, 10th, 12th and 13th fields after comm,
+    //totals of every thread of the process including the exited ones
+    ProcfsFile stat;
+    ssize_t length = stat.open(base + "/stat") ? stat.read(buffer, sizeof(buffer)) : -1;
+    if (length <= 0)
+    {
+        return false;
+    }
+    const char* end = buffer + length;
+    const char* fields = skip_procfs_stat_comm(buffer, length);
+    int64_t minor = 0, major = 0, user = 0, system = 0;
+    if (!parse_procfs_token(fields, end, 7, minor) || !parse_procfs_token(fields, end, 9, major) ||
+        !parse_procfs_token(fields, end, 11, user) || !parse_procfs_token(fields, end, 12, system))
+    {
+        return false;
+    }
+    values[0] = static_cast<uint64_t>(user + system) * ns_per_tick;
+    values[1] = static_cast<uint64_t>(minor + major);
+
+    uint64_t voluntary = 0, involuntary = 0;
+    ProcfsField switches[] = {{"voluntary_ctxt_switches", &voluntary, false}, {"nonvoluntary_ctxt_switches", &involuntary, false}};
+    ProcfsFile status;
+    length = status.open(base + "/status") ? status.read(buffer, sizeof(buffer)) : -1;
+    if (length > 0)
+    {
+        scan_procfs_fields(buffer, length, switches, 2);
+    }
+    values[2] = voluntary + involuntary;
+    return true;
+}
+
+void ProcessTreeSource::fold_interval()
+{
+    for (size_t i = 0; i < interval_.size(); i++)
+    {
+        total_[i].processes += interval_[i].processes;
+        for (size_t column = 0; column < column_count; column++)
+        {
+            total_[i].values[column] += interval_[i].values[column];
+        }
+        interval_[i].processes = 0;
+        interval_[i].values.fill(0);
+    }
+    forks_ = 0;
+    exits_ = 0;
+    exited_previous_.swap(exited_);
+    exited_.clear();
+}
+
+uint32_t ProcessTreeSource::intern_command(const char* name, size_t length)
+{
+    //comm is at most 16 bytes, the key stays in the small string buffer;
+    //"Web Content" would split the space-separated tables and T records
+    std::string key(name, length);
+    std::replace_if(key.begin(), key.end(), [](char c){ return c == ' ' || c == '\t' || c == '\n'; }, '_');
+    auto it = command_index_.find(key);
+    if (it != command_index_.end())
+    {
+        return it->second;
+    }
+    if (interval_.size() >= max_commands - 1)
+    {
+        key = "[other]";
+        it = command_index_.find(key);
+        if (it != command_index_.end())
+        {
+            return it->second;
+        }
+    }
+
+    uint32_t index = static_cast<uint32_t>(interval_.size());
+    CommandTotals command;
+    command.name = key;
+    interval_.push_back(command);
+    total_.push_back(command);
+    command_index_[key] = index;
+    return index;
+}
+
+bool ProcessTreeSource::write_table(const std::string& path) const
+{
+    std::ofstream out(path);
+    if (!out.is_open())
+    {
+        return false;
+    }
+
+    std::vector<uint32_t> order;
+    for (uint32_t i = 0; i < total_.size(); i++)
+    {
+        if (total_[i].processes || total_[i].values[0])
+        {
+            order.push_back(i);
+        }
+    }
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return total_[a].values[0] > total_[b].values[0]; });
+
+    std::array<uint64_t, column_count> tree = live_;
+    uint64_t processes = 0;
+    out << "# command processes cpu_ns page_faults context_switches\n";
+    for (uint32_t i : order)
+    {
+        const CommandTotals& command = total_[i];
+        out << command.name << ' ' << command.processes << ' ' << command.values[0] << ' ' << command.values[1] << ' ' << command.values[2] << '\n';
+        processes += command.processes;
+        for (size_t column = 0; column < column_count; column++)
+        {
+            tree[column] += command.values[column];
+        }
+    }
+    //the root task and tasks that never exited while profiled
+    out << "[live] 0 " << live_[0] << ' ' << live_[1] << ' ' << live_[2] << '\n';
+    out << "# tree " << processes << ' ' << tree[0] << ' ' << tree[1] << ' ' << tree[2] << '\n';
+    if (lost_records_)
+    {
+        out << "# lost " << lost_records_ << " records\n";
+    }
+    return true;
+}
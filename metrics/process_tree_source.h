@@ -0,0 +1,110 @@
+#ifndef PROCESS_TREE_SOURCE_H
+#define PROCESS_TREE_SOURCE_H
+
+#include <array>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "metric_source.h"
+#include "perf_ring.h"
+
+//follows every descendant of the target: fork/comm/exit records name the tasks,
+//inherited counters with inherit_stat hand back each task's counts as
+//PERF_RECORD_READ when it exits, which are summed per command name; running
+//processes are read from procfs, inherit_stat makes the kernel swap counts
+//between cloned contexts and the events themselves do not read back a sane total.
+//Descendants started before open() inherit nothing, the events are opened on
+//each of their threads so that what they start later is followed
+class ProcessTreeSource : public MetricSource
+{
+public:
+    explicit ProcessTreeSource(const SourceOptions& options);
+
+    const char* name() const override { return "process tree"; }
+    bool open(int pid, std::string& error) override;
+    void collect(ProfilingSnapshot& snapshot) override;
+    void close() override;
+
+    //whole-run totals, one command per line ordered by CPU time
+    bool write_table(const std::string& path) const;
+
+private:
+    static constexpr size_t max_commands = 1024;        //later names share [other]
+    static constexpr size_t max_tasks = 262144;
+    static constexpr size_t top_commands = 8;
+    static constexpr size_t column_count = 3;           //task clock, page faults, context switches
+    static constexpr size_t max_attached = 1024;        //threads running at open(), later ones are only in procfs
+    static constexpr int attach_passes = 3;
+    static constexpr uint32_t switches_column = 2;
+
+    enum class EventKind : uint8_t
+    {
+        FORK,
+        COMM,
+        READ,
+        EXIT
+    };
+
+    struct TreeEvent
+    {
+        uint64_t time;
+        uint32_t pid;
+        uint32_t tid;
+        uint32_t parent_tid;
+        uint32_t command;   //COMM
+        uint32_t column;    //READ
+        uint64_t value;     //READ
+        EventKind kind;
+    };
+
+    struct ProcessEntry
+    {
+        std::array<uint64_t, column_count> values{};            //last procfs values, less its exited threads
+        std::array<uint64_t, column_count> exited_threads{};    //READ counts of its threads that stat still has
+        bool attached = false;      //opened directly: no READ, its values are held once it is gone
+    };
+
+    struct CommandTotals
+    {
+        std::string name;
+        uint64_t processes = 0;     //exited processes
+        std::array<uint64_t, column_count> values{};
+    };
+
+    SourceOptions options_;
+    PerCpuSampler sampler_;
+    std::unordered_map<uint64_t, uint32_t> column_of_;     //perf event id -> column
+    size_t cpus_ = 0;
+    uint32_t root_pid_ = 0;
+    uint32_t root_command_ = 0;
+
+    std::vector<CommandTotals> interval_;
+    std::vector<CommandTotals> total_;
+    std::unordered_map<std::string, uint32_t> command_index_;
+    std::unordered_map<uint32_t, uint32_t> tasks_;      //tid -> command
+    std::unordered_map<uint32_t, ProcessEntry> processes_;
+    std::unordered_set<uint32_t> attached_;             //tids the events were opened on
+    std::unordered_map<uint32_t, uint32_t> exited_;     //tasks that exited this tick and the one before,
+    std::unordered_map<uint32_t, uint32_t> exited_previous_;   //their READ records may still come
+    std::vector<TreeEvent> events_;
+    std::array<uint64_t, column_count> last_tree_{};
+    std::array<uint64_t, column_count> live_{};         //root and still running tasks, not in any command
+    std::array<uint64_t, column_count> held_{};         //last procfs values of attached processes that are gone
+    std::array<uint64_t, column_count> exited_total_{};
+    uint64_t forks_ = 0;
+    uint64_t exits_ = 0;
+    uint64_t lost_records_ = 0;
+
+    bool map_columns(size_t first, std::string& error);
+    void attach_descendants(uint32_t pid);
+    void drain();
+    void process_events();
+    //counts of the whole tree since the last call, and the growth of what the running tasks hold
+    void advance(std::array<uint64_t, column_count>& tree_delta, std::array<uint64_t, column_count>& live_delta);
+    void fold_interval();
+    bool read_process(uint32_t pid, std::array<uint64_t, column_count>& values) const;
+    uint32_t intern_command(const char* name, size_t length);
+};
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef PROCFS_READER_H
+#define PROCFS_READER_H
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+//procfs file kept open between ticks and re-read with pread
+class ProcfsFile
+{
+public:
+    ProcfsFile() = default;
+    ~ProcfsFile() { close(); }
+
+    ProcfsFile(const ProcfsFile&) = delete;
+    ProcfsFile& operator=(const ProcfsFile&) = delete;
+    ProcfsFile(ProcfsFile&& other) noexcept: fd_(other.fd_) { other.fd_ = -1; }
+    ProcfsFile& operator=(ProcfsFile&& other) noexcept
+    {
+        if (this != &other)
+        {
+            close();
+            fd_ = other.fd_;
+            other.fd_ = -1;
+        }
+        return *this;
+    }
+
+    bool open(const std::string& path)
+    {
+        close();
+        fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        return fd_ >= 0;
+    }
+
+    void close()
+    {
+        if (fd_ >= 0)
+        {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    bool is_open() const { return fd_ >= 0; }
+
+    //reads the whole file into buffer (NUL terminated), returns the length or -1
+    ssize_t read(char* buffer, size_t size) const
+    {
+        if (fd_ < 0 || size == 0)
+        {
+            return -1;
+        }
+        size_t total = 0;
+        while (total + 1 < size)
+        {
+            ssize_t got = pread(fd_, buffer + total, size - 1 - total, total);
+            if (got < 0)
+            {
+                return -1;
+            }
+            if (got == 0)
+            {
+                break;
+            }
+            total += got;
+        }
+        buffer[total] = '\0';
+        return static_cast<ssize_t>(total);
+    }
+
+private:
+    int fd_ = -1;
+};
+
+struct ProcfsField
+{
+    const char* key;    //without the trailing ':'
+    uint64_t* value;
+    bool found;
+};
+
+//parses an unsigned number, skipping leading blanks; returns the position after it
+inline const char* parse_procfs_u64(const char* pos, const char* end, uint64_t& value)
+{
+    while (pos < end && (*pos == ' ' || *pos == '\t'))
+    {
+        pos++;
+    }
+    value = 0;
+    while (pos < end && *pos >= '0' && *pos <= '9')
+    {
+        value = value * 10 + (*pos - '0');
+        pos++;
+    }
+    return pos;
+}
+
+//single pass over "Key: value [kB]" lines, no allocations; kB values are converted to bytes
+inline size_t scan_procfs_fields(const char* buffer, size_t length, ProcfsField* fields, size_t count)
+{
+    const char* pos = buffer;
+    const char* end = buffer + length;
+    size_t found = 0;
+
+    while (pos < end && found < count)
+    {
+        const char* line_end = static_cast<const char*>(memchr(pos, '\n', end - pos));
+        if (!line_end)
+        {
+            line_end = end;
+        }
+
+        const char* colon = static_cast<const char*>(memchr(pos, ':', line_end - pos));
+        if (colon)
+        {
+            //keys of /proc/<pid>/sched are padded with blanks before the colon
+            size_t key_length = colon - pos;
+            while (key_length > 0 && (pos[key_length - 1] == ' ' || pos[key_length - 1] == '\t'))
+            {
+                key_length--;
+            }
+            for (size_t i = 0; i < count; i++)
+            {
+                ProcfsField& field = fields[i];
+                if (!field.found && strlen(field.key) == key_length && memcmp(field.key, pos, key_length) == 0)
+                {
+                    const char* after = parse_procfs_u64(colon + 1, line_end, *field.value);
+                    if (after + 3 <= line_end && memcmp(after, " kB", 3) == 0)
+                    {
+                        *field.value *= 1024;
+                    }
+                    field.found = true;
+                    found++;
+                    break;
+                }
+            }
+        }
+        pos = line_end + 1;
+    }
+    return found;
+}
+
+//returns the fields after "pid (comm)" of a /proc/<pid>/stat line, comm may contain blanks and parens
+inline const char* skip_procfs_stat_comm(const char* buffer, size_t length)
+{
+    const char* end = buffer + length;
+    const char* paren = nullptr;
+    for (const char* pos = buffer; pos < end; pos++)
+    {
+        if (*pos == ')')
+        {
+            paren = pos;
+        }
+    }
+    return paren ? paren + 1 : end;
+}
+
+//n-th (from 0) blank separated token after pos, parsed as a signed number
+inline bool parse_procfs_token(const char* pos, const char* end, size_t index, int64_t& value)
+{
+    for (size_t token = 0; pos < end; token++)
+    {
+        while (pos < end && *pos == ' ')
+        {
+            pos++;
+        }
+        const char* start = pos;
+        while (pos < end && *pos != ' ' && *pos != '\n')
+        {
+            pos++;
+        }
+        if (token == index)
+        {
+            bool negative = start < pos && *start == '-';
+            uint64_t magnitude = 0;
+            parse_procfs_u64(start + (negative ? 1 : 0), pos, magnitude);
+            value = negative ? -static_cast<int64_t>(magnitude) : static_cast<int64_t>(magnitude);
+            return start < pos;
+        }
+    }
+    return false;
+}
+
+#endif
@@ -0,0 +1,305 @@
+#include "profiling_snapshot.h"
+
+const char* metric_name(MetricType type)
+{
+    switch (type)
+    {
+        case MetricType::INSTRUCTIONS:
+            return "instructions";
+        case MetricType::CPU_CYCLES:
+            return "cpu_cycles";
+        case MetricType::CACHE_MISSES:
+            return "cache_misses";
+        case MetricType::CACHE_REFERENCES:
+            return "cache_references";
+        case MetricType::BRANCH_MISSES:
+            return "branch_misses";
+        case MetricType::PAGE_FAULTS:
+            return "page_faults";
+        case MetricType::CONTEXT_SWITCHES:
+            return "context_switches";
+        case MetricType::PROFILER_CPU_TIME:
+            return "profiler_cpu_time";
+        case MetricType::PROFILER_CONTEXT_SWITCHES:
+            return "profiler_context_switches";
+        case MetricType::PROFILER_PAGE_FAULTS:
+            return "profiler_page_faults";
+        case MetricType::MEMORY_RSS:
+            return "memory_rss";
+        case MetricType::MEMORY_PSS:
+            return "memory_pss";
+        case MetricType::MEMORY_ANON:
+            return "memory_anon";
+        case MetricType::MEMORY_FILE:
+            return "memory_file";
+        case MetricType::MEMORY_SWAP:
+            return "memory_swap";
+        case MetricType::SCHED_RUN_TIME:
+            return "sched_run_time";
+        case MetricType::SCHED_WAIT_TIME:
+            return "sched_wait_time";
+        case MetricType::SCHED_VOLUNTARY_SWITCHES:
+            return "sched_voluntary_switches";
+        case MetricType::SCHED_INVOLUNTARY_SWITCHES:
+            return "sched_involuntary_switches";
+        case MetricType::SCHED_MIGRATIONS:
+            return "sched_migrations";
+        case MetricType::OFFCPU_TIME:
+            return "offcpu_time";
+        case MetricType::FAULT_SAMPLES:
+            return "fault_samples";
+        case MetricType::ALLOC_CALLS:
+            return "alloc_calls";
+        case MetricType::ALLOC_BYTES:
+            return "alloc_bytes";
+        case MetricType::FREE_CALLS:
+            return "free_calls";
+        case MetricType::FREE_BYTES:
+            return "free_bytes";
+        case MetricType::MMAP_CALLS:
+            return "mmap_calls";
+        case MetricType::MMAP_BYTES:
+            return "mmap_bytes";
+        case MetricType::SYSCALL_COUNT:
+            return "syscalls";
+        case MetricType::SYSCALL_TIME:
+            return "syscall_time";
+        case MetricType::TREE_PROCESSES:
+            return "tree_processes";
+        case MetricType::TREE_EXITS:
+            return "tree_exits";
+        case MetricType::TREE_TASKS:
+            return "tree_tasks";
+        case MetricType::TREE_CPU_TIME:
+            return "tree_cpu_time";
+        case MetricType::FUTEX_WAITS:
+            return "futex_waits";
+        case MetricType::FUTEX_WAIT_TIME:
+            return "futex_wait_time";
+        case MetricType::FUTEX_WAKES:
+            return "futex_wakes";
+        case MetricType::IO_READ_CHARS:
+            return "io_read_chars";
+        case MetricType::IO_WRITE_CHARS:
+            return "io_write_chars";
+        case MetricType::IO_READ_SYSCALLS:
+            return "io_read_syscalls";
+        case MetricType::IO_WRITE_SYSCALLS:
+            return "io_write_syscalls";
+        case MetricType::IO_READ_BYTES:
+            return "io_read_bytes";
+        case MetricType::IO_WRITE_BYTES:
+            return "io_write_bytes";
+        case MetricType::IO_CANCELLED_WRITE_BYTES:
+            return "io_cancelled_write_bytes";
+        case MetricType::BLOCK_REQUESTS:
+            return "block_requests";
+        case MetricType::BLOCK_TIME:
+            return "block_time";
+        default:
+            return "unknown";
+    }
+}
+
+const char* metric_unit(MetricType type)
+{
+    switch (type)
+    {
+        case MetricType::INSTRUCTIONS:
+            return "count";
+        case MetricType::CPU_CYCLES:
+            return "cycles";
+        case MetricType::CACHE_MISSES:
+        case MetricType::BRANCH_MISSES:
+            return "misses";
+        case MetricType::CACHE_REFERENCES:
+            return "references";
+        case MetricType::PAGE_FAULTS:
+        case MetricType::PROFILER_PAGE_FAULTS:
+            return "faults";
+        case MetricType::CONTEXT_SWITCHES:
+        case MetricType::PROFILER_CONTEXT_SWITCHES:
+            return "switches";
+        case MetricType::PROFILER_CPU_TIME:
+            return "us";
+        case MetricType::MEMORY_RSS:
+        case MetricType::MEMORY_PSS:
+        case MetricType::MEMORY_ANON:
+        case MetricType::MEMORY_FILE:
+        case MetricType::MEMORY_SWAP:
+        case MetricType::ALLOC_BYTES:
+        case MetricType::FREE_BYTES:
+        case MetricType::MMAP_BYTES:
+        case MetricType::IO_READ_CHARS:
+        case MetricType::IO_WRITE_CHARS:
+        case MetricType::IO_READ_BYTES:
+        case MetricType::IO_WRITE_BYTES:
+        case MetricType::IO_CANCELLED_WRITE_BYTES:
+            return "bytes";
+        case MetricType::SCHED_RUN_TIME:
+        case MetricType::SCHED_WAIT_TIME:
+        case MetricType::OFFCPU_TIME:
+        case MetricType::SYSCALL_TIME:
+        case MetricType::TREE_CPU_TIME:
+        case MetricType::FUTEX_WAIT_TIME:
+        case MetricType::BLOCK_TIME:
+            return "ns";
+        case MetricType::SCHED_VOLUNTARY_SWITCHES:
+        case MetricType::SCHED_INVOLUNTARY_SWITCHES:
+            return "switches";
+        case MetricType::SCHED_MIGRATIONS:
+            return "migrations";
+        case MetricType::FAULT_SAMPLES:
+            return "samples";
+        case MetricType::ALLOC_CALLS:
+        case MetricType::FREE_CALLS:
+        case MetricType::MMAP_CALLS:
+        case MetricType::SYSCALL_COUNT:
+        case MetricType::IO_READ_SYSCALLS:
+        case MetricType::IO_WRITE_SYSCALLS:
+            return "calls";
+        case MetricType::TREE_PROCESSES:
+        case MetricType::TREE_EXITS:
+            return "processes";
+        case MetricType::TREE_TASKS:
+            return "tasks";
+        case MetricType::FUTEX_WAITS:
+            return "waits";
+        case MetricType::FUTEX_WAKES:
+            return "wakes";
+        case MetricType::BLOCK_REQUESTS:
+            return "requests";
+        default:
+            return "";
+    }
+}
+
+bool metric_from_name(const std::string& name, MetricType& type)
+{
+    for (int i = static_cast<int>(MetricType::INSTRUCTIONS); i < static_cast<int>(MetricType::COUNT); i++)
+    {
+        if (name == metric_name(static_cast<MetricType>(i)))
+        {
+            type = static_cast<MetricType>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool is_profiler_metric(MetricType type)
+{
+    return type == MetricType::PROFILER_CPU_TIME || type == MetricType::PROFILER_CONTEXT_SWITCHES || type == MetricType::PROFILER_PAGE_FAULTS;
+}
+
+bool is_perf_metric(MetricType type)
+{
+    return type >= MetricType::INSTRUCTIONS && type <= MetricType::CONTEXT_SWITCHES;
+}
+
+bool is_memory_metric(MetricType type)
+{
+    return type >= MetricType::MEMORY_RSS && type <= MetricType::MEMORY_SWAP;
+}
+
+bool is_sched_metric(MetricType type)
+{
+    return type >= MetricType::SCHED_RUN_TIME && type <= MetricType::SCHED_MIGRATIONS;
+}
+
+bool is_alloc_metric(MetricType type)
+{
+    return type >= MetricType::ALLOC_CALLS && type <= MetricType::MMAP_BYTES;
+}
+
+bool is_io_metric(MetricType type)
+{
+    return type >= MetricType::IO_READ_CHARS && type <= MetricType::IO_CANCELLED_WRITE_BYTES;
+}
+
+bool is_gauge_metric(MetricType type)
+{
+    return is_memory_metric(type) || type == MetricType::TREE_TASKS;
+}
+
+std::ostream& operator<<(std::ostream& ostr, const ProfilingSnapshot& snapshot)
+{
+    ostr << "interval: " << snapshot.duration_ms << "ms" << std::endl;
+    for(const auto& metric : snapshot.metrics)
+    {
+        ostr << metric.name << ": " << metric.value;
+        if(metric.coverage < 1.0)
+        {
+            ostr << " (scaled, " << static_cast<int>(metric.coverage * 100.0) << "% counted, +-" << static_cast<int>(metric.error * 100.0 + 0.5) << "%)";
+        }
+        ostr << std::endl;
+    }
+    if(!snapshot.threads.empty())
+    {
+        ostr << "threads (tid comm run_ms wait_ms vol invol migr cpu):" << std::endl;
+        for(const auto& thread : snapshot.threads)
+        {
+            ostr << "  " << thread.tid << " " << thread.comm
+                 << " " << thread.run_time_ns / 1000000.0 << " " << thread.wait_time_ns / 1000000.0
+                 << " " << thread.voluntary_switches << " " << thread.involuntary_switches
+                 << " " << thread.migrations << " " << thread.cpu << std::endl;
+        }
+    }
+    for(const auto& region : snapshot.regions)
+    {
+        ostr << "region " << region.name << ": " << region.time_ns / 1000000.0 << "ms, " << region.entries << " entries";
+        for(const auto& metric : region.metrics)
+        {
+            ostr << ", " << metric.name << " " << metric.value;
+        }
+        ostr << std::endl;
+    }
+    for(const auto& syscall : snapshot.syscalls)
+    {
+        ostr << "syscall " << syscall.name << ": " << syscall.count << " calls, " << syscall.time_ns / 1000000.0 << "ms, p50 "
+             << syscall.p50_ns << "ns, p99 " << syscall.p99_ns << "ns";
+        if(syscall.errors)
+        {
+            ostr << ", " << syscall.errors << " errors";
+        }
+        ostr << std::endl;
+    }
+    for(const auto& command : snapshot.commands)
+    {
+        ostr << "command " << command.name << ": " << command.processes << " exited, cpu " << command.cpu_ns / 1000000.0 << "ms, "
+             << command.page_faults << " faults, " << command.context_switches << " switches" << std::endl;
+    }
+    for(const auto& lock : snapshot.locks)
+    {
+        ostr << "lock " << lock.name << ": " << lock.waits << " waits, " << lock.wait_ns / 1000000.0 << "ms, p99 " << lock.p99_ns
+             << "ns, " << lock.wakes << " wakes" << std::endl;
+    }
+    for(const auto& device : snapshot.devices)
+    {
+        ostr << "device " << device.name << ": " << device.requests << " requests, " << device.bytes << " bytes, p50 " << device.p50_ns
+             << "ns, p99 " << device.p99_ns << "ns" << std::endl;
+    }
+    bool any_alloc = false;
+    for(size_t size_class = 0; size_class < snapshot.alloc_sizes.size(); size_class++)
+    {
+        if(snapshot.alloc_sizes[size_class])
+        {
+            //class n holds sizes below 2^n, the last one everything above
+            bool last = size_class + 1 == snapshot.alloc_sizes.size();
+            ostr << (any_alloc ? ", " : "alloc sizes: ") << (last ? ">=" : "<") << (1ull << (last ? size_class - 1 : size_class)) << " " << snapshot.alloc_sizes[size_class];
+            any_alloc = true;
+        }
+    }
+    if(any_alloc)
+    {
+        ostr << std::endl;
+    }
+    for(const auto& stage : snapshot.stage_latencies)
+    {
+        if(stage.count)
+        {
+            ostr << "stage_" << stage_name(stage.stage) << ": p50 " << stage.p50_ns << "ns, p99 " << stage.p99_ns << "ns" << std::endl;
+        }
+    }
+    return ostr;
+}
\ No newline at end of file
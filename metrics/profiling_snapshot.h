@@ -0,0 +1,180 @@
+#ifndef PROFILING_SNAPSHOT_H
+#define PROFILING_SNAPSHOT_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <iostream>
+
+#include "self_monitor.h"
+
+enum class MetricType 
+{
+    INSTRUCTIONS,      
+    CPU_CYCLES,        
+    CACHE_MISSES,      
+    CACHE_REFERENCES,  
+    BRANCH_MISSES,     
+    PAGE_FAULTS,      
+    CONTEXT_SWITCHES,
+    PROFILER_CPU_TIME,
+    PROFILER_CONTEXT_SWITCHES,
+    PROFILER_PAGE_FAULTS,
+    MEMORY_RSS,
+    MEMORY_PSS,
+    MEMORY_ANON,
+    MEMORY_FILE,
+    MEMORY_SWAP,
+    SCHED_RUN_TIME,
+    SCHED_WAIT_TIME,
+    SCHED_VOLUNTARY_SWITCHES,
+    SCHED_INVOLUNTARY_SWITCHES,
+    SCHED_MIGRATIONS,
+    OFFCPU_TIME,
+    FAULT_SAMPLES,
+    ALLOC_CALLS,
+    ALLOC_BYTES,
+    FREE_CALLS,
+    FREE_BYTES,
+    MMAP_CALLS,
+    MMAP_BYTES,
+    SYSCALL_COUNT,
+    SYSCALL_TIME,
+    TREE_PROCESSES,
+    TREE_EXITS,
+    TREE_TASKS,
+    TREE_CPU_TIME,
+    FUTEX_WAITS,
+    FUTEX_WAIT_TIME,
+    FUTEX_WAKES,
+    IO_READ_CHARS,
+    IO_WRITE_CHARS,
+    IO_READ_SYSCALLS,
+    IO_WRITE_SYSCALLS,
+    IO_READ_BYTES,
+    IO_WRITE_BYTES,
+    IO_CANCELLED_WRITE_BYTES,
+    BLOCK_REQUESTS,
+    BLOCK_TIME,
+    COUNT
+};
+
+const char* metric_name(MetricType type);
+const char* metric_unit(MetricType type);
+bool metric_from_name(const std::string& name, MetricType& type);
+bool is_profiler_metric(MetricType type);
+bool is_perf_metric(MetricType type);
+bool is_memory_metric(MetricType type);
+bool is_sched_metric(MetricType type);
+bool is_alloc_metric(MetricType type);
+bool is_io_metric(MetricType type);
+//gauges report the current level, other metrics the delta over the interval
+bool is_gauge_metric(MetricType type);
+
+
+struct MetricValue 
+{
+    MetricType type;    
+    uint64_t value;     
+    std::string name;   
+    std::string unit;   
+    double coverage = 1.0;  //fraction of the interval the counter was really counting
+    double error = 0.0;     //estimated relative error of a scaled value
+};
+
+
+//per-thread scheduler statistics over the snapshot interval
+struct ThreadSchedStats
+{
+    int tid = 0;
+    std::string comm;
+    uint64_t run_time_ns = 0;
+    uint64_t wait_time_ns = 0;      //runnable but waiting on a runqueue
+    uint64_t voluntary_switches = 0;
+    uint64_t involuntary_switches = 0;
+    uint64_t migrations = 0;
+    int cpu = -1;
+};
+
+//perf counter deltas of the interval split by the time spent in a marked code region
+struct RegionSample
+{
+    std::string name;
+    uint64_t time_ns = 0;       //summed over threads, innermost region only
+    uint64_t entries = 0;
+    std::vector<MetricValue> metrics;
+};
+
+//one of the busiest syscalls of the interval
+struct SyscallSample
+{
+    std::string name;
+    uint64_t count = 0;
+    uint64_t time_ns = 0;
+    uint64_t errors = 0;
+    uint64_t p50_ns = 0;
+    uint64_t p99_ns = 0;
+};
+
+//counts of one command name in a followed process tree over the interval
+struct CommandSample
+{
+    std::string name;
+    uint64_t processes = 0;     //processes that exited
+    uint64_t cpu_ns = 0;
+    uint64_t page_faults = 0;
+    uint64_t context_switches = 0;
+};
+
+//one of the most contended futexes of the interval
+struct LockSample
+{
+    std::string name;           //"app+0x4c2a0" for static locks, the address otherwise
+    uint64_t waits = 0;
+    uint64_t wakes = 0;
+    uint64_t wait_ns = 0;
+    uint64_t p99_ns = 0;
+};
+
+//block request latency of one device over the interval, system-wide
+struct DeviceSample
+{
+    std::string name;
+    uint64_t requests = 0;
+    uint64_t bytes = 0;
+    uint64_t p50_ns = 0;
+    uint64_t p99_ns = 0;
+};
+
+struct ProfilingSnapshot 
+{
+    std::vector<MetricValue> metrics;
+    std::vector<ThreadSchedStats> threads;
+    std::vector<StageLatency> stage_latencies;
+    std::vector<RegionSample> regions;
+    std::vector<SyscallSample> syscalls;
+    std::vector<CommandSample> commands;
+    std::vector<LockSample> locks;
+    std::vector<DeviceSample> devices;
+    std::vector<uint64_t> alloc_sizes;  //allocations of the interval per log2 size class, empty without the shim
+    uint64_t timestamp_ms;             
+    uint64_t duration_ms;              
+    uint32_t phase_id = 0;
+    bool phase_boundary = false;
+    
+    const MetricValue* find_metric(MetricType type) const 
+    {
+        for (const auto& metric : metrics) 
+        {
+            if (metric.type == type) 
+            {
+                return &metric;
+            }
+        }
+        return nullptr;
+    }
+
+    friend std::ostream& operator<<(std::ostream& ostr, const ProfilingSnapshot& snapshot);
+};
+
+#endif
@@ -0,0 +1,169 @@
+#include "region_source.h"
+
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+
+static uint64_t monotonic_ns()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000ull + now.tv_nsec;
+}
+
+bool RegionSource::open(int pid, std::string& error)
+{
+    (void)pid;
+    if (!shm_)
+    {
+        error = "no region marker buffer";
+        return false;
+    }
+    threads_.assign(region_max_threads, ThreadState());
+    totals_.assign(region_max_names + 1, RegionTotals());
+    last_tick_ns_ = monotonic_ns();
+    return true;
+}
+
+void RegionSource::close()
+{
+    threads_.clear();
+    totals_.clear();
+}
+
+void RegionSource::attribute(const OpenRegion& region, uint64_t until_ns)
+{
+    //markers written before the tick (or before we attached) only count from its start
+    uint64_t since_ns = std::max(region.since_ns, last_tick_ns_);
+    if (until_ns > since_ns)
+    {
+        totals_[region.region].time_ns += until_ns - since_ns;
+    }
+}
+
+void RegionSource::drain_thread(RegionThreadRing& ring, ThreadState& state, uint64_t until_ns)
+{
+    uint64_t dropped = ring.dropped.load(std::memory_order_relaxed);
+    if (dropped != state.dropped)
+    {
+        //begin/end pairs are broken, start over from the next marker
+        state.dropped = dropped;
+        state.stack.clear();
+    }
+
+    uint64_t head = ring.head.load(std::memory_order_acquire);
+    uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+    for (; tail < head; tail++)
+    {
+        const RegionMarker& marker = ring.markers[tail & (region_ring_capacity - 1)];
+        if (marker.time_ns > until_ns)
+        {
+            break;      //belongs to the next tick
+        }
+        uint32_t region = std::min(marker.region, region_overflow_id);
+
+        if (marker.kind == REGION_BEGIN)
+        {
+            if (!state.stack.empty())
+            {
+                attribute(state.stack.back(), marker.time_ns);
+            }
+            state.stack.push_back({region, marker.time_ns});
+            totals_[region].entries++;
+        }
+        else if (!state.stack.empty())
+        {
+            attribute(state.stack.back(), marker.time_ns);
+            state.stack.pop_back();
+            if (!state.stack.empty())
+            {
+                state.stack.back().since_ns = marker.time_ns;
+            }
+        }
+    }
+    ring.tail.store(tail, std::memory_order_release);
+
+    if (!state.stack.empty())
+    {
+        attribute(state.stack.back(), until_ns);
+        state.stack.back().since_ns = until_ns;
+    }
+}
+
+void RegionSource::collect(ProfilingSnapshot& snapshot)
+{
+    uint64_t now_ns = monotonic_ns();
+    uint64_t tick_ns = now_ns - last_tick_ns_;
+
+    for (auto& totals : totals_)
+    {
+        totals = RegionTotals();
+    }
+
+    uint32_t thread_count = std::min(shm_->thread_count.load(std::memory_order_acquire), region_max_threads);
+    uint32_t active_threads = 0;
+    for (uint32_t i = 0; i < thread_count; i++)
+    {
+        RegionThreadRing& ring = shm_->threads[i];
+        if (ring.tid.load(std::memory_order_acquire) == 0)
+        {
+            continue;
+        }
+        active_threads++;
+        drain_thread(ring, threads_[i], now_ns);
+    }
+    last_tick_ns_ = now_ns;
+    if (active_threads == 0 || tick_ns == 0)
+    {
+        return;
+    }
+
+    //the same region name may have been registered twice by racing threads
+    std::vector<RegionSample> regions;
+    for (uint32_t id = 0; id < totals_.size(); id++)
+    {
+        const RegionTotals& totals = totals_[id];
+        if (totals.time_ns == 0 && totals.entries == 0)
+        {
+            continue;
+        }
+        std::string name = region_name(id);
+        auto it = std::find_if(regions.begin(), regions.end(), [&name](const RegionSample& r){ return r.name == name; });
+        if (it == regions.end())
+        {
+            regions.push_back(RegionSample());
+            it = regions.end() - 1;
+            it->name = name;
+        }
+        it->time_ns += totals.time_ns;
+        it->entries += totals.entries;
+    }
+
+    double thread_time_ns = static_cast<double>(tick_ns) * active_threads;
+    for (auto& region : regions)
+    {
+        double share = std::min(1.0, region.time_ns / thread_time_ns);
+        for (const auto& metric : snapshot.metrics)
+        {
+            if (!is_perf_metric(metric.type))
+            {
+                continue;
+            }
+            MetricValue split = metric;
+            split.value = static_cast<uint64_t>(std::llround(metric.value * share));
+            region.metrics.push_back(split);
+        }
+    }
+    snapshot.regions = std::move(regions);
+}
+
+std::string RegionSource::region_name(uint32_t id) const
+{
+    if (id >= region_max_names || !shm_->name_ready[id].load(std::memory_order_acquire))
+    {
+        return "[other]";
+    }
+    std::string name(shm_->names[id], strnlen(shm_->names[id], region_name_length));
+    std::replace_if(name.begin(), name.end(), [](char c){ return c == ' ' || c == '\t' || c == '\n'; }, '_');
+    return name;
+}
@@ -0,0 +1,51 @@
+#ifndef REGION_SOURCE_H
+#define REGION_SOURCE_H
+
+#include <string>
+#include <vector>
+
+#include "metric_source.h"
+#include "../markers/region_markers.h"
+
+//splits the perf counter deltas of a tick between the code regions the target
+//marked with region_begin/region_end, proportionally to the time spent in them
+class RegionSource : public MetricSource
+{
+public:
+    explicit RegionSource(RegionShm* shm): shm_(shm) {}
+
+    const char* name() const override { return "regions"; }
+    bool open(int pid, std::string& error) override;
+    void collect(ProfilingSnapshot& snapshot) override;
+    void close() override;
+
+private:
+    struct OpenRegion
+    {
+        uint32_t region;
+        uint64_t since_ns;      //start of the not yet attributed part
+    };
+
+    struct ThreadState
+    {
+        uint64_t dropped = 0;
+        std::vector<OpenRegion> stack;
+    };
+
+    struct RegionTotals
+    {
+        uint64_t time_ns = 0;
+        uint64_t entries = 0;
+    };
+
+    RegionShm* shm_;
+    std::vector<ThreadState> threads_;
+    std::vector<RegionTotals> totals_;      //per region id, the last one is region_overflow_id
+    uint64_t last_tick_ns_ = 0;
+
+    void drain_thread(RegionThreadRing& ring, ThreadState& state, uint64_t until_ns);
+    void attribute(const OpenRegion& region, uint64_t until_ns);
+    std::string region_name(uint32_t id) const;
+};
+
+#endif
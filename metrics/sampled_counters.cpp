@@ -0,0 +1,189 @@
+#include "sampled_counters.h"
+
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+bool SampledCounters::open(int pid, const std::vector<MetricType>& metrics, uint64_t period_ns, uint32_t batch, std::string& error)
+{
+    close();
+
+    std::vector<MetricType> types;
+    for (auto type : metrics)
+    {
+        if (is_perf_metric(type) && std::find(types.begin(), types.end(), type) == types.end())
+        {
+            types.push_back(type);
+        }
+    }
+
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_CPU_CLOCK;
+    attr.sample_period = std::max<uint64_t>(period_ns, 1);
+    attr.sample_type = PERF_SAMPLE_TIME | PERF_SAMPLE_READ;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.use_clockid = 1;
+    attr.clockid = CLOCK_MONOTONIC;
+    attr.wakeup_events = std::max<uint32_t>(batch, 1);
+    attr.disabled = 1;
+    attr.exclude_hv = 1;
+
+    leader_ = static_cast<int>(sys_perf_event_open(&attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC));
+    if (leader_ < 0)
+    {
+        error = std::string("failed to open the sampling cpu-clock: ") + strerror(errno);
+        return false;
+    }
+
+    //the whole group is one record, the ring holds a few batches of them
+    size_t record_size = sizeof(perf_event_header) + (5 + types.size()) * sizeof(uint64_t);
+    size_t pages = 8;
+    while (pages * 4096 < 4 * record_size * attr.wakeup_events)
+    {
+        pages *= 2;
+    }
+    if (!ring_.open(leader_, pages, error))
+    {
+        close();
+        return false;
+    }
+
+    for (auto type : types)
+    {
+        perf_event_attr member;
+        memset(&member, 0, sizeof(member));
+        member.size = sizeof(member);
+        PerfEvent perf_event;
+        perf_event_of(type, perf_event);
+        describe_perf_event(perf_event, member);
+        member.exclude_hv = 1;
+        member.read_format = attr.read_format;
+        member.use_clockid = 1;         //a group shares one clock
+        member.clockid = attr.clockid;
+
+        Event event;
+        event.type = type;
+        event.fd = static_cast<int>(sys_perf_event_open(&member, pid, -1, leader_, PERF_FLAG_FD_CLOEXEC));
+        if (event.fd < 0)
+        {
+            //no rotation here: every event has to fit on the PMU next to the others
+            error = std::string("failed to open perf event ") + metric_name(type) + " in the sampled group: " + strerror(errno);
+            close();
+            return false;
+        }
+        events_.push_back(event);
+    }
+
+    read_buffer_.assign(4 + events_.size(), 0);
+    ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+}
+
+void SampledCounters::close()
+{
+    ring_.close();
+    for (auto& event : events_)
+    {
+        ::close(event.fd);
+    }
+    events_.clear();
+    if (leader_ >= 0)
+    {
+        ::close(leader_);
+        leader_ = -1;
+    }
+    last_time_ns_ = 0;
+    last_cpu_ns_ = 0;
+    last_enabled_ = 0;
+    last_running_ = 0;
+    lost_samples_ = 0;
+}
+
+int SampledCounters::wait(int timeout_ms)
+{
+    pollfd fd{leader_, POLLIN, 0};
+    if (poll(&fd, 1, timeout_ms) <= 0)
+    {
+        return 0;
+    }
+    return fd.revents & (POLLHUP | POLLERR) ? -1 : 1;
+}
+
+void SampledCounters::drain(std::vector<Sample>& out)
+{
+    ring_.drain([this, &out](const perf_event_header* record)
+    {
+        const uint64_t* body = reinterpret_cast<const uint64_t*>(record + 1);
+        if (record->type == PERF_RECORD_LOST)
+        {
+            lost_samples_ += body[1];
+            return;
+        }
+        //time, nr, time_enabled, time_running, values[nr]
+        if (record->type != PERF_RECORD_SAMPLE || record->size < sizeof(perf_event_header) + 5 * sizeof(uint64_t) || body[1] != events_.size() + 1)
+        {
+            return;
+        }
+        Sample sample;
+        if (make_sample(body[0], body + 1, sample))
+        {
+            out.push_back(std::move(sample));
+        }
+    });
+}
+
+bool SampledCounters::read_now(Sample& out)
+{
+    size_t size = read_buffer_.size() * sizeof(uint64_t);
+    if (::read(leader_, read_buffer_.data(), size) != static_cast<ssize_t>(size) || read_buffer_[0] != events_.size() + 1)
+    {
+        return false;
+    }
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return make_sample(static_cast<uint64_t>(now.tv_sec) * 1000000000ull + now.tv_nsec, read_buffer_.data(), out);
+}
+
+bool SampledCounters::make_sample(uint64_t time_ns, const uint64_t* values, Sample& out)
+{
+    if (time_ns < last_time_ns_ || values[1] < last_enabled_)
+    {
+        return false;
+    }
+    last_time_ns_ = time_ns;
+    uint64_t enabled = values[1] - last_enabled_;
+    uint64_t running = values[2] - last_running_;
+    last_enabled_ = values[1];
+    last_running_ = values[2];
+
+    out.time_ns = time_ns;
+    out.cpu_ns = values[3] - last_cpu_ns_;
+    last_cpu_ns_ = values[3];
+
+    //the group is on the PMU as a whole, one scale for every member
+    double coverage = enabled ? static_cast<double>(running) / enabled : 1.0;
+    for (size_t i = 0; i < events_.size(); i++)
+    {
+        Event& event = events_[i];
+        uint64_t raw = values[4 + i] - event.last_raw;
+        event.last_raw = values[4 + i];
+
+        MetricValue metric{event.type, raw, metric_name(event.type), metric_unit(event.type)};
+        metric.coverage = coverage;
+        if (running > 0 && running < enabled)
+        {
+            metric.value = static_cast<uint64_t>(std::llround(static_cast<double>(raw) * enabled / running));
+        }
+        out.metrics.push_back(metric);
+    }
+    return true;
+}
@@ -0,0 +1,69 @@
+#ifndef SAMPLED_COUNTERS_H
+#define SAMPLED_COUNTERS_H
+
+#include <linux/perf_event.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "profiling_snapshot.h"
+#include "counter_scheduler.h"
+#include "perf_ring.h"
+
+//the perf metrics as one group under a cpu-clock leader that samples them with
+//PERF_SAMPLE_READ: the kernel writes the whole group with a timestamp into the
+//ring every period of the target's CPU time, the collector only wakes for batches
+class SampledCounters
+{
+public:
+    struct Sample
+    {
+        uint64_t time_ns;           //CLOCK_MONOTONIC, the steady_clock of the collector
+        uint64_t cpu_ns;            //target on-CPU time since the previous sample
+        std::vector<MetricValue> metrics;
+    };
+
+    SampledCounters() = default;
+    ~SampledCounters() { close(); }
+
+    SampledCounters(const SampledCounters&) = delete;
+    SampledCounters& operator=(const SampledCounters&) = delete;
+
+    //opens every perf metric in metrics, others are ignored
+    bool open(int pid, const std::vector<MetricType>& metrics, uint64_t period_ns, uint32_t batch, std::string& error);
+    void close();
+    bool is_open() const { return leader_ >= 0; }
+
+    //waits until a batch of samples is in the ring: 1, 0 on timeout, -1 once the task is gone
+    int wait(int timeout_ms);
+    //appends a sample per record in the ring
+    void drain(std::vector<Sample>& out);
+    //reads the group now, for ticks in which the target did not run long enough to be sampled
+    bool read_now(Sample& out);
+    uint64_t lost_samples() const { return lost_samples_; }
+
+private:
+    struct Event
+    {
+        MetricType type;
+        int fd = -1;
+        uint64_t last_raw = 0;
+    };
+
+    int leader_ = -1;
+    std::vector<Event> events_;
+    PerfRing ring_;
+    uint64_t last_time_ns_ = 0;
+    uint64_t last_cpu_ns_ = 0;
+    uint64_t last_enabled_ = 0;
+    uint64_t last_running_ = 0;
+    uint64_t lost_samples_ = 0;
+    std::vector<uint64_t> read_buffer_;
+
+    //values is the group read: nr, time_enabled, time_running, leader, members;
+    //false for a sample written before the last read_now
+    bool make_sample(uint64_t time_ns, const uint64_t* values, Sample& out);
+};
+
+#endif
@@ -0,0 +1,247 @@
+#include "sched_source.h"
+
+#include <dirent.h>
+
+#include <cstdlib>
+
+SchedStatSource::SchedStatSource(const std::vector<MetricType>& metrics)
+{
+    for (auto type : metrics)
+    {
+        if (is_sched_metric(type))
+        {
+            metrics_.push_back(type);
+        }
+    }
+}
+
+bool SchedStatSource::open(int pid, std::string& error)
+{
+    pid_ = pid;
+    if (!process_stat_.open("/proc/" + std::to_string(pid) + "/stat"))
+    {
+        error = "Can't open /proc/" + std::to_string(pid) + "/stat";
+        return false;
+    }
+
+    threads_.clear();
+    rescan(true);
+    if (threads_.empty())
+    {
+        error = "No readable threads in /proc/" + std::to_string(pid) + "/task (schedstats disabled?)";
+        process_stat_.close();
+        return false;
+    }
+    last_thread_count_ = read_thread_count();
+    ticks_since_rescan_ = 0;
+    return true;
+}
+
+void SchedStatSource::collect(ProfilingSnapshot& snapshot)
+{
+    int64_t thread_count = read_thread_count();
+    if (thread_count != last_thread_count_ || ++ticks_since_rescan_ >= rescan_interval_ticks)
+    {
+        rescan(false);
+        last_thread_count_ = thread_count;
+        ticks_since_rescan_ = 0;
+    }
+
+    ThreadSchedStats total;
+    for (auto it = threads_.begin(); it != threads_.end();)
+    {
+        ThreadSchedStats delta;
+        delta.tid = it->first;
+        if (!read_thread(it->second, delta))
+        {
+            it = threads_.erase(it);
+            continue;
+        }
+
+        total.run_time_ns += delta.run_time_ns;
+        total.wait_time_ns += delta.wait_time_ns;
+        total.voluntary_switches += delta.voluntary_switches;
+        total.involuntary_switches += delta.involuntary_switches;
+        total.migrations += delta.migrations;
+        snapshot.threads.push_back(std::move(delta));
+        ++it;
+    }
+
+    for (auto type : metrics_)
+    {
+        uint64_t value = 0;
+        switch (type)
+        {
+            case MetricType::SCHED_RUN_TIME:
+                value = total.run_time_ns;
+                break;
+            case MetricType::SCHED_WAIT_TIME:
+                value = total.wait_time_ns;
+                break;
+            case MetricType::SCHED_VOLUNTARY_SWITCHES:
+                value = total.voluntary_switches;
+                break;
+            case MetricType::SCHED_INVOLUNTARY_SWITCHES:
+                value = total.involuntary_switches;
+                break;
+            case MetricType::SCHED_MIGRATIONS:
+                value = total.migrations;
+                break;
+            default:
+                continue;
+        }
+        snapshot.metrics.push_back({type, value, metric_name(type), metric_unit(type)});
+    }
+}
+
+void SchedStatSource::close()
+{
+    threads_.clear();
+    process_stat_.close();
+    pid_ = -1;
+}
+
+void SchedStatSource::rescan(bool baseline)
+{
+    std::string task_dir = "/proc/" + std::to_string(pid_) + "/task";
+    DIR* dir = opendir(task_dir.c_str());
+    if (!dir)
+    {
+        return;
+    }
+
+    while (dirent* entry = readdir(dir))
+    {
+        char* end = nullptr;
+        long tid = strtol(entry->d_name, &end, 10);
+        if (*end != '\0' || tid <= 0 || threads_.count(tid))
+        {
+            continue;
+        }
+
+        ThreadState state;
+        if (!open_thread(tid, state))
+        {
+            continue;
+        }
+        if (baseline)
+        {
+            //threads alive before profiling started: only count from now on
+            ThreadSchedStats ignored;
+            read_thread(state, ignored);
+        }
+        threads_.emplace(tid, std::move(state));
+    }
+    closedir(dir);
+}
+
+bool SchedStatSource::open_thread(int tid, ThreadState& state)
+{
+    std::string base = "/proc/" + std::to_string(pid_) + "/task/" + std::to_string(tid) + "/";
+    if (!state.schedstat.open(base + "schedstat") || !state.stat.open(base + "stat"))
+    {
+        return false;
+    }
+    if (!state.sched.open(base + "sched") && !state.status.open(base + "status"))
+    {
+        return false;
+    }
+
+    ProcfsFile comm;
+    char buffer[64];
+    ssize_t length = comm.open(base + "comm") ? comm.read(buffer, sizeof(buffer)) : -1;
+    if (length > 0)
+    {
+        state.comm.assign(buffer, buffer[length - 1] == '\n' ? length - 1 : length);
+    }
+    return true;
+}
+
+bool SchedStatSource::read_thread(ThreadState& state, ThreadSchedStats& delta)
+{
+    char buffer[4096];
+
+    //run_ns wait_ns timeslices
+    ssize_t length = state.schedstat.read(buffer, sizeof(buffer));
+    if (length <= 0)
+    {
+        return false;
+    }
+    uint64_t run_time_ns = 0;
+    uint64_t wait_time_ns = 0;
+    const char* pos = parse_procfs_u64(buffer, buffer + length, run_time_ns);
+    parse_procfs_u64(pos, buffer + length, wait_time_ns);
+
+    length = state.stat.read(buffer, sizeof(buffer));
+    if (length <= 0)
+    {
+        return false;
+    }
+    //processor is field 39, the 37th token after "pid (comm)"
+    int64_t cpu = -1;
+    parse_procfs_token(skip_procfs_stat_comm(buffer, length), buffer + length, 36, cpu);
+
+    uint64_t voluntary = 0;
+    uint64_t involuntary = 0;
+    uint64_t migrations = 0;
+    if (state.sched.is_open())
+    {
+        length = state.sched.read(buffer, sizeof(buffer));
+        if (length <= 0)
+        {
+            return false;
+        }
+        ProcfsField fields[] = {
+            {"nr_voluntary_switches", &voluntary, false},
+            {"nr_involuntary_switches", &involuntary, false},
+            {"se.nr_migrations", &migrations, false}
+        };
+        scan_procfs_fields(buffer, length, fields, 3);
+    }
+    else
+    {
+        length = state.status.read(buffer, sizeof(buffer));
+        if (length <= 0)
+        {
+            return false;
+        }
+        ProcfsField fields[] = {
+            {"voluntary_ctxt_switches", &voluntary, false},
+            {"nonvoluntary_ctxt_switches", &involuntary, false}
+        };
+        scan_procfs_fields(buffer, length, fields, 2);
+
+        //without sched debug only observed CPU changes are counted, a lower bound
+        migrations = state.migrations + (state.cpu >= 0 && cpu != state.cpu ? 1 : 0);
+    }
+
+    delta.comm = state.comm;
+    delta.run_time_ns = run_time_ns - state.run_time_ns;
+    delta.wait_time_ns = wait_time_ns - state.wait_time_ns;
+    delta.voluntary_switches = voluntary - state.voluntary_switches;
+    delta.involuntary_switches = involuntary - state.involuntary_switches;
+    delta.migrations = migrations - state.migrations;
+    delta.cpu = static_cast<int>(cpu);
+
+    state.run_time_ns = run_time_ns;
+    state.wait_time_ns = wait_time_ns;
+    state.voluntary_switches = voluntary;
+    state.involuntary_switches = involuntary;
+    state.migrations = migrations;
+    state.cpu = static_cast<int>(cpu);
+    return true;
+}
+
+int64_t SchedStatSource::read_thread_count()
+{
+    char buffer[1024];
+    ssize_t length = process_stat_.read(buffer, sizeof(buffer));
+    if (length <= 0)
+    {
+        return -1;
+    }
+    //num_threads is field 20, the 18th token after "pid (comm)"
+    int64_t count = -1;
+    parse_procfs_token(skip_procfs_stat_comm(buffer, length), buffer + length, 17, count);
+    return count;
+}
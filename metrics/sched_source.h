@@ -0,0 +1,53 @@
+#ifndef SCHED_SOURCE_H
+#define SCHED_SOURCE_H
+
+#include <map>
+#include <vector>
+
+#include "metric_source.h"
+#include "procfs_reader.h"
+
+//per-thread run time, runqueue delay, switches and migrations from /proc/<pid>/task/*
+class SchedStatSource : public MetricSource
+{
+public:
+    explicit SchedStatSource(const std::vector<MetricType>& metrics);
+
+    const char* name() const override { return "sched"; }
+    bool open(int pid, std::string& error) override;
+    void collect(ProfilingSnapshot& snapshot) override;
+    void close() override;
+
+private:
+    //the task directory is rescanned when the thread count changes and at least this often
+    static constexpr uint32_t rescan_interval_ticks = 20;
+
+    struct ThreadState
+    {
+        std::string comm;
+        ProcfsFile schedstat;
+        ProcfsFile stat;
+        ProcfsFile sched;       //needs CONFIG_SCHED_DEBUG
+        ProcfsFile status;      //fallback for context switches
+        uint64_t run_time_ns = 0;
+        uint64_t wait_time_ns = 0;
+        uint64_t voluntary_switches = 0;
+        uint64_t involuntary_switches = 0;
+        uint64_t migrations = 0;
+        int cpu = -1;
+    };
+
+    std::vector<MetricType> metrics_;
+    int pid_ = -1;
+    ProcfsFile process_stat_;
+    std::map<int, ThreadState> threads_;
+    int64_t last_thread_count_ = -1;
+    uint32_t ticks_since_rescan_ = 0;
+
+    void rescan(bool baseline);
+    bool open_thread(int tid, ThreadState& state);
+    bool read_thread(ThreadState& state, ThreadSchedStats& delta);
+    int64_t read_thread_count();
+};
+
+#endif
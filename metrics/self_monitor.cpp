@@ -0,0 +1,115 @@
+#include "self_monitor.h"
+
+#include <sys/resource.h>
+#include <algorithm>
+#include <iomanip>
+
+const char* stage_name(PipelineStage stage)
+{
+    switch (stage)
+    {
+        case PipelineStage::READ:
+            return "read";
+        case PipelineStage::SOURCE_READ:
+            return "source_read";
+        case PipelineStage::SNAPSHOT_BUILD:
+            return "snapshot_build";
+        case PipelineStage::CALLBACK:
+            return "callback";
+        case PipelineStage::RENDER:
+            return "render";
+        case PipelineStage::EXPORT:
+            return "export";
+        default:
+            return "unknown";
+    }
+}
+
+void SelfMonitor::reset()
+{
+    for (auto& stage : stages_)
+    {
+        stage.clear();
+    }
+    base_usage_ = read_usage();
+    started_ = std::chrono::steady_clock::now();
+}
+
+void SelfMonitor::record(PipelineStage stage, uint64_t ns)
+{
+    stages_[static_cast<size_t>(stage)].record(ns);
+}
+
+SelfUsage SelfMonitor::usage() const
+{
+    SelfUsage current = read_usage();
+    current.cpu_time_us -= base_usage_.cpu_time_us;
+    current.context_switches -= base_usage_.context_switches;
+    current.page_faults -= base_usage_.page_faults;
+    return current;
+}
+
+std::vector<StageLatency> SelfMonitor::stage_latencies() const
+{
+    std::vector<StageLatency> result;
+    for (size_t i = 0; i < stages_.size(); i++)
+    {
+        LogHistogram histogram = stages_[i].values();
+
+        StageLatency latency;
+        latency.stage = static_cast<PipelineStage>(i);
+        latency.count = histogram.count;
+        latency.mean_ns = latency.count ? histogram.sum_ns / latency.count : 0;
+        latency.p50_ns = histogram.percentile_ns(0.50);
+        latency.p99_ns = histogram.percentile_ns(0.99);
+        latency.max_ns = histogram.max_ns;
+        result.push_back(latency);
+    }
+    return result;
+}
+
+SelfOverheadReport SelfMonitor::report() const
+{
+    SelfOverheadReport report;
+    report.usage = usage();
+    report.wall_time_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started_).count();
+    report.stages = stage_latencies();
+    return report;
+}
+
+SelfUsage SelfMonitor::read_usage()
+{
+    SelfUsage usage;
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0)
+    {
+        return usage;
+    }
+
+    usage.cpu_time_us = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000ull + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+    usage.context_switches = ru.ru_nvcsw + ru.ru_nivcsw;
+    usage.page_faults = ru.ru_minflt + ru.ru_majflt;
+    return usage;
+}
+
+std::ostream& operator<<(std::ostream& ostr, const SelfOverheadReport& report)
+{
+    ostr << "Profiler CPU time: " << report.usage.cpu_time_us << " us (" << std::fixed << std::setprecision(2) << report.cpu_fraction() * 100.0 << "% of wall time)" << std::endl;
+    ostr << "Profiler context switches: " << report.usage.context_switches << std::endl;
+    ostr << "Profiler page faults: " << report.usage.page_faults << std::endl;
+    for (const auto& stage : report.stages)
+    {
+        if (stage.count == 0)
+        {
+            continue;
+        }
+        ostr << "  " << std::left << std::setw(16) << stage_name(stage.stage) << std::right
+             << " n=" << stage.count
+             << " mean=" << stage.mean_ns << "ns"
+             << " p50=" << stage.p50_ns << "ns"
+             << " p99=" << stage.p99_ns << "ns"
+             << " max=" << stage.max_ns << "ns" << std::endl;
+    }
+    ostr.unsetf(std::ios::floatfield);
+    return ostr;
+}
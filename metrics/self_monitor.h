@@ -0,0 +1,92 @@
+#ifndef SELF_MONITOR_H
+#define SELF_MONITOR_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "latency_histogram.h"
+
+enum class PipelineStage
+{
+    READ,
+    SOURCE_READ,
+    SNAPSHOT_BUILD,
+    CALLBACK,
+    RENDER,
+    EXPORT,
+    COUNT
+};
+
+const char* stage_name(PipelineStage stage);
+
+struct StageLatency
+{
+    PipelineStage stage;
+    uint64_t count = 0;
+    uint64_t mean_ns = 0;
+    uint64_t p50_ns = 0;
+    uint64_t p99_ns = 0;
+    uint64_t max_ns = 0;
+};
+
+struct SelfUsage
+{
+    uint64_t cpu_time_us = 0;
+    uint64_t context_switches = 0;
+    uint64_t page_faults = 0;
+};
+
+struct SelfOverheadReport
+{
+    SelfUsage usage;
+    uint64_t wall_time_us = 0;
+    std::vector<StageLatency> stages;
+
+    double cpu_fraction() const
+    {
+        return wall_time_us ? static_cast<double>(usage.cpu_time_us) / wall_time_us : 0.0;
+    }
+
+    friend std::ostream& operator<<(std::ostream& ostr, const SelfOverheadReport& report);
+};
+
+class SelfMonitor
+{
+public:
+    class StageTimer
+    {
+    public:
+        StageTimer(SelfMonitor& monitor, PipelineStage stage): monitor_(monitor), stage_(stage), start_(std::chrono::steady_clock::now()) {}
+        ~StageTimer()
+        {
+            monitor_.record(stage_, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count());
+        }
+
+    private:
+        SelfMonitor& monitor_;
+        PipelineStage stage_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    void reset();
+    void record(PipelineStage stage, uint64_t ns);
+
+    //usage of all profiler threads since reset()
+    SelfUsage usage() const;
+    std::vector<StageLatency> stage_latencies() const;
+    SelfOverheadReport report() const;
+
+private:
+    std::array<LatencyHistogram, static_cast<size_t>(PipelineStage::COUNT)> stages_;
+    SelfUsage base_usage_;
+    std::chrono::steady_clock::time_point started_ = std::chrono::steady_clock::now();
+
+    static SelfUsage read_usage();
+};
+
+#endif
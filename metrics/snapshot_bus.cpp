@@ -0,0 +1,171 @@
+#include "snapshot_bus.h"
+
+#include <algorithm>
+
+#include "../processes/isolation.h"
+
+void SnapshotBus::subscribe(const std::string& name, SnapshotHandler handler, const SinkOptions& options)
+{
+    auto sink = std::make_shared<Sink>();
+    sink->name = name;
+    sink->handler = std::move(handler);
+    sink->options = options;
+    sink->options.capacity = std::max<size_t>(options.capacity, 1);
+    sink->ring.resize(sink->options.capacity);
+    sink->stats.name = name;
+    sink->thread = std::thread(&SnapshotBus::deliver, std::ref(*sink));
+
+    std::lock_guard<std::mutex> lock(sinks_mutex_);
+    std::string error;
+    pin_thread(sink->thread.native_handle(), cpus_, error);
+    sinks_.push_back(std::move(sink));
+}
+
+std::vector<std::shared_ptr<SnapshotBus::Sink>> SnapshotBus::sinks() const
+{
+    std::lock_guard<std::mutex> lock(sinks_mutex_);
+    return sinks_;
+}
+
+void SnapshotBus::publish(const SnapshotPtr& snapshot)
+{
+    //a BLOCK sink may wait here, stats() and subscribe() must not wait with it
+    for (auto& sink : sinks())
+    {
+        enqueue(*sink, snapshot);
+    }
+}
+
+void SnapshotBus::enqueue(Sink& sink, const SnapshotPtr& snapshot)
+{
+    std::unique_lock<std::mutex> lock(sink.mutex);
+    if (sink.stopping)
+    {
+        return;
+    }
+
+    const size_t capacity = sink.ring.size();
+    if (sink.count == capacity)
+    {
+        switch (sink.options.policy)
+        {
+            case BackpressurePolicy::BLOCK:
+                sink.stats.blocked++;
+                sink.not_full.wait(lock, [&sink, capacity]{ return sink.count < capacity || sink.stopping; });
+                if (sink.stopping)
+                {
+                    return;
+                }
+                break;
+            case BackpressurePolicy::DROP_OLDEST:
+                sink.ring[sink.head].reset();
+                sink.head = (sink.head + 1) % capacity;
+                sink.count--;
+                sink.stats.dropped++;
+                break;
+            case BackpressurePolicy::DROP_NEWEST:
+                sink.stats.dropped++;
+                return;
+        }
+    }
+
+    sink.ring[(sink.head + sink.count) % capacity] = snapshot;
+    sink.count++;
+    sink.not_empty.notify_one();
+}
+
+void SnapshotBus::deliver(Sink& sink)
+{
+    std::unique_lock<std::mutex> lock(sink.mutex);
+    while (true)
+    {
+        sink.not_empty.wait(lock, [&sink]{ return sink.count > 0 || sink.stopping; });
+        if (sink.count == 0)
+        {
+            break;      //stopping and drained
+        }
+
+        SnapshotPtr snapshot = std::move(sink.ring[sink.head]);
+        sink.head = (sink.head + 1) % sink.ring.size();
+        sink.count--;
+        sink.busy = true;
+        sink.not_full.notify_one();
+
+        lock.unlock();
+        sink.handler(snapshot);
+        snapshot.reset();
+        lock.lock();
+
+        sink.busy = false;
+        sink.stats.delivered++;
+        if (sink.count == 0)
+        {
+            sink.idle.notify_all();
+        }
+    }
+    sink.idle.notify_all();
+}
+
+void SnapshotBus::flush()
+{
+    for (auto& sink : sinks())
+    {
+        std::unique_lock<std::mutex> sink_lock(sink->mutex);
+        sink->idle.wait(sink_lock, [&sink]{ return (sink->count == 0 && !sink->busy) || sink->stopping; });
+    }
+}
+
+void SnapshotBus::stop()
+{
+    std::vector<std::shared_ptr<Sink>> stopped;
+    {
+        std::lock_guard<std::mutex> lock(sinks_mutex_);
+        stopped.swap(sinks_);
+    }
+    for (auto& sink : stopped)
+    {
+        {
+            std::lock_guard<std::mutex> sink_lock(sink->mutex);
+            sink->stopping = true;
+        }
+        sink->not_empty.notify_all();
+        sink->not_full.notify_all();
+        sink->idle.notify_all();
+        if (sink->thread.joinable())
+        {
+            sink->thread.join();
+        }
+    }
+}
+
+bool SnapshotBus::pin(const std::vector<int>& cpus, std::string& error)
+{
+    std::lock_guard<std::mutex> lock(sinks_mutex_);
+    cpus_ = cpus;
+    for (auto& sink : sinks_)
+    {
+        if (!pin_thread(sink->thread.native_handle(), cpus_, error))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<SinkStats> SnapshotBus::stats() const
+{
+    std::vector<SinkStats> result;
+    for (const auto& sink : sinks())
+    {
+        std::lock_guard<std::mutex> sink_lock(sink->mutex);
+        result.push_back(sink->stats);
+        result.back().queued = sink->count;
+    }
+    return result;
+}
+
+std::ostream& operator<<(std::ostream& ostr, const SinkStats& stats)
+{
+    ostr << stats.name << ": delivered " << stats.delivered << ", dropped " << stats.dropped << ", blocked " << stats.blocked << ", queued " << stats.queued;
+    return ostr;
+}
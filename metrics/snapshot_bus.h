@@ -0,0 +1,99 @@
+#ifndef SNAPSHOT_BUS_H
+#define SNAPSHOT_BUS_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "profiling_snapshot.h"
+
+//snapshots are immutable once published, every sink shares the same one
+using SnapshotPtr = std::shared_ptr<const ProfilingSnapshot>;
+using SnapshotHandler = std::function<void(const SnapshotPtr& snapshot)>;
+
+enum class BackpressurePolicy
+{
+    BLOCK,          //lossless, the publisher waits for room
+    DROP_OLDEST,    //keeps the newest snapshots
+    DROP_NEWEST     //keeps what is queued, refuses new snapshots
+};
+
+struct SinkOptions
+{
+    size_t capacity = 64;
+    BackpressurePolicy policy = BackpressurePolicy::DROP_OLDEST;
+};
+
+struct SinkStats
+{
+    std::string name;
+    uint64_t delivered = 0;
+    uint64_t dropped = 0;
+    uint64_t blocked = 0;       //publishes that had to wait for room
+    size_t queued = 0;
+};
+
+//publish/subscribe fan-out: each sink has its own bounded queue and delivery
+//thread, so a slow sink only affects itself (unless it asked to BLOCK)
+class SnapshotBus
+{
+public:
+    SnapshotBus() = default;
+    ~SnapshotBus() { stop(); }
+
+    SnapshotBus(const SnapshotBus&) = delete;
+    SnapshotBus& operator=(const SnapshotBus&) = delete;
+
+    void subscribe(const std::string& name, SnapshotHandler handler, const SinkOptions& options = SinkOptions());
+    //only pointers are queued, the snapshot is never copied
+    void publish(const SnapshotPtr& snapshot);
+    //waits until every sink has handled everything published so far
+    void flush();
+    //delivers what is queued and joins the sink threads
+    void stop();
+    //moves every sink thread, and those subscribed later, onto cpus
+    bool pin(const std::vector<int>& cpus, std::string& error);
+
+    std::vector<SinkStats> stats() const;
+
+private:
+    struct Sink
+    {
+        std::string name;
+        SnapshotHandler handler;
+        SinkOptions options;
+
+        std::mutex mutex;
+        std::condition_variable not_empty;
+        std::condition_variable not_full;
+        std::condition_variable idle;
+        std::vector<SnapshotPtr> ring;
+        size_t head = 0;
+        size_t count = 0;
+        bool busy = false;
+        bool stopping = false;
+        SinkStats stats;
+
+        std::thread thread;
+    };
+
+    //guards the list only, waiting on a sink happens outside it
+    mutable std::mutex sinks_mutex_;
+    std::vector<std::shared_ptr<Sink>> sinks_;
+    std::vector<int> cpus_;
+
+    std::vector<std::shared_ptr<Sink>> sinks() const;
+
+    static void enqueue(Sink& sink, const SnapshotPtr& snapshot);
+    static void deliver(Sink& sink);
+};
+
+std::ostream& operator<<(std::ostream& ostr, const SinkStats& stats);
+
+#endif
@@ -0,0 +1,421 @@
+#include "snapshot_history.h"
+
+#include <algorithm>
+#include <sstream>
+
+void RollupStats::add(uint64_t value)
+{
+    sum += value;
+    min = std::min(min, value);
+    max = std::max(max, value);
+    count++;
+}
+
+void RollupStats::merge(const RollupStats& other)
+{
+    sum += other.sum;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+    count += other.count;
+}
+
+void RollupBucket::add(const ProfilingSnapshot& snapshot)
+{
+    uint64_t begin = std::max(end_ms, snapshot.timestamp_ms - std::min(snapshot.duration_ms, snapshot.timestamp_ms));
+    duration_ms += snapshot.timestamp_ms > begin ? snapshot.timestamp_ms - begin : 0;
+    end_ms = std::max(end_ms, snapshot.timestamp_ms);
+    snapshots++;
+    for (const auto& metric : snapshot.metrics)
+    {
+        metrics[static_cast<size_t>(metric.type)].add(metric.value);
+    }
+}
+
+void RollupBucket::merge(const RollupBucket& other)
+{
+    duration_ms += other.duration_ms;
+    end_ms = std::max(end_ms, other.end_ms);
+    snapshots += other.snapshots;
+    for (size_t i = 0; i < metrics.size(); i++)
+    {
+        if (other.metrics[i].count)
+        {
+            metrics[i].merge(other.metrics[i]);
+        }
+    }
+}
+
+const RollupStats* RollupBucket::find(MetricType type) const
+{
+    const RollupStats& stats = metrics[static_cast<size_t>(type)];
+    return stats.count ? &stats : nullptr;
+}
+
+bool parse_duration(const std::string& text, uint64_t& ms)
+{
+    if (text == "forever" || text == "inf")
+    {
+        ms = 0;
+        return true;
+    }
+
+    size_t digits = 0;
+    while (digits < text.size() && isdigit(static_cast<unsigned char>(text[digits])))
+    {
+        digits++;
+    }
+    if (digits == 0)
+    {
+        return false;
+    }
+    uint64_t value = std::stoull(text.substr(0, digits));
+    std::string suffix = text.substr(digits);
+    if (suffix == "ms")
+    {
+        ms = value;
+    }
+    else if (suffix == "s" || suffix.empty())
+    {
+        ms = value * 1000;
+    }
+    else if (suffix == "m")
+    {
+        ms = value * 60 * 1000;
+    }
+    else if (suffix == "h")
+    {
+        ms = value * 60 * 60 * 1000;
+    }
+    else if (suffix == "d")
+    {
+        ms = value * 24 * 60 * 60 * 1000;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+bool parse_retention(const std::string& spec, HistorySettings& settings, std::string& error)
+{
+    HistorySettings parsed = settings;
+    parsed.tiers.clear();
+
+    std::istringstream istr(spec);
+    std::string item;
+    while (std::getline(istr, item, ','))
+    {
+        size_t colon = item.find(':');
+        uint64_t resolution = 0;
+        uint64_t retention = 0;
+        if (colon == std::string::npos || !parse_duration(item.substr(colon + 1), retention))
+        {
+            error = "Invalid retention tier: " + item;
+            return false;
+        }
+
+        std::string label = item.substr(0, colon);
+        if (label == "raw")
+        {
+            parsed.raw_retention_ms = retention;
+        }
+        else if (parse_duration(label, resolution) && resolution > 0)
+        {
+            parsed.tiers.push_back({resolution, retention});
+        }
+        else
+        {
+            error = "Invalid rollup resolution: " + label;
+            return false;
+        }
+    }
+
+    std::sort(parsed.tiers.begin(), parsed.tiers.end(), [](const RetentionTier& a, const RetentionTier& b)
+    {
+        return a.resolution_ms < b.resolution_ms;
+    });
+    settings = parsed;
+    return true;
+}
+
+SnapshotHistory::SnapshotHistory(const HistorySettings& settings)
+{
+    set_settings(settings);
+}
+
+void SnapshotHistory::set_settings(const HistorySettings& settings)
+{
+    settings_ = settings;
+    tiers_.clear();
+    for (const auto& retention : settings_.tiers)
+    {
+        tiers_.emplace_back();
+        tiers_.back().retention = retention;
+    }
+    raw_.clear();
+    memory_bytes_ = 0;
+    evicted_ = 0;
+}
+
+void SnapshotHistory::clear()
+{
+    raw_.clear();
+    for (auto& tier : tiers_)
+    {
+        tier.buckets.clear();
+        tier.has_open = false;
+        std::atomic_store(&tier.published_open, std::shared_ptr<const RollupBucket>());
+    }
+    memory_bytes_ = 0;
+    evicted_ = 0;
+}
+
+void SnapshotHistory::append(const SnapshotPtr& snapshot)
+{
+    size_t bytes = estimate_bytes(*snapshot);
+    raw_.push_back({snapshot, bytes});
+    memory_bytes_ += bytes;
+
+    RollupBucket single;
+    single.start_ms = snapshot->timestamp_ms;
+    single.add(*snapshot);
+    for (size_t i = 0; i < tiers_.size(); i++)
+    {
+        add_to_tier(i, single);
+    }
+
+    expire(snapshot->timestamp_ms);
+    enforce_cap();
+}
+
+void SnapshotHistory::add_to_tier(size_t index, const RollupBucket& bucket)
+{
+    Tier& tier = tiers_[index];
+    uint64_t start = bucket.start_ms - bucket.start_ms % tier.retention.resolution_ms;
+    if (tier.has_open && tier.open.start_ms != start)
+    {
+        tier.buckets.push_back(tier.open);
+        memory_bytes_ += sizeof(RollupBucket);
+        tier.has_open = false;
+    }
+    if (!tier.has_open)
+    {
+        tier.open = RollupBucket();
+        tier.open.start_ms = start;
+        tier.has_open = true;
+    }
+    tier.open.merge(bucket);
+    std::atomic_store(&tier.published_open, std::shared_ptr<const RollupBucket>(std::make_shared<RollupBucket>(tier.open)));
+}
+
+void SnapshotHistory::expire(uint64_t now_ms)
+{
+    if (settings_.raw_retention_ms)
+    {
+        while (!raw_.empty() && raw_.front().snapshot->timestamp_ms + settings_.raw_retention_ms < now_ms)
+        {
+            memory_bytes_ -= raw_.front().bytes;
+            raw_.pop_front();
+        }
+    }
+
+    for (auto& tier : tiers_)
+    {
+        if (tier.retention.retention_ms == 0)
+        {
+            continue;
+        }
+        while (!tier.buckets.empty() && tier.buckets.front().start_ms + tier.retention.resolution_ms + tier.retention.retention_ms < now_ms)
+        {
+            memory_bytes_ -= sizeof(RollupBucket);
+            tier.buckets.pop_front();
+        }
+    }
+}
+
+void SnapshotHistory::enforce_cap()
+{
+    //finest data goes first, coarser tiers still cover the evicted range
+    while (memory_bytes_ > settings_.memory_cap_bytes)
+    {
+        if (raw_.size() > 1)
+        {
+            memory_bytes_ -= raw_.front().bytes;
+            raw_.pop_front();
+            evicted_++;
+            continue;
+        }
+
+        auto tier = std::find_if(tiers_.begin(), tiers_.end(), [](const Tier& t){ return !t.buckets.empty(); });
+        if (tier == tiers_.end())
+        {
+            break;
+        }
+        memory_bytes_ -= sizeof(RollupBucket);
+        tier->buckets.pop_front();
+        evicted_++;
+    }
+}
+
+bool SnapshotHistory::covers(const RawView& raw, uint64_t from_ms)
+{
+    return !raw.empty() && raw.front().snapshot->timestamp_ms <= from_ms;
+}
+
+bool SnapshotHistory::covers(const BucketView& buckets, const std::shared_ptr<const RollupBucket>& open, uint64_t from_ms)
+{
+    if (!buckets.empty())
+    {
+        return buckets.front().start_ms <= from_ms;
+    }
+    return open && open->start_ms <= from_ms;
+}
+
+std::vector<SnapshotPtr> SnapshotHistory::raw() const
+{
+    RawView raw = raw_.view();
+    std::vector<SnapshotPtr> result;
+    result.reserve(raw.size());
+    for (size_t i = 0; i < raw.size(); i++)
+    {
+        result.push_back(raw[i].snapshot);
+    }
+    return result;
+}
+
+bool SnapshotHistory::oldest_raw(uint64_t& timestamp_ms) const
+{
+    RawView raw = raw_.view();
+    if (raw.empty())
+    {
+        return false;
+    }
+    timestamp_ms = raw.front().snapshot->timestamp_ms;
+    return true;
+}
+
+HistoryQuery SnapshotHistory::query(uint64_t from_ms, uint64_t to_ms, size_t max_points) const
+{
+    //views first: everything below works on what was published at this point;
+    //an open bucket is taken before the closed ones, it can only move into them
+    RawView raw = raw_.view();
+    std::vector<BucketView> buckets;
+    std::vector<std::shared_ptr<const RollupBucket>> open;
+    for (const auto& tier : tiers_)
+    {
+        open.push_back(std::atomic_load(&tier.published_open));
+        buckets.push_back(tier.buckets.view());
+    }
+
+    //candidate 0 is raw, candidate i is tiers_[i - 1]
+    auto points = [this, &raw, from_ms, to_ms](size_t candidate)
+    {
+        if (candidate == 0)
+        {
+            size_t count = 0;
+            for (size_t i = 0; i < raw.size(); i++)
+            {
+                uint64_t timestamp = raw[i].snapshot->timestamp_ms;
+                count += timestamp >= from_ms && timestamp <= to_ms;
+            }
+            return count;
+        }
+        uint64_t resolution = tiers_[candidate - 1].retention.resolution_ms;
+        return static_cast<size_t>((to_ms - std::min(from_ms, to_ms)) / resolution + 1);
+    };
+    auto covered = [&](size_t candidate)
+    {
+        return candidate == 0 ? covers(raw, from_ms) : covers(buckets[candidate - 1], open[candidate - 1], from_ms);
+    };
+
+    size_t chosen = tiers_.size();
+    for (size_t candidate = 0; candidate <= tiers_.size(); candidate++)
+    {
+        if (covered(candidate) && (max_points == 0 || points(candidate) <= max_points))
+        {
+            chosen = candidate;
+            break;
+        }
+    }
+
+    HistoryQuery result;
+    if (chosen == 0)
+    {
+        for (size_t i = 0; i < raw.size(); i++)
+        {
+            const ProfilingSnapshot& snapshot = *raw[i].snapshot;
+            if (snapshot.timestamp_ms >= from_ms && snapshot.timestamp_ms <= to_ms)
+            {
+                RollupBucket bucket;
+                bucket.start_ms = snapshot.timestamp_ms;
+                bucket.add(snapshot);
+                result.buckets.push_back(bucket);
+            }
+        }
+        return result;
+    }
+    const BucketView& tier = buckets[chosen - 1];
+    result.resolution_ms = tiers_[chosen - 1].retention.resolution_ms;
+    auto in_range = [resolution = result.resolution_ms, from_ms, to_ms](const RollupBucket& bucket)
+    {
+        return bucket.start_ms + resolution > from_ms && bucket.start_ms <= to_ms;
+    };
+    for (size_t i = 0; i < tier.size(); i++)
+    {
+        if (in_range(tier[i]))
+        {
+            result.buckets.push_back(tier[i]);
+        }
+    }
+    //the open bucket may have been closed after the view was taken, it is then the view's last one
+    const auto& last = open[chosen - 1];
+    if (last && in_range(*last) && (tier.empty() || tier.back().start_ms != last->start_ms))
+    {
+        result.buckets.push_back(*last);
+    }
+    return result;
+}
+
+HistoryUsage SnapshotHistory::usage() const
+{
+    HistoryUsage usage;
+    usage.raw_snapshots = raw_.view().size();
+    for (const auto& tier : tiers_)
+    {
+        usage.tier_resolutions_ms.push_back(tier.retention.resolution_ms);
+        usage.tier_buckets.push_back(tier.buckets.view().size() + (std::atomic_load(&tier.published_open) ? 1 : 0));
+    }
+    usage.memory_bytes = memory_bytes_;
+    usage.evicted = evicted_;
+    return usage;
+}
+
+size_t SnapshotHistory::estimate_bytes(const ProfilingSnapshot& snapshot)
+{
+    //control block and the snapshot itself, strings are assumed to fit SSO
+    size_t bytes = sizeof(ProfilingSnapshot) + 2 * sizeof(void*) + sizeof(RawEntry);
+    bytes += snapshot.metrics.capacity() * sizeof(MetricValue);
+    bytes += snapshot.threads.capacity() * sizeof(ThreadSchedStats);
+    bytes += snapshot.stage_latencies.capacity() * sizeof(StageLatency);
+    for (const auto& region : snapshot.regions)
+    {
+        bytes += sizeof(RegionSample) + region.metrics.capacity() * sizeof(MetricValue);
+    }
+    return bytes;
+}
+
+std::ostream& operator<<(std::ostream& ostr, const HistoryUsage& usage)
+{
+    ostr << "raw " << usage.raw_snapshots;
+    for (size_t i = 0; i < usage.tier_buckets.size(); i++)
+    {
+        ostr << ", " << usage.tier_resolutions_ms[i] << "ms rollups " << usage.tier_buckets[i];
+    }
+    ostr << ", " << usage.memory_bytes / 1024 << " KiB";
+    if (usage.evicted)
+    {
+        ostr << ", " << usage.evicted << " evicted by the memory cap";
+    }
+    return ostr;
+}
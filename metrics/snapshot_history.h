@@ -0,0 +1,131 @@
+#ifndef SNAPSHOT_HISTORY_H
+#define SNAPSHOT_HISTORY_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "append_log.h"
+#include "snapshot_bus.h"
+
+struct RollupStats
+{
+    uint64_t sum = 0;
+    uint64_t min = UINT64_MAX;
+    uint64_t max = 0;
+    uint64_t count = 0;
+
+    void add(uint64_t value);
+    void merge(const RollupStats& other);
+    double mean() const { return count ? static_cast<double>(sum) / count : 0.0; }
+};
+
+//aggregate of the snapshots in [start_ms, start_ms + resolution)
+struct RollupBucket
+{
+    uint64_t start_ms = 0;
+    uint64_t duration_ms = 0;       //time covered by its snapshots, rate = sum / duration
+    uint64_t end_ms = 0;            //kernel-timed mode publishes the sources over the samples of a batch
+    uint32_t snapshots = 0;
+    std::array<RollupStats, static_cast<size_t>(MetricType::COUNT)> metrics;
+
+    void add(const ProfilingSnapshot& snapshot);
+    void merge(const RollupBucket& other);
+    const RollupStats* find(MetricType type) const;
+};
+
+struct RetentionTier
+{
+    uint64_t resolution_ms;
+    uint64_t retention_ms;          //0 - kept forever (up to the memory cap)
+};
+
+struct HistorySettings
+{
+    uint64_t raw_retention_ms = 10 * 60 * 1000;
+    std::vector<RetentionTier> tiers = {{1000, 24 * 60 * 60 * 1000ull}, {60 * 1000, 0}};
+    size_t memory_cap_bytes = 64 << 20;
+};
+
+//"250ms", "10s", "5m", "1h", "1d", a bare number is seconds, "forever" is 0
+bool parse_duration(const std::string& text, uint64_t& ms);
+//"raw:10m,1s:1d,1m:forever", durations in ms, s, m, h or d
+bool parse_retention(const std::string& spec, HistorySettings& settings, std::string& error);
+
+struct HistoryQuery
+{
+    uint64_t resolution_ms = 0;     //0 - raw snapshots, one bucket each
+    std::vector<RollupBucket> buckets;
+};
+
+struct HistoryUsage
+{
+    size_t raw_snapshots = 0;
+    std::vector<uint64_t> tier_resolutions_ms;
+    std::vector<size_t> tier_buckets;
+    size_t memory_bytes = 0;
+    uint64_t evicted = 0;           //entries dropped early to stay under the cap
+};
+
+//tiered retention: raw snapshots for a while, then coarser and coarser rollups;
+//every tier is fed incrementally as snapshots arrive, expiry is per tier.
+//One thread appends, any thread reads: readers work on append-only logs and
+//never block the appending sink
+class SnapshotHistory
+{
+public:
+    explicit SnapshotHistory(const HistorySettings& settings = HistorySettings());
+
+    //not concurrent with readers, only while nothing is profiled
+    void set_settings(const HistorySettings& settings);
+    void append(const SnapshotPtr& snapshot);
+    void clear();
+
+    std::vector<SnapshotPtr> raw() const;
+    //timestamp of the oldest raw snapshot, false while there is none
+    bool oldest_raw(uint64_t& timestamp_ms) const;
+    //finest tier that still covers from_ms and returns at most max_points buckets (0 - any)
+    HistoryQuery query(uint64_t from_ms, uint64_t to_ms, size_t max_points = 0) const;
+    HistoryUsage usage() const;
+
+private:
+    struct RawEntry
+    {
+        SnapshotPtr snapshot;
+        size_t bytes;
+    };
+
+    struct Tier
+    {
+        RetentionTier retention;
+        AppendLog<RollupBucket, 64> buckets;    //closed buckets, oldest first
+        RollupBucket open;                      //the appending thread's own
+        bool has_open = false;
+        std::shared_ptr<const RollupBucket> published_open;    //copy of open for readers, atomic_load/atomic_store
+    };
+
+    using RawView = AppendLog<RawEntry>::View;
+    using BucketView = AppendLog<RollupBucket, 64>::View;
+
+    HistorySettings settings_;
+    AppendLog<RawEntry> raw_;
+    std::deque<Tier> tiers_;                    //a deque: the logs can't be moved
+    std::atomic<size_t> memory_bytes_{0};
+    std::atomic<uint64_t> evicted_{0};
+
+    void add_to_tier(size_t index, const RollupBucket& bucket);
+    void expire(uint64_t now_ms);
+    void enforce_cap();
+    static bool covers(const RawView& raw, uint64_t from_ms);
+    static bool covers(const BucketView& buckets, const std::shared_ptr<const RollupBucket>& open, uint64_t from_ms);
+    static size_t estimate_bytes(const ProfilingSnapshot& snapshot);
+};
+
+std::ostream& operator<<(std::ostream& ostr, const HistoryUsage& usage);
+
+#endif
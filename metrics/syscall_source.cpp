@@ -0,0 +1,356 @@
+#include "syscall_source.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+
+//PERF_SAMPLE_RAW records are large, a busy target makes millions per second
+static constexpr size_t syscall_ring_pages = 512;
+
+struct SyscallName
+{
+    long nr;
+    const char* name;
+};
+
+#define SYSCALL(name) {SYS_##name, #name}
+
+static const SyscallName syscall_names[] =
+{
+    SYSCALL(read), SYSCALL(write), SYSCALL(openat), SYSCALL(close), SYSCALL(fstat), SYSCALL(newfstatat), SYSCALL(statx),
+    SYSCALL(lseek), SYSCALL(mmap), SYSCALL(mprotect), SYSCALL(munmap), SYSCALL(mremap), SYSCALL(msync), SYSCALL(madvise),
+    SYSCALL(brk), SYSCALL(rt_sigaction), SYSCALL(rt_sigprocmask), SYSCALL(rt_sigreturn), SYSCALL(ioctl), SYSCALL(pread64),
+    SYSCALL(pwrite64), SYSCALL(readv), SYSCALL(writev), SYSCALL(sched_yield), SYSCALL(dup), SYSCALL(dup3),
+    SYSCALL(nanosleep), SYSCALL(clock_nanosleep), SYSCALL(clock_gettime), SYSCALL(gettimeofday), SYSCALL(getpid),
+    SYSCALL(gettid), SYSCALL(getuid), SYSCALL(getgid), SYSCALL(sendfile), SYSCALL(socket), SYSCALL(connect),
+    SYSCALL(accept), SYSCALL(accept4), SYSCALL(sendto), SYSCALL(recvfrom), SYSCALL(sendmsg), SYSCALL(recvmsg),
+    SYSCALL(sendmmsg), SYSCALL(recvmmsg), SYSCALL(shutdown), SYSCALL(bind), SYSCALL(listen), SYSCALL(getsockname),
+    SYSCALL(getpeername), SYSCALL(socketpair), SYSCALL(setsockopt), SYSCALL(getsockopt), SYSCALL(clone), SYSCALL(execve),
+    SYSCALL(exit), SYSCALL(exit_group), SYSCALL(wait4), SYSCALL(kill), SYSCALL(tgkill), SYSCALL(uname), SYSCALL(fcntl),
+    SYSCALL(flock), SYSCALL(fsync), SYSCALL(fdatasync), SYSCALL(truncate), SYSCALL(ftruncate), SYSCALL(getdents64),
+    SYSCALL(getcwd), SYSCALL(chdir), SYSCALL(renameat), SYSCALL(mkdirat), SYSCALL(unlinkat), SYSCALL(readlinkat),
+    SYSCALL(faccessat), SYSCALL(fchmod), SYSCALL(fchown), SYSCALL(umask), SYSCALL(getrusage), SYSCALL(sysinfo),
+    SYSCALL(prctl), SYSCALL(futex), SYSCALL(set_robust_list), SYSCALL(sched_setaffinity), SYSCALL(sched_getaffinity),
+    SYSCALL(epoll_create1), SYSCALL(epoll_ctl), SYSCALL(epoll_pwait), SYSCALL(ppoll), SYSCALL(pselect6),
+    SYSCALL(eventfd2), SYSCALL(pipe2), SYSCALL(timerfd_create), SYSCALL(timerfd_settime), SYSCALL(signalfd4),
+    SYSCALL(prlimit64), SYSCALL(getrandom), SYSCALL(membarrier), SYSCALL(io_uring_setup), SYSCALL(io_uring_enter),
+    SYSCALL(restart_syscall), SYSCALL(perf_event_open), SYSCALL(memfd_create), SYSCALL(process_vm_readv),
+#ifdef SYS_rseq
+    SYSCALL(rseq),
+#endif
+#ifdef SYS_clone3
+    SYSCALL(clone3),
+#endif
+    //legacy calls that newer architectures only have as *at variants
+#ifdef SYS_open
+    SYSCALL(open), SYSCALL(stat), SYSCALL(lstat), SYSCALL(poll), SYSCALL(access), SYSCALL(pipe), SYSCALL(select),
+    SYSCALL(dup2), SYSCALL(epoll_wait), SYSCALL(epoll_create), SYSCALL(fork), SYSCALL(vfork), SYSCALL(getdents),
+    SYSCALL(readlink), SYSCALL(unlink), SYSCALL(rename), SYSCALL(mkdir), SYSCALL(rmdir), SYSCALL(creat),
+#endif
+#ifdef SYS_arch_prctl
+    SYSCALL(arch_prctl),
+#endif
+};
+
+#undef SYSCALL
+
+const char* syscall_name(int64_t nr)
+{
+    for (const auto& entry : syscall_names)
+    {
+        if (entry.nr == nr)
+        {
+            return entry.name;
+        }
+    }
+    return nullptr;
+}
+
+static std::string slot_name(size_t slot, size_t other_slot)
+{
+    if (slot == other_slot)
+    {
+        return "other";
+    }
+    const char* name = syscall_name(static_cast<int64_t>(slot));
+    return name ? name : "sys_" + std::to_string(slot);
+}
+
+void SyscallSource::SyscallStats::add(const SyscallStats& other)
+{
+    calls += other.calls;
+    errors += other.errors;
+    latency.add(other.latency);
+}
+
+SyscallSource::SyscallSource(const SourceOptions& options): options_(options)
+{
+}
+
+bool SyscallSource::open(int pid, std::string& error)
+{
+    Tracepoint enter, exit;
+    if (!enter.load("raw_syscalls", "sys_enter", error) || !exit.load("raw_syscalls", "sys_exit", error)
+        || !enter.find("id", enter_nr_, error) || !exit.find("id", exit_nr_, error) || !exit.find("ret", exit_ret_, error))
+    {
+        return false;
+    }
+    enter_id_ = enter.id;
+
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_TRACEPOINT;
+    attr.config = enter.id;
+    attr.sample_period = 1;
+    attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_RAW;
+    attr.inherit = 1;
+    attr.task = 1;
+    attr.watermark = 1;
+    attr.wakeup_watermark = static_cast<uint32_t>(syscall_ring_pages * sysconf(_SC_PAGESIZE) / 4);
+
+    if (!sampler_.open(pid, attr, syscall_ring_pages, error))
+    {
+        return false;
+    }
+    //one PERF_RECORD_EXIT per thread is enough
+    attr.task = 0;
+    attr.config = exit.id;
+    if (!sampler_.add_event(attr, error))
+    {
+        sampler_.close();
+        return false;
+    }
+
+    interval_.assign(max_syscalls, SyscallStats());
+    total_.assign(max_syscalls, SyscallStats());
+    touched_.clear();
+    touched_.reserve(max_syscalls);
+    pending_.clear();
+    pending_.reserve(1024);
+    events_.clear();
+    events_.reserve(1 << 16);
+    lost_records_ = 0;
+
+    sampler_.enable();
+    reader_.start(sampler_, [this]
+    {
+        drain();
+        process_events();
+    });
+    return true;
+}
+
+void SyscallSource::collect(ProfilingSnapshot& snapshot)
+{
+    std::lock_guard<std::mutex> lock(reader_.mutex());
+    drain();
+    process_events();
+
+    uint64_t calls = 0;
+    uint64_t time_ns = 0;
+    for (uint32_t nr : touched_)
+    {
+        calls += interval_[nr].calls;
+        time_ns += interval_[nr].latency.sum_ns;
+    }
+
+    //top syscalls of the interval by time spent, calls that never block still show up by count
+    std::sort(touched_.begin(), touched_.end(), [this](uint32_t a, uint32_t b)
+    {
+        const SyscallStats& first = interval_[a];
+        const SyscallStats& second = interval_[b];
+        return first.latency.sum_ns != second.latency.sum_ns ? first.latency.sum_ns > second.latency.sum_ns : first.calls > second.calls;
+    });
+    for (size_t i = 0; i < touched_.size() && i < top_syscalls; i++)
+    {
+        const SyscallStats& stats = interval_[touched_[i]];
+        SyscallSample sample;
+        sample.name = slot_name(touched_[i], max_syscalls - 1);
+        sample.count = stats.calls;
+        sample.time_ns = stats.latency.sum_ns;
+        sample.errors = stats.errors;
+        sample.p50_ns = stats.latency.percentile_ns(0.5);
+        sample.p99_ns = stats.latency.percentile_ns(0.99);
+        snapshot.syscalls.push_back(sample);
+    }
+
+    for (uint32_t nr : touched_)
+    {
+        total_[nr].add(interval_[nr]);
+        interval_[nr] = SyscallStats();
+    }
+    touched_.clear();
+
+    snapshot.metrics.push_back({MetricType::SYSCALL_COUNT, calls, metric_name(MetricType::SYSCALL_COUNT), metric_unit(MetricType::SYSCALL_COUNT)});
+    snapshot.metrics.push_back({MetricType::SYSCALL_TIME, time_ns, metric_name(MetricType::SYSCALL_TIME), metric_unit(MetricType::SYSCALL_TIME)});
+}
+
+void SyscallSource::close()
+{
+    if (!sampler_.is_open())
+    {
+        return;
+    }
+
+    reader_.stop();
+    sampler_.disable();
+    drain();
+    process_events();
+    sampler_.close();
+    for (uint32_t nr : touched_)
+    {
+        total_[nr].add(interval_[nr]);
+    }
+    touched_.clear();
+
+    if (!options_.syscall_table_path.empty())
+    {
+        write_table(options_.syscall_table_path);
+    }
+}
+
+void SyscallSource::drain()
+{
+    sampler_.drain([this](const perf_event_header* record)
+    {
+        const char* body = reinterpret_cast<const char*>(record + 1);
+        const char* end = reinterpret_cast<const char*>(record) + record->size;
+
+        if (record->type == PERF_RECORD_SAMPLE && body + 20 <= end)
+        {
+            //pid, tid, time, raw size, raw data
+            uint32_t raw_size = *reinterpret_cast<const uint32_t*>(body + 16);
+            const char* raw = body + 20;
+            if (raw + raw_size > end || raw_size < 2)
+            {
+                return;
+            }
+
+            SyscallEvent event;
+            event.tid = *reinterpret_cast<const uint32_t*>(body + 4);
+            event.time = *reinterpret_cast<const uint64_t*>(body + 8);
+            //common_type tells the two tracepoints apart, both share the ring
+            uint16_t type = *reinterpret_cast<const uint16_t*>(raw);
+            bool exit = type != enter_id_;
+            event.kind = exit ? EventKind::EXIT : EventKind::ENTER;
+            const TracepointField& nr = exit ? exit_nr_ : enter_nr_;
+            if (nr.offset + nr.size > raw_size || (exit && exit_ret_.offset + exit_ret_.size > raw_size))
+            {
+                return;
+            }
+            event.nr = static_cast<int32_t>(read_tracepoint_field(raw, nr));
+            event.ret = exit ? read_tracepoint_field(raw, exit_ret_) : 0;
+            events_.push_back(event);
+        }
+        else if (record->type == PERF_RECORD_EXIT && body + 24 <= end)
+        {
+            //pid, ppid, tid, ptid, time
+            SyscallEvent event;
+            event.tid = *reinterpret_cast<const uint32_t*>(body + 8);
+            event.time = *reinterpret_cast<const uint64_t*>(body + 16);
+            event.nr = -1;
+            event.ret = 0;
+            event.kind = EventKind::THREAD_EXIT;
+            events_.push_back(event);
+        }
+        else if (record->type == PERF_RECORD_LOST && body + 16 <= end)
+        {
+            lost_records_ += *reinterpret_cast<const uint64_t*>(body + 8);
+        }
+    });
+}
+
+void SyscallSource::process_events()
+{
+    //a thread that migrated while blocked exits in another ring
+    sort_by_time(events_);
+
+    for (const auto& event : events_)
+    {
+        if (event.kind == EventKind::THREAD_EXIT)
+        {
+            pending_.erase(event.tid);
+            continue;
+        }
+        if (event.kind == EventKind::ENTER)
+        {
+            if (pending_.size() >= max_pending && !pending_.count(event.tid))
+            {
+                //the exits of some threads were lost with their records
+                sweep_pending(event.time);
+            }
+            if (pending_.size() < max_pending || pending_.count(event.tid))
+            {
+                pending_[event.tid] = {event.time, event.nr};
+            }
+            continue;
+        }
+
+        size_t nr = slot(event.nr);
+        SyscallStats& stats = interval_[nr];
+        if (stats.calls == 0)
+        {
+            touched_.push_back(static_cast<uint32_t>(nr));
+        }
+        stats.calls++;
+        if (event.ret < 0)
+        {
+            stats.errors++;
+        }
+
+        //entered before profiling started, or the entry was lost: counted, not timed
+        auto it = pending_.find(event.tid);
+        if (it == pending_.end() || it->second.nr != event.nr || it->second.enter_time > event.time)
+        {
+            continue;
+        }
+        stats.latency.record(event.time - it->second.enter_time);
+        pending_.erase(it);
+    }
+    events_.clear();
+}
+
+void SyscallSource::sweep_pending(uint64_t now)
+{
+    for (auto it = pending_.begin(); it != pending_.end();)
+    {
+        it = it->second.enter_time + stale_pending_ns < now ? pending_.erase(it) : std::next(it);
+    }
+}
+
+bool SyscallSource::write_table(const std::string& path) const
+{
+    std::ofstream out(path);
+    if (!out.is_open())
+    {
+        return false;
+    }
+
+    std::vector<uint32_t> order;
+    for (uint32_t nr = 0; nr < max_syscalls; nr++)
+    {
+        if (total_[nr].calls)
+        {
+            order.push_back(nr);
+        }
+    }
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return total_[a].latency.sum_ns > total_[b].latency.sum_ns; });
+
+    out << "# syscall calls errors total_ns p50_ns p99_ns max_ns latency buckets (<ns:count)\n";
+    for (uint32_t nr : order)
+    {
+        const SyscallStats& stats = total_[nr];
+        const LogHistogram& latency = stats.latency;
+        out << slot_name(nr, max_syscalls - 1) << ' ' << stats.calls << ' ' << stats.errors << ' ' << latency.sum_ns
+            << ' ' << latency.percentile_ns(0.5) << ' ' << latency.percentile_ns(0.99) << ' ' << latency.max_ns;
+        latency.write_buckets(out);
+        out << '\n';
+    }
+    if (lost_records_)
+    {
+        out << "# lost " << lost_records_ << " records\n";
+    }
+    return true;
+}
@@ -0,0 +1,90 @@
+#ifndef SYSCALL_SOURCE_H
+#define SYSCALL_SOURCE_H
+
+#include <unordered_map>
+#include <vector>
+
+#include "latency_histogram.h"
+#include "metric_source.h"
+#include "perf_ring.h"
+#include "tracepoint.h"
+#include "tracepoint_reader.h"
+
+//per-syscall counts and latencies from the raw_syscalls:sys_enter/sys_exit tracepoints;
+//a reader thread empties the rings between ticks, a syscall storm fills them in milliseconds
+class SyscallSource : public MetricSource
+{
+public:
+    explicit SyscallSource(const SourceOptions& options);
+
+    const char* name() const override { return "syscalls"; }
+    bool open(int pid, std::string& error) override;
+    void collect(ProfilingSnapshot& snapshot) override;
+    void close() override;
+
+    //whole-run table, one syscall per line ordered by time spent
+    bool write_table(const std::string& path) const;
+
+private:
+    static constexpr size_t max_syscalls = 512;         //numbers above share the last slot
+    static constexpr size_t max_pending = 65536;
+    static constexpr uint64_t stale_pending_ns = 10000000000ull;    //swept once the table is full
+    static constexpr size_t top_syscalls = 8;
+
+    struct SyscallStats
+    {
+        uint64_t calls = 0;
+        uint64_t errors = 0;
+        LogHistogram latency;       //without the exits whose entry was not seen
+
+        void add(const SyscallStats& other);
+    };
+
+    enum class EventKind : uint8_t
+    {
+        ENTER,
+        EXIT,
+        THREAD_EXIT     //frees the entry of a thread that died in exit() or exit_group()
+    };
+
+    struct SyscallEvent
+    {
+        uint64_t time;
+        uint32_t tid;
+        int32_t nr;
+        int64_t ret;
+        EventKind kind;
+    };
+
+    struct PendingSyscall
+    {
+        uint64_t enter_time;
+        int32_t nr;
+    };
+
+    SourceOptions options_;
+    PerCpuSampler sampler_;
+    uint32_t enter_id_ = 0;
+    TracepointField enter_nr_;
+    TracepointField exit_nr_;
+    TracepointField exit_ret_;
+
+    //bounded: indexed by syscall number, reused every tick
+    std::vector<SyscallStats> interval_;
+    std::vector<SyscallStats> total_;
+    std::vector<uint32_t> touched_;
+    std::unordered_map<uint32_t, PendingSyscall> pending_;
+    std::vector<SyscallEvent> events_;
+    uint64_t lost_records_ = 0;
+
+    TracepointReader reader_;       //everything above is shared with it
+
+    void drain();
+    void process_events();
+    void sweep_pending(uint64_t now);
+    size_t slot(int32_t nr) const { return nr >= 0 && static_cast<size_t>(nr) < max_syscalls - 1 ? nr : max_syscalls - 1; }
+};
+
+const char* syscall_name(int64_t nr);
+
+#endif
@@ -0,0 +1,79 @@
+#include "tracepoint.h"
+
+#include <fstream>
+
+static const char* tracefs_roots[] = {"/sys/kernel/tracing", "/sys/kernel/debug/tracing"};
+
+bool Tracepoint::load(const std::string& subsystem, const std::string& event, std::string& error)
+{
+    fields.clear();
+    id = 0;
+
+    std::ifstream format;
+    for (const char* root : tracefs_roots)
+    {
+        format.open(std::string(root) + "/events/" + subsystem + "/" + event + "/format");
+        if (format.is_open())
+        {
+            break;
+        }
+        format.clear();
+    }
+    if (!format.is_open())
+    {
+        error = "tracepoint " + subsystem + ":" + event + " not found, is tracefs mounted on /sys/kernel/tracing?";
+        return false;
+    }
+
+    //  ID: 443
+    //  	field:long id;	offset:8;	size:8;	signed:1;
+    std::string line;
+    while (std::getline(format, line))
+    {
+        if (line.compare(0, 3, "ID:") == 0)
+        {
+            id = static_cast<uint32_t>(std::stoul(line.substr(3)));
+            continue;
+        }
+
+        size_t declaration = line.find("field:");
+        size_t offset = line.find("offset:");
+        size_t size = line.find("size:");
+        size_t sign = line.find("signed:");
+        if (declaration == std::string::npos || offset == std::string::npos || size == std::string::npos)
+        {
+            continue;
+        }
+
+        //the name is the last word before ';', without an array suffix
+        std::string text = line.substr(declaration + 6, line.find(';', declaration) - declaration - 6);
+        text = text.substr(0, text.find('['));
+        size_t name_start = text.find_last_of(" *");
+        std::string name = name_start == std::string::npos ? text : text.substr(name_start + 1);
+
+        TracepointField field;
+        field.offset = static_cast<uint32_t>(std::stoul(line.substr(offset + 7)));
+        field.size = static_cast<uint32_t>(std::stoul(line.substr(size + 5)));
+        field.is_signed = sign != std::string::npos && line.compare(sign + 7, 1, "1") == 0;
+        fields[name] = field;
+    }
+
+    if (id == 0)
+    {
+        error = "tracepoint " + subsystem + ":" + event + " has no id";
+        return false;
+    }
+    return true;
+}
+
+bool Tracepoint::find(const std::string& field, TracepointField& out, std::string& error) const
+{
+    auto it = fields.find(field);
+    if (it == fields.end())
+    {
+        error = "tracepoint field " + field + " not found";
+        return false;
+    }
+    out = it->second;
+    return true;
+}
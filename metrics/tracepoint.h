@@ -0,0 +1,55 @@
+#ifndef TRACEPOINT_H
+#define TRACEPOINT_H
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+
+struct TracepointField
+{
+    uint32_t offset = 0;
+    uint32_t size = 0;
+    bool is_signed = false;
+};
+
+//id and field layout of a kernel tracepoint from tracefs
+//(events/<subsystem>/<event>/format)
+struct Tracepoint
+{
+    uint32_t id = 0;
+    std::map<std::string, TracepointField> fields;
+
+    bool load(const std::string& subsystem, const std::string& event, std::string& error);
+    bool find(const std::string& field, TracepointField& out, std::string& error) const;
+};
+
+//reads a PERF_SAMPLE_RAW field as a 64-bit value, sign extended when signed
+inline int64_t read_tracepoint_field(const char* raw, const TracepointField& field)
+{
+    switch (field.size)
+    {
+        case 1:
+            return field.is_signed ? static_cast<int64_t>(*reinterpret_cast<const int8_t*>(raw + field.offset)) : *reinterpret_cast<const uint8_t*>(raw + field.offset);
+        case 2:
+        {
+            uint16_t value;
+            memcpy(&value, raw + field.offset, sizeof(value));
+            return field.is_signed ? static_cast<int16_t>(value) : value;
+        }
+        case 4:
+        {
+            uint32_t value;
+            memcpy(&value, raw + field.offset, sizeof(value));
+            return field.is_signed ? static_cast<int32_t>(value) : value;
+        }
+        default:
+        {
+            int64_t value;
+            memcpy(&value, raw + field.offset, sizeof(value));
+            return value;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,36 @@
+#include "tracepoint_reader.h"
+
+#include <chrono>
+
+void TracepointReader::start(PerCpuSampler& sampler, std::function<void()> drain)
+{
+    stop();
+    sampler_ = &sampler;
+    drain_ = std::move(drain);
+    reading_ = true;
+    thread_ = std::thread(&TracepointReader::read_loop, this);
+}
+
+void TracepointReader::stop()
+{
+    reading_ = false;
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+}
+
+void TracepointReader::read_loop()
+{
+    while (reading_)
+    {
+        if (sampler_->wait(poll_ms) < 0)
+        {
+            //the target is gone, what is left is drained by collect() and close()
+            std::this_thread::sleep_for(std::chrono::milliseconds(poll_ms));
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        drain_();
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef TRACEPOINT_READER_H
+#define TRACEPOINT_READER_H
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "perf_ring.h"
+
+//empties the rings of a tracepoint sampler between ticks: a storm of syscalls
+//or futex calls fills them in milliseconds. The owner's drain runs under mutex(),
+//which collect() and close() take too
+class TracepointReader
+{
+public:
+    static constexpr int poll_ms = 10;
+
+    TracepointReader() = default;
+    ~TracepointReader() { stop(); }
+
+    TracepointReader(const TracepointReader&) = delete;
+    TracepointReader& operator=(const TracepointReader&) = delete;
+
+    void start(PerCpuSampler& sampler, std::function<void()> drain);
+    //joins the thread, what is still in the rings is for the owner to drain
+    void stop();
+    std::mutex& mutex() { return mutex_; }
+
+private:
+    PerCpuSampler* sampler_ = nullptr;
+    std::function<void()> drain_;
+    std::mutex mutex_;
+    std::atomic<bool> reading_{false};
+    std::thread thread_;
+
+    void read_loop();
+};
+
+//each ring is ordered, but an enter and its exit may sit in the rings of two CPUs
+template <typename Event>
+void sort_by_time(std::vector<Event>& events)
+{
+    auto earlier = [](const Event& a, const Event& b) { return a.time < b.time; };
+    if (!std::is_sorted(events.begin(), events.end(), earlier))
+    {
+        std::sort(events.begin(), events.end(), earlier);
+    }
+}
+
+#endif
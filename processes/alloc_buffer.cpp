@@ -0,0 +1,89 @@
+#include "alloc_buffer.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+std::string default_alloc_shim_path()
+{
+    char path[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (length <= 0)
+    {
+        return "libprofiler_alloc.so";
+    }
+    std::string exe(path, length);
+    return exe.substr(0, exe.rfind('/') + 1) + "libprofiler_alloc.so";
+}
+
+bool AllocBuffer::create(const AllocOptions& options, std::string& error)
+{
+    close();
+
+    //the dynamic loader silently skips a missing preload, fail loudly instead
+    shim_path_ = options.shim_path.empty() ? default_alloc_shim_path() : options.shim_path;
+    char resolved[PATH_MAX];
+    if (!realpath(shim_path_.c_str(), resolved) || access(resolved, R_OK) != 0)
+    {
+        error = "allocation shim " + shim_path_ + " not found";
+        return false;
+    }
+    shim_path_ = resolved;
+
+    fd_ = memfd_create("profiler-allocs", MFD_CLOEXEC);
+    if (fd_ < 0 || ftruncate(fd_, sizeof(AllocShm)) != 0)
+    {
+        error = std::string("can't create allocation buffer: ") + strerror(errno);
+        close();
+        return false;
+    }
+
+    void* base = mmap(nullptr, sizeof(AllocShm), PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (base == MAP_FAILED)
+    {
+        error = std::string("can't map allocation buffer: ") + strerror(errno);
+        close();
+        return false;
+    }
+
+    //the memfd is zero filled, which is the initial state of every slot
+    shm_ = static_cast<AllocShm*>(base);
+    shm_->sample_bytes = options.sample_bytes;
+    shm_->version = alloc_version;
+    shm_->magic = alloc_magic;
+    return true;
+}
+
+void AllocBuffer::close()
+{
+    if (shm_)
+    {
+        munmap(shm_, sizeof(AllocShm));
+        shm_ = nullptr;
+    }
+    if (fd_ >= 0)
+    {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool AllocBuffer::export_to_child() const
+{
+    if (fd_ < 0 || fcntl(fd_, F_SETFD, 0) != 0)
+    {
+        return false;
+    }
+
+    std::string preload = shim_path_;
+    if (const char* existing = getenv("LD_PRELOAD"))
+    {
+        preload += std::string(" ") + existing;
+    }
+    return setenv(ALLOC_ENV_VARIABLE, std::to_string(fd_).c_str(), 1) == 0 && setenv("LD_PRELOAD", preload.c_str(), 1) == 0;
+}
@@ -0,0 +1,43 @@
+#ifndef ALLOC_BUFFER_H
+#define ALLOC_BUFFER_H
+
+#include <cstdint>
+#include <string>
+
+#include "../markers/alloc_shm.h"
+
+struct AllocOptions
+{
+    bool enabled = false;
+    std::string shim_path;              //empty - libprofiler_alloc.so next to the profiler
+    uint64_t sample_bytes = 512 * 1024; //mean bytes between stack samples, 0 - counters only
+};
+
+//profiler side of the allocation shim's shared memory; the child gets the
+//memfd through ALLOC_ENV_VARIABLE and the shim through LD_PRELOAD
+class AllocBuffer
+{
+public:
+    AllocBuffer() = default;
+    ~AllocBuffer() { close(); }
+
+    AllocBuffer(const AllocBuffer&) = delete;
+    AllocBuffer& operator=(const AllocBuffer&) = delete;
+
+    bool create(const AllocOptions& options, std::string& error);
+    void close();
+
+    //call in the forked child before exec
+    bool export_to_child() const;
+
+    AllocShm* shm() const { return shm_; }
+
+private:
+    int fd_ = -1;
+    AllocShm* shm_ = nullptr;
+    std::string shim_path_;
+};
+
+std::string default_alloc_shim_path();
+
+#endif
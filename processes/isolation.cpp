@@ -0,0 +1,314 @@
+#include "isolation.h"
+
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+static bool fill_cpu_set(const std::vector<int>& cpus, cpu_set_t& set, std::string& error)
+{
+    CPU_ZERO(&set);
+    for(int cpu : cpus)
+    {
+        if(cpu < 0 || cpu >= CPU_SETSIZE)
+        {
+            error = "CPU " + std::to_string(cpu) + " is out of range";
+            return false;
+        }
+        CPU_SET(cpu, &set);
+    }
+    return true;
+}
+
+static bool apply_numa_policy(NumaPolicy policy, const std::vector<int>& nodes, std::string& error)
+{
+    if(policy == NumaPolicy::DEFAULT)
+    {
+        return true;
+    }
+
+    int mode = MPOL_DEFAULT;
+    switch(policy)
+    {
+        case NumaPolicy::BIND:
+            mode = MPOL_BIND;
+            break;
+        case NumaPolicy::INTERLEAVE:
+            mode = MPOL_INTERLEAVE;
+            break;
+        case NumaPolicy::PREFERRED:
+            mode = MPOL_PREFERRED;
+            break;
+        default:
+            break;
+    }
+
+    const unsigned long bits = 8 * sizeof(unsigned long);
+    unsigned long mask[16] = {};
+    for(int node : nodes)
+    {
+        if(node < 0 || static_cast<unsigned long>(node) >= bits * 16)
+        {
+            error = "NUMA node " + std::to_string(node) + " is out of range";
+            return false;
+        }
+        mask[node / bits] |= 1ul << (node % bits);
+    }
+
+    if(syscall(SYS_set_mempolicy, mode, mask, bits * 16) != 0)
+    {
+        error = std::string("set_mempolicy failed: ") + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+static bool apply_scheduling_class(SchedulingClass sched_class, int priority, std::string& error)
+{
+    int policy = SCHED_OTHER;
+    switch(sched_class)
+    {
+        case SchedulingClass::INHERIT:
+            return true;
+        case SchedulingClass::OTHER:
+            policy = SCHED_OTHER;
+            break;
+        case SchedulingClass::BATCH:
+            policy = SCHED_BATCH;
+            break;
+        case SchedulingClass::IDLE:
+            policy = SCHED_IDLE;
+            break;
+        case SchedulingClass::FIFO:
+            policy = SCHED_FIFO;
+            break;
+        case SchedulingClass::RR:
+            policy = SCHED_RR;
+            break;
+    }
+
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = (policy == SCHED_FIFO || policy == SCHED_RR) ? priority : 0;
+    if(sched_setscheduler(0, policy, &param) != 0)
+    {
+        error = std::string("sched_setscheduler failed: ") + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool apply_isolation(const IsolationOptions& options, std::string& error)
+{
+    if(!options.cpu_set.empty())
+    {
+        cpu_set_t set;
+        if(!fill_cpu_set(options.cpu_set, set, error))
+        {
+            return false;
+        }
+        if(sched_setaffinity(0, sizeof(set), &set) != 0)
+        {
+            error = std::string("sched_setaffinity failed: ") + strerror(errno);
+            return false;
+        }
+    }
+
+    if(!apply_numa_policy(options.numa_policy, options.numa_nodes, error))
+    {
+        return false;
+    }
+
+    //nice before the class: SCHED_IDLE/BATCH keep the nice value
+    if(options.nice_value && setpriority(PRIO_PROCESS, 0, *options.nice_value) != 0)
+    {
+        error = std::string("setpriority failed: ") + strerror(errno);
+        return false;
+    }
+
+    return apply_scheduling_class(options.scheduling_class, options.scheduling_priority, error);
+}
+
+bool pin_current_thread(const std::vector<int>& cpus, std::string& error)
+{
+    return pin_thread(pthread_self(), cpus, error);
+}
+
+bool pin_thread(pthread_t thread, const std::vector<int>& cpus, std::string& error)
+{
+    if(cpus.empty())
+    {
+        return true;
+    }
+
+    cpu_set_t set;
+    if(!fill_cpu_set(cpus, set, error))
+    {
+        return false;
+    }
+    int result = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if(result != 0)
+    {
+        error = std::string("pthread_setaffinity_np failed: ") + strerror(result);
+        return false;
+    }
+    return true;
+}
+
+bool parse_cpu_list(const std::string& text, std::vector<int>& cpus)
+{
+    std::istringstream istr(text);
+    std::string range;
+    try
+    {
+        while(std::getline(istr, range, ','))
+        {
+            size_t dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            if(first < 0 || last < first)
+            {
+                return false;
+            }
+            for(int cpu = first; cpu <= last; cpu++)
+            {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    catch(const std::exception&)
+    {
+        return false;
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return !cpus.empty();
+}
+
+bool parse_numa_policy(const std::string& text, NumaPolicy& policy, std::vector<int>& nodes)
+{
+    size_t colon = text.find(':');
+    std::string name = text.substr(0, colon);
+    if(name == "default")
+    {
+        policy = NumaPolicy::DEFAULT;
+        return colon == std::string::npos;
+    }
+
+    if(name == "bind")
+    {
+        policy = NumaPolicy::BIND;
+    }
+    else if(name == "interleave")
+    {
+        policy = NumaPolicy::INTERLEAVE;
+    }
+    else if(name == "preferred")
+    {
+        policy = NumaPolicy::PREFERRED;
+    }
+    else
+    {
+        return false;
+    }
+    return colon != std::string::npos && parse_cpu_list(text.substr(colon + 1), nodes);
+}
+
+bool parse_scheduling_class(const std::string& text, SchedulingClass& sched_class, int& priority)
+{
+    size_t colon = text.find(':');
+    std::string name = text.substr(0, colon);
+    priority = 0;
+
+    if(name == "other")
+    {
+        sched_class = SchedulingClass::OTHER;
+    }
+    else if(name == "batch")
+    {
+        sched_class = SchedulingClass::BATCH;
+    }
+    else if(name == "idle")
+    {
+        sched_class = SchedulingClass::IDLE;
+    }
+    else if(name == "fifo" || name == "rr")
+    {
+        sched_class = name == "fifo" ? SchedulingClass::FIFO : SchedulingClass::RR;
+        try
+        {
+            priority = colon == std::string::npos ? 1 : std::stoi(text.substr(colon + 1));
+        }
+        catch(const std::exception&)
+        {
+            return false;
+        }
+        return priority >= 1 && priority <= 99;
+    }
+    else
+    {
+        return false;
+    }
+    return colon == std::string::npos;
+}
+
+std::string format_cpu_list(const std::vector<int>& cpus)
+{
+    std::string result;
+    for(size_t i = 0; i < cpus.size();)
+    {
+        size_t j = i;
+        while(j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1)
+        {
+            j++;
+        }
+        result += (result.empty() ? "" : ",") + std::to_string(cpus[i]);
+        if(j > i)
+        {
+            result += "-" + std::to_string(cpus[j]);
+        }
+        i = j + 1;
+    }
+    return result.empty() ? "inherit" : result;
+}
+
+std::string describe_numa_policy(NumaPolicy policy, const std::vector<int>& nodes)
+{
+    switch(policy)
+    {
+        case NumaPolicy::BIND:
+            return "bind:" + format_cpu_list(nodes);
+        case NumaPolicy::INTERLEAVE:
+            return "interleave:" + format_cpu_list(nodes);
+        case NumaPolicy::PREFERRED:
+            return "preferred:" + format_cpu_list(nodes);
+        default:
+            return "default";
+    }
+}
+
+std::string describe_scheduling_class(SchedulingClass sched_class, int priority)
+{
+    switch(sched_class)
+    {
+        case SchedulingClass::OTHER:
+            return "other";
+        case SchedulingClass::BATCH:
+            return "batch";
+        case SchedulingClass::IDLE:
+            return "idle";
+        case SchedulingClass::FIFO:
+            return "fifo:" + std::to_string(priority);
+        case SchedulingClass::RR:
+            return "rr:" + std::to_string(priority);
+        default:
+            return "inherit";
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef ISOLATION_H
+#define ISOLATION_H
+
+#include <pthread.h>
+
+#include <optional>
+#include <string>
+#include <vector>
+
+enum class NumaPolicy
+{
+    DEFAULT,
+    BIND,
+    INTERLEAVE,
+    PREFERRED
+};
+
+enum class SchedulingClass
+{
+    INHERIT,
+    OTHER,
+    BATCH,
+    IDLE,
+    FIFO,
+    RR
+};
+
+struct IsolationOptions
+{
+    std::vector<int> cpu_set;               //empty - inherit the profiler affinity
+    NumaPolicy numa_policy = NumaPolicy::DEFAULT;
+    std::vector<int> numa_nodes;
+    std::optional<int> nice_value;
+    SchedulingClass scheduling_class = SchedulingClass::INHERIT;
+    int scheduling_priority = 0;            //only for FIFO / RR
+};
+
+//called in the forked child before exec, returns false with a message on failure
+bool apply_isolation(const IsolationOptions& options, std::string& error);
+bool pin_current_thread(const std::vector<int>& cpus, std::string& error);
+bool pin_thread(pthread_t thread, const std::vector<int>& cpus, std::string& error);
+
+bool parse_cpu_list(const std::string& text, std::vector<int>& cpus);
+bool parse_numa_policy(const std::string& text, NumaPolicy& policy, std::vector<int>& nodes);
+bool parse_scheduling_class(const std::string& text, SchedulingClass& sched_class, int& priority);
+
+std::string format_cpu_list(const std::vector<int>& cpus);
+std::string describe_numa_policy(NumaPolicy policy, const std::vector<int>& nodes);
+std::string describe_scheduling_class(SchedulingClass sched_class, int priority);
+
+#endif
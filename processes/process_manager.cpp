@@ -1,6 +1,6 @@
 #include "process_manager.h"
 
-pid_t ProcessManager::launch_programm(const std::string& programm, const std::vector<std::string>& args)
+pid_t ProcessManager::launch_programm(const std::string& programm, const std::vector<std::string>& args, const LaunchOptions& options)
 {
     if(programm.empty())
     {
@@ -12,6 +12,21 @@ pid_t ProcessManager::launch_programm(const std::string& programm, const std::ve
         return -1;
     }
 
+    regions.close();
+    std::string region_error;
+    if(options.region_markers && !regions.create(region_error))
+    {
+        std::cerr << region_error << std::endl;
+        return -1;
+    }
+    allocs.close();
+    std::string alloc_error;
+    if(options.alloc.enabled && !allocs.create(options.alloc, alloc_error))
+    {
+        std::cerr << alloc_error << std::endl;
+        return -1;
+    }
+
     child_pid = fork();
 
     if(child_pid.load() == -1)
@@ -20,6 +35,23 @@ pid_t ProcessManager::launch_programm(const std::string& programm, const std::ve
     }
     else if(child_pid.load() == 0)
     {
+        std::string error;
+        if(!apply_isolation(options.isolation, error))
+        {
+            std::cerr << "Can't isolate " << programm << ": " << error << std::endl;
+            _exit(EXIT_FAILURE);
+        }
+        if(options.region_markers && !regions.export_to_child())
+        {
+            std::cerr << "Can't pass region marker buffer to " << programm << std::endl;
+            _exit(EXIT_FAILURE);
+        }
+        if(options.alloc.enabled && !allocs.export_to_child())
+        {
+            std::cerr << "Can't pass allocation buffer to " << programm << std::endl;
+            _exit(EXIT_FAILURE);
+        }
+
         std::vector<char*> argv;
         char* programm_copy = strdup(programm.c_str());
         argv.push_back(programm_copy);
@@ -40,6 +72,10 @@ pid_t ProcessManager::launch_programm(const std::string& programm, const std::ve
     else
     {
         is_run = true;
+        if(waiter.joinable())
+        {
+            waiter.join();
+        }
         waiter = std::thread(&ProcessManager::wait_child_process,this);
     }
     return child_pid.load();
@@ -11,11 +11,24 @@
 #include <thread>
 #include <atomic>
 
+#include "isolation.h"
+#include "region_buffer.h"
+#include "alloc_buffer.h"
+
+struct LaunchOptions
+{
+    IsolationOptions isolation;
+    bool region_markers = false;    //hand the child a region marker buffer
+    AllocOptions alloc;             //preload the allocation shim into the child
+};
+
 class ProcessManager
 {
     std::atomic<pid_t> child_pid{-1};
     std::thread waiter;
     std::atomic<bool> is_run{false};
+    RegionBuffer regions;
+    AllocBuffer allocs;
 
     void report_error(const std::string& error);
 
@@ -30,11 +43,15 @@ class ProcessManager
         }
     }
 
-    pid_t launch_programm(const std::string& programm, const std::vector<std::string>& args);
+    pid_t launch_programm(const std::string& programm, const std::vector<std::string>& args, const LaunchOptions& options = LaunchOptions());
     void terminate_process();
     bool is_running();
     void wait_child_process();
     pid_t get_pid();
+    //nullptr unless the last launch asked for region markers
+    RegionShm* get_regions() { return regions.shm(); }
+    //nullptr unless the last launch asked for allocation tracking
+    AllocShm* get_allocs() { return allocs.shm(); }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,58 @@
+#include "region_buffer.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+bool RegionBuffer::create(std::string& error)
+{
+    close();
+
+    fd_ = memfd_create("profiler-regions", MFD_CLOEXEC);
+    if (fd_ < 0 || ftruncate(fd_, sizeof(RegionShm)) != 0)
+    {
+        error = std::string("can't create region marker buffer: ") + strerror(errno);
+        close();
+        return false;
+    }
+
+    void* base = mmap(nullptr, sizeof(RegionShm), PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (base == MAP_FAILED)
+    {
+        error = std::string("can't map region marker buffer: ") + strerror(errno);
+        close();
+        return false;
+    }
+
+    //the memfd is zero filled, which is the initial state of every ring
+    shm_ = static_cast<RegionShm*>(base);
+    shm_->version = region_version;
+    shm_->magic = region_magic;
+    return true;
+}
+
+void RegionBuffer::close()
+{
+    if (shm_)
+    {
+        munmap(shm_, sizeof(RegionShm));
+        shm_ = nullptr;
+    }
+    if (fd_ >= 0)
+    {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool RegionBuffer::export_to_child() const
+{
+    if (fd_ < 0 || fcntl(fd_, F_SETFD, 0) != 0)
+    {
+        return false;
+    }
+    return setenv(REGION_ENV_VARIABLE, std::to_string(fd_).c_str(), 1) == 0;
+}
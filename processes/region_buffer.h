@@ -0,0 +1,32 @@
+#ifndef REGION_BUFFER_H
+#define REGION_BUFFER_H
+
+#include <string>
+
+#include "../markers/region_markers.h"
+
+//profiler side of the region marker shared memory, an anonymous memfd the
+//child inherits and finds through REGION_ENV_VARIABLE
+class RegionBuffer
+{
+public:
+    RegionBuffer() = default;
+    ~RegionBuffer() { close(); }
+
+    RegionBuffer(const RegionBuffer&) = delete;
+    RegionBuffer& operator=(const RegionBuffer&) = delete;
+
+    bool create(std::string& error);
+    void close();
+
+    //call in the forked child before exec
+    bool export_to_child() const;
+
+    RegionShm* shm() const { return shm_; }
+
+private:
+    int fd_ = -1;
+    RegionShm* shm_ = nullptr;
+};
+
+#endif
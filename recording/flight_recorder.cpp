@@ -0,0 +1,377 @@
+#include "flight_recorder.h"
+
+#include <algorithm>
+#include <fstream>
+
+#include "recorder.h"
+#include "../analysis/window_query.h"
+
+bool parse_trigger(const std::string& spec, FlightTrigger& trigger, std::string& error)
+{
+    size_t op = spec.find_first_of("<>");
+    if (op == std::string::npos || op == 0 || op + 1 >= spec.size())
+    {
+        error = "Expected <signal><|><threshold>: " + spec;
+        return false;
+    }
+
+    trigger.text = spec;
+    trigger.signal = spec.substr(0, op);
+    trigger.above = spec[op] == '>';
+    try
+    {
+        trigger.threshold = std::stod(spec.substr(op + 1));
+    }
+    catch (const std::exception&)
+    {
+        error = "Invalid trigger threshold: " + spec;
+        return false;
+    }
+
+    if (!is_known_signal(trigger.signal))
+    {
+        error = "Unknown trigger signal: " + trigger.signal;
+        return false;
+    }
+    return true;
+}
+
+static bool signal_value(const ProfilingSnapshot& snapshot, const std::string& signal, double& value)
+{
+    double numerator = 0.0, denominator = 0.0;
+    if (!signal_sample(snapshot, signal, numerator, denominator))
+    {
+        return false;
+    }
+    value = numerator / denominator;
+    return true;
+}
+
+void FlightRecorder::arm(int pid, const std::string& command, const FlightSettings& settings)
+{
+    disarm();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    settings_ = settings;
+    settings_.ring_capacity = std::max<size_t>(settings_.ring_capacity, 1);
+    pid_ = pid;
+    command_ = command;
+    ring_.assign(settings_.ring_capacity, nullptr);
+    ring_head_ = 0;
+    holding_.assign(settings_.triggers.size(), 0);
+    capturing_ = false;
+    fired_ = nullptr;
+    capture_.clear();
+    captures_ = 0;
+    dumps_.clear();
+    writer_stopping_ = false;
+    writer_ = std::thread(&FlightRecorder::write_loop, this);
+    armed_ = true;
+}
+
+void FlightRecorder::disarm()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (capturing_)
+        {
+            finish_capture(true);
+        }
+        armed_ = false;
+        ring_.clear();
+    }
+
+    //the writer empties the queue before it stops
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        writer_stopping_ = true;
+    }
+    writer_wake_.notify_one();
+    if (writer_.joinable())
+    {
+        writer_.join();
+    }
+}
+
+bool FlightRecorder::is_armed() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return armed_;
+}
+
+std::vector<std::string> FlightRecorder::dumps() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return dumps_;
+}
+
+void FlightRecorder::on_snapshot(const SnapshotPtr& snapshot)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!armed_)
+    {
+        return;
+    }
+
+    push(snapshot);
+    if (capturing_)
+    {
+        capture_.push_back(snapshot);
+        drain_samples();
+        if (snapshot->timestamp_ms >= fired_ms_ + settings_.post_trigger_ms)
+        {
+            finish_capture(false);
+        }
+        return;
+    }
+
+    if (captures_ >= settings_.max_dumps)
+    {
+        return;
+    }
+    if (const FlightTrigger* trigger = check_triggers(*snapshot))
+    {
+        start_capture(*trigger, snapshot->timestamp_ms);
+    }
+}
+
+void FlightRecorder::push(const SnapshotPtr& snapshot)
+{
+    ring_[ring_head_] = snapshot;
+    ring_head_ = (ring_head_ + 1) % ring_.size();
+}
+
+const FlightTrigger* FlightRecorder::check_triggers(const ProfilingSnapshot& snapshot)
+{
+    const FlightTrigger* fired = nullptr;
+    for (size_t i = 0; i < settings_.triggers.size(); i++)
+    {
+        const FlightTrigger& trigger = settings_.triggers[i];
+        double value;
+        bool holds = signal_value(snapshot, trigger.signal, value) && (trigger.above ? value > trigger.threshold : value < trigger.threshold);
+        holding_[i] = holds ? holding_[i] + 1 : 0;
+        if (!fired && holding_[i] >= std::max<uint32_t>(settings_.hold_ticks, 1))
+        {
+            fired = &trigger;
+        }
+    }
+    return fired;
+}
+
+void FlightRecorder::start_capture(const FlightTrigger& trigger, uint64_t timestamp_ms)
+{
+    capturing_ = true;
+    captures_++;
+    fired_ = &trigger;
+    fired_ms_ = timestamp_ms;
+    std::fill(holding_.begin(), holding_.end(), 0);
+
+    //the pre-trigger window, oldest first; includes the triggering snapshot
+    capture_.clear();
+    for (size_t i = 0; i < ring_.size(); i++)
+    {
+        const SnapshotPtr& snapshot = ring_[(ring_head_ + i) % ring_.size()];
+        if (snapshot && snapshot->timestamp_ms + settings_.pre_trigger_ms >= timestamp_ms)
+        {
+            capture_.push_back(snapshot);
+        }
+    }
+
+    report_log("[Flight] Trigger " + trigger.text + " fired at " + std::to_string(timestamp_ms) + "ms\n");
+    if (settings_.callchain_frequency > 0)
+    {
+        start_sampling();
+    }
+    if (settings_.post_trigger_ms == 0)
+    {
+        finish_capture(false);
+    }
+}
+
+void FlightRecorder::finish_capture(bool truncated)
+{
+    bool sampled = sampler_.is_open();
+    if (sampled)
+    {
+        sampler_.disable();
+        drain_samples();
+        sampler_.close();
+    }
+
+    FlightDump dump;
+    dump.path = settings_.dump_dir + "/flight-" + std::to_string(pid_) + "-" + std::to_string(fired_ms_) + ".rec";
+    dump.command = command_;
+    dump.pid = pid_;
+    dump.trigger = fired_ ? fired_->text : "";
+    dump.trigger_ms = fired_ms_;
+    dump.pre_trigger_ms = settings_.pre_trigger_ms;
+    dump.post_trigger_ms = settings_.post_trigger_ms;
+    dump.truncated = truncated;
+    dump.sampled = sampled;
+    dump.samples = samples_;
+    dump.snapshots.swap(capture_);
+    dump.stacks.swap(stacks_);
+    if (sampled)
+    {
+        dump.maps = maps_;
+    }
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        pending_dumps_.push_back(std::move(dump));
+    }
+    writer_wake_.notify_one();
+
+    capturing_ = false;
+    fired_ = nullptr;
+    samples_ = 0;
+}
+
+void FlightRecorder::write_loop()
+{
+    std::unique_lock<std::mutex> lock(writer_mutex_);
+    while (true)
+    {
+        writer_wake_.wait(lock, [this] { return writer_stopping_ || !pending_dumps_.empty(); });
+        if (pending_dumps_.empty())
+        {
+            return;
+        }
+        FlightDump dump = std::move(pending_dumps_.front());
+        pending_dumps_.pop_front();
+        lock.unlock();
+
+        //neither lock is held here, the bus and dumps() go on meanwhile
+        bool written = write_dump(dump);
+        if (written)
+        {
+            report_log("[Flight] Dumped " + std::to_string(dump.snapshots.size()) + " snapshots to " + dump.path + "\n");
+        }
+        else
+        {
+            report_log("[Flight] Can't write " + dump.path + "\n");
+        }
+        if (dump.sampled && !write_folded(dump))
+        {
+            report_log("[Flight] Can't write " + dump.path + ".folded\n");
+        }
+        if (written)
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            dumps_.push_back(dump.path);
+        }
+
+        lock.lock();
+    }
+}
+
+void FlightRecorder::start_sampling()
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_CPU_CLOCK;
+    attr.freq = 1;
+    attr.sample_freq = settings_.callchain_frequency;
+    attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_CALLCHAIN;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_callchain_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.disabled = 1;
+
+    std::string error;
+    if (!sampler_.open(pid_, attr, sampling_ring_pages, error))
+    {
+        report_log("[Flight] Callchain sampling unavailable: " + error + "\n");
+        return;
+    }
+    maps_.load(pid_);
+    sampler_.enable();
+}
+
+void FlightRecorder::drain_samples()
+{
+    std::vector<uint64_t> frames;
+    sampler_.drain([&](const perf_event_header* record)
+    {
+        //pid, tid, nr, ips[nr]
+        const char* body = reinterpret_cast<const char*>(record + 1);
+        const char* end = reinterpret_cast<const char*>(record) + record->size;
+        if (record->type != PERF_RECORD_SAMPLE || body + 16 > end)
+        {
+            return;
+        }
+        uint64_t nr = *reinterpret_cast<const uint64_t*>(body + 8);
+        const uint64_t* ips = reinterpret_cast<const uint64_t*>(body + 16);
+        nr = std::min<uint64_t>(nr, (end - body - 16) / sizeof(uint64_t));
+
+        frames.clear();
+        for (uint64_t i = 0; i < nr && frames.size() < max_frames; i++)
+        {
+            if (ips[i] < static_cast<uint64_t>(PERF_CONTEXT_MAX))
+            {
+                frames.push_back(ips[i]);
+            }
+        }
+        stacks_[frames]++;
+        samples_++;
+    });
+}
+
+bool FlightRecorder::write_dump(const FlightDump& dump)
+{
+    Recorder recorder;
+    if (!recorder.open(dump.path))
+    {
+        return false;
+    }
+    recorder.write_metadata("command", dump.command);
+    recorder.write_metadata("pid", std::to_string(dump.pid));
+    recorder.write_metadata("flight.trigger", dump.trigger);
+    recorder.write_metadata("flight.trigger_ms", std::to_string(dump.trigger_ms));
+    recorder.write_metadata("flight.pre_trigger_ms", std::to_string(dump.pre_trigger_ms));
+    recorder.write_metadata("flight.post_trigger_ms", std::to_string(dump.post_trigger_ms));
+    recorder.write_metadata("flight.truncated", dump.truncated ? "1" : "0");
+    recorder.write_metadata("flight.callchain_samples", std::to_string(dump.samples));
+    for (const auto& snapshot : dump.snapshots)
+    {
+        recorder.write_snapshot(*snapshot);
+    }
+    recorder.close();
+    return true;
+}
+
+bool FlightRecorder::write_folded(const FlightDump& dump)
+{
+    std::ofstream out(dump.path + ".folded");
+    if (!out.is_open())
+    {
+        return false;
+    }
+
+    std::string comm = dump.command.substr(0, dump.command.find(' '));
+    comm = comm.substr(comm.find_last_of('/') + 1);
+    for (const auto& [frames, count] : dump.stacks)
+    {
+        std::string line = comm;
+        if (frames.empty())
+        {
+            line += ";[unknown]";
+        }
+        //leaf first in the callchain, root first in folded stacks
+        for (auto it = frames.rbegin(); it != frames.rend(); ++it)
+        {
+            line += ";" + dump.maps.format_address(*it);
+        }
+        out << line << ' ' << count << '\n';
+    }
+    return true;
+}
+
+void FlightRecorder::report_log(const std::string& log) const
+{
+    if (log_)
+    {
+        log_(log);
+    }
+}
@@ -0,0 +1,134 @@
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../metrics/snapshot_bus.h"
+#include "../metrics/perf_ring.h"
+#include "../metrics/proc_maps.h"
+
+//"ipc<0.8", "page_faults/s>5000", "rss_bytes>1e9"
+//signals: ipc, cache_miss_rate, <metric>/s (rate) or <metric> (value per snapshot)
+struct FlightTrigger
+{
+    std::string text;
+    std::string signal;
+    bool above = true;
+    double threshold = 0.0;
+};
+
+bool parse_trigger(const std::string& spec, FlightTrigger& trigger, std::string& error);
+
+struct FlightSettings
+{
+    bool enabled = false;
+    std::string dump_dir = ".";
+    std::vector<FlightTrigger> triggers;
+    uint64_t pre_trigger_ms = 30000;
+    uint64_t post_trigger_ms = 10000;
+    size_t ring_capacity = 4096;        //snapshots, the ring never grows past it
+    uint32_t hold_ticks = 1;            //consecutive snapshots a trigger must hold
+    uint32_t max_dumps = 8;
+    uint32_t callchain_frequency = 0;   //Hz of the sampling started by a trigger, 0 - off
+};
+
+//always-on ring of recent snapshots; a trigger dumps the window before it
+//plus post_trigger_ms after it, optionally with callchains sampled meanwhile.
+//Dumps are written by their own thread, a slow disk never holds up the bus
+class FlightRecorder
+{
+public:
+    using log_callback = std::function<void(const std::string&)>;
+
+    FlightRecorder() = default;
+    ~FlightRecorder() { disarm(); }
+
+    FlightRecorder(const FlightRecorder&) = delete;
+    FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+    void setup_log_callback(log_callback callback) { log_ = std::move(callback); }
+
+    void arm(int pid, const std::string& command, const FlightSettings& settings);
+    //a capture in progress is dumped truncated, returns once every dump is written
+    void disarm();
+    bool is_armed() const;
+
+    //bus handler
+    void on_snapshot(const SnapshotPtr& snapshot);
+
+    //dumps written so far
+    std::vector<std::string> dumps() const;
+
+private:
+    static constexpr size_t max_frames = 64;
+    static constexpr size_t sampling_ring_pages = 32;
+
+    //a finished capture, owned by the writer from here on
+    struct FlightDump
+    {
+        std::string path;
+        std::string command;
+        int pid = -1;
+        std::string trigger;
+        uint64_t trigger_ms = 0;
+        uint64_t pre_trigger_ms = 0;
+        uint64_t post_trigger_ms = 0;
+        bool truncated = false;
+        bool sampled = false;
+        uint64_t samples = 0;
+        std::vector<SnapshotPtr> snapshots;
+        std::map<std::vector<uint64_t>, uint64_t> stacks;
+        ProcMaps maps;
+    };
+
+    mutable std::mutex mutex_;
+    log_callback log_;
+    FlightSettings settings_;
+    bool armed_ = false;
+    int pid_ = -1;
+    std::string command_;
+
+    std::vector<SnapshotPtr> ring_;
+    size_t ring_head_ = 0;
+    std::vector<uint32_t> holding_;     //per trigger
+
+    bool capturing_ = false;
+    const FlightTrigger* fired_ = nullptr;
+    uint64_t fired_ms_ = 0;
+    std::vector<SnapshotPtr> capture_;
+
+    PerCpuSampler sampler_;
+    ProcMaps maps_;
+    std::map<std::vector<uint64_t>, uint64_t> stacks_;
+    uint64_t samples_ = 0;
+
+    uint32_t captures_ = 0;             //fired, max_dumps counts these
+    std::vector<std::string> dumps_;
+
+    std::mutex writer_mutex_;
+    std::condition_variable writer_wake_;
+    std::deque<FlightDump> pending_dumps_;
+    bool writer_stopping_ = false;
+    std::thread writer_;
+
+    void push(const SnapshotPtr& snapshot);
+    const FlightTrigger* check_triggers(const ProfilingSnapshot& snapshot);
+    void start_capture(const FlightTrigger& trigger, uint64_t timestamp_ms);
+    void finish_capture(bool truncated);
+    void start_sampling();
+    void drain_samples();
+    void write_loop();
+    static bool write_dump(const FlightDump& dump);
+    static bool write_folded(const FlightDump& dump);
+    void report_log(const std::string& log) const;
+};
+
+#endif
@@ -0,0 +1,378 @@
+#include "recorder.h"
+
+#include <algorithm>
+#include <sstream>
+
+static const char* recording_header = "# profiler recording v1";
+
+Recorder::~Recorder()
+{
+    close();
+}
+
+bool Recorder::open(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    out_.open(path, std::ios::out | std::ios::trunc);
+    if (!out_.is_open())
+    {
+        return false;
+    }
+    out_ << recording_header << '\n';
+    return true;
+}
+
+void Recorder::close()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (out_.is_open())
+    {
+        out_.close();
+    }
+}
+
+bool Recorder::is_open() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return out_.is_open();
+}
+
+void Recorder::write_metadata(const std::string& key, const std::string& value)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (out_.is_open())
+    {
+        out_ << "M " << key << ' ' << value << '\n';
+    }
+}
+
+void Recorder::write_snapshot(const ProfilingSnapshot& snapshot)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!out_.is_open())
+    {
+        return;
+    }
+
+    if (snapshot.phase_boundary)
+    {
+        out_ << "B " << snapshot.timestamp_ms << ' ' << snapshot.phase_id << '\n';
+    }
+    out_ << "S " << snapshot.timestamp_ms << ' ' << snapshot.duration_ms << ' ' << snapshot.phase_id;
+    for (const auto& metric : snapshot.metrics)
+    {
+        out_ << ' ' << metric.name << '=' << metric.value;
+        if (metric.coverage < 1.0)
+        {
+            out_ << '@' << metric.coverage << ':' << metric.error;
+        }
+    }
+    out_ << '\n';
+
+    for (const auto& region : snapshot.regions)
+    {
+        out_ << "R " << snapshot.timestamp_ms << ' ' << region.name << ' ' << region.time_ns << ' ' << region.entries;
+        for (const auto& metric : region.metrics)
+        {
+            out_ << ' ' << metric.name << '=' << metric.value;
+        }
+        out_ << '\n';
+    }
+
+    for (const auto& syscall : snapshot.syscalls)
+    {
+        out_ << "Y " << snapshot.timestamp_ms << ' ' << syscall.name << ' ' << syscall.count << ' ' << syscall.time_ns << ' '
+             << syscall.errors << ' ' << syscall.p50_ns << ' ' << syscall.p99_ns << '\n';
+    }
+
+    for (const auto& command : snapshot.commands)
+    {
+        out_ << "T " << snapshot.timestamp_ms << ' ' << command.name << ' ' << command.processes << ' ' << command.cpu_ns << ' '
+             << command.page_faults << ' ' << command.context_switches << '\n';
+    }
+
+    for (const auto& lock : snapshot.locks)
+    {
+        out_ << "F " << snapshot.timestamp_ms << ' ' << lock.name << ' ' << lock.waits << ' ' << lock.wakes << ' ' << lock.wait_ns << ' '
+             << lock.p99_ns << '\n';
+    }
+
+    for (const auto& device : snapshot.devices)
+    {
+        out_ << "D " << snapshot.timestamp_ms << ' ' << device.name << ' ' << device.requests << ' ' << device.bytes << ' ' << device.p50_ns
+             << ' ' << device.p99_ns << '\n';
+    }
+
+    if (std::any_of(snapshot.alloc_sizes.begin(), snapshot.alloc_sizes.end(), [](uint64_t count) { return count != 0; }))
+    {
+        out_ << "A " << snapshot.timestamp_ms;
+        for (size_t size_class = 0; size_class < snapshot.alloc_sizes.size(); size_class++)
+        {
+            if (snapshot.alloc_sizes[size_class])
+            {
+                out_ << ' ' << size_class << '=' << snapshot.alloc_sizes[size_class];
+            }
+        }
+        out_ << '\n';
+    }
+}
+
+void Recorder::write_phases(const std::vector<PhaseStats>& phases)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!out_.is_open())
+    {
+        return;
+    }
+
+    for (const auto& phase : phases)
+    {
+        out_ << "P " << phase.id << ' ' << phase.start_ms << ' ' << phase.end_ms << ' ' << phase.ticks;
+        for (const auto& [name, mean] : phase.signal_means)
+        {
+            out_ << ' ' << name << '=' << mean;
+        }
+        out_ << '\n';
+    }
+    out_.flush();
+}
+
+void Recorder::write_stage_latencies(const std::vector<StageLatency>& stages)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!out_.is_open())
+    {
+        return;
+    }
+
+    for (const auto& stage : stages)
+    {
+        out_ << "L " << stage_name(stage.stage) << ' ' << stage.count << ' ' << stage.mean_ns << ' ' << stage.p50_ns << ' ' << stage.p99_ns << ' ' << stage.max_ns << '\n';
+    }
+    out_.flush();
+}
+
+static bool split_pair(const std::string& token, std::string& key, std::string& value)
+{
+    size_t eq = token.find('=');
+    if (eq == std::string::npos)
+    {
+        return false;
+    }
+    key = token.substr(0, eq);
+    value = token.substr(eq + 1);
+    return true;
+}
+
+static bool parse_record(const std::string& line, Recording& recording)
+{
+    std::istringstream istr(line);
+    char kind;
+    istr >> kind;
+
+    std::string token, key, value;
+    switch (kind)
+    {
+        case 'M':
+        {
+            istr >> key;
+            std::getline(istr >> std::ws, value);
+            recording.metadata[key] = value;
+            break;
+        }
+        case 'S':
+        {
+            ProfilingSnapshot snapshot;
+            istr >> snapshot.timestamp_ms >> snapshot.duration_ms >> snapshot.phase_id;
+            while (istr >> token)
+            {
+                MetricType type;
+                if (!split_pair(token, key, value) || !metric_from_name(key, type))
+                {
+                    continue;
+                }
+                MetricValue metric{type, std::stoull(value), metric_name(type), metric_unit(type)};
+                size_t at = value.find('@');
+                if (at != std::string::npos)
+                {
+                    //scaled value: @coverage:error
+                    size_t colon = value.find(':', at);
+                    metric.coverage = std::stod(value.substr(at + 1, colon - at - 1));
+                    metric.error = colon != std::string::npos ? std::stod(value.substr(colon + 1)) : 0.0;
+                }
+                snapshot.metrics.push_back(metric);
+            }
+            if (!recording.snapshots.empty() && recording.snapshots.back().phase_id != snapshot.phase_id)
+            {
+                snapshot.phase_boundary = true;
+            }
+            recording.snapshots.push_back(snapshot);
+            break;
+        }
+        case 'R':
+        {
+            uint64_t timestamp_ms = 0;
+            RegionSample region;
+            istr >> timestamp_ms >> region.name >> region.time_ns >> region.entries;
+            while (istr >> token)
+            {
+                MetricType type;
+                if (split_pair(token, key, value) && metric_from_name(key, type))
+                {
+                    region.metrics.push_back({type, std::stoull(value), metric_name(type), metric_unit(type)});
+                }
+            }
+            if (!recording.snapshots.empty() && recording.snapshots.back().timestamp_ms == timestamp_ms)
+            {
+                recording.snapshots.back().regions.push_back(region);
+            }
+            break;
+        }
+        case 'Y':
+        {
+            uint64_t timestamp_ms = 0;
+            SyscallSample syscall;
+            istr >> timestamp_ms >> syscall.name >> syscall.count >> syscall.time_ns >> syscall.errors >> syscall.p50_ns >> syscall.p99_ns;
+            if (istr && !recording.snapshots.empty() && recording.snapshots.back().timestamp_ms == timestamp_ms)
+            {
+                recording.snapshots.back().syscalls.push_back(syscall);
+            }
+            break;
+        }
+        case 'T':
+        {
+            uint64_t timestamp_ms = 0;
+            CommandSample command;
+            istr >> timestamp_ms >> command.name >> command.processes >> command.cpu_ns >> command.page_faults >> command.context_switches;
+            if (istr && !recording.snapshots.empty() && recording.snapshots.back().timestamp_ms == timestamp_ms)
+            {
+                recording.snapshots.back().commands.push_back(command);
+            }
+            break;
+        }
+        case 'F':
+        {
+            uint64_t timestamp_ms = 0;
+            LockSample lock;
+            istr >> timestamp_ms >> lock.name >> lock.waits >> lock.wakes >> lock.wait_ns >> lock.p99_ns;
+            if (istr && !recording.snapshots.empty() && recording.snapshots.back().timestamp_ms == timestamp_ms)
+            {
+                recording.snapshots.back().locks.push_back(lock);
+            }
+            break;
+        }
+        case 'D':
+        {
+            uint64_t timestamp_ms = 0;
+            DeviceSample device;
+            istr >> timestamp_ms >> device.name >> device.requests >> device.bytes >> device.p50_ns >> device.p99_ns;
+            if (istr && !recording.snapshots.empty() && recording.snapshots.back().timestamp_ms == timestamp_ms)
+            {
+                recording.snapshots.back().devices.push_back(device);
+            }
+            break;
+        }
+        case 'A':
+        {
+            uint64_t timestamp_ms = 0;
+            istr >> timestamp_ms;
+            if (recording.snapshots.empty() || recording.snapshots.back().timestamp_ms != timestamp_ms)
+            {
+                break;
+            }
+            std::vector<uint64_t>& sizes = recording.snapshots.back().alloc_sizes;
+            while (istr >> token)
+            {
+                if (split_pair(token, key, value))
+                {
+                    size_t size_class = std::stoul(key);
+                    if (size_class >= sizes.size())
+                    {
+                        sizes.resize(size_class + 1);
+                    }
+                    sizes[size_class] = std::stoull(value);
+                }
+            }
+            break;
+        }
+        case 'P':
+        {
+            PhaseStats phase;
+            istr >> phase.id >> phase.start_ms >> phase.end_ms >> phase.ticks;
+            while (istr >> token)
+            {
+                if (split_pair(token, key, value))
+                {
+                    phase.signal_means[key] = std::stod(value);
+                }
+            }
+            recording.phases.push_back(phase);
+            break;
+        }
+        case 'L':
+        {
+            std::string name;
+            StageLatency stage{};
+            istr >> name >> stage.count >> stage.mean_ns >> stage.p50_ns >> stage.p99_ns >> stage.max_ns;
+            for (int i = 0; i < static_cast<int>(PipelineStage::COUNT); i++)
+            {
+                if (name == stage_name(static_cast<PipelineStage>(i)))
+                {
+                    stage.stage = static_cast<PipelineStage>(i);
+                    recording.stage_latencies.push_back(stage);
+                }
+            }
+            break;
+        }
+        case 'B':
+        case '#':
+            break;
+        default:
+            return false;
+    }
+    return !istr.bad();
+}
+
+bool load_recording(const std::string& path, Recording& recording, std::string& error)
+{
+    std::ifstream in(path);
+    if (!in.is_open())
+    {
+        error = "Can't open recording " + path;
+        return false;
+    }
+
+    std::string line;
+    if (!std::getline(in, line) || line != recording_header)
+    {
+        error = path + " is not a profiler recording";
+        return false;
+    }
+
+    size_t line_number = 1;
+    while (std::getline(in, line))
+    {
+        line_number++;
+        if (line.empty())
+        {
+            continue;
+        }
+
+        bool parsed = false;
+        try
+        {
+            parsed = parse_record(line, recording);
+        }
+        catch (const std::exception&)
+        {
+            parsed = false;
+        }
+
+        if (!parsed)
+        {
+            error = path + ":" + std::to_string(line_number) + ": malformed record";
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,58 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../metrics/metrics_collector.h"
+#include "../analysis/phase_detector.h"
+
+//Line based text format:
+//  M <key> <value>                          run metadata
+//  S <ts_ms> <duration_ms> <phase> k=v ...  snapshot, scaled counters as k=v@coverage:error
+//  R <ts_ms> <name> <time_ns> <entries> k=v  counters of a marked region, follows its S line
+//  Y <ts_ms> <name> <count> <time_ns> <errors> <p50_ns> <p99_ns>  a top syscall, follows its S line
+//  T <ts_ms> <command> <processes> <cpu_ns> <faults> <switches>   a command of the process tree, follows its S line
+//  F <ts_ms> <lock> <waits> <wakes> <wait_ns> <p99_ns>           a contended futex, follows its S line
+//  D <ts_ms> <device> <requests> <bytes> <p50_ns> <p99_ns>        block latency of a device, follows its S line
+//  A <ts_ms> <class>=<count> ...            allocations per log2 size class, follows its S line
+//  B <ts_ms> <phase>                        phase boundary
+//  P <id> <start_ms> <end_ms> <ticks> k=v   phase summary
+//  L <stage> <count> <mean> <p50> <p99> <max> stage latency summary (ns)
+struct Recording
+{
+    std::map<std::string, std::string> metadata;
+    std::vector<ProfilingSnapshot> snapshots;
+    std::vector<PhaseStats> phases;
+    std::vector<StageLatency> stage_latencies;
+};
+
+class Recorder
+{
+public:
+    Recorder() = default;
+    ~Recorder();
+
+    Recorder(const Recorder&) = delete;
+    Recorder& operator=(const Recorder&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+    bool is_open() const;
+
+    void write_metadata(const std::string& key, const std::string& value);
+    void write_snapshot(const ProfilingSnapshot& snapshot);
+    void write_phases(const std::vector<PhaseStats>& phases);
+    void write_stage_latencies(const std::vector<StageLatency>& stages);
+
+private:
+    mutable std::mutex mutex_;
+    std::ofstream out_;
+};
+
+bool load_recording(const std::string& path, Recording& recording, std::string& error);
+
+#endif
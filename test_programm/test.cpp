@@ -6,6 +6,8 @@
 #include <thread>
 #include <atomic>
 
+#include "../markers/region_markers.h"
+
 class CPUStressTest {
 private:
     std::vector<double> data;
@@ -148,12 +150,12 @@ public:
     // Главный метод - запускает все виды нагрузки
     void run_all_stress_tests() {
         while (true) {
-            heavy_math_computations();
-            memory_intensive_operations();
-            algorithmic_stress();
-            string_manipulation_stress();
-            run_recursive_stress();
-            parallel_stress();
+            { RegionScope region("math"); heavy_math_computations(); }
+            { RegionScope region("memory"); memory_intensive_operations(); }
+            { RegionScope region("algorithms"); algorithmic_stress(); }
+            { RegionScope region("strings"); string_manipulation_stress(); }
+            { RegionScope region("recursion"); run_recursive_stress(); }
+            { RegionScope region("parallel"); parallel_stress(); }
             
             // Переинициализация данных для разнообразия
             initialize_data();
@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../analysis/run_comparison.h"
+
+//mann_whitney_p_value against U and its variance over every split of the pooled
+//values, and the bootstrap CI of compare_runs against cases whose interval is known
+
+static int failures = 0;
+
+static void check(bool condition, const std::string& what)
+{
+    if (!condition)
+    {
+        std::cerr << "FAIL: " << what << std::endl;
+        failures++;
+    }
+}
+
+static uint64_t next_random(uint64_t& state)
+{
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    return state >> 33;
+}
+
+//U of a by counting pairs, ties count a half
+static double brute_force_u(const std::vector<double>& a, const std::vector<double>& b)
+{
+    double u = 0.0;
+    for (double x : a)
+    {
+        for (double y : b)
+        {
+            u += x > y ? 1.0 : (x == y ? 0.5 : 0.0);
+        }
+    }
+    return u;
+}
+
+//every split of the pooled values into samples of a's and b's sizes: the two-sided
+//exact p-value, and the variance of U the tie correction stands for
+static void exact_test(const std::vector<double>& a, const std::vector<double>& b, double& p_value, double& variance)
+{
+    std::vector<double> pooled(a);
+    pooled.insert(pooled.end(), b.begin(), b.end());
+    const double mu = a.size() * b.size() / 2.0;
+    const double observed = std::fabs(brute_force_u(a, b) - mu);
+
+    std::vector<char> in_a(pooled.size(), 0);
+    std::fill(in_a.begin(), in_a.begin() + a.size(), 1);
+    std::sort(in_a.begin(), in_a.end());
+    size_t splits = 0, extreme = 0;
+    double squares = 0.0;
+    do
+    {
+        std::vector<double> left, right;
+        for (size_t i = 0; i < pooled.size(); i++)
+        {
+            (in_a[i] ? left : right).push_back(pooled[i]);
+        }
+        double deviation = brute_force_u(left, right) - mu;
+        splits++;
+        squares += deviation * deviation;
+        if (std::fabs(deviation) >= observed - 1e-9)
+        {
+            extreme++;
+        }
+    }
+    while (std::next_permutation(in_a.begin(), in_a.end()));
+    p_value = static_cast<double>(extreme) / splits;
+    variance = squares / splits;
+}
+
+static std::vector<ProfilingSnapshot> make_run(const std::vector<uint64_t>& faults_per_s)
+{
+    std::vector<ProfilingSnapshot> run;
+    for (size_t i = 0; i < faults_per_s.size(); i++)
+    {
+        ProfilingSnapshot snapshot;
+        snapshot.timestamp_ms = 1000 * (i + 1);
+        snapshot.duration_ms = 1000;
+        snapshot.metrics.push_back({MetricType::PAGE_FAULTS, faults_per_s[i], metric_name(MetricType::PAGE_FAULTS), metric_unit(MetricType::PAGE_FAULTS)});
+        run.push_back(snapshot);
+    }
+    return run;
+}
+
+static void check_mann_whitney()
+{
+    check(mann_whitney_p_value({}, {1.0, 2.0}) == 1.0, "empty sample");
+    check(mann_whitney_p_value({3.0, 3.0, 3.0}, {3.0, 3.0}) == 1.0, "all values tied");
+    check(mann_whitney_p_value({1.0, 2.0, 3.0}, {1.0, 2.0, 3.0}) == 1.0, "identical samples");
+
+    //U and its tie-corrected variance against counting pairs and enumerating every
+    //split, then the normal approximation with the continuity correction
+    uint64_t state = 7;
+    for (int round = 0; round < 60; round++)
+    {
+        size_t n1 = 3 + next_random(state) % 5;
+        size_t n2 = 3 + next_random(state) % 5;
+        uint64_t spread = round % 2 ? 6 : 1000;     //odd rounds are full of ties
+        uint64_t shift = next_random(state) % (spread / 2 + 1);
+        std::vector<double> a, b;
+        for (size_t i = 0; i < n1; i++)
+        {
+            a.push_back(static_cast<double>(next_random(state) % spread));
+        }
+        for (size_t i = 0; i < n2; i++)
+        {
+            b.push_back(static_cast<double>(next_random(state) % spread + shift));
+        }
+
+        double exact = 0.0, variance = 0.0;
+        exact_test(a, b, exact, variance);
+        double deviation = brute_force_u(a, b) - n1 * n2 / 2.0;
+        double corrected = deviation > 0.0 ? deviation - 0.5 : (deviation < 0.0 ? deviation + 0.5 : 0.0);
+        double expected = variance > 0.0 ? std::erfc(std::fabs(corrected) / std::sqrt(variance) / std::sqrt(2.0)) : 1.0;
+        double approximate = mann_whitney_p_value(a, b);
+        std::string name = "round " + std::to_string(round);
+        check(std::fabs(approximate - expected) < 1e-9, name + ": " + std::to_string(approximate) + " against " + std::to_string(expected));
+        check(approximate == mann_whitney_p_value(b, a), name + " is symmetric in its samples");
+    }
+
+    //without ties and with 8 a side the approximation is close to the exact test
+    for (int round = 0; round < 10; round++)
+    {
+        std::vector<double> pool(16);
+        for (size_t i = 0; i < pool.size(); i++)
+        {
+            pool[i] = static_cast<double>(i);
+        }
+        for (size_t i = pool.size() - 1; i > 0; i--)
+        {
+            std::swap(pool[i], pool[next_random(state) % (i + 1)]);
+        }
+        std::vector<double> a(pool.begin(), pool.begin() + 8), b(pool.begin() + 8, pool.end());
+        double exact = 0.0, variance = 0.0;
+        exact_test(a, b, exact, variance);
+        check(std::fabs(mann_whitney_p_value(a, b) - exact) < 0.02, "exact test, round " + std::to_string(round));
+    }
+
+    //separated samples of 20: far below any alpha, the exact value is 2 / C(40, 20)
+    std::vector<double> low, high;
+    for (int i = 0; i < 20; i++)
+    {
+        low.push_back(i);
+        high.push_back(100 + i);
+    }
+    check(mann_whitney_p_value(low, high) < 1e-6, "separated samples");
+}
+
+static void check_bootstrap()
+{
+    ComparisonSettings settings;
+
+    //constant runs: every resample has the same means, the CI is the delta itself
+    std::vector<uint64_t> constant_a(30, 1000), constant_b(30, 1100);
+    ComparisonReport report = compare_runs(make_run(constant_a), make_run(constant_b), settings);
+    check(report.metrics.size() == 1, "one metric compared");
+    if (report.metrics.size() == 1)
+    {
+        const MetricComparison& metric = report.metrics[0];
+        check(std::fabs(metric.delta_pct - 10.0) < 1e-9, "constant delta");
+        check(metric.ci_low_pct == metric.delta_pct && metric.ci_high_pct == metric.delta_pct, "constant CI");
+        check(metric.significant && metric.regression, "constant regression");
+    }
+
+    //noisy runs, B 20% worse: the percentile CI against the normal interval of the
+    //ratio of means (delta method) and a fixed seed giving the same CI twice
+    uint64_t state = 11;
+    std::vector<uint64_t> noisy_a, noisy_b;
+    for (int i = 0; i < 200; i++)
+    {
+        noisy_a.push_back(900 + next_random(state) % 200);
+        noisy_b.push_back(1080 + next_random(state) % 240);
+    }
+    report = compare_runs(make_run(noisy_a), make_run(noisy_b), settings);
+    ComparisonReport again = compare_runs(make_run(noisy_a), make_run(noisy_b), settings);
+    check(report.metrics.size() == 1 && again.metrics.size() == 1, "one noisy metric compared");
+    if (report.metrics.size() == 1 && again.metrics.size() == 1)
+    {
+        auto moments = [](const std::vector<uint64_t>& values, double& mean, double& variance)
+        {
+            mean = 0.0;
+            for (uint64_t value : values)
+            {
+                mean += static_cast<double>(value) / values.size();
+            }
+            variance = 0.0;
+            for (uint64_t value : values)
+            {
+                variance += (value - mean) * (value - mean) / values.size();
+            }
+        };
+        double mean_a, variance_a, mean_b, variance_b;
+        moments(noisy_a, mean_a, variance_a);
+        moments(noisy_b, mean_b, variance_b);
+        double delta = 100.0 * (mean_b - mean_a) / mean_a;
+        double error = 100.0 * std::sqrt(variance_b / noisy_b.size() / (mean_a * mean_a)
+                                         + mean_b * mean_b * variance_a / noisy_a.size() / (mean_a * mean_a * mean_a * mean_a));
+
+        const MetricComparison& metric = report.metrics[0];
+        check(std::fabs(metric.delta_pct - delta) < 1e-9, "noisy delta");
+        check(metric.ci_low_pct < delta && delta < metric.ci_high_pct, "CI holds the delta");
+        double half_width = (metric.ci_high_pct - metric.ci_low_pct) / 2.0;
+        check(std::fabs(half_width - 1.96 * error) < 0.08 * 1.96 * error,
+              "CI half-width " + std::to_string(half_width) + " against " + std::to_string(1.96 * error));
+        check(metric.ci_low_pct == again.metrics[0].ci_low_pct && metric.ci_high_pct == again.metrics[0].ci_high_pct, "CI is reproducible");
+        check(metric.significant && metric.regression && report.has_regression(), "noisy regression");
+    }
+
+    //the same run twice: nothing to report
+    report = compare_runs(make_run(noisy_a), make_run(noisy_a), settings);
+    check(report.metrics.size() == 1 && !report.metrics[0].significant && !report.has_regression(), "no change");
+    if (report.metrics.size() == 1)
+    {
+        check(report.metrics[0].ci_low_pct <= 0.0 && 0.0 <= report.metrics[0].ci_high_pct, "CI of no change holds zero");
+    }
+}
+
+int main()
+{
+    check_mann_whitney();
+    check_bootstrap();
+
+    if (failures)
+    {
+        std::cerr << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "run_comparison_test: ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../analysis/window_query.h"
+
+//SignalSeries against a brute-force scan of the same snapshots: windows that
+//cross block (64) and superblock (4096) boundaries, before and after eviction
+//compacts whole superblocks away
+
+struct Sample
+{
+    uint64_t time_ms;
+    uint64_t duration_ms;
+    uint64_t value;
+};
+
+static int failures = 0;
+
+static void check(bool condition, const std::string& what)
+{
+    if (!condition)
+    {
+        std::cerr << "FAIL: " << what << std::endl;
+        failures++;
+    }
+}
+
+static bool close_to(double actual, double expected, double tolerance)
+{
+    return std::fabs(actual - expected) <= tolerance * std::max(std::fabs(expected), 1.0);
+}
+
+static uint64_t next_random(uint64_t& state)
+{
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    return state >> 33;
+}
+
+static ProfilingSnapshot make_snapshot(const Sample& sample)
+{
+    ProfilingSnapshot snapshot;
+    snapshot.timestamp_ms = sample.time_ms;
+    snapshot.duration_ms = sample.duration_ms;
+    snapshot.metrics.push_back({MetricType::PAGE_FAULTS, sample.value, metric_name(MetricType::PAGE_FAULTS), metric_unit(MetricType::PAGE_FAULTS)});
+    return snapshot;
+}
+
+static double nearest_rank(std::vector<double> values, double percentile)
+{
+    std::sort(values.begin(), values.end());
+    size_t rank = static_cast<size_t>(std::ceil(percentile / 100.0 * values.size()));
+    return values[rank > 0 ? rank - 1 : 0];
+}
+
+//every aggregate of the snapshots in [from_ms, to_ms], the series against a scan of samples
+static void check_window(const SignalSeries& series, const std::vector<Sample>& samples, uint64_t from_ms, uint64_t to_ms)
+{
+    std::string window = "[" + std::to_string(from_ms) + ", " + std::to_string(to_ms) + "]";
+
+    double sum = 0.0, seconds = 0.0;
+    std::vector<double> values;
+    for (const auto& sample : samples)
+    {
+        if (sample.time_ms < from_ms || sample.time_ms > to_ms)
+        {
+            continue;
+        }
+        sum += static_cast<double>(sample.value);
+        seconds += sample.duration_ms / 1000.0;
+        values.push_back(sample.value / (sample.duration_ms / 1000.0));
+    }
+
+    size_t first, last;
+    series.range(from_ms, to_ms, first, last);
+    check(last - first == values.size(), "count of " + window);
+    if (values.empty() || last - first != values.size())
+    {
+        return;
+    }
+
+    double result = 0.0;
+    check(series.aggregate(first, last, WindowAggregate::SUM, 0.0, result) && close_to(result, sum, 1e-9), "sum of " + window);
+    //a rate signal's denominator is the interval, mean and rate agree
+    check(series.aggregate(first, last, WindowAggregate::MEAN, 0.0, result) && close_to(result, sum / seconds, 1e-9), "mean of " + window);
+    check(series.aggregate(first, last, WindowAggregate::RATE, 0.0, result) && close_to(result, sum / seconds, 1e-9), "rate of " + window);
+    check(series.aggregate(first, last, WindowAggregate::MIN, 0.0, result) && result == *std::min_element(values.begin(), values.end()), "min of " + window);
+    check(series.aggregate(first, last, WindowAggregate::MAX, 0.0, result) && result == *std::max_element(values.begin(), values.end()), "max of " + window);
+
+    for (double percentile : {0.0, 1.0, 50.0, 90.0, 99.0, 100.0})
+    {
+        double expected = nearest_rank(values, percentile);
+        //exact up to a superblock of snapshots, then within one histogram bucket (1/32 of the value)
+        double tolerance = values.size() > 4096 ? 1.0 / 32 : 0.0;
+        check(series.aggregate(first, last, WindowAggregate::PERCENTILE, percentile, result) && std::fabs(result - expected) <= tolerance * expected,
+              "p" + std::to_string(percentile) + " of " + window);
+    }
+}
+
+static void check_windows(const SignalSeries& series, const std::vector<Sample>& samples, uint64_t& state)
+{
+    const size_t count = samples.size();
+    //around block and superblock boundaries
+    const size_t edges[][2] = {
+        {0, count - 1}, {0, 0}, {63, 64}, {63, 128}, {1, 4095}, {4095, 4096},
+        {4000, 4200}, {4033, 8191}, {100, 8300}, {4096, 12288}, {5, count - 5}, {8000, count - 1}
+    };
+    for (const auto& edge : edges)
+    {
+        if (edge[1] < count)
+        {
+            check_window(series, samples, samples[edge[0]].time_ms, samples[edge[1]].time_ms);
+        }
+    }
+    for (int i = 0; i < 200; i++)
+    {
+        size_t a = next_random(state) % count;
+        size_t b = next_random(state) % count;
+        check_window(series, samples, samples[std::min(a, b)].time_ms, samples[std::max(a, b)].time_ms);
+    }
+}
+
+static void append_samples(SignalSeries& series, std::vector<Sample>& samples, size_t count, uint64_t& state)
+{
+    uint64_t time_ms = samples.empty() ? 1000 : samples.back().time_ms;
+    for (size_t i = 0; i < count; i++)
+    {
+        Sample sample;
+        sample.duration_ms = 50 + next_random(state) % 200;
+        time_ms += sample.duration_ms;
+        sample.time_ms = time_ms;
+        //spans several powers of two, with repeats for the percentile ranks; the
+        //trend gives every superblock its own extremes
+        sample.value = (1 + next_random(state) % (1u << (1 + next_random(state) % 20))) * (1 + time_ms / 200000);
+        samples.push_back(sample);
+        series.append(make_snapshot(sample));
+    }
+}
+
+int main()
+{
+    uint64_t state = 42;
+    SignalSeries series("page_faults/s");
+    std::vector<Sample> samples;
+
+    append_samples(series, samples, 3 * 4096 + 1000, state);
+    check(series.size() == samples.size(), "size after append");
+    check_windows(series, samples, state);
+
+    //past a superblock and half the series: two superblocks are compacted away
+    size_t evicted = 2 * 4096 + 10;
+    series.evict_before(samples[evicted].time_ms);
+    samples.erase(samples.begin(), samples.begin() + evicted);
+    check(series.size() == samples.size(), "size after eviction");
+    check_windows(series, samples, state);
+
+    //new superblocks on top of the rebased prefix sums and histograms
+    append_samples(series, samples, 2 * 4096 + 300, state);
+    check(series.size() == samples.size(), "size after appending to an evicted series");
+    check_windows(series, samples, state);
+
+    //evicted without compaction: the start only moves
+    evicted = 100;
+    series.evict_before(samples[evicted].time_ms);
+    samples.erase(samples.begin(), samples.begin() + evicted);
+    check(series.size() == samples.size(), "size after a partial eviction");
+    check_windows(series, samples, state);
+
+    WindowQuery query;
+    std::string error;
+    check(parse_window_query("sum(page_faults/s)@-10s", query, error), "parse " + error);
+    double result = 0.0, sum = 0.0;
+    size_t count = 0;
+    for (const auto& sample : samples)
+    {
+        sum += sample.time_ms + 10000 >= samples.back().time_ms ? sample.value : 0;
+    }
+    check(series.evaluate(query, result, count) && close_to(result, sum, 1e-9), "evaluate the last 10s");
+
+    if (failures)
+    {
+        std::cerr << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "window_query_test: ok" << std::endl;
+    return 0;
+}